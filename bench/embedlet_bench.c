@@ -0,0 +1,820 @@
+// embedlet_bench.c
+/**
+ * @file embedlet_bench.c
+ * @brief Reproducible benchmark suite for the embedlet library.
+ *
+ * Builds synthetic stores (clustered Gaussian rows from a fixed seed) and,
+ * optionally, a store of the sample_data embeddings, then measures for every
+ * combination of rows, dims and element type:
+ *   - append and batch-append throughput
+ *   - reopen, warm-up and compact times
+ *   - single and batched search latency (p50/p99) per thread count, and
+ *     single search latency over the blocked layout of float32 stores
+ *   - recall@k of the approximate searches against exact search (the
+ *     prefix search scans the leading quarter of the dims)
+ * Results are written as one JSON document.
+ *
+ * Usage:
+ *   embedlet_bench [--rows 20000,100000] [--dims 384,1024]
+ *                  [--threads 1,2,4,8] [--dtypes f32,f16,bf16,i8]
+ *                  [--queries 200] [--k 10] [--seed 1]
+ *                  [--hnsw-max-rows 50000] [--sample-data DIR]
+ *                  [--dir DIR] [--out FILE] [--quick]
+ *
+ * Compile:
+ *   Linux:   gcc -O3 embedlet_bench.c -o embedlet_bench -lm -lpthread
+ *   Windows: cl /O2 embedlet_bench.c /link
+ */
+
+#define EMBEDLET_IMPLEMENTATION
+#include "../include/embedlet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_LIST 16
+#define BENCH_CLUSTERS 64
+#define BENCH_CHUNK_ROWS 1024
+#define BENCH_SINGLE_APPENDS 1000
+#define BENCH_SAMPLE_ROWS 150
+#define BENCH_SAMPLE_DIMS 1024
+
+typedef struct {
+  size_t values[BENCH_MAX_LIST];
+  size_t count;
+} bench_list_t;
+
+typedef struct {
+  bench_list_t rows;
+  bench_list_t dims;
+  bench_list_t threads;
+  bench_list_t dtypes;
+  size_t queries;
+  size_t k;
+  uint64_t seed;
+  size_t hnsw_max_rows;
+  const char *sample_dir;
+  const char *dir;
+  const char *out;
+} bench_config_t;
+
+/* Where rows and queries come from: synthetic clusters or loaded rows */
+typedef struct {
+  const char *name;
+  size_t rows;
+  size_t dims;
+  uint64_t seed;
+  float *centres; /* BENCH_CLUSTERS x dims, synthetic only */
+  float *loaded;  /* rows x dims, sample data only */
+} bench_source_t;
+
+/* Minimal JSON writer; tracks whether a separator is due at each level */
+typedef struct {
+  FILE *f;
+  int depth;
+  bool first[32];
+} bench_json_t;
+
+static const char *const bench_dtype_names[] = {"f32", "f16", "bf16", "i8"};
+
+/*============================================================================
+ * Timing, Random Numbers and Statistics
+ *============================================================================*/
+
+static double bench_now(void) {
+#if EMBEDLET_WINDOWS
+  LARGE_INTEGER freq, counter;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* splitmix64: the same seed gives the same stores on every platform */
+static uint64_t bench_next(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static float bench_uniform(uint64_t *state) {
+  return (float)((bench_next(state) >> 40) + 1) / (float)(1ULL << 24);
+}
+
+static float bench_gaussian(uint64_t *state) {
+  float u = bench_uniform(state), v = bench_uniform(state);
+  return sqrtf(-2.0f * logf(u)) * cosf(6.28318530718f * v);
+}
+
+static int bench_compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of count samples; sorts them in place */
+static double bench_percentile(double *samples, size_t count, double p) {
+  if (count == 0)
+    return 0.0;
+  qsort(samples, count, sizeof(double), bench_compare_double);
+  size_t rank = (size_t)ceil(p / 100.0 * (double)count);
+  return samples[rank ? rank - 1 : 0];
+}
+
+/*============================================================================
+ * Workload Sources
+ *============================================================================*/
+
+static int bench_source_synthetic(bench_source_t *src, size_t rows,
+                                  size_t dims, uint64_t seed) {
+  memset(src, 0, sizeof(*src));
+  src->name = "synthetic";
+  src->rows = rows;
+  src->dims = dims;
+  src->seed = seed;
+  src->centres = (float *)malloc(BENCH_CLUSTERS * dims * sizeof(float));
+  if (!src->centres)
+    return EMBEDLET_ERR_ALLOC;
+  uint64_t state = seed;
+  for (size_t i = 0; i < BENCH_CLUSTERS * dims; i++)
+    src->centres[i] = bench_gaussian(&state);
+  return EMBEDLET_OK;
+}
+
+static int bench_source_sample(bench_source_t *src, const char *dir) {
+  memset(src, 0, sizeof(*src));
+  src->name = "sample_data";
+  src->rows = BENCH_SAMPLE_ROWS;
+  src->dims = BENCH_SAMPLE_DIMS;
+  src->loaded = (float *)malloc(BENCH_SAMPLE_ROWS * BENCH_SAMPLE_DIMS *
+                                sizeof(float));
+  if (!src->loaded)
+    return EMBEDLET_ERR_ALLOC;
+  for (size_t i = 0; i < BENCH_SAMPLE_ROWS; i++) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/embedding-%03zu.dat", dir, i);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      fprintf(stderr, "Failed to open: %s\n", path);
+      return EMBEDLET_ERR_FILE_OPEN;
+    }
+    size_t read = fread(src->loaded + i * BENCH_SAMPLE_DIMS, sizeof(float),
+                        BENCH_SAMPLE_DIMS, f);
+    fclose(f);
+    if (read != BENCH_SAMPLE_DIMS)
+      return EMBEDLET_ERR_FORMAT;
+  }
+  return EMBEDLET_OK;
+}
+
+static void bench_source_free(bench_source_t *src) {
+  free(src->centres);
+  free(src->loaded);
+  src->centres = src->loaded = NULL;
+}
+
+/* Row i depends only on the seed and i, so chunks can be made in any order */
+static void bench_source_row(const bench_source_t *src, size_t i, float *out) {
+  if (src->loaded) {
+    memcpy(out, src->loaded + (i % src->rows) * src->dims,
+           src->dims * sizeof(float));
+    return;
+  }
+  uint64_t state = src->seed ^ (0xD1B54A32D192ED03ULL * (i + 1));
+  const float *centre =
+      src->centres + (bench_next(&state) % BENCH_CLUSTERS) * src->dims;
+  for (size_t d = 0; d < src->dims; d++)
+    out[d] = centre[d] + 0.5f * bench_gaussian(&state);
+}
+
+/* Queries are perturbed copies of stored rows, so neighbours exist */
+static void bench_source_query(const bench_source_t *src, size_t q,
+                               float *out) {
+  uint64_t state = src->seed ^ (0x8CB92BA72F3D8DD7ULL * (q + 1));
+  bench_source_row(src, bench_next(&state) % src->rows, out);
+  for (size_t d = 0; d < src->dims; d++)
+    out[d] += 0.1f * bench_gaussian(&state);
+}
+
+/*============================================================================
+ * JSON Output
+ *============================================================================*/
+
+static void bench_json_key(bench_json_t *j, const char *key) {
+  if (!j->first[j->depth])
+    fputc(',', j->f);
+  j->first[j->depth] = false;
+  fprintf(j->f, "\n%*s", 2 * (j->depth + 1), "");
+  if (key)
+    fprintf(j->f, "\"%s\": ", key);
+}
+
+static void bench_json_open(bench_json_t *j, const char *key, char bracket) {
+  if (j->depth >= 0)
+    bench_json_key(j, key);
+  fputc(bracket, j->f);
+  j->first[++j->depth] = true;
+}
+
+static void bench_json_close(bench_json_t *j, char bracket) {
+  j->depth--;
+  fprintf(j->f, "\n%*s%c", 2 * (j->depth + 1), "", bracket);
+}
+
+static void bench_json_number(bench_json_t *j, const char *key, double v) {
+  bench_json_key(j, key);
+  fprintf(j->f, "%.9g", v);
+}
+
+static void bench_json_string(bench_json_t *j, const char *key,
+                              const char *v) {
+  bench_json_key(j, key);
+  fprintf(j->f, "\"%s\"", v);
+}
+
+static void bench_json_null(bench_json_t *j, const char *key) {
+  bench_json_key(j, key);
+  fputs("null", j->f);
+}
+
+/* {"p50_ms", "p99_ms", "mean_ms"} of count latencies in seconds */
+static void bench_json_latency(bench_json_t *j, double *samples,
+                               size_t count) {
+  double total = 0.0;
+  for (size_t i = 0; i < count; i++)
+    total += samples[i];
+  bench_json_number(j, "p50_ms", 1e3 * bench_percentile(samples, count, 50));
+  bench_json_number(j, "p99_ms", 1e3 * bench_percentile(samples, count, 99));
+  bench_json_number(j, "mean_ms", count ? 1e3 * total / (double)count : 0.0);
+}
+
+/*============================================================================
+ * Measurements
+ *============================================================================*/
+
+/* Fraction of the exact top-k ids that also appear in an approximate list */
+static double bench_recall(const embedlet_result_t *exact, size_t exact_count,
+                           const embedlet_result_t *approx,
+                           size_t approx_count) {
+  if (exact_count == 0)
+    return 1.0;
+  size_t hits = 0;
+  for (size_t i = 0; i < exact_count; i++) {
+    for (size_t j = 0; j < approx_count; j++) {
+      if (approx[j].id == exact[i].id) {
+        hits++;
+        break;
+      }
+    }
+  }
+  return (double)hits / (double)exact_count;
+}
+
+typedef enum {
+  BENCH_RERANK,
+  BENCH_IVF,
+  BENCH_IVF_RESCORE,
+  BENCH_HNSW,
+  BENCH_PREFIX
+} bench_mode_t;
+
+static int bench_approx(embedlet_store_t *store, bench_mode_t mode,
+                        const float *query, size_t k,
+                        embedlet_result_t *results, size_t *count) {
+  switch (mode) {
+  case BENCH_RERANK:
+    return embedlet_search_rerank(store, query, k, 0, true,
+                                  EMBEDLET_SINGLE_THREAD, results, count);
+  case BENCH_IVF:
+    return embedlet_search_ivf(store, query, k, 0, 0, EMBEDLET_SINGLE_THREAD,
+                               results, count);
+  case BENCH_IVF_RESCORE:
+    return embedlet_search_ivf(store, query, k, 0,
+                               EMBEDLET_DEFAULT_OVERSAMPLE,
+                               EMBEDLET_SINGLE_THREAD, results, count);
+  case BENCH_PREFIX:
+    return embedlet_search_prefix(store, query, k, 0, true,
+                                  EMBEDLET_SINGLE_THREAD, results, count);
+  default:
+    return embedlet_search_ann(store, query, k, 0, results, count);
+  }
+}
+
+/* Single-threaded latency and mean recall@k of one approximate mode */
+static int bench_recall_mode(bench_json_t *j, const char *key,
+                             embedlet_store_t *store, bench_mode_t mode,
+                             const float *queries, size_t num_queries,
+                             size_t dims, size_t k,
+                             const embedlet_result_t *exact,
+                             const size_t *exact_counts, double *samples,
+                             embedlet_result_t *results) {
+  double recall = 0.0;
+  for (size_t q = 0; q < num_queries; q++) {
+    size_t count;
+    double start = bench_now();
+    int err = bench_approx(store, mode, queries + q * dims, k, results, &count);
+    samples[q] = bench_now() - start;
+    if (err != EMBEDLET_OK)
+      return err;
+    recall +=
+        bench_recall(exact + q * k, exact_counts[q], results, count);
+  }
+  bench_json_open(j, key, '{');
+  bench_json_number(j, "recall", recall / (double)num_queries);
+  bench_json_latency(j, samples, num_queries);
+  bench_json_close(j, '}');
+  return EMBEDLET_OK;
+}
+
+static int bench_fail(const char *what, int err) {
+  fprintf(stderr, "%s failed: %d\n", what, err);
+  return err;
+}
+
+/* Run every measurement for one source and element type */
+static int bench_workload(bench_json_t *j, const bench_config_t *cfg,
+                          const bench_source_t *src, int dtype) {
+  size_t rows = src->rows, dims = src->dims, k = cfg->k;
+  size_t num_queries = cfg->queries;
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/embedlet_bench.emb", cfg->dir);
+  embedlet_remove(path);
+
+  fprintf(stderr, "bench: %s rows=%zu dims=%zu dtype=%s\n", src->name, rows,
+          dims, bench_dtype_names[dtype]);
+
+  size_t chunk = BENCH_CHUNK_ROWS > num_queries ? BENCH_CHUNK_ROWS
+                                                : num_queries;
+  float *buf = (float *)malloc(chunk * dims * sizeof(float));
+  float *queries = (float *)malloc(num_queries * dims * sizeof(float));
+  double *samples = (double *)malloc(num_queries * sizeof(double));
+  embedlet_result_t *exact =
+      (embedlet_result_t *)malloc(num_queries * k * sizeof(*exact));
+  size_t *exact_counts = (size_t *)malloc(num_queries * sizeof(size_t));
+  size_t *batch_counts = (size_t *)malloc(num_queries * sizeof(size_t));
+  embedlet_result_t *results =
+      (embedlet_result_t *)malloc(num_queries * k * sizeof(*results));
+  embedlet_store_t *store = NULL;
+  int err = EMBEDLET_ERR_ALLOC;
+  if (!buf || !queries || !samples || !exact || !exact_counts ||
+      !batch_counts || !results)
+    goto cleanup;
+  for (size_t q = 0; q < num_queries; q++)
+    bench_source_query(src, q, queries + q * dims);
+
+  bench_json_open(j, NULL, '{');
+  bench_json_string(j, "source", src->name);
+  bench_json_number(j, "rows", (double)rows);
+  bench_json_number(j, "dims", (double)dims);
+  bench_json_string(j, "dtype", bench_dtype_names[dtype]);
+
+  /* Appends: a few single rows, then the rest in batches */
+  embedlet_options_t options = {0};
+  options.dtype = dtype;
+  if ((err = embedlet_open_ex(path, dims, &options, &store)) != EMBEDLET_OK) {
+    bench_fail("open", err);
+    goto cleanup;
+  }
+  size_t singles = rows < BENCH_SINGLE_APPENDS ? rows : BENCH_SINGLE_APPENDS;
+  double elapsed = 0.0;
+  for (size_t i = 0; i < singles; i++) {
+    size_t id;
+    bench_source_row(src, i, buf);
+    double start = bench_now();
+    err = embedlet_append(store, buf, false, &id);
+    elapsed += bench_now() - start;
+    if (err != EMBEDLET_OK) {
+      bench_fail("append", err);
+      goto cleanup;
+    }
+  }
+  bench_json_open(j, "append", '{');
+  bench_json_number(j, "rows", (double)singles);
+  bench_json_number(j, "seconds", elapsed);
+  bench_json_number(j, "rows_per_sec",
+                    elapsed > 0.0 ? (double)singles / elapsed : 0.0);
+  bench_json_close(j, '}');
+
+  elapsed = 0.0;
+  for (size_t first = singles; first < rows; first += chunk) {
+    size_t count = rows - first < chunk ? rows - first : chunk;
+    for (size_t i = 0; i < count; i++)
+      bench_source_row(src, first + i, buf + i * dims);
+    double start = bench_now();
+    err = embedlet_append_batch(store, buf, count, NULL);
+    elapsed += bench_now() - start;
+    if (err != EMBEDLET_OK) {
+      bench_fail("append_batch", err);
+      goto cleanup;
+    }
+  }
+  bench_json_open(j, "append_batch", '{');
+  bench_json_number(j, "rows", (double)(rows - singles));
+  bench_json_number(j, "batch", (double)chunk);
+  bench_json_number(j, "seconds", elapsed);
+  bench_json_number(j, "rows_per_sec",
+                    elapsed > 0.0 ? (double)(rows - singles) / elapsed : 0.0);
+  bench_json_close(j, '}');
+
+  embedlet_close(store, false);
+  store = NULL;
+  double start = bench_now();
+  if ((err = embedlet_open(path, dims, &store)) != EMBEDLET_OK) {
+    bench_fail("reopen", err);
+    goto cleanup;
+  }
+  bench_json_number(j, "open_seconds", bench_now() - start);
+  start = bench_now();
+  if ((err = embedlet_warm(store, EMBEDLET_AUTO_THREADS)) != EMBEDLET_OK) {
+    bench_fail("warm", err);
+    goto cleanup;
+  }
+  bench_json_number(j, "warm_seconds", bench_now() - start);
+
+  /* Exact search per thread count; the first pass also records the truth */
+  bench_json_open(j, "search", '[');
+  for (size_t t = 0; t < cfg->threads.count; t++) {
+    int threads = (int)cfg->threads.values[t];
+    for (size_t q = 0; q < num_queries; q++) {
+      size_t count;
+      start = bench_now();
+      err = embedlet_search(store, queries + q * dims, k, true, threads,
+                            results, &count);
+      samples[q] = bench_now() - start;
+      if (err != EMBEDLET_OK) {
+        bench_fail("search", err);
+        goto cleanup;
+      }
+      if (t == 0) {
+        memcpy(exact + q * k, results, count * sizeof(*results));
+        exact_counts[q] = count;
+      }
+    }
+    bench_json_open(j, NULL, '{');
+    bench_json_number(j, "threads", threads);
+    bench_json_latency(j, samples, num_queries);
+    bench_json_close(j, '}');
+  }
+  bench_json_close(j, ']');
+
+  bench_json_open(j, "search_batch", '[');
+  for (size_t t = 0; t < cfg->threads.count; t++) {
+    int threads = (int)cfg->threads.values[t];
+    start = bench_now();
+    err = embedlet_search_batch(store, queries, num_queries, k, true, threads,
+                                results, batch_counts);
+    elapsed = bench_now() - start;
+    if (err != EMBEDLET_OK) {
+      bench_fail("search_batch", err);
+      goto cleanup;
+    }
+    bench_json_open(j, NULL, '{');
+    bench_json_number(j, "threads", threads);
+    bench_json_number(j, "queries", (double)num_queries);
+    bench_json_number(j, "seconds", elapsed);
+    bench_json_number(j, "per_query_ms", 1e3 * elapsed / (double)num_queries);
+    bench_json_close(j, '}');
+  }
+  bench_json_close(j, ']');
+
+  bench_json_open(j, "approximate", '{');
+  err = bench_recall_mode(j, "rerank", store, BENCH_RERANK, queries,
+                          num_queries, dims, k, exact, exact_counts, samples,
+                          results);
+  if (err != EMBEDLET_OK) {
+    bench_fail("search_rerank", err);
+    goto cleanup;
+  }
+
+  start = bench_now();
+  err = embedlet_ivf_train(store, NULL, EMBEDLET_AUTO_THREADS);
+  elapsed = bench_now() - start;
+  if (err != EMBEDLET_OK) {
+    bench_fail("ivf_train", err);
+    goto cleanup;
+  }
+  bench_json_number(j, "ivf_train_seconds", elapsed);
+  err = bench_recall_mode(j, "ivf", store, BENCH_IVF, queries, num_queries,
+                          dims, k, exact, exact_counts, samples, results);
+  if (err == EMBEDLET_OK)
+    err = bench_recall_mode(j, "ivf_rescore", store, BENCH_IVF_RESCORE,
+                            queries, num_queries, dims, k, exact,
+                            exact_counts, samples, results);
+  if (err != EMBEDLET_OK) {
+    bench_fail("search_ivf", err);
+    goto cleanup;
+  }
+  embedlet_close(store, false);
+  store = NULL;
+
+  /* HNSW is built by a reopen that asks for an index */
+  if (rows <= cfg->hnsw_max_rows) {
+    options.hnsw_m = EMBEDLET_DEFAULT_HNSW_M;
+    start = bench_now();
+    err = embedlet_open_ex(path, dims, &options, &store);
+    elapsed = bench_now() - start;
+    options.hnsw_m = 0;
+    if (err != EMBEDLET_OK) {
+      bench_fail("hnsw build", err);
+      goto cleanup;
+    }
+    bench_json_number(j, "hnsw_build_seconds", elapsed);
+    err = bench_recall_mode(j, "hnsw", store, BENCH_HNSW, queries,
+                            num_queries, dims, k, exact, exact_counts,
+                            samples, results);
+    if (err != EMBEDLET_OK) {
+      bench_fail("search_ann", err);
+      goto cleanup;
+    }
+    embedlet_close(store, false);
+    store = NULL;
+  } else {
+    bench_json_null(j, "hnsw_build_seconds");
+    bench_json_null(j, "hnsw");
+  }
+
+  /* So is the copy of the leading quarter of the dims */
+  if (dims >= 4) {
+    options.prefix_dims = dims / 4;
+    start = bench_now();
+    err = embedlet_open_ex(path, dims, &options, &store);
+    elapsed = bench_now() - start;
+    options.prefix_dims = 0;
+    if (err != EMBEDLET_OK) {
+      bench_fail("prefix build", err);
+      goto cleanup;
+    }
+    bench_json_number(j, "prefix_build_seconds", elapsed);
+    err = bench_recall_mode(j, "prefix", store, BENCH_PREFIX, queries,
+                            num_queries, dims, k, exact, exact_counts,
+                            samples, results);
+    if (err != EMBEDLET_OK) {
+      bench_fail("search_prefix", err);
+      goto cleanup;
+    }
+    embedlet_close(store, false);
+    store = NULL;
+  } else {
+    bench_json_null(j, "prefix_build_seconds");
+    bench_json_null(j, "prefix");
+  }
+  bench_json_close(j, '}');
+
+  /* Exact search over the blocked copy of a float32 store */
+  if (dtype == EMBEDLET_DTYPE_F32) {
+    options.blocked = 1;
+    start = bench_now();
+    err = embedlet_open_ex(path, dims, &options, &store);
+    elapsed = bench_now() - start;
+    options.blocked = 0;
+    if (err != EMBEDLET_OK) {
+      bench_fail("blocked build", err);
+      goto cleanup;
+    }
+    bench_json_number(j, "blocked_build_seconds", elapsed);
+    bench_json_open(j, "search_blocked", '[');
+    for (size_t t = 0; t < cfg->threads.count; t++) {
+      int threads = (int)cfg->threads.values[t];
+      for (size_t q = 0; q < num_queries; q++) {
+        size_t count;
+        start = bench_now();
+        err = embedlet_search(store, queries + q * dims, k, true, threads,
+                              results, &count);
+        samples[q] = bench_now() - start;
+        if (err != EMBEDLET_OK) {
+          bench_fail("search blocked", err);
+          goto cleanup;
+        }
+      }
+      bench_json_open(j, NULL, '{');
+      bench_json_number(j, "threads", threads);
+      bench_json_latency(j, samples, num_queries);
+      bench_json_close(j, '}');
+    }
+    bench_json_close(j, ']');
+    embedlet_close(store, false);
+    store = NULL;
+
+    /* Drop the copy again so the compact below stays comparable */
+    char blocks_path[sizeof(path) + 8];
+    snprintf(blocks_path, sizeof(blocks_path), "%s.blocks", path);
+    remove(blocks_path);
+  } else {
+    bench_json_null(j, "blocked_build_seconds");
+    bench_json_null(j, "search_blocked");
+  }
+
+  /* Compact after deleting the last tenth of the rows */
+  if ((err = embedlet_open(path, dims, &store)) != EMBEDLET_OK) {
+    bench_fail("reopen", err);
+    goto cleanup;
+  }
+  for (size_t id = rows - rows / 10; id < rows; id++)
+    embedlet_delete(store, id);
+  start = bench_now();
+  err = embedlet_compact(store);
+  elapsed = bench_now() - start;
+  if (err != EMBEDLET_OK) {
+    bench_fail("compact", err);
+    goto cleanup;
+  }
+  bench_json_number(j, "compact_seconds", elapsed);
+  bench_json_close(j, '}');
+
+cleanup:
+  if (store)
+    embedlet_close(store, false);
+  embedlet_remove(path);
+  free(buf);
+  free(queries);
+  free(samples);
+  free(exact);
+  free(exact_counts);
+  free(batch_counts);
+  free(results);
+  return err;
+}
+
+/*============================================================================
+ * Command Line
+ *============================================================================*/
+
+static bool bench_parse_list(const char *arg, bench_list_t *list,
+                             bool dtypes) {
+  list->count = 0;
+  while (*arg) {
+    size_t len = strcspn(arg, ",");
+    if (list->count == BENCH_MAX_LIST || len == 0)
+      return false;
+    size_t value = 0;
+    if (dtypes) {
+      size_t d = 0;
+      while (d < 4 && (strlen(bench_dtype_names[d]) != len ||
+                       strncmp(arg, bench_dtype_names[d], len) != 0))
+        d++;
+      if (d == 4)
+        return false;
+      value = d;
+    } else {
+      char *end;
+      value = (size_t)strtoull(arg, &end, 10);
+      if (end != arg + len || value == 0)
+        return false;
+    }
+    list->values[list->count++] = value;
+    arg += len + (arg[len] == ',');
+  }
+  return list->count > 0;
+}
+
+static void bench_usage(void) {
+  fprintf(stderr,
+          "usage: embedlet_bench [--rows N,...] [--dims D,...] "
+          "[--threads T,...]\n"
+          "                      [--dtypes f32,f16,bf16,i8] [--queries Q] "
+          "[--k K]\n"
+          "                      [--seed S] [--hnsw-max-rows N] "
+          "[--sample-data DIR]\n"
+          "                      [--dir DIR] [--out FILE] [--quick]\n");
+}
+
+static bool bench_parse_args(int argc, char **argv, bench_config_t *cfg) {
+  bench_parse_list("20000,100000", &cfg->rows, false);
+  bench_parse_list("384,1024", &cfg->dims, false);
+  bench_parse_list("1,2,4,8", &cfg->threads, false);
+  bench_parse_list("f32,i8", &cfg->dtypes, true);
+  cfg->queries = 200;
+  cfg->k = 10;
+  cfg->seed = 1;
+  cfg->hnsw_max_rows = 50000;
+  cfg->sample_dir = NULL;
+  cfg->dir = ".";
+  cfg->out = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+    bool ok = arg != NULL;
+    if (strcmp(opt, "--quick") == 0) {
+      bench_parse_list("5000", &cfg->rows, false);
+      bench_parse_list("128", &cfg->dims, false);
+      bench_parse_list("1,2", &cfg->threads, false);
+      cfg->queries = 50;
+      continue;
+    } else if (!ok) {
+      return false;
+    } else if (strcmp(opt, "--rows") == 0) {
+      ok = bench_parse_list(arg, &cfg->rows, false);
+    } else if (strcmp(opt, "--dims") == 0) {
+      ok = bench_parse_list(arg, &cfg->dims, false);
+    } else if (strcmp(opt, "--threads") == 0) {
+      ok = bench_parse_list(arg, &cfg->threads, false);
+    } else if (strcmp(opt, "--dtypes") == 0) {
+      ok = bench_parse_list(arg, &cfg->dtypes, true);
+    } else if (strcmp(opt, "--queries") == 0) {
+      cfg->queries = (size_t)strtoull(arg, NULL, 10);
+      ok = cfg->queries > 0;
+    } else if (strcmp(opt, "--k") == 0) {
+      cfg->k = (size_t)strtoull(arg, NULL, 10);
+      ok = cfg->k > 0;
+    } else if (strcmp(opt, "--seed") == 0) {
+      cfg->seed = (uint64_t)strtoull(arg, NULL, 10);
+    } else if (strcmp(opt, "--hnsw-max-rows") == 0) {
+      cfg->hnsw_max_rows = (size_t)strtoull(arg, NULL, 10);
+    } else if (strcmp(opt, "--sample-data") == 0) {
+      cfg->sample_dir = arg;
+    } else if (strcmp(opt, "--dir") == 0) {
+      cfg->dir = arg;
+    } else if (strcmp(opt, "--out") == 0) {
+      cfg->out = arg;
+    } else {
+      ok = false;
+    }
+    if (!ok)
+      return false;
+    i++;
+  }
+  for (size_t t = 0; t < cfg->threads.count; t++)
+    if (cfg->threads.values[t] > EMBEDLET_MAX_THREADS)
+      return false;
+  return true;
+}
+
+static void bench_json_list(bench_json_t *j, const char *key,
+                            const bench_list_t *list, bool dtypes) {
+  bench_json_open(j, key, '[');
+  for (size_t i = 0; i < list->count; i++) {
+    if (dtypes)
+      bench_json_string(j, NULL, bench_dtype_names[list->values[i]]);
+    else
+      bench_json_number(j, NULL, (double)list->values[i]);
+  }
+  bench_json_close(j, ']');
+}
+
+int main(int argc, char **argv) {
+  bench_config_t cfg;
+  if (!bench_parse_args(argc, argv, &cfg)) {
+    bench_usage();
+    return 2;
+  }
+  FILE *f = cfg.out ? fopen(cfg.out, "w") : stdout;
+  if (!f) {
+    fprintf(stderr, "Failed to open: %s\n", cfg.out);
+    return 1;
+  }
+
+  bench_json_t j;
+  memset(&j, 0, sizeof(j));
+  j.f = f;
+  j.depth = -1;
+  bench_json_open(&j, NULL, '{');
+  bench_json_string(&j, "library", "embedlet");
+  bench_json_string(&j, "simd_backend", embedlet_simd_backend());
+  bench_json_open(&j, "config", '{');
+  bench_json_list(&j, "rows", &cfg.rows, false);
+  bench_json_list(&j, "dims", &cfg.dims, false);
+  bench_json_list(&j, "threads", &cfg.threads, false);
+  bench_json_list(&j, "dtypes", &cfg.dtypes, true);
+  bench_json_number(&j, "queries", (double)cfg.queries);
+  bench_json_number(&j, "k", (double)cfg.k);
+  bench_json_number(&j, "seed", (double)cfg.seed);
+  bench_json_number(&j, "hnsw_max_rows", (double)cfg.hnsw_max_rows);
+  bench_json_close(&j, '}');
+
+  int err = EMBEDLET_OK;
+  bench_json_open(&j, "workloads", '[');
+  for (size_t d = 0; d < cfg.dtypes.count && err == EMBEDLET_OK; d++) {
+    int dtype = (int)cfg.dtypes.values[d];
+    for (size_t r = 0; r < cfg.rows.count && err == EMBEDLET_OK; r++) {
+      for (size_t n = 0; n < cfg.dims.count && err == EMBEDLET_OK; n++) {
+        bench_source_t src;
+        err = bench_source_synthetic(&src, cfg.rows.values[r],
+                                     cfg.dims.values[n], cfg.seed);
+        if (err == EMBEDLET_OK)
+          err = bench_workload(&j, &cfg, &src, dtype);
+        bench_source_free(&src);
+      }
+    }
+    if (cfg.sample_dir && err == EMBEDLET_OK) {
+      bench_source_t src;
+      err = bench_source_sample(&src, cfg.sample_dir);
+      src.seed = cfg.seed;
+      if (err == EMBEDLET_OK)
+        err = bench_workload(&j, &cfg, &src, dtype);
+      bench_source_free(&src);
+    }
+  }
+  bench_json_close(&j, ']');
+  bench_json_close(&j, '}');
+  fputc('\n', f);
+  if (f != stdout)
+    fclose(f);
+  return err == EMBEDLET_OK ? 0 : 1;
+}
@@ -23,9 +23,8 @@
 
 /* Load embedding from file */
 static int load_embedding(const char *path, float *out, size_t dims) {
-  FILE *f;
-  errno_t err = fopen_s(&f, path, "rb");
-  if (err != 0) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
     fprintf(stderr, "Failed to open: %s\n", path);
     return -1;
   }
@@ -41,7 +40,7 @@ int main(void) {
   printf("=== Embedlet Example ===\n\n");
 
   /* Remove any existing store */
-  remove(STORE_PATH);
+  embedlet_remove(STORE_PATH);
 
   /* Open/create store */
   printf("Opening store with %d dimensions...\n", DIMS);
@@ -205,7 +204,7 @@ int main(void) {
   free(emb);
 
   /* Cleanup test file */
-  remove(STORE_PATH);
+  embedlet_remove(STORE_PATH);
 
   /* === Benchmark Phase === */
   printf("\n=== Embedlet Benchmark Phase ===\n");
@@ -216,7 +215,7 @@ int main(void) {
 #endif
 
   /* Remove any existing benchmark store */
-  remove(STORE_PATH);
+  embedlet_remove(STORE_PATH);
 
   /* Open new store */
   embedlet_store_t *bench_store = NULL;
@@ -280,7 +279,7 @@ int main(void) {
       fprintf(stderr, "Append failed at %d: %d\n", i, err);
       free(templates);
       embedlet_close(bench_store, false);
-      remove(STORE_PATH);
+      embedlet_remove(STORE_PATH);
       return 1;
     }
   }
@@ -294,7 +293,7 @@ int main(void) {
     fprintf(stderr, "Failed to load query embedding\n");
     free(templates);
     embedlet_close(bench_store, false);
-    remove(STORE_PATH);
+    embedlet_remove(STORE_PATH);
     return 1;
   }
 
@@ -351,7 +350,7 @@ int main(void) {
     fprintf(stderr, "Failed to load replacement embedding\n");
     free(templates);
     embedlet_close(bench_store, false);
-    remove(STORE_PATH);
+    embedlet_remove(STORE_PATH);
     return 1;
   }
 
@@ -381,7 +380,7 @@ int main(void) {
   free(emb);
 
   /* Cleanup benchmark file */
-  remove(STORE_PATH);
+  embedlet_remove(STORE_PATH);
 
   printf("\n=== Benchmark Complete ===\n");
 
@@ -5,9 +5,10 @@
  * embeddings.
  *
  * Provides storage, retrieval, and similarity search for fixed-dimensional
- * float32 embeddings using memory-mapped files. Thread-safe with optional
+ * float32 embeddings using memory-mapped files, stored as float32 or
+ * optionally as f16, bf16 or int8 rows. Thread-safe with optional
  * multithreaded queries. Uses a portable C implementation with optional
- * SSE2 acceleration when available.
+ * SSE2/AVX2/AVX-512/NEON/SVE kernels, selected at runtime for the host CPU.
  *
  * Basic Usage:
  *   #define EMBEDLET_IMPLEMENTATION
@@ -50,6 +51,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -59,11 +61,32 @@ extern "C" {
 #endif
 #include <windows.h>
 #else
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+/* Architecture detection */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+#define EMBEDLET_ARCH_X86 1
+#else
+#define EMBEDLET_ARCH_X86 0
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define EMBEDLET_ARCH_ARM64 1
+#else
+#define EMBEDLET_ARCH_ARM64 0
 #endif
 
 /* Optional SSE2 acceleration */
@@ -75,6 +98,37 @@ extern "C" {
 #define EMBEDLET_HAS_SSE2 0
 #endif
 
+/*
+ * Optional AVX2/FMA and AVX-512 acceleration. These kernels are compiled with
+ * per-function target attributes and selected at runtime via CPUID, so the
+ * program itself does not need to be built with -mavx2. Define
+ * EMBEDLET_NO_DISPATCH to use only the compile-time kernels.
+ */
+#if EMBEDLET_ARCH_X86 && !defined(EMBEDLET_NO_DISPATCH) &&                     \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5) ||             \
+     defined(_MSC_VER))
+#include <immintrin.h>
+#define EMBEDLET_HAS_AVX 1
+#else
+#define EMBEDLET_HAS_AVX 0
+#endif
+
+/* Optional NEON acceleration (baseline on AArch64) */
+#if EMBEDLET_ARCH_ARM64 && (defined(__ARM_NEON) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define EMBEDLET_HAS_NEON 1
+#else
+#define EMBEDLET_HAS_NEON 0
+#endif
+
+/* Optional SVE acceleration (requires building with SVE enabled) */
+#if EMBEDLET_ARCH_ARM64 && defined(__ARM_FEATURE_SVE)
+#include <arm_sve.h>
+#define EMBEDLET_HAS_SVE 1
+#else
+#define EMBEDLET_HAS_SVE 0
+#endif
+
 /*============================================================================
  * Error Codes
  *============================================================================*/
@@ -88,6 +142,13 @@ extern "C" {
 #define EMBEDLET_ERR_TRUNCATE -6
 #define EMBEDLET_ERR_THREAD -7
 #define EMBEDLET_ERR_NOT_FOUND -8
+#define EMBEDLET_ERR_FORMAT -9
+#define EMBEDLET_ERR_DIMS_MISMATCH -10
+#define EMBEDLET_ERR_CANCELLED -11
+#define EMBEDLET_ERR_READ_ONLY -12
+
+/* Not an error: an asynchronous search is still running */
+#define EMBEDLET_PENDING 1
 
 /*============================================================================
  * Constants
@@ -96,6 +157,64 @@ extern "C" {
 #define EMBEDLET_AUTO_THREADS 0
 #define EMBEDLET_SINGLE_THREAD 1
 
+/* Candidates per result kept by embedlet_search_rerank() when 0 is passed */
+#define EMBEDLET_DEFAULT_OVERSAMPLE 10
+
+/* HNSW index defaults, used when the corresponding knob is 0 */
+#define EMBEDLET_DEFAULT_HNSW_M 16
+#define EMBEDLET_DEFAULT_EF_CONSTRUCTION 200
+#define EMBEDLET_DEFAULT_EF_SEARCH 64
+
+/* Rows per segment of a segmented store when options.segment_rows is 0 */
+#define EMBEDLET_DEFAULT_SEGMENT_ROWS ((size_t)1 << 20)
+
+/* Store file address space reserved when options.reserve_bytes is 0 */
+#define EMBEDLET_DEFAULT_RESERVE_BYTES                                         \
+  ((size_t)1 << (sizeof(void *) > 4 ? 36 : 28))
+
+/*
+ * Rows ahead of the one being scored whose first cache line a scan
+ * prefetches, so the next page's TLB walk and stream start early (0 = off)
+ */
+#ifndef EMBEDLET_PREFETCH_ROWS
+#define EMBEDLET_PREFETCH_ROWS 4
+#endif
+
+/*
+ * Compile float32 dot products specialized for 384, 768 and 1024 dims,
+ * fully unrolled with no tail loops, which stores of those sizes use for
+ * their scans (0 = generic kernels only)
+ */
+#ifndef EMBEDLET_FIXED_DIMS
+#define EMBEDLET_FIXED_DIMS 1
+#endif
+
+/* IVF-PQ index defaults, used when the corresponding knob is 0 */
+#define EMBEDLET_DEFAULT_NPROBE 8
+#define EMBEDLET_DEFAULT_KMEANS_ITERATIONS 10
+
+/* Element types for stored rows (queries are always float32) */
+#define EMBEDLET_DTYPE_F32 0  /**< float32, exact */
+#define EMBEDLET_DTYPE_F16 1  /**< IEEE half precision, 2 bytes/dim */
+#define EMBEDLET_DTYPE_BF16 2 /**< bfloat16, 2 bytes/dim */
+#define EMBEDLET_DTYPE_I8 3   /**< int8 with per-row scale/offset, 1 byte/dim */
+
+/* Scoring metrics for exact search. Cosine and inner product rank highest
+ * first; L2 and Hamming are distances and rank lowest first. */
+#define EMBEDLET_METRIC_COSINE 0        /**< cosine similarity (default) */
+#define EMBEDLET_METRIC_INNER_PRODUCT 1 /**< dot product */
+#define EMBEDLET_METRIC_L2 2            /**< squared Euclidean distance */
+#define EMBEDLET_METRIC_HAMMING 3       /**< differing sign bits */
+
+/* Page-cache advice for the row file and its sidecars; flags can be or-ed.
+ * Only EMBEDLET_ADVISE_LOCK has an effect on Windows. */
+#define EMBEDLET_ADVISE_NORMAL 0       /**< kernel defaults */
+#define EMBEDLET_ADVISE_SEQUENTIAL 1   /**< aggressive readahead for scans */
+#define EMBEDLET_ADVISE_RANDOM 2       /**< no readahead (index lookups) */
+#define EMBEDLET_ADVISE_WILLNEED 4     /**< start reading the file in now */
+#define EMBEDLET_ADVISE_HUGEPAGE 8     /**< transparent huge pages */
+#define EMBEDLET_ADVISE_LOCK 16        /**< keep the mapping resident */
+
 /*============================================================================
  * Types
  *============================================================================*/
@@ -108,11 +227,205 @@ typedef struct embedlet_result {
   float score; /**< Similarity score (cosine similarity) */
 } embedlet_result_t;
 
+/**
+ * @brief A row relocated by embedlet_vacuum().
+ */
+typedef struct embedlet_move {
+  size_t from; /**< Id the row had */
+  size_t to;   /**< Id it has now */
+} embedlet_move_t;
+
+/**
+ * @brief Header of the file embedlet_knn_graph() writes, followed by `rows`
+ *        lists of `k` embedlet_result_t: the list of row id i starts at
+ *        entry i * k. Fields are stored in native byte order.
+ */
+typedef struct embedlet_knn_header {
+  char magic[8];        /**< "EMBKNN01" */
+  uint64_t rows;        /**< Lists, one per row id of the store */
+  uint64_t k;           /**< Entries per list */
+  uint64_t metric;      /**< EMBEDLET_METRIC_* the scores use */
+  uint64_t reserved[4]; /**< Zero */
+} embedlet_knn_header_t;
+
+/* Id of the unused entries of a kNN list */
+#define EMBEDLET_NO_ID ((size_t)-1)
+
 /**
  * @brief Opaque handle to an embedding store.
  */
 typedef struct embedlet_store embedlet_store_t;
 
+/**
+ * @brief Opaque handle to a search thread pool that stores can share.
+ */
+typedef struct embedlet_pool embedlet_pool_t;
+
+/**
+ * @brief Row filter for embedlet_search_filtered(). Zero-initialize to let
+ *        every row through.
+ *
+ * A row is a candidate only if the bitset and the predicate (each when set)
+ * both accept it; rejected rows are never scored.
+ */
+typedef struct embedlet_filter {
+  const uint64_t *bits; /**< Row id is bit id % 64 of bits[id / 64]; NULL =
+                             no bitset */
+  size_t num_bits;      /**< Rows the bitset covers; later rows read as 0 */
+  bool deny;            /**< false: set bits allow rows; true: they exclude */
+  bool (*predicate)(void *user_data, size_t id); /**< NULL = none; called
+                                                      from several threads */
+  void *user_data; /**< Passed to predicate */
+} embedlet_filter_t;
+
+/**
+ * @brief Opaque handle to a search started by embedlet_search_async().
+ */
+typedef struct embedlet_job embedlet_job_t;
+
+/**
+ * @brief Completion callback of an asynchronous search, run on a pool
+ *        thread with the final status and the sorted results.
+ */
+typedef void (*embedlet_search_callback_t)(void *user_data, int status,
+                                           embedlet_result_t *results,
+                                           size_t count);
+
+/**
+ * @brief Options for embedlet_open_ex(). Zero-initialize for the defaults.
+ */
+typedef struct embedlet_options {
+  int dtype;                /**< EMBEDLET_DTYPE_* for a new store */
+  int hnsw_m;               /**< Build an HNSW index with M links per node (0 =
+                                 only use an index that already exists) */
+  int hnsw_ef_construction; /**< HNSW build beam width (0 = default) */
+  size_t reserve_bytes;     /**< Address space reserved for the store file,
+                                 so growth never moves it (0 = default);
+                                 each sidecar's is scaled from it */
+  int pin_threads;          /**< Pin search threads to cores, grouped by
+                                 NUMA node (0 = let the OS schedule) */
+  int metric;               /**< EMBEDLET_METRIC_* for a new store */
+  int advice;               /**< EMBEDLET_ADVISE_* flags, applied to every
+                                 mapping of the rows (best effort) */
+  int read_only;            /**< Map an existing store read-only and follow
+                                 the rows another process appends */
+  size_t prefix_dims;       /**< Keep a contiguous copy of every row's first
+                                 prefix_dims dimensions for
+                                 embedlet_search_prefix() (0 = only use a
+                                 copy that already exists) */
+  int blocked;              /**< Also keep a float32 store's rows interleaved
+                                 in blocks of 16, which exact searches score
+                                 16 rows at a time (0 = only use a copy
+                                 that already exists) */
+} embedlet_options_t;
+
+/**
+ * @brief Opaque handle to a segmented store: many fixed-size store files
+ *        behind one id space.
+ */
+typedef struct embedlet_segmented embedlet_segmented_t;
+
+/**
+ * @brief Options for embedlet_segmented_open(). Zero-initialize for the
+ *        defaults.
+ */
+typedef struct embedlet_segment_options {
+  size_t segment_rows;      /**< Rows per segment of a new store (0 =
+                                 EMBEDLET_DEFAULT_SEGMENT_ROWS) */
+  const char *const *dirs;  /**< Directories new segments are spread over,
+                                 round robin (NULL = next to the manifest) */
+  size_t num_dirs;          /**< Entries in dirs */
+  embedlet_options_t store; /**< Options every segment is opened with */
+} embedlet_segment_options_t;
+
+/**
+ * @brief Training parameters for embedlet_ivf_train(). Zero-initialize for
+ *        the defaults.
+ */
+typedef struct embedlet_ivf_params {
+  size_t nlist;      /**< Inverted lists (0 = about sqrt(rows)) */
+  size_t pq_m;       /**< PQ sub-quantizers, must divide dims (0 = dims/8,
+                          rounded down to a divisor) */
+  size_t train_size; /**< Rows sampled for k-means (0 = 64 per list, at
+                          least 16384) */
+  int iterations;    /**< k-means iterations (0 = default) */
+} embedlet_ivf_params_t;
+
+/**
+ * @brief Counters reported by embedlet_get_stats(). Search counters cover
+ *        the searches run since stats were enabled or last reset; times are
+ *        in nanoseconds, summed over the threads of each search.
+ */
+typedef struct embedlet_stats {
+  uint64_t searches;        /**< Instrumented searches run */
+  uint64_t rows_scanned;    /**< Rows scored (per query in a batch) */
+  uint64_t rows_skipped;    /**< Rows passed over as deleted or filtered */
+  uint64_t bytes_touched;   /**< Row (or sign-bit) bytes read to score */
+  uint64_t kernel_ns;       /**< Time threads spent scanning rows */
+  uint64_t queue_wait_ns;   /**< Time from posting a scan to its start */
+  uint64_t merge_ns;        /**< Time merging per-thread results and
+                                 sorting them */
+  uint64_t grow_events;     /**< Times the store files grew (always
+                                 counted) */
+  uint64_t remap_events;    /**< Growths that moved the row mapping */
+  const char *simd_backend; /**< Same as embedlet_simd_backend() */
+} embedlet_stats_t;
+
+/**
+ * @brief Stats export hook, run on the searching thread after each
+ *        instrumented search with that search's own counters.
+ */
+typedef void (*embedlet_stats_hook_t)(void *user_data, const char *operation,
+                                      const embedlet_stats_t *stats);
+
+/**
+ * @brief Search backend on another device (a GPU, say), attached with
+ *        embedlet_attach_offload().
+ *
+ * The backend keeps its own copy of the rows, which the store keeps up to
+ * date through write(), and answers searches on it like
+ * embedlet_search_batch() does. The store does no device work itself, so
+ * the library needs no GPU toolkit; a CUDA backend, for instance, holds the
+ * rows in device memory and scores a batch as one GEMM followed by a
+ * per-query top-k.
+ *
+ * Callbacks run on the calling threads: write() under the store's write
+ * lock, search() from any number of searching threads at once, also while
+ * a write runs. detach() runs once every search() has returned; a write
+ * that detaches the backend waits for them, so search() must not call
+ * back into the store.
+ */
+typedef struct embedlet_offload {
+  void *ctx; /**< Passed to the callbacks */
+
+  /**
+   * Take rows first .. first + count - 1, count * dims floats decoded from
+   * the store's element type, or NULL when those rows are deleted. Rows
+   * past the end of the copy grow it. Anything but EMBEDLET_OK detaches
+   * the backend, since its copy no longer matches the store.
+   */
+  int (*write)(void *ctx, size_t first, size_t count, const float *rows);
+
+  /**
+   * Top-n search of num_queries queries (dims floats each) under metric
+   * (EMBEDLET_METRIC_*), keeping the highest scores if `highest`, the
+   * lowest otherwise, and skipping deleted rows. Query q's results go to
+   * results + q * n, sorted best first, and their number to counts[q].
+   * Scores must be those of embedlet_score_raw(), up to float rounding.
+   * Anything but EMBEDLET_OK runs the search on the CPU instead.
+   */
+  int (*search)(void *ctx, int metric, const float *queries,
+                size_t num_queries, size_t n, bool highest,
+                embedlet_result_t *results, size_t *counts);
+
+  /** Called once the store no longer uses the backend; may be NULL */
+  void (*detach)(void *ctx);
+
+  /** Fewest queries per call worth sending to the device; smaller batches
+   *  are searched on the CPU (0 or 1 = offload every search) */
+  size_t min_batch;
+} embedlet_offload_t;
+
 /*============================================================================
  * Public API Declarations
  *============================================================================*/
@@ -120,12 +433,40 @@ typedef struct embedlet_store embedlet_store_t;
 /**
  * @brief Open or create an embedding store.
  * @param path      File path for the store.
- * @param dims      Dimensionality of embeddings (must be > 0).
+ * @param dims      Dimensionality of embeddings (must be > 0 and match the
+ *                  file header of an existing store).
  * @param store_out Pointer to receive the store handle.
- * @return EMBEDLET_OK on success, error code otherwise.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_DIMS_MISMATCH or
+ *         EMBEDLET_ERR_FORMAT if an existing file does not fit, error code
+ *         otherwise.
  */
 int embedlet_open(const char *path, size_t dims, embedlet_store_t **store_out);
 
+/**
+ * @brief Open or create an embedding store with explicit options.
+ *
+ * The element type and metric only apply when the store is created; an
+ * existing store keeps those recorded in its header, which embedlet_dtype()
+ * and embedlet_metric() report.
+ *
+ * With options->read_only the store must already exist: it is mapped
+ * read-only, write calls return EMBEDLET_ERR_READ_ONLY and the HNSW and IVF
+ * indexes are not opened. Any number of processes can open a store this way
+ * next to one writer and share its page cache; see embedlet_refresh().
+ * Each holds a shared lock on the store file until it is closed, and while
+ * any does the writer never shrinks a file under its mappings (compaction
+ * only lowers the count).
+ *
+ * @param path      File path for the store.
+ * @param dims      Dimensionality of embeddings (must be > 0).
+ * @param options   Options, or NULL for the defaults (float32 rows).
+ * @param store_out Pointer to receive the store handle.
+ * @return EMBEDLET_OK on success, error code otherwise (see embedlet_open).
+ */
+int embedlet_open_ex(const char *path, size_t dims,
+                     const embedlet_options_t *options,
+                     embedlet_store_t **store_out);
+
 /**
  * @brief Close an embedding store and optionally compact (trim trailing zeros).
  * @param store   Store handle.
@@ -135,23 +476,60 @@ int embedlet_open(const char *path, size_t dims, embedlet_store_t **store_out);
 int embedlet_close(embedlet_store_t *store, bool compact);
 
 /**
- * @brief Get the current number of embeddings in the store.
+ * @brief Delete a store file and its sidecar files from disk.
+ * @param path File path of a store that is not currently open.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_NOT_FOUND if the store file
+ *         did not exist.
+ */
+int embedlet_remove(const char *path);
+
+/**
+ * @brief Get the current number of embedding slots in the store.
  * @param store Store handle.
- * @return Number of embeddings (file_size / (dims * sizeof(float))).
+ * @return Number of slots (live and deleted), as recorded in the file header.
+ *         A read-only store reports only the rows it has mapped.
  */
 size_t embedlet_count(const embedlet_store_t *store);
 
+/**
+ * @brief Map the rows another process appended since a read-only store was
+ *        opened or last refreshed. Exact searches do this on their own.
+ * @param store Store handle (a no-op unless it was opened read-only).
+ * @return EMBEDLET_OK on success, error code otherwise (the rows mapped
+ *         before stay readable).
+ */
+int embedlet_refresh(embedlet_store_t *store);
+
 /**
  * @brief Append a new embedding to the store.
  * @param store  Store handle.
  * @param data   Pointer to dims floats.
- * @param reuse  If true, reuse first zeroed slot; otherwise always append.
+ * @param reuse  If true, reuse the lowest deleted slot; otherwise append.
  * @param id_out Pointer to receive the assigned index.
- * @return EMBEDLET_OK on success, error code otherwise.
+ * @return EMBEDLET_OK once the row is stored (an HNSW graph that could not
+ *         link it is rebuilt on the next open), error code otherwise.
  */
 int embedlet_append(embedlet_store_t *store, const float *data, bool reuse,
                     size_t *id_out);
 
+/**
+ * @brief Append many embeddings at the end of the store in one operation.
+ *
+ * Capacity for the whole batch is reserved with at most one file growth, and
+ * all rows are copied under a single lock acquisition. Deleted slots are not
+ * reused; the batch receives consecutive ids.
+ *
+ * @param store   Store handle.
+ * @param data    Pointer to count * dims floats, row-major.
+ * @param count   Number of embeddings to append.
+ * @param ids_out Optional array of count entries to receive the assigned
+ *                indices (may be NULL).
+ * @return EMBEDLET_OK once the rows are stored (an HNSW graph that could not
+ *         link them is rebuilt on the next open), error code otherwise.
+ */
+int embedlet_append_batch(embedlet_store_t *store, const float *data,
+                          size_t count, size_t *ids_out);
+
 /**
  * @brief Replace the embedding at a given index.
  * @param store Store handle.
@@ -162,7 +540,7 @@ int embedlet_append(embedlet_store_t *store, const float *data, bool reuse,
 int embedlet_replace(embedlet_store_t *store, size_t id, const float *data);
 
 /**
- * @brief Delete an embedding by zeroing its data.
+ * @brief Delete an embedding: mark its slot free and zero its data.
  * @param store Store handle.
  * @param id    Index to delete.
  * @return EMBEDLET_OK on success, error code otherwise.
@@ -173,15 +551,27 @@ int embedlet_delete(embedlet_store_t *store, size_t id);
  * @brief Get a pointer to the embedding at a given index (read-only).
  * @param store Store handle.
  * @param id    Index to retrieve.
- * @return Pointer to dims floats, or NULL if id is invalid.
+ * @return Pointer to dims floats, or NULL if id is invalid or the store does
+ *         not hold float32 rows (use embedlet_get_copy instead).
  */
 const float *embedlet_get(const embedlet_store_t *store, size_t id);
 
 /**
- * @brief Check if an embedding slot is zeroed (deleted).
+ * @brief Copy the embedding at a given index out as float32, converting from
+ * the store's element type.
+ * @param store Store handle.
+ * @param id    Index to retrieve.
+ * @param out   Buffer of dims floats to receive the embedding.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_get_copy(const embedlet_store_t *store, size_t id, float *out);
+
+/**
+ * @brief Check if an embedding slot is deleted.
  * @param store Store handle.
  * @param id    Index to check.
- * @return true if zeroed, false otherwise.
+ * @return true if deleted (or id is invalid), false if live. A stored all-zero
+ *         vector counts as live.
  */
 bool embedlet_is_zeroed(const embedlet_store_t *store, size_t id);
 
@@ -204,8 +594,24 @@ float embedlet_similarity(const embedlet_store_t *store, const float *a,
  */
 float embedlet_similarity_raw(const float *a, const float *b, size_t dims);
 
+/**
+ * @brief Score two raw float arrays under a metric.
+ * @param a      First array.
+ * @param b      Second array.
+ * @param dims   Number of elements.
+ * @param metric EMBEDLET_METRIC_* constant.
+ * @return Cosine similarity, dot product, squared L2 distance, or the number
+ *         of dimensions whose signs differ (0 for an unknown metric).
+ */
+float embedlet_score_raw(const float *a, const float *b, size_t dims,
+                         int metric);
+
 /**
  * @brief Find the top-N most or least similar embeddings.
+ *
+ * Rows are scored under the store's metric (options.metric); for distance
+ * metrics "most similar" means the smallest distances.
+ *
  * @param store        Store handle.
  * @param query        Query embedding (dims floats).
  * @param n            Number of results to return.
@@ -222,1164 +628,9728 @@ int embedlet_search(embedlet_store_t *store, const float *query, size_t n,
                     embedlet_result_t *results, size_t *count_out);
 
 /**
- * @brief Explicitly compact the store (truncate trailing zeros).
- * @param store Store handle.
+ * @brief Find the top-N embeddings among the rows a filter accepts.
+ *
+ * The filter is applied inside the scan before a row is scored, so the
+ * results are the exact top-N within the filter.
+ *
+ * @param store        Store handle.
+ * @param query        Query embedding (dims floats).
+ * @param n            Number of results to return.
+ * @param most_similar If true, return most similar; if false, least similar.
+ * @param num_threads  Thread count: EMBEDLET_AUTO_THREADS,
+ *                     EMBEDLET_SINGLE_THREAD, or specific count.
+ * @param filter       Rows to consider, or NULL for all.
+ * @param results      Array of n embedlet_result_t to receive results (sorted
+ *                     by score).
+ * @param count_out    Pointer to receive actual number of results (may be < n).
  * @return EMBEDLET_OK on success, error code otherwise.
  */
-int embedlet_compact(embedlet_store_t *store);
+int embedlet_search_filtered(embedlet_store_t *store, const float *query,
+                             size_t n, bool most_similar, int num_threads,
+                             const embedlet_filter_t *filter,
+                             embedlet_result_t *results, size_t *count_out);
 
 /**
- * @brief Get the dimensionality of the store.
- * @param store Store handle.
- * @return Number of dimensions.
+ * @brief Find the top-N results for several queries in one pass over the
+ * store.
+ *
+ * Rows are scored in cache-sized blocks against every query, so the store is
+ * read from memory once per batch instead of once per query.
+ *
+ * @param store        Store handle.
+ * @param queries      num_queries query embeddings, row-major (dims floats
+ *                     each).
+ * @param num_queries  Number of queries.
+ * @param n            Number of results per query.
+ * @param most_similar If true, return most similar; if false, least similar.
+ * @param num_threads  Thread count: EMBEDLET_AUTO_THREADS,
+ *                     EMBEDLET_SINGLE_THREAD, or specific count.
+ * @param results      Array of num_queries * n results; query q's results
+ *                     start at results + q * n (sorted by score).
+ * @param counts_out   Array of num_queries counts (each may be < n).
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_INVALID_ARG if the bytes of
+ *         num_queries * n results, or of one such set per thread, overflow
+ *         a size_t, error code otherwise.
  */
-size_t embedlet_dims(const embedlet_store_t *store);
+int embedlet_search_batch(embedlet_store_t *store, const float *queries,
+                          size_t num_queries, size_t n, bool most_similar,
+                          int num_threads, embedlet_result_t *results,
+                          size_t *counts_out);
 
-/*============================================================================
- * Implementation
- *============================================================================*/
+/**
+ * @brief Find every embedding whose score is within a threshold.
+ *
+ * Under the store's metric, returns rows scoring >= threshold (cosine, inner
+ * product) or <= threshold (L2, Hamming), in no particular order.
+ *
+ * @param store        Store handle.
+ * @param query        Query embedding (dims floats).
+ * @param threshold    Score bound.
+ * @param max_results  Stop after this many matches (0 = return all); which
+ *                     ones are found first is unspecified.
+ * @param num_threads  Thread count: EMBEDLET_AUTO_THREADS,
+ *                     EMBEDLET_SINGLE_THREAD, or specific count.
+ * @param results_out  Receives the matches, to be freed with
+ *                     embedlet_free_results() (NULL when there are none).
+ * @param count_out    Receives the number of matches.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_search_range(embedlet_store_t *store, const float *query,
+                          float threshold, size_t max_results,
+                          int num_threads, embedlet_result_t **results_out,
+                          size_t *count_out);
 
-#ifdef EMBEDLET_IMPLEMENTATION
+/**
+ * @brief Free a result list returned by embedlet_search_range().
+ * @param results List to free (may be NULL).
+ */
+void embedlet_free_results(embedlet_result_t *results);
 
-/*----------------------------------------------------------------------------
- * Internal Types and Structures
- *----------------------------------------------------------------------------*/
+/**
+ * @brief Start an exact search on the store's pool and return at once.
+ *
+ * The query is copied, so its buffer can be reused immediately; `results`
+ * must stay valid until the search completes. On completion `callback`
+ * (if set) runs on a pool thread, possibly before this call returns.
+ *
+ * @param store        Store handle; must stay open until completion.
+ * @param query        Query embedding (dims floats).
+ * @param n            Number of results.
+ * @param most_similar true for highest scores, false for lowest.
+ * @param num_threads  Threads for the scan: EMBEDLET_AUTO_THREADS,
+ *                     EMBEDLET_SINGLE_THREAD, or specific count.
+ * @param results      Output buffer (n entries), sorted on completion.
+ * @param callback     Completion callback, or NULL.
+ * @param user_data    Passed to the callback.
+ * @param job_out      Receives a handle for embedlet_job_poll(),
+ *                     embedlet_job_wait() and embedlet_job_cancel(), to be
+ *                     freed by embedlet_job_release(); or NULL to rely on
+ *                     the callback alone.
+ * @return EMBEDLET_OK if the search was started, error code otherwise.
+ */
+int embedlet_search_async(embedlet_store_t *store, const float *query,
+                          size_t n, bool most_similar, int num_threads,
+                          embedlet_result_t *results,
+                          embedlet_search_callback_t callback, void *user_data,
+                          embedlet_job_t **job_out);
 
-/* Platform-specific mutex type */
-#if EMBEDLET_WINDOWS
-typedef CRITICAL_SECTION embedlet_mutex_t;
-#else
-typedef pthread_mutex_t embedlet_mutex_t;
-#endif
+/**
+ * @brief Check whether an asynchronous search has completed.
+ * @param job       Handle from embedlet_search_async().
+ * @param count_out Receives the number of results once complete (may be
+ *                  NULL).
+ * @return EMBEDLET_PENDING while running; otherwise the search's status.
+ */
+int embedlet_job_poll(embedlet_job_t *job, size_t *count_out);
 
-typedef struct embedlet_work {
-  void (*func)(void *arg);
-  void *arg;
-  struct embedlet_work *next;
-} embedlet_work_t;
+/**
+ * @brief Wait for an asynchronous search to complete.
+ * @param job       Handle from embedlet_search_async().
+ * @param count_out Receives the number of results (may be NULL).
+ * @return The search's status: EMBEDLET_OK, EMBEDLET_ERR_CANCELLED, ...
+ */
+int embedlet_job_wait(embedlet_job_t *job, size_t *count_out);
 
-typedef struct embedlet_pool {
-  int num_threads;
-  volatile bool shutdown;
-  volatile int active_count;
-  volatile int pending_count;
-  embedlet_work_t *work_head;
-  embedlet_work_t *work_tail;
-#if EMBEDLET_WINDOWS
-  HANDLE *threads;
-  CRITICAL_SECTION mutex;
-  CONDITION_VARIABLE cond_work;
-  CONDITION_VARIABLE cond_done;
-#else
-  pthread_t *threads;
-  pthread_mutex_t mutex;
-  pthread_cond_t cond_work;
-  pthread_cond_t cond_done;
-#endif
-} embedlet_pool_t;
+/**
+ * @brief Ask an asynchronous search to stop early.
+ *
+ * Scanning threads stop at their next block and the search completes with
+ * EMBEDLET_ERR_CANCELLED, unless it had already completed.
+ *
+ * @param job Handle from embedlet_search_async().
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_job_cancel(embedlet_job_t *job);
 
-struct embedlet_store {
-  size_t dims;
-  size_t capacity;
-  size_t file_size;
-  float *data;
-  char *path;
-  embedlet_mutex_t mutex;
-  embedlet_pool_t *pool;
-#if EMBEDLET_WINDOWS
-  HANDLE file_handle;
-  HANDLE map_handle;
-#else
-  int fd;
-#endif
-};
+/**
+ * @brief Wait for an asynchronous search and free its handle.
+ *
+ * Must not be called from the search's own callback.
+ *
+ * @param job Handle from embedlet_search_async().
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_job_release(embedlet_job_t *job);
 
-typedef struct {
-  const embedlet_store_t *store;
-  const float *query;
-  float query_norm;
-  size_t start;
-  size_t end;
-  embedlet_result_t *local_results;
-  size_t n;
-  bool most_similar;
-  size_t result_count;
-} embedlet_search_task_t;
+/**
+ * @brief Two-stage top-N search: a sign-bit prefilter, then an exact rerank.
+ *
+ * Every live row is first ranked by the Hamming distance between its stored
+ * sign bits and the query's (1 bit per dimension, 1/32 of the float32 data).
+ * The best n * oversample candidates are then rescored exactly under the
+ * store's metric, so returned scores match embedlet_search(), but a
+ * neighbour the prefilter ranks too low is missed. Under the Hamming metric,
+ * whose exact scan already reads only sign bits, this is embedlet_search().
+ *
+ * @param store        Store handle.
+ * @param query        Query embedding (dims floats).
+ * @param n            Number of results to return.
+ * @param oversample   Candidates kept per result; 0 selects
+ *                     EMBEDLET_DEFAULT_OVERSAMPLE.
+ * @param most_similar If true, return most similar; if false, least similar.
+ * @param num_threads  Thread count for the prefilter: EMBEDLET_AUTO_THREADS,
+ *                     EMBEDLET_SINGLE_THREAD, or specific count.
+ * @param results      Array of n embedlet_result_t to receive results (sorted
+ *                     by score).
+ * @param count_out    Pointer to receive actual number of results (may be < n).
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_search_rerank(embedlet_store_t *store, const float *query,
+                           size_t n, size_t oversample, bool most_similar,
+                           int num_threads, embedlet_result_t *results,
+                           size_t *count_out);
 
-/*----------------------------------------------------------------------------
- * Platform-Specific Mutex Operations
- *----------------------------------------------------------------------------*/
+/**
+ * @brief Two-stage top-N search: a scan of the leading dimensions, then an
+ *        exact rerank.
+ *
+ * Meant for embeddings trained so that their leading dimensions work as a
+ * smaller embedding (Matryoshka representation learning). Every live row is
+ * first scored under the store's metric on only its first prefix dimensions,
+ * read from the contiguous copy kept with options.prefix_dims, so the scan
+ * streams prefix_dims / dims of the data. The best n * oversample candidates
+ * are then rescored on all dimensions, so returned scores match
+ * embedlet_search(). Under the Hamming metric, whose exact scan already reads
+ * only sign bits, this is embedlet_search().
+ *
+ * @param store        Store handle.
+ * @param query        Query embedding (dims floats).
+ * @param n            Number of results to return.
+ * @param oversample   Candidates kept per result; 0 selects
+ *                     EMBEDLET_DEFAULT_OVERSAMPLE.
+ * @param most_similar If true, return most similar; if false, least similar.
+ * @param num_threads  Thread count for the prefix scan: EMBEDLET_AUTO_THREADS,
+ *                     EMBEDLET_SINGLE_THREAD, or specific count.
+ * @param results      Array of n embedlet_result_t to receive results (sorted
+ *                     by score).
+ * @param count_out    Pointer to receive actual number of results (may be < n).
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_NOT_FOUND if the store keeps
+ *         no prefix copy, error code otherwise.
+ */
+int embedlet_search_prefix(embedlet_store_t *store, const float *query,
+                           size_t n, size_t oversample, bool most_similar,
+                           int num_threads, embedlet_result_t *results,
+                           size_t *count_out);
 
-static inline void embedlet_mutex_init(embedlet_mutex_t *m) {
-#if EMBEDLET_WINDOWS
-  InitializeCriticalSection(m);
-#else
-  pthread_mutex_init(m, NULL);
-#endif
-}
+/**
+ * @brief All-pairs k-nearest-neighbour graph of the live rows.
+ *
+ * Finds, for every live row, the k other live rows that score best against
+ * it under the store's metric, as embedlet_search() scores them. Rows are
+ * joined a cache-sized tile against another, each pair of tiles once, and
+ * a pair's score goes to both rows' lists, so every score is computed once.
+ * The lists, sorted best first, are written through a mapping to the file
+ * at out_path (see embedlet_knn_header_t), which is created or replaced. A
+ * deleted row's list, and the end of a list with fewer than k candidates,
+ * hold id EMBEDLET_NO_ID.
+ *
+ * @param store       Store handle.
+ * @param k           Neighbours per row (> 0).
+ * @param num_threads Number of threads (EMBEDLET_AUTO_THREADS,
+ *                    EMBEDLET_SINGLE_THREAD, or specific count).
+ * @param out_path    Output file.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_knn_graph(embedlet_store_t *store, size_t k, int num_threads,
+                       const char *out_path);
 
-static inline void embedlet_mutex_destroy(embedlet_mutex_t *m) {
-#if EMBEDLET_WINDOWS
-  DeleteCriticalSection(m);
-#else
-  pthread_mutex_destroy(m);
-#endif
-}
+/**
+ * @brief Scores of every pair of a set of rows under the store's metric.
+ *
+ * out[a * count + b] receives the score of rows ids[a] and ids[b], as
+ * embedlet_search() scores them. The matrix is symmetric; each pair is
+ * computed once, tile against tile like embedlet_knn_graph().
+ *
+ * @param store       Store handle.
+ * @param ids         Row ids.
+ * @param count       Number of ids.
+ * @param num_threads Number of threads (EMBEDLET_AUTO_THREADS,
+ *                    EMBEDLET_SINGLE_THREAD, or specific count).
+ * @param out         Array of count * count floats to receive the scores.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_INVALID_ID if an id is out of
+ *         range or deleted, error code otherwise.
+ */
+int embedlet_similarity_matrix(embedlet_store_t *store, const size_t *ids,
+                               size_t count, int num_threads, float *out);
 
-static inline void embedlet_mutex_lock(embedlet_mutex_t *m) {
+/**
+ * @brief Approximate top-N most similar search through the HNSW index.
+ *
+ * Requires a store opened with options.hnsw_m > 0 (or one whose index
+ * sidecar already exists). The graph is built and walked under the store's
+ * metric (cosine, inner product or L2; Hamming stores keep no index), and
+ * scores are exact scores of the rows found, as embedlet_search() gives
+ * them; recall depends on ef_search. Searches walk the graph under a
+ * shared lock, each with its own scratch, so they run in parallel with each
+ * other and only wait while a write relinks a layer.
+ *
+ * @param store     Store handle.
+ * @param query     Query embedding (dims floats).
+ * @param n         Number of results to return.
+ * @param ef_search Search beam width (>= n is used); 0 selects
+ *                  EMBEDLET_DEFAULT_EF_SEARCH.
+ * @param results   Array of n embedlet_result_t to receive results (sorted
+ *                  by score, most similar first).
+ * @param count_out Pointer to receive actual number of results (may be < n).
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_NOT_FOUND if the store has no
+ *         index, error code otherwise.
+ */
+int embedlet_search_ann(embedlet_store_t *store, const float *query, size_t n,
+                        size_t ef_search, embedlet_result_t *results,
+                        size_t *count_out);
+
+/**
+ * @brief Train an IVF-PQ index over the current rows.
+ *
+ * Clusters a sample of the rows into nlist inverted lists with k-means,
+ * trains a product quantizer on the residuals, then writes every row's list
+ * and PQ code to the "<path>.ivf" sidecar, each list stored contiguously.
+ * Replaces any previous IVF index. Must not run concurrently with searches.
+ * The quantizer works on unit vectors, so only cosine stores are indexed.
+ *
+ * @param store       Store handle.
+ * @param params      Training parameters, or NULL for the defaults.
+ * @param num_threads Number of threads (EMBEDLET_AUTO_THREADS,
+ *                    EMBEDLET_SINGLE_THREAD, or specific count).
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_NOT_FOUND if the store has no
+ *         live rows, EMBEDLET_ERR_INVALID_ARG for a store whose metric is
+ *         not cosine, error code otherwise.
+ */
+int embedlet_ivf_train(embedlet_store_t *store,
+                       const embedlet_ivf_params_t *params, int num_threads);
+
+/**
+ * @brief Approximate top-N most similar search through the IVF-PQ index.
+ *
+ * Scans the nprobe lists whose centroids are closest to the query, scoring
+ * rows from their PQ codes, plus rows appended since training (exactly).
+ *
+ * @param store       Store handle.
+ * @param query       Query embedding (dims floats).
+ * @param n           Number of results to return.
+ * @param nprobe      Lists to scan; 0 selects EMBEDLET_DEFAULT_NPROBE.
+ * @param oversample  0 to return PQ-estimated scores without reading rows;
+ *                    otherwise n * oversample candidates are rescored
+ *                    exactly against the stored rows.
+ * @param num_threads Number of threads (EMBEDLET_AUTO_THREADS,
+ *                    EMBEDLET_SINGLE_THREAD, or specific count).
+ * @param results     Array of n embedlet_result_t to receive results (sorted
+ *                    by score, most similar first).
+ * @param count_out   Pointer to receive actual number of results (may be < n).
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_NOT_FOUND if the store has no
+ *         trained index, error code otherwise.
+ */
+int embedlet_search_ivf(embedlet_store_t *store, const float *query, size_t n,
+                        size_t nprobe, size_t oversample, int num_threads,
+                        embedlet_result_t *results, size_t *count_out);
+
+/**
+ * @brief Explicitly compact the store (truncate trailing zeros). Files that
+ *        a vacuum left more than twice the size of the rows are shrunk too.
+ *
+ * While a read-only handle has the store open the trailing rows are dropped
+ * from the count only, and the files keep their size.
+ *
+ * @param store Store handle.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_compact(embedlet_store_t *store);
+
+/**
+ * @brief Move live rows from the end of the store into the lowest deleted
+ *        slots and drop the deleted tail, so searches stop scanning holes.
+ *
+ * Searches may run alongside and never fault, but one that overlaps a move
+ * is not exact. A moved row is live in its new slot before it leaves the old
+ * one, yet nothing waits for searches in flight: a scan that passed the
+ * (lower) new slot before the copy and reaches the old one after the delete
+ * misses the row, one that sees both returns it twice, and one scoring the
+ * old slot while it is cleared gets a wrong score. Searches that start after
+ * the call returns see every row once. Each move is recorded in the store's
+ * move log. Appends and other writes wait while a call runs; bound that with
+ * max_moves.
+ *
+ * @param store     Store handle.
+ * @param max_moves Rows to move at most (0 = until no hole is left).
+ * @param moved_out Receives the number of rows moved (may be NULL).
+ * @return EMBEDLET_OK on success, error code otherwise (the moves made
+ *         before the error stand, and are logged).
+ */
+int embedlet_vacuum(embedlet_store_t *store, size_t max_moves,
+                    size_t *moved_out);
+
+/**
+ * @brief Number of entries in the move log.
+ * @param store Store handle.
+ * @return Moves recorded since the log was last cleared.
+ */
+size_t embedlet_move_count(const embedlet_store_t *store);
+
+/**
+ * @brief Copy entries of the move log, oldest first. A row moved twice has
+ *        two entries, the second starting from where the first ended.
+ * @param store     Store handle.
+ * @param first     Index of the first entry to copy.
+ * @param max       Entries moves_out has room for.
+ * @param moves_out Receives the entries.
+ * @param count_out Receives the number of entries copied.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_get_moves(const embedlet_store_t *store, size_t first,
+                       size_t max, embedlet_move_t *moves_out,
+                       size_t *count_out);
+
+/**
+ * @brief Empty the move log, once the ids it records have been applied.
+ * @param store Store handle.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_clear_moves(embedlet_store_t *store);
+
+/**
+ * @brief Set page-cache advice for the row file and its sidecars.
+ *
+ * Replaces the advice given at open. It is reapplied whenever growth remaps
+ * the files, so it holds for the lifetime of the store.
+ *
+ * @param store  Store handle.
+ * @param advice EMBEDLET_ADVISE_* flags (SEQUENTIAL and RANDOM exclude each
+ *               other).
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_MMAP if the mapping could not
+ *         be locked (see RLIMIT_MEMLOCK), error code otherwise.
+ */
+int embedlet_advise(embedlet_store_t *store, int advice);
+
+/**
+ * @brief Fault the row file and its sidecars into memory ahead of queries.
+ *
+ * Touches every page of the rows in parallel, so the first searches after
+ * opening do not stall on page faults. Safe to run alongside searches and
+ * appends; rows appended meanwhile may not be warmed.
+ *
+ * @param store       Store handle.
+ * @param num_threads Thread count: EMBEDLET_AUTO_THREADS,
+ *                    EMBEDLET_SINGLE_THREAD, or specific count.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_warm(embedlet_store_t *store, int num_threads);
+
+/**
+ * @brief Get the dimensionality of the store.
+ * @param store Store handle.
+ * @return Number of dimensions.
+ */
+size_t embedlet_dims(const embedlet_store_t *store);
+
+/**
+ * @brief Get the leading dimensions the store's prefix copy holds.
+ * @param store Store handle.
+ * @return Dimensions scanned by embedlet_search_prefix(), 0 without a copy.
+ */
+size_t embedlet_prefix_dims(const embedlet_store_t *store);
+
+/**
+ * @brief Get the element type rows are stored as.
+ * @param store Store handle.
+ * @return One of the EMBEDLET_DTYPE_* constants.
+ */
+int embedlet_dtype(const embedlet_store_t *store);
+
+/**
+ * @brief Get the metric exact searches on the store rank by, recorded in
+ *        its header when it was created.
+ * @param store Store handle.
+ * @return One of the EMBEDLET_METRIC_* constants.
+ */
+int embedlet_metric(const embedlet_store_t *store);
+
+/**
+ * @brief Create a thread pool that any number of stores can share.
+ *
+ * The pool keeps a fixed number of threads. Queued work is picked first
+ * from the stores with the fewest tasks already running, so one busy store
+ * cannot starve the others.
+ *
+ * @param num_threads  Worker threads: EMBEDLET_AUTO_THREADS or a count.
+ * @param pin_threads  Pin workers to cores, grouped by NUMA node.
+ * @param pool_out     Receives the pool.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_THREAD if no thread could
+ *         be started, error code otherwise.
+ */
+int embedlet_pool_create(int num_threads, bool pin_threads,
+                         embedlet_pool_t **pool_out);
+
+/**
+ * @brief Release the caller's reference to a pool.
+ *
+ * The threads stop once no store is attached any more.
+ *
+ * @param pool Pool from embedlet_pool_create().
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_pool_destroy(embedlet_pool_t *pool);
+
+/**
+ * @brief Run a store's parallel work on a shared pool.
+ *
+ * Safe while searches run: the call waits until every parallel search,
+ * warm-up or IVF training using the current pool has finished, and every
+ * async job has been released (or, without a handle, has called back),
+ * while new ones wait for the swap. So it must not be called from a search
+ * callback or while holding an unreleased job of this store.
+ *
+ * @param store Store handle.
+ * @param pool  Pool to use, or NULL to go back to a private pool created
+ *              on demand.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_attach_pool(embedlet_store_t *store, embedlet_pool_t *pool);
+
+/**
+ * @brief Search a store on a device backend when one is worth using.
+ *
+ * Sends every row to the backend's write(), then keeps its copy up to date
+ * on each append, replace, delete and vacuum move. embedlet_search() and
+ * embedlet_search_batch() go to the backend's search() for batches of at
+ * least min_batch queries; smaller batches, failed device searches and all
+ * other searches run on the CPU. A previously attached backend is
+ * detached. Not safe while other calls on this store are running.
+ *
+ * @param store   Store handle.
+ * @param offload Backend (copied), or NULL to detach the current one.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_READ_ONLY for a read-only
+ *         store, whose rows another process writes, EMBEDLET_ERR_INVALID_ARG
+ *         under the Hamming metric, whose sign-bit scan stays on the CPU,
+ *         error code otherwise (the backend is then not attached).
+ */
+int embedlet_attach_offload(embedlet_store_t *store,
+                            const embedlet_offload_t *offload);
+
+/**
+ * @brief Get the name of the SIMD kernel set selected for this CPU.
+ * @return Static string: "avx512", "avx2", "sse2", "sve", "neon" or "c".
+ */
+const char *embedlet_simd_backend(void);
+
+/**
+ * @brief Turn search instrumentation on or off for a store.
+ *
+ * Off by default. While on, exact, filtered, batch and range searches and
+ * the rerank prefilter read the clock a few times per thread, and their
+ * counters are added to the store's totals once per search.
+ *
+ * @param store  Store handle.
+ * @param enable true to collect search stats.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_enable_stats(embedlet_store_t *store, bool enable);
+
+/**
+ * @brief Read a store's counters.
+ * @param store     Store handle.
+ * @param stats_out Receives the totals.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_get_stats(const embedlet_store_t *store,
+                       embedlet_stats_t *stats_out);
+
+/**
+ * @brief Zero a store's counters.
+ * @param store Store handle.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_reset_stats(embedlet_store_t *store);
+
+/**
+ * @brief Set the hook that receives each instrumented search's counters.
+ *
+ * Must not be called while searches are running on the store.
+ *
+ * @param store     Store handle.
+ * @param hook      Hook, or NULL to remove it.
+ * @param user_data Passed to the hook.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_set_stats_hook(embedlet_store_t *store,
+                            embedlet_stats_hook_t hook, void *user_data);
+
+/**
+ * @brief Open or create a segmented store.
+ *
+ * `path` is a small manifest listing the segments. Each segment is an
+ * ordinary store holding segment_rows rows; only the last one is appended
+ * to, and a new segment is started when it fills. Global id g lives in
+ * segment g / segment_rows at row g % segment_rows.
+ *
+ * @param path    Manifest path.
+ * @param dims    Dimensionality of embeddings (must be > 0).
+ * @param options Options, or NULL for the defaults. segment_rows only
+ *                applies when the store is created.
+ * @param set_out Pointer to receive the handle.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_DIMS_MISMATCH or
+ *         EMBEDLET_ERR_FORMAT if an existing manifest does not fit, error
+ *         code otherwise.
+ */
+int embedlet_segmented_open(const char *path, size_t dims,
+                            const embedlet_segment_options_t *options,
+                            embedlet_segmented_t **set_out);
+
+/**
+ * @brief Close a segmented store and all its segments.
+ * @param set Handle.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_segmented_close(embedlet_segmented_t *set);
+
+/**
+ * @brief Delete a segmented store's manifest and every segment it lists.
+ * @param path Manifest path of a store that is not currently open.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_NOT_FOUND if there is no
+ *         manifest, error code otherwise.
+ */
+int embedlet_segmented_remove(const char *path);
+
+/**
+ * @brief One past the highest global id handed out so far.
+ * @param set Handle.
+ * @return Id space in use, 0 for NULL.
+ */
+size_t embedlet_segmented_count(const embedlet_segmented_t *set);
+
+/**
+ * @brief Number of segments.
+ * @param set Handle.
+ * @return Segment count, 0 for NULL.
+ */
+size_t embedlet_segmented_segments(const embedlet_segmented_t *set);
+
+/**
+ * @brief Store handle of one segment, for per-segment calls such as
+ *        embedlet_advise() or embedlet_get_stats(). Rows must be added
+ *        through the segmented store, not through this handle.
+ * @param set   Handle.
+ * @param index Segment index.
+ * @return The segment, or NULL if index is out of range.
+ */
+embedlet_store_t *embedlet_segmented_segment(embedlet_segmented_t *set,
+                                             size_t index);
+
+/**
+ * @brief Append one embedding to the active segment.
+ * @param set    Handle.
+ * @param data   Pointer to dims floats.
+ * @param id_out Receives the global id.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_segmented_append(embedlet_segmented_t *set, const float *data,
+                              size_t *id_out);
+
+/**
+ * @brief Append count embeddings, filling the active segment and starting
+ *        new ones as needed. Ids are consecutive.
+ * @param set     Handle.
+ * @param data    count * dims floats, row-major.
+ * @param count   Number of embeddings.
+ * @param ids_out Receives count global ids, or NULL.
+ * @return EMBEDLET_OK on success, error code otherwise (rows stored before
+ *         the failure stay stored).
+ */
+int embedlet_segmented_append_batch(embedlet_segmented_t *set,
+                                    const float *data, size_t count,
+                                    size_t *ids_out);
+
+/**
+ * @brief Overwrite the embedding with global id `id`.
+ * @param set  Handle.
+ * @param id   Global id.
+ * @param data Pointer to dims floats.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_INVALID_ID if out of range.
+ */
+int embedlet_segmented_replace(embedlet_segmented_t *set, size_t id,
+                               const float *data);
+
+/**
+ * @brief Delete the embedding with global id `id`.
+ * @param set Handle.
+ * @param id  Global id.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_INVALID_ID if out of range.
+ */
+int embedlet_segmented_delete(embedlet_segmented_t *set, size_t id);
+
+/**
+ * @brief Copy the embedding with global id `id` out as float32.
+ * @param set Handle.
+ * @param id  Global id.
+ * @param out Receives dims floats.
+ * @return EMBEDLET_OK on success, EMBEDLET_ERR_INVALID_ID if out of range.
+ */
+int embedlet_segmented_get_copy(const embedlet_segmented_t *set, size_t id,
+                                float *out);
+
+/**
+ * @brief Exact top-n search over every segment, merged into one result.
+ * @param set          Handle.
+ * @param query        Query vector (dims floats).
+ * @param n            Number of results wanted.
+ * @param most_similar As for embedlet_search().
+ * @param num_threads  Threads to use (EMBEDLET_AUTO_THREADS for all cores).
+ * @param results      Receives up to n results with global ids, best first.
+ * @param count_out    Receives the number of results.
+ * @return EMBEDLET_OK on success, error code otherwise.
+ */
+int embedlet_segmented_search(embedlet_segmented_t *set, const float *query,
+                              size_t n, bool most_similar, int num_threads,
+                              embedlet_result_t *results, size_t *count_out);
+
+/*============================================================================
+ * Implementation
+ *============================================================================*/
+
+#ifdef EMBEDLET_IMPLEMENTATION
+
+/*----------------------------------------------------------------------------
+ * Internal Types and Structures
+ *----------------------------------------------------------------------------*/
+
+/* Platform-specific mutex and condition variable types */
 #if EMBEDLET_WINDOWS
-  EnterCriticalSection(m);
+typedef CRITICAL_SECTION embedlet_mutex_t;
+typedef CONDITION_VARIABLE embedlet_cond_t;
+typedef SRWLOCK embedlet_rwlock_t;
 #else
-  pthread_mutex_lock(m);
+typedef pthread_mutex_t embedlet_mutex_t;
+typedef pthread_cond_t embedlet_cond_t;
+typedef pthread_rwlock_t embedlet_rwlock_t;
 #endif
-}
 
-static inline void embedlet_mutex_unlock(embedlet_mutex_t *m) {
+/* Upper bound on pool workers, and on cores considered for pinning */
+#define EMBEDLET_MAX_THREADS 256
+#define EMBEDLET_MAX_CPUS 1024
+
+/* Completion count of one parallel run, guarded by the pool mutex */
+typedef struct embedlet_latch {
+  int remaining;
+} embedlet_latch_t;
+
+/* Submitter of pool work (one per store), for fair scheduling */
+typedef struct embedlet_pool_client {
+  volatile size_t running; /* items of this client being run, atomic */
+} embedlet_pool_client_t;
+
+typedef struct embedlet_work {
+  void (*func)(void *arg);
+  void *arg;
+  embedlet_latch_t *latch; /* NULL for plain submissions */
+  embedlet_pool_client_t *client;
+  struct embedlet_work *next;
+  struct embedlet_work *prev;
+} embedlet_work_t;
+
+/* One pool thread and its deque of queued work */
+typedef struct embedlet_worker {
+  struct embedlet_pool *pool;
+  embedlet_mutex_t lock; /* guards head and tail */
+  embedlet_work_t *head; /* queued items, oldest first */
+  embedlet_work_t *tail;
+  int index;
+  int cpu; /* core the thread is pinned to, -1 = not pinned */
 #if EMBEDLET_WINDOWS
-  LeaveCriticalSection(m);
+  HANDLE thread;
 #else
-  pthread_mutex_unlock(m);
+  pthread_t thread;
 #endif
-}
+} embedlet_worker_t;
+
+struct embedlet_pool {
+  int num_threads; /* workers started so far, under mutex */
+  int max_threads; /* growth limit: fixed for a shared pool */
+  int refs;        /* owner plus attached stores, under mutex */
+  bool pin;
+  int *cpus; /* pinning order: allowed cores grouped by NUMA node */
+  int num_cpus;
+  volatile bool shutdown;
+  int pending_count;          /* queued or running items */
+  unsigned generation;        /* bumped by every submission */
+  unsigned next_worker;       /* round-robin target of plain submissions */
+  embedlet_work_t *free_work; /* finished items, reused by submissions */
+  embedlet_pool_client_t anon; /* client of work with no store */
+  embedlet_worker_t *workers[EMBEDLET_MAX_THREADS];
+  embedlet_mutex_t mutex;
+  embedlet_cond_t cond_work;
+  embedlet_cond_t cond_done;
+};
 
-/*----------------------------------------------------------------------------
- * Thread Pool Implementation
- *----------------------------------------------------------------------------*/
+/*
+ * Work of a parallel scan over [0, total): slice i starts as participant
+ * i's contiguous share and is claimed `grain` items at a time, first by its
+ * owner and then by any participant that has drained its own slice.
+ */
+typedef struct {
+  volatile size_t next; /* first unclaimed item */
+  size_t end;
+  uint8_t pad[64 - 2 * sizeof(size_t)]; /* one cache line per slice */
+} embedlet_slice_t;
+
+typedef struct {
+  embedlet_slice_t *slices;
+  int count;
+  size_t grain;
+  volatile size_t *stop; /* non-zero ends the scan early; may be NULL */
+} embedlet_steal_t;
+
+/* A superseded view, kept mapped until close so that readers never fault */
+typedef struct embedlet_retired_view {
+  void *data;
+  size_t size;
+#if EMBEDLET_WINDOWS
+  HANDLE map_handle;
+#endif
+  struct embedlet_retired_view *next;
+} embedlet_retired_view_t;
+
+/*
+ * A memory-mapped file: the store itself or one of its sidecars. On POSIX
+ * the view sits at the start of a larger reserved address range and grows in
+ * place, so `data` does not move while the file fits the reservation.
+ */
+typedef struct embedlet_map {
+  void *data;
+  size_t size;         /* on-disk file size */
+  size_t capacity;     /* mapped bytes */
+  size_t reserved;     /* address space reserved at data (POSIX) */
+  size_t reserve_hint; /* bytes to reserve up front, 0 = default */
+  int advice;          /* EMBEDLET_ADVISE_* applied to each new view */
+  bool read_only;      /* opened and mapped without write access */
+  embedlet_retired_view_t *retired;
+#if EMBEDLET_WINDOWS
+  HANDLE file_handle;
+  HANDLE map_handle;
+#else
+  int fd;
+#endif
+} embedlet_map_t;
+
+/*
+ * Store file layout: a fixed EMBEDLET_HEADER_SIZE header page followed by
+ * `count` rows of `row_bytes` each. The file may extend past the last row
+ * (capacity reserved by doubling); only `count` is authoritative. Fields are
+ * stored in native byte order.
+ *
+ * `elem_type` is an EMBEDLET_DTYPE_* value and `metric` an EMBEDLET_METRIC_*
+ * one (zero, cosine, in files written before it was recorded). Half-precision
+ * rows are padded to a multiple of 4 bytes; int8 rows start with a float
+ * scale and offset (value = offset + scale * code) followed by the codes,
+ * also padded.
+ */
+#define EMBEDLET_FILE_MAGIC "EMBEDLET"
+#define EMBEDLET_FILE_VERSION 1
+#define EMBEDLET_HEADER_SIZE 4096
+#define EMBEDLET_I8_PREFIX (2 * sizeof(float))
+
+typedef struct embedlet_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t dims;
+  uint32_t elem_type;
+  uint32_t flags;
+  uint64_t count;
+  uint64_t row_bytes;
+  uint32_t metric;
+  uint32_t reserved;
+} embedlet_file_header_t;
+
+/*
+ * Sidecar files live next to the store and share a 64-byte header; `rows` is
+ * the number of leading rows the sidecar holds valid data for.
+ *
+ *   "<path>.norms": one float per row with that row's L2 norm, so search only
+ *                   needs one dot product per row.
+ *   "<path>.live":  occupancy bitmap, one bit per row (1 = live). Deleted
+ *                   rows are skipped a word at a time without touching data.
+ *   "<path>.bits":  sign bit of every dimension, (dims + 63) / 64 words per
+ *                   row, scored by Hamming distance as a search prefilter.
+ */
+#define EMBEDLET_NORMS_SUFFIX ".norms"
+#define EMBEDLET_NORMS_MAGIC "EMBNORM1"
+#define EMBEDLET_LIVE_SUFFIX ".live"
+#define EMBEDLET_LIVE_MAGIC "EMBLIVE1"
+#define EMBEDLET_BITS_SUFFIX ".bits"
+#define EMBEDLET_BITS_MAGIC "EMBBITS1"
+
+typedef struct embedlet_sidecar_header {
+  char magic[8];
+  uint64_t rows;
+  uint64_t reserved[6];
+} embedlet_sidecar_header_t;
+
+/*
+ * Optional HNSW graph, in two sidecars:
+ *
+ *   "<path>.hnsw":  header, then one fixed record of 3 + 2M uint32 per row:
+ *                   {level, first upper block, level-0 count, 2M links}.
+ *   "<path>.hnswu": upper-layer link blocks of 1 + M uint32 ({count, M
+ *                   links}), `level` consecutive blocks per node, allocated
+ *                   append-only.
+ *
+ * Deleted rows stay in the graph as records with no links; their neighbours
+ * are relinked to each other when they are removed. A row that could not be
+ * linked (out of memory, say) stays stored and sets `stale`, and the graph
+ * is rebuilt the next time the store is opened.
+ */
+#define EMBEDLET_HNSW_SUFFIX ".hnsw"
+#define EMBEDLET_HNSW_MAGIC "EMBHNSW1"
+#define EMBEDLET_HNSW_UPPER_SUFFIX ".hnswu"
+#define EMBEDLET_HNSW_UPPER_MAGIC "EMBHNSWU"
+#define EMBEDLET_HNSW_NO_ENTRY UINT64_MAX
+#define EMBEDLET_HNSW_MAX_LEVEL 16
+
+typedef struct embedlet_hnsw_header {
+  char magic[8];
+  uint64_t rows; /* rows with a node record */
+  uint32_t m;
+  uint32_t ef_construction;
+  uint64_t entry; /* top-level entry node or EMBEDLET_HNSW_NO_ENTRY */
+  uint32_t max_level;
+  uint32_t metric; /* EMBEDLET_METRIC_* the graph was built under */
+  uint64_t upper_blocks; /* blocks used in the upper-layer file */
+  uint64_t stale; /* non-zero: a stored row went unlinked, rebuild on open */
+  uint64_t reserved;
+} embedlet_hnsw_header_t;
+
+/*
+ * Scratch state for one graph traversal. Writers share the store's, under
+ * its mutex; each search takes its own from the store's idle list.
+ */
+typedef struct embedlet_hnsw_ctx {
+  struct embedlet_hnsw_ctx *next; /* idle list link */
+  size_t ef;     /* beam width used for insertions */
+  size_t ef_cap; /* capacity of top and eps */
+  uint8_t *visited; /* visit epoch per row */
+  size_t visited_cap;
+  uint8_t epoch;
+  embedlet_result_t *cand; /* max-heap of nodes to expand */
+  size_t cand_size;
+  size_t cand_cap;
+  embedlet_result_t *top; /* min-heap of the best ef nodes */
+  size_t top_size;
+  uint32_t *eps;           /* entry points for the next layer */
+  embedlet_result_t *sel;  /* neighbour selection candidates */
+  uint32_t *ids;           /* relink candidate ids */
+  uint32_t *picked;        /* selected neighbours */
+  float *query;            /* vector being inserted */
+  float *base;             /* node whose links are being rebuilt */
+  float *scratch;          /* candidate vector during selection */
+} embedlet_hnsw_ctx_t;
+
+/*
+ * Optional IVF-PQ index, in one sidecar "<path>.ivf" written by training:
+ *
+ *   header, then
+ *   centroids  float[nlist * dims]   unit-length list centroids
+ *   codebooks  float[256 * dims]     256 codewords per sub-quantizer,
+ *                                    transposed: [pq_m][dims / pq_m][256]
+ *   offsets    uint64[nlist + 1]     first slot of each list
+ *   slot_rows  uint32[rows]          row id stored in each slot
+ *   slot_of    uint32[rows]          slot of each row id
+ *   codes      uint8[rows * pq_m]    PQ code of each slot, by slot
+ *
+ * Slots are grouped by list, so a probe reads one contiguous run of codes.
+ * Rows are encoded unit-length as centroid + residual; a query's score for
+ * a slot is q.c + sum of per-sub-quantizer lookup-table entries.
+ */
+#define EMBEDLET_IVF_SUFFIX ".ivf"
+#define EMBEDLET_IVF_MAGIC "EMBIVF01"
+
+/*
+ * Move log "<path>.moves", appended by embedlet_vacuum(): a sidecar header
+ * (`rows` = entries), then {uint64 from, uint64 to} per moved row, oldest
+ * first. Created by the first vacuum, emptied by embedlet_clear_moves().
+ */
+#define EMBEDLET_MOVES_SUFFIX ".moves"
+#define EMBEDLET_MOVES_MAGIC "EMBMOVE1"
+
+/*
+ * Prefix copy "<path>.prefix", kept when options.prefix_dims is set: a
+ * sidecar header (`rows` = rows copied, reserved[0] = prefix dims), then per
+ * row its leading dims in the store's encoding (int8 rows keep their scale
+ * and offset) followed by the float L2 norm of those dims.
+ */
+#define EMBEDLET_PREFIX_SUFFIX ".prefix"
+#define EMBEDLET_PREFIX_MAGIC "EMBPFX01"
+
+/*
+ * Blocked copy "<path>.blocks" of a float32 store, kept when options.blocked
+ * is set: a sidecar header (`rows` = rows copied, reserved[0] = dims), then
+ * the rows in blocks of EMBEDLET_BLOCK_ROWS stored dimension-major, so that
+ * dimension d of row r of a block is at block[d * EMBEDLET_BLOCK_ROWS + r].
+ * The block kernels assume 16 rows per block.
+ */
+#define EMBEDLET_BLOCKS_SUFFIX ".blocks"
+#define EMBEDLET_BLOCKS_MAGIC "EMBBLKS1"
+#define EMBEDLET_BLOCK_ROWS 16
+#define EMBEDLET_PQ_KSUB 256
+
+typedef struct embedlet_ivf_header {
+  char magic[8];
+  uint64_t rows;    /* rows encoded at training time */
+  uint64_t covered; /* rows [0, covered) are scored from the index */
+  uint64_t dims;
+  uint32_t nlist; /* 0 = no index */
+  uint32_t pq_m;
+  uint64_t reserved[3];
+} embedlet_ivf_header_t;
+
+/*
+ * Scratch memory for one query: task descriptors, per-thread heaps and
+ * candidate lists are bumped out of an arena taken from the store's free
+ * list and handed back when the query returns. An arena that overflowed
+ * is folded into a single block on release, so after warm-up a query
+ * allocates nothing.
+ */
+#define EMBEDLET_ARENA_ALIGN 64 /* keeps per-thread heaps on own lines */
+#define EMBEDLET_ARENA_MIN_BYTES (64 * 1024)
+
+typedef struct embedlet_arena_block {
+  struct embedlet_arena_block *next;
+  uint8_t *data; /* EMBEDLET_ARENA_ALIGN-aligned start of cap bytes */
+  size_t cap;
+  size_t used;
+} embedlet_arena_block_t;
+
+typedef struct embedlet_arena {
+  embedlet_arena_block_t *blocks; /* block being filled first */
+  struct embedlet_arena *next;    /* free list link */
+} embedlet_arena_t;
+
+/*
+ * Dot product of a float32 query with one stored row of the store's type.
+ * A store's row_dot may be specialized for its dims, so it only scores whole
+ * rows.
+ */
+typedef float (*embedlet_row_dot_fn)(const float *query, float query_sum,
+                                     const void *row, size_t dims);
+
+struct embedlet_store {
+  size_t dims;
+  int dtype;
+  size_t row_bytes;
+  embedlet_row_dot_fn row_dot;
+  embedlet_file_header_t *header;
+  float *data;
+  float *norms;
+  uint64_t *live;
+  uint64_t *bits;
+  size_t bits_words; /* uint64 words of sign bits per row */
+  embedlet_sidecar_header_t *norms_header;
+  embedlet_sidecar_header_t *live_header;
+  embedlet_sidecar_header_t *bits_header;
+  size_t *free_ids; /* min-heap of deleted slots */
+  size_t free_count;
+  size_t free_capacity;
+  char *path;
+  embedlet_mutex_t mutex;
+  embedlet_pool_t *pool; /* private or shared; one reference held */
+  int pool_users;        /* holds from embedlet_acquire_pool(), under mutex */
+  bool pool_swap;        /* embedlet_attach_pool() is waiting for them */
+  embedlet_cond_t pool_idle; /* signalled as pool_users or pool_swap drop */
+  embedlet_pool_client_t pool_client;
+  bool pin_threads; /* pin a private pool's workers */
+  int metric;       /* EMBEDLET_METRIC_* of exact searches */
+  bool read_only;       /* options.read_only: another process writes */
+  uint64_t mapped_rows; /* rows every view covers (read-only), atomic */
+  uint64_t stats_enabled; /* embedlet_enable_stats(), atomic */
+  embedlet_stats_t stats; /* totals, updated atomically */
+  embedlet_stats_hook_t stats_hook;
+  void *stats_hook_data;
+  embedlet_offload_t offload; /* device backend, valid while attached */
+  /* Bit 0: a backend is attached; 2 more per search inside it, atomic */
+  volatile size_t offload_refs;
+  embedlet_arena_t *arenas; /* idle scratch arenas, under arena_mutex */
+  embedlet_mutex_t arena_mutex;
+  embedlet_map_t file;
+  embedlet_map_t norms_file;
+  embedlet_map_t live_file;
+  embedlet_map_t bits_file;
+  embedlet_hnsw_header_t *hnsw_header; /* NULL when there is no index */
+  uint32_t *hnsw_nodes;
+  uint32_t *hnsw_upper;
+  embedlet_hnsw_ctx_t *hnsw_ctx; /* writers' traversal scratch, under mutex */
+  embedlet_hnsw_ctx_t *hnsw_idle; /* idle search scratch, under arena_mutex */
+  embedlet_rwlock_t hnsw_lock; /* graph: searches shared, relinking exclusive */
+  embedlet_map_t hnsw_file;
+  embedlet_map_t hnsw_upper_file;
+  embedlet_ivf_header_t *ivf_header; /* NULL when there is no index */
+  float *ivf_centroids;
+  float *ivf_codebooks;
+  uint64_t *ivf_offsets;
+  uint32_t *ivf_slot_rows;
+  uint32_t *ivf_slot_of;
+  uint8_t *ivf_codes;
+  float *ivf_unit; /* 2 * dims floats of update scratch, under the mutex */
+  embedlet_map_t ivf_file;
+  embedlet_sidecar_header_t *moves_header; /* NULL until a vacuum */
+  uint64_t *moves;                         /* {from, to} pairs */
+  embedlet_map_t moves_file;
+  embedlet_sidecar_header_t *prefix_header; /* NULL without a prefix copy */
+  uint8_t *prefix;
+  size_t prefix_dims;
+  size_t prefix_row_bytes; /* encoded leading dims, then their norm */
+  embedlet_map_t prefix_file;
+  embedlet_sidecar_header_t *blocks_header; /* NULL without a blocked copy */
+  float *blocks;
+  embedlet_map_t blocks_file;
+};
+
+/*
+ * Segmented store manifest "<path>": this header, then `segments` records of
+ * {uint32 length, path bytes} naming each segment's store file in order. It
+ * is rewritten to "<path>.tmp" and renamed over whenever a segment is added.
+ * Segment i is named "<path>.seg<i>", or "<dir>/<name>.seg<i>" with
+ * directories given, where name is the last component of path.
+ */
+#define EMBEDLET_SEGMENTS_MAGIC "EMBSEGS1"
+#define EMBEDLET_SEGMENTS_VERSION 1
+#define EMBEDLET_SEGMENT_SUFFIX ".seg"
+
+typedef struct embedlet_manifest_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t dims;
+  uint64_t segment_rows;
+  uint64_t segments;
+} embedlet_manifest_header_t;
+
+struct embedlet_segmented {
+  char *path; /* manifest */
+  size_t dims;
+  size_t segment_rows;
+  embedlet_options_t options; /* every segment's open options */
+  char **dirs;                /* copies of options.dirs */
+  size_t num_dirs;
+  embedlet_store_t **segments; /* the last one takes appends */
+  char **segment_paths;
+  size_t num_segments; /* under mutex, as is the list */
+  size_t segments_capacity;
+  embedlet_pool_t *pool; /* shared by the segments, made on demand */
+  embedlet_mutex_t mutex;
+};
+
+/* Lists picked for an IVF scan and the query's PQ lookup table */
+typedef struct {
+  const embedlet_result_t *lists; /* {list, query.centroid} per probe */
+  const float *lut;               /* [pq_m][256] query.codeword */
+  size_t covered;
+} embedlet_ivf_probe_t;
+
+/* Counters a scan task fills in for embedlet_get_stats() */
+typedef struct {
+  uint64_t posted_ns; /* when the task was handed out, 0 = stats off */
+  uint64_t wait_ns;   /* posted until the scan started */
+  uint64_t kernel_ns; /* scanning */
+  size_t visited;     /* rows covered by the blocks claimed */
+  size_t scanned;     /* rows scored */
+} embedlet_scan_stats_t;
+
+typedef struct {
+  const embedlet_store_t *store;
+  const float *query;
+  float query_norm;
+  float query_sum;
+  const uint64_t *query_bits;      /* prefilter and Hamming only */
+  const embedlet_ivf_probe_t *ivf; /* IVF scan only */
+  const embedlet_filter_t *filter; /* exact search only, may be NULL */
+  const embedlet_steal_t *steal;   /* blocks to claim */
+  size_t rows;                     /* blocked scan only: rows to score */
+  int slot;                        /* this task's own slice */
+  embedlet_result_t *local_results;
+  size_t n;
+  bool most_similar;
+  size_t result_count;
+  embedlet_scan_stats_t stats;
+} embedlet_search_task_t;
+
+/* One scanning participant of an asynchronous search */
+typedef struct {
+  struct embedlet_job *job;
+  embedlet_search_task_t task;
+} embedlet_job_part_t;
+
+/* An asynchronous search; it lives inside its own scratch arena */
+struct embedlet_job {
+  embedlet_store_t *store;
+  embedlet_pool_t *pool;
+  embedlet_arena_t *arena;
+  embedlet_job_part_t *parts;
+  int num_parts;
+  embedlet_result_t *merged; /* merge buffer for large n, else results */
+  embedlet_steal_t steal;
+  volatile size_t remaining; /* participants still scanning, atomic */
+  volatile size_t cancel;    /* set by embedlet_job_cancel(), atomic */
+  embedlet_result_t *results;
+  size_t n;
+  bool most_similar;
+  embedlet_search_callback_t callback;
+  void *user_data;
+  bool has_handle; /* false: freed as soon as it completes */
+  bool done;       /* under the pool mutex */
+  int status;
+  size_t count;
+};
+
+/* Row data claimed at a time by a search worker (~64 KB) */
+#define EMBEDLET_STEAL_BLOCK_BYTES (64 * 1024)
+
+/* Rows per cache block in batched search (~256 KB of row data) */
+#define EMBEDLET_BATCH_BLOCK_BYTES (256 * 1024)
+
+typedef struct {
+  const embedlet_store_t *store;
+  const float *queries;
+  const float *query_norms;
+  const float *query_sums;
+  const uint64_t *query_bits; /* Hamming metric only, bits_words each */
+  size_t num_queries;
+  const embedlet_steal_t *steal;    /* cache blocks to claim */
+  int slot;                         /* this task's own slice */
+  embedlet_result_t *local_results; /* num_queries heaps of n */
+  size_t *result_counts;            /* num_queries heap sizes */
+  size_t n;
+  bool most_similar;
+  embedlet_scan_stats_t stats;
+} embedlet_batch_task_t;
+
+/* Per-thread state of a range search; results grow with realloc */
+typedef struct {
+  const embedlet_store_t *store;
+  const float *query;
+  float query_norm;
+  float query_sum;
+  const uint64_t *query_bits; /* Hamming metric only */
+  const embedlet_steal_t *steal;
+  int slot;
+  float threshold;
+  float sign;            /* 1: keep scores >= threshold, -1: <= threshold */
+  size_t limit;          /* hits to stop after across all tasks, 0 = none */
+  volatile size_t *hits; /* hits so far when limited, atomic */
+  embedlet_result_t *results;
+  size_t count;
+  size_t cap;
+  bool failed; /* out of memory */
+  embedlet_scan_stats_t stats;
+} embedlet_threshold_task_t;
+
+/* One slice [start, end) of a parallel loop run by embedlet_run_ranges() */
+typedef struct {
+  int (*fn)(void *ctx, size_t start, size_t end);
+  void *ctx;
+  const embedlet_steal_t *steal;
+  int slot;
+  int err;
+} embedlet_range_task_t;
+
+/*----------------------------------------------------------------------------
+ * Platform-Specific Mutex Operations
+ *----------------------------------------------------------------------------*/
+
+static inline void embedlet_mutex_init(embedlet_mutex_t *m) {
+#if EMBEDLET_WINDOWS
+  InitializeCriticalSection(m);
+#else
+  pthread_mutex_init(m, NULL);
+#endif
+}
+
+static inline void embedlet_mutex_destroy(embedlet_mutex_t *m) {
+#if EMBEDLET_WINDOWS
+  DeleteCriticalSection(m);
+#else
+  pthread_mutex_destroy(m);
+#endif
+}
+
+static inline void embedlet_mutex_lock(embedlet_mutex_t *m) {
+#if EMBEDLET_WINDOWS
+  EnterCriticalSection(m);
+#else
+  pthread_mutex_lock(m);
+#endif
+}
+
+static inline void embedlet_mutex_unlock(embedlet_mutex_t *m) {
+#if EMBEDLET_WINDOWS
+  LeaveCriticalSection(m);
+#else
+  pthread_mutex_unlock(m);
+#endif
+}
+
+static inline void embedlet_rwlock_init(embedlet_rwlock_t *l) {
+#if EMBEDLET_WINDOWS
+  InitializeSRWLock(l);
+#else
+  pthread_rwlock_init(l, NULL);
+#endif
+}
+
+static inline void embedlet_rwlock_destroy(embedlet_rwlock_t *l) {
+#if EMBEDLET_WINDOWS
+  (void)l;
+#else
+  pthread_rwlock_destroy(l);
+#endif
+}
+
+static inline void embedlet_rwlock_read(embedlet_rwlock_t *l) {
+#if EMBEDLET_WINDOWS
+  AcquireSRWLockShared(l);
+#else
+  pthread_rwlock_rdlock(l);
+#endif
+}
+
+static inline void embedlet_rwlock_read_unlock(embedlet_rwlock_t *l) {
+#if EMBEDLET_WINDOWS
+  ReleaseSRWLockShared(l);
+#else
+  pthread_rwlock_unlock(l);
+#endif
+}
+
+static inline void embedlet_rwlock_write(embedlet_rwlock_t *l) {
+#if EMBEDLET_WINDOWS
+  AcquireSRWLockExclusive(l);
+#else
+  pthread_rwlock_wrlock(l);
+#endif
+}
+
+static inline void embedlet_rwlock_write_unlock(embedlet_rwlock_t *l) {
+#if EMBEDLET_WINDOWS
+  ReleaseSRWLockExclusive(l);
+#else
+  pthread_rwlock_unlock(l);
+#endif
+}
+
+static inline void embedlet_cond_init(embedlet_cond_t *c) {
+#if EMBEDLET_WINDOWS
+  InitializeConditionVariable(c);
+#else
+  pthread_cond_init(c, NULL);
+#endif
+}
+
+static inline void embedlet_cond_destroy(embedlet_cond_t *c) {
+#if EMBEDLET_WINDOWS
+  (void)c;
+#else
+  pthread_cond_destroy(c);
+#endif
+}
+
+static inline void embedlet_cond_wait(embedlet_cond_t *c,
+                                      embedlet_mutex_t *m) {
+#if EMBEDLET_WINDOWS
+  SleepConditionVariableCS(c, m, INFINITE);
+#else
+  pthread_cond_wait(c, m);
+#endif
+}
+
+static inline void embedlet_cond_signal(embedlet_cond_t *c) {
+#if EMBEDLET_WINDOWS
+  WakeConditionVariable(c);
+#else
+  pthread_cond_signal(c);
+#endif
+}
+
+static inline void embedlet_cond_broadcast(embedlet_cond_t *c) {
+#if EMBEDLET_WINDOWS
+  WakeAllConditionVariable(c);
+#else
+  pthread_cond_broadcast(c);
+#endif
+}
+
+static inline void embedlet_thread_yield(void) {
+#if EMBEDLET_WINDOWS
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+static inline size_t embedlet_atomic_load(volatile size_t *p) {
+#if EMBEDLET_WINDOWS
+  return *p; /* aligned volatile reads are atomic on Windows targets */
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Add v to *p atomically, returning the previous value (acquire-release) */
+static inline size_t embedlet_atomic_fetch_add(volatile size_t *p, size_t v) {
+#if EMBEDLET_WINDOWS && defined(_WIN64)
+  return (size_t)InterlockedExchangeAdd64((volatile LONG64 *)p, (LONG64)v);
+#elif EMBEDLET_WINDOWS
+  return (size_t)InterlockedExchangeAdd((volatile LONG *)p, (LONG)v);
+#else
+  return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+#endif
+}
+
+/* 64-bit counters; relaxed, they order nothing */
+static inline void embedlet_atomic_add_u64(uint64_t *p, uint64_t v) {
+#if EMBEDLET_WINDOWS
+  InterlockedExchangeAdd64((volatile LONG64 *)p, (LONG64)v);
+#else
+  __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void embedlet_atomic_store_u64(uint64_t *p, uint64_t v) {
+#if EMBEDLET_WINDOWS
+  InterlockedExchange64((volatile LONG64 *)p, (LONG64)v);
+#else
+  __atomic_store_n(p, v, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint64_t embedlet_atomic_load_u64(const uint64_t *p) {
+#if EMBEDLET_WINDOWS
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p, 0, 0);
+#else
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+#endif
+}
+
+/* Publish a value that orders the writes before it (release / acquire) */
+static inline void embedlet_atomic_release_u64(uint64_t *p, uint64_t v) {
+#if EMBEDLET_WINDOWS
+  InterlockedExchange64((volatile LONG64 *)p, (LONG64)v);
+#else
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline uint64_t embedlet_atomic_acquire_u64(const uint64_t *p) {
+#if EMBEDLET_WINDOWS
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p, 0, 0);
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Monotonic clock in nanoseconds */
+static inline uint64_t embedlet_now_ns(void) {
+#if EMBEDLET_WINDOWS
+  LARGE_INTEGER freq, counter;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&counter);
+  uint64_t f = (uint64_t)freq.QuadPart, c = (uint64_t)counter.QuadPart;
+  return c / f * 1000000000u + c % f * 1000000000u / f;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ * CPU Topology
+ *----------------------------------------------------------------------------*/
+
+#if defined(__linux__)
+/* Move an allowed core from the affinity mask to the end of the order */
+static void embedlet_cpu_take(uint64_t *mask, int cpu, int *cpus, int *count,
+                              int cap) {
+  if (cpu < 0 || cpu >= EMBEDLET_MAX_CPUS || *count >= cap)
+    return;
+  uint64_t bit = (uint64_t)1 << (cpu & 63);
+  if (mask[cpu >> 6] & bit) {
+    mask[cpu >> 6] &= ~bit;
+    cpus[(*count)++] = cpu;
+  }
+}
+#endif
+
+/*
+ * Cores this process may run on, grouped by NUMA node, so that consecutive
+ * workers (which scan consecutive row slices) share a node. Returns the
+ * number written to cpus, 0 when the affinity cannot be read.
+ */
+static int embedlet_cpu_order(int *cpus, int cap) {
+  int count = 0;
+#if EMBEDLET_WINDOWS
+  DWORD_PTR process_mask, system_mask;
+  ULONG highest = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask,
+                              &system_mask))
+    return 0;
+  GetNumaHighestNodeNumber(&highest);
+  for (ULONG node = 0; node <= highest; node++) {
+    for (int cpu = 0; cpu < (int)(sizeof(DWORD_PTR) * 8); cpu++) {
+      UCHAR cpu_node = 0;
+      if (!((process_mask >> cpu) & 1) || count >= cap)
+        continue;
+      if (!GetNumaProcessorNode((UCHAR)cpu, &cpu_node))
+        cpu_node = 0;
+      if (cpu_node == node)
+        cpus[count++] = cpu;
+    }
+  }
+#elif defined(__linux__)
+  uint64_t mask[EMBEDLET_MAX_CPUS / 64];
+  memset(mask, 0, sizeof(mask));
+  if (syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) <= 0)
+    return 0;
+  /* Node by node as listed in sysfs, then any core sysfs did not list */
+  for (int node = 0; node < 64; node++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE *f = fopen(path, "r");
+    if (!f)
+      continue;
+    int lo, hi, c;
+    while (fscanf(f, "%d", &lo) == 1) {
+      hi = lo;
+      c = fgetc(f);
+      if (c == '-') {
+        if (fscanf(f, "%d", &hi) != 1)
+          break;
+        c = fgetc(f);
+      }
+      for (int cpu = lo; cpu <= hi; cpu++)
+        embedlet_cpu_take(mask, cpu, cpus, &count, cap);
+      if (c != ',')
+        break;
+    }
+    fclose(f);
+  }
+  for (int cpu = 0; cpu < EMBEDLET_MAX_CPUS; cpu++)
+    embedlet_cpu_take(mask, cpu, cpus, &count, cap);
+#else
+  (void)cpus;
+  (void)cap;
+#endif
+  return count;
+}
+
+/* Pin the calling thread to one core; best effort */
+static void embedlet_pin_thread(int cpu) {
+#if EMBEDLET_WINDOWS
+  if (cpu < (int)(sizeof(DWORD_PTR) * 8))
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+  uint64_t mask[EMBEDLET_MAX_CPUS / 64];
+  memset(mask, 0, sizeof(mask));
+  mask[cpu >> 6] = (uint64_t)1 << (cpu & 63);
+  syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+#else
+  (void)cpu;
+#endif
+}
+
+static int embedlet_get_cpu_count(void) {
+#if EMBEDLET_WINDOWS
+  SYSTEM_INFO sysinfo;
+  GetSystemInfo(&sysinfo);
+  return (int)sysinfo.dwNumberOfProcessors;
+#else
+#if defined(__linux__)
+  /* Cores this process may use, which a container may restrict */
+  uint64_t mask[EMBEDLET_MAX_CPUS / 64];
+  memset(mask, 0, sizeof(mask));
+  if (syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) > 0) {
+    int allowed = 0;
+    for (size_t i = 0; i < EMBEDLET_MAX_CPUS / 64; i++)
+      for (uint64_t w = mask[i]; w; w &= w - 1)
+        allowed++;
+    if (allowed > 0)
+      return allowed;
+  }
+#endif
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ * Thread Pool Implementation
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Every worker owns a deque. A parallel run queues its task i on worker i,
+ * so a store's row slices keep landing on the same (optionally pinned)
+ * cores; plain submissions go round-robin. A worker serves its own deque
+ * and, when that is empty, steals from another. Either way it takes the
+ * oldest item of the client (store) with the fewest items running, so
+ * stores sharing a pool get a fair share of it. The pool mutex only covers
+ * sleeping, completion counts, growth and references.
+ */
+
+static void embedlet_deque_push(embedlet_worker_t *w, embedlet_work_t *work) {
+  embedlet_mutex_lock(&w->lock);
+  work->next = NULL;
+  work->prev = w->tail;
+  if (w->tail) {
+    w->tail->next = work;
+  } else {
+    w->head = work;
+  }
+  w->tail = work;
+  embedlet_mutex_unlock(&w->lock);
+}
+
+/*
+ * Take the oldest item of the least busy client in a deque, or with a
+ * latch the oldest item of that run
+ */
+static embedlet_work_t *embedlet_deque_pop(embedlet_worker_t *w,
+                                           const embedlet_latch_t *latch) {
+  embedlet_mutex_lock(&w->lock);
+  embedlet_work_t *work = NULL;
+  size_t fewest = SIZE_MAX;
+  for (embedlet_work_t *e = w->head; e; e = e->next) {
+    if (latch) {
+      if (e->latch == latch) {
+        work = e;
+        break;
+      }
+      continue;
+    }
+    size_t running = embedlet_atomic_load(&e->client->running);
+    if (running < fewest) {
+      fewest = running;
+      work = e;
+      if (running == 0)
+        break;
+    }
+  }
+  if (work) {
+    if (work->prev) {
+      work->prev->next = work->next;
+    } else {
+      w->head = work->next;
+    }
+    if (work->next) {
+      work->next->prev = work->prev;
+    } else {
+      w->tail = work->prev;
+    }
+  }
+  embedlet_mutex_unlock(&w->lock);
+  return work;
+}
+
+/*
+ * Next item for worker `self` of the first n: its own deque, then the
+ * others'. A caller waiting on `latch` (self = -1) only takes that run's.
+ */
+static embedlet_work_t *embedlet_pool_take(embedlet_pool_t *pool, int self,
+                                           int n,
+                                           const embedlet_latch_t *latch) {
+  embedlet_work_t *work = NULL;
+  if (self >= 0)
+    work = embedlet_deque_pop(pool->workers[self], NULL);
+  for (int k = 1; !work && k <= n; k++) {
+    int victim = (self + k) % n;
+    if (victim != self)
+      work = embedlet_deque_pop(pool->workers[victim], latch);
+  }
+  if (work)
+    embedlet_atomic_fetch_add(&work->client->running, 1);
+  return work;
+}
+
+/* Account for a finished item and recycle it; the pool mutex is held */
+static void embedlet_pool_complete(embedlet_pool_t *pool,
+                                   embedlet_work_t *work) {
+  bool wake = --pool->pending_count == 0;
+  embedlet_atomic_fetch_add(&work->client->running, (size_t)-1);
+  if (work->latch && --work->latch->remaining == 0)
+    wake = true;
+  work->next = pool->free_work;
+  pool->free_work = work;
+  if (wake)
+    embedlet_cond_broadcast(&pool->cond_done);
+}
+
+/* Queue func(arg) on worker w; the pool mutex is held */
+static bool embedlet_pool_queue(embedlet_pool_t *pool, int w,
+                                void (*func)(void *), void *arg,
+                                embedlet_latch_t *latch,
+                                embedlet_pool_client_t *client) {
+  /* Reuse a finished work item; only a cold pool allocates */
+  embedlet_work_t *work = pool->free_work;
+  if (work) {
+    pool->free_work = work->next;
+  } else {
+    work = (embedlet_work_t *)malloc(sizeof(embedlet_work_t));
+    if (!work)
+      return false;
+  }
+  work->func = func;
+  work->arg = arg;
+  work->latch = latch;
+  work->client = client ? client : &pool->anon;
+  embedlet_deque_push(pool->workers[w], work);
+  pool->pending_count++;
+  return true;
+}
+
+#if EMBEDLET_WINDOWS
+static DWORD WINAPI embedlet_pool_worker(LPVOID arg) {
+#else
+static void *embedlet_pool_worker(void *arg) {
+#endif
+  embedlet_worker_t *self = (embedlet_worker_t *)arg;
+  embedlet_pool_t *pool = self->pool;
+  if (self->cpu >= 0)
+    embedlet_pin_thread(self->cpu);
+
+  embedlet_mutex_lock(&pool->mutex);
+  for (;;) {
+    unsigned generation = pool->generation;
+    int n = pool->num_threads;
+    bool shutdown = pool->shutdown;
+    embedlet_mutex_unlock(&pool->mutex);
+
+    embedlet_work_t *work = embedlet_pool_take(pool, self->index, n, NULL);
+    if (work)
+      work->func(work->arg);
+
+    embedlet_mutex_lock(&pool->mutex);
+    if (work) {
+      embedlet_pool_complete(pool, work);
+      continue;
+    }
+    if (shutdown)
+      break;
+    /* Nothing queued when we looked: sleep until the next submission */
+    while (pool->generation == generation && !pool->shutdown)
+      embedlet_cond_wait(&pool->cond_work, &pool->mutex);
+  }
+  embedlet_mutex_unlock(&pool->mutex);
+
+#if EMBEDLET_WINDOWS
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void embedlet_worker_join(embedlet_worker_t *w) {
+#if EMBEDLET_WINDOWS
+  WaitForSingleObject(w->thread, INFINITE);
+  CloseHandle(w->thread);
+#else
+  pthread_join(w->thread, NULL);
+#endif
+}
+
+/* Start workers until the pool has `threads` (up to max_threads) */
+static int embedlet_pool_grow(embedlet_pool_t *pool, int threads) {
+  if (threads > pool->max_threads)
+    threads = pool->max_threads;
+
+  int err = EMBEDLET_OK;
+  embedlet_mutex_lock(&pool->mutex);
+  while (pool->num_threads < threads) {
+    int i = pool->num_threads;
+    embedlet_worker_t *w =
+        (embedlet_worker_t *)calloc(1, sizeof(embedlet_worker_t));
+    if (!w) {
+      err = EMBEDLET_ERR_ALLOC;
+      break;
+    }
+    w->pool = pool;
+    w->index = i;
+    w->cpu = pool->pin && pool->num_cpus > 0 ? pool->cpus[i % pool->num_cpus]
+                                             : -1;
+    embedlet_mutex_init(&w->lock);
+#if EMBEDLET_WINDOWS
+    w->thread = CreateThread(NULL, 0, embedlet_pool_worker, w, 0, NULL);
+    bool started = w->thread != NULL;
+#else
+    bool started =
+        pthread_create(&w->thread, NULL, embedlet_pool_worker, w) == 0;
+#endif
+    if (!started) {
+      embedlet_mutex_destroy(&w->lock);
+      free(w);
+      err = EMBEDLET_ERR_THREAD;
+      break;
+    }
+    /* The new thread blocks on the mutex until it is published here */
+    pool->workers[i] = w;
+    pool->num_threads++;
+  }
+  embedlet_mutex_unlock(&pool->mutex);
+  return err;
+}
+
+static void embedlet_pool_stop(embedlet_pool_t *pool);
+
+/* A pool with one reference that may grow to max_threads workers */
+static embedlet_pool_t *embedlet_pool_start(int num_threads, int max_threads,
+                                            bool pin) {
+  if (num_threads <= 0)
+    return NULL;
+
+  embedlet_pool_t *pool = (embedlet_pool_t *)calloc(1, sizeof(embedlet_pool_t));
+  if (!pool)
+    return NULL;
+
+  pool->max_threads =
+      max_threads < EMBEDLET_MAX_THREADS ? max_threads : EMBEDLET_MAX_THREADS;
+  pool->refs = 1;
+  pool->pin = pin;
+  embedlet_mutex_init(&pool->mutex);
+  embedlet_cond_init(&pool->cond_work);
+  embedlet_cond_init(&pool->cond_done);
+
+  if (pin) {
+    pool->cpus = (int *)malloc(EMBEDLET_MAX_CPUS * sizeof(int));
+    if (pool->cpus)
+      pool->num_cpus = embedlet_cpu_order(pool->cpus, EMBEDLET_MAX_CPUS);
+  }
+
+  embedlet_pool_grow(pool, num_threads);
+  if (pool->num_threads == 0) {
+    embedlet_pool_stop(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+static void embedlet_pool_retain(embedlet_pool_t *pool) {
+  embedlet_mutex_lock(&pool->mutex);
+  pool->refs++;
+  embedlet_mutex_unlock(&pool->mutex);
+}
+
+/* Drop a reference, stopping the pool with the last one */
+static void embedlet_pool_release(embedlet_pool_t *pool) {
+  if (!pool)
+    return;
+  embedlet_mutex_lock(&pool->mutex);
+  bool last = --pool->refs == 0;
+  embedlet_mutex_unlock(&pool->mutex);
+  if (last)
+    embedlet_pool_stop(pool);
+}
+
+static inline void embedlet_pool_submit(embedlet_pool_t *pool,
+                                        void (*func)(void *), void *arg) {
+  embedlet_mutex_lock(&pool->mutex);
+  int w = (int)(pool->next_worker++ % (unsigned)pool->num_threads);
+  bool queued = embedlet_pool_queue(pool, w, func, arg, NULL, NULL);
+  if (queued) {
+    pool->generation++;
+    embedlet_cond_signal(&pool->cond_work);
+  }
+  embedlet_mutex_unlock(&pool->mutex);
+  if (!queued)
+    func(arg); /* out of memory: run it here rather than drop it */
+}
+
+/*
+ * Queue func on `count` tasks laid out task_size apart for `client`, task
+ * i on worker i, counting them on `latch` if set. Returns how many were
+ * queued (fewer only when out of memory) and the pool's worker count.
+ */
+static int embedlet_pool_post(embedlet_pool_t *pool,
+                              embedlet_pool_client_t *client,
+                              void (*func)(void *), void *tasks,
+                              size_t task_size, int count,
+                              embedlet_latch_t *latch, int *workers_out) {
+  uint8_t *base = (uint8_t *)tasks;
+  int queued = 0;
+
+  embedlet_mutex_lock(&pool->mutex);
+  int n = pool->num_threads;
+  while (queued < count &&
+         embedlet_pool_queue(pool, queued % n, func,
+                             base + (size_t)queued * task_size, latch,
+                             client)) {
+    if (latch)
+      latch->remaining++;
+    queued++;
+  }
+  pool->generation++;
+  for (int i = 0; i < queued && i < n; i++)
+    embedlet_cond_signal(&pool->cond_work);
+  embedlet_mutex_unlock(&pool->mutex);
+
+  *workers_out = n;
+  return queued;
+}
+
+/*
+ * Run func on `count` tasks laid out task_size apart for `client` and
+ * return once all have finished. Task i is queued on worker i; while it
+ * waits, the caller runs any of its own tasks no worker has picked up yet.
+ */
+static void embedlet_pool_run(embedlet_pool_t *pool,
+                              embedlet_pool_client_t *client,
+                              void (*func)(void *), void *tasks,
+                              size_t task_size, int count) {
+  embedlet_latch_t latch = {0};
+  uint8_t *base = (uint8_t *)tasks;
+  int n;
+  int queued = embedlet_pool_post(pool, client, func, tasks, task_size, count,
+                                  &latch, &n);
+  for (int i = queued; i < count; i++)
+    func(base + (size_t)i * task_size);
+
+  for (;;) {
+    embedlet_work_t *work = embedlet_pool_take(pool, -1, n, &latch);
+    if (!work)
+      break;
+    work->func(work->arg);
+    embedlet_mutex_lock(&pool->mutex);
+    embedlet_pool_complete(pool, work);
+    embedlet_mutex_unlock(&pool->mutex);
+  }
+
+  embedlet_mutex_lock(&pool->mutex);
+  while (latch.remaining > 0)
+    embedlet_cond_wait(&pool->cond_done, &pool->mutex);
+  embedlet_mutex_unlock(&pool->mutex);
+}
+
+/* Wait until every submitted item has finished */
+static inline void embedlet_pool_wait(embedlet_pool_t *pool) {
+  embedlet_mutex_lock(&pool->mutex);
+  while (pool->pending_count > 0)
+    embedlet_cond_wait(&pool->cond_done, &pool->mutex);
+  embedlet_mutex_unlock(&pool->mutex);
+}
+
+static void embedlet_pool_stop(embedlet_pool_t *pool) {
+  if (!pool)
+    return;
+
+  /* Workers drain what is still queued before they exit */
+  embedlet_mutex_lock(&pool->mutex);
+  pool->shutdown = true;
+  embedlet_cond_broadcast(&pool->cond_work);
+  embedlet_mutex_unlock(&pool->mutex);
+
+  /* Join them all first: any of them may still steal from another's deque */
+  for (int i = 0; i < pool->num_threads; i++)
+    embedlet_worker_join(pool->workers[i]);
+  for (int i = 0; i < pool->num_threads; i++) {
+    embedlet_mutex_destroy(&pool->workers[i]->lock);
+    free(pool->workers[i]);
+  }
+
+  embedlet_work_t *work = pool->free_work;
+  while (work) {
+    embedlet_work_t *next = work->next;
+    free(work);
+    work = next;
+  }
+
+  embedlet_mutex_destroy(&pool->mutex);
+  embedlet_cond_destroy(&pool->cond_work);
+  embedlet_cond_destroy(&pool->cond_done);
+  free(pool->cpus);
+  free(pool);
+}
+
+/* Contiguous slice i of `threads` over [0, total) */
+static void embedlet_split_range(size_t total, int threads, int i,
+                                 size_t *start, size_t *end) {
+  size_t chunk = total / (size_t)threads;
+  size_t remainder = total % (size_t)threads;
+  *start = (size_t)i * chunk + ((size_t)i < remainder ? (size_t)i : remainder);
+  *end = *start + chunk + ((size_t)i < remainder ? 1 : 0);
+}
+
+/* Split [0, total) into `count` slices claimed `grain` items at a time */
+static void embedlet_steal_init(embedlet_steal_t *steal,
+                                embedlet_slice_t *slices, int count,
+                                size_t total, size_t grain) {
+  for (int i = 0; i < count; i++) {
+    size_t start;
+    embedlet_split_range(total, count, i, &start, &slices[i].end);
+    slices[i].next = start;
+  }
+  steal->slices = slices;
+  steal->count = count;
+  steal->grain = grain ? grain : 1;
+  steal->stop = NULL;
+}
+
+/* Claim the next block for participant `slot`: own slice first */
+static bool embedlet_steal_next(const embedlet_steal_t *steal, int slot,
+                                size_t *start, size_t *end) {
+  if (steal->stop && embedlet_atomic_load(steal->stop))
+    return false;
+  for (int k = 0; k < steal->count; k++) {
+    embedlet_slice_t *s = &steal->slices[(slot + k) % steal->count];
+    if (embedlet_atomic_load(&s->next) >= s->end)
+      continue;
+    size_t b = embedlet_atomic_fetch_add(&s->next, steal->grain);
+    if (b < s->end) {
+      *start = b;
+      *end = s->end - b > steal->grain ? b + steal->grain : s->end;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*----------------------------------------------------------------------------
+ * Similarity Functions (C + optional SSE2/AVX2/AVX-512/NEON/SVE)
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Fixed-size kernels: each backend's float32 dot product again, as a row
+ * kernel a store of that size calls directly, with the dimension count a
+ * constant the loop is unrolled over. The sizes are multiples of 64, so the
+ * main loop covers every element and scores are bit-identical to the
+ * generic kernel's.
+ */
+#if defined(__clang__)
+#define EMBEDLET_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#define EMBEDLET_UNROLL _Pragma("GCC unroll 64")
+#else
+#define EMBEDLET_UNROLL
+#endif
+
+static float embedlet_dot_c(const float *a, const float *b, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+#define EMBEDLET_DEFINE_FIXED_DOT_C(dims)                                      \
+  static float embedlet_row_dot_c_##dims(const float *a, float a_sum,          \
+                                         const void *row, size_t n) {          \
+    (void)a_sum;                                                               \
+    (void)n;                                                                   \
+    return embedlet_dot_c(a, (const float *)row, dims);                        \
+  }
+
+/* Only the default table of a build without SSE2 or NEON uses them */
+#if EMBEDLET_FIXED_DIMS && !EMBEDLET_HAS_SSE2 && !EMBEDLET_HAS_NEON
+EMBEDLET_DEFINE_FIXED_DOT_C(384)
+EMBEDLET_DEFINE_FIXED_DOT_C(768)
+EMBEDLET_DEFINE_FIXED_DOT_C(1024)
+#endif
+
+static float embedlet_norm_c(const float *a, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * a[i];
+  }
+  return sqrtf(sum);
+}
+
+/* Scalar element conversions, used for encoding and for kernel tails */
+
+static inline float embedlet_bits_to_f32(uint32_t bits) {
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+static inline uint32_t embedlet_f32_to_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+static inline float embedlet_f16_to_f32(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+  uint32_t exp = (h >> 10) & 0x1fu;
+  uint32_t mant = h & 0x3ffu;
+
+  if (exp == 0x1f)
+    return embedlet_bits_to_f32(sign | 0x7f800000u | (mant << 13));
+  if (exp == 0) {
+    if (mant == 0)
+      return embedlet_bits_to_f32(sign);
+    /* Subnormal: renormalise into a float32 exponent */
+    exp = 113;
+    while (!(mant & 0x400u)) {
+      mant <<= 1;
+      exp--;
+    }
+    return embedlet_bits_to_f32(sign | (exp << 23) | ((mant & 0x3ffu) << 13));
+  }
+  return embedlet_bits_to_f32(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+/* float32 -> IEEE half, round to nearest even */
+static inline uint16_t embedlet_f32_to_f16(float f) {
+  uint32_t x = embedlet_f32_to_bits(f);
+  uint32_t sign = (x >> 16) & 0x8000u;
+  uint32_t exp = (x >> 23) & 0xffu;
+  uint32_t mant = x & 0x7fffffu;
+
+  if (exp == 0xff)
+    return (uint16_t)(sign | 0x7c00u | (mant ? 0x200u : 0));
+
+  int e = (int)exp - 112;
+  if (e >= 31)
+    return (uint16_t)(sign | 0x7c00u);
+
+  uint32_t shift, base;
+  if (e <= 0) {
+    if (e < -10)
+      return (uint16_t)sign;
+    mant |= 0x800000u;
+    shift = (uint32_t)(14 - e);
+    base = 0;
+  } else {
+    shift = 13;
+    base = (uint32_t)e << 10;
+  }
+
+  uint32_t h = base | (mant >> shift);
+  uint32_t rem = mant & ((1u << shift) - 1u);
+  uint32_t half = 1u << (shift - 1);
+  if (rem > half || (rem == half && (h & 1u)))
+    h++; /* may carry into the exponent, which is the correct rounding */
+  return (uint16_t)(sign | h);
+}
+
+static inline float embedlet_bf16_to_f32(uint16_t h) {
+  return embedlet_bits_to_f32((uint32_t)h << 16);
+}
+
+/* float32 -> bfloat16, round to nearest even */
+static inline uint16_t embedlet_f32_to_bf16(float f) {
+  uint32_t x = embedlet_f32_to_bits(f);
+  if ((x & 0x7fffffffu) > 0x7f800000u)
+    return (uint16_t)((x >> 16) | 0x40u); /* keep NaN quiet */
+  x += 0x7fffu + ((x >> 16) & 1u);
+  return (uint16_t)(x >> 16);
+}
+
+static inline float embedlet_i8_to_f32(int8_t v) { return (float)v; }
+
+/*
+ * Dot products of a float32 query with a converted row. The int8 kernel
+ * returns the raw sum of query * code; the caller applies scale and offset.
+ */
+static float embedlet_dot_f16_c(const float *a, const uint16_t *b, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * embedlet_f16_to_f32(b[i]);
+  }
+  return sum;
+}
+
+/* Only the default table of a build without SSE2 or NEON uses these two */
+#if !EMBEDLET_HAS_SSE2 && !EMBEDLET_HAS_NEON
+static float embedlet_dot_bf16_c(const float *a, const uint16_t *b, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * embedlet_bf16_to_f32(b[i]);
+  }
+  return sum;
+}
+
+static float embedlet_dot_i8_c(const float *a, const int8_t *b, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i] * (float)b[i];
+  }
+  return sum;
+}
+#endif
+
+/*
+ * Dot products of `q` with the EMBEDLET_BLOCK_ROWS rows of one block of the
+ * blocked copy, written to out[0..15]. Each query element is loaded once for
+ * all rows and every row accumulates in its own lane, so no horizontal sums
+ * are needed. Only the default table of a build without SSE2 or NEON uses it.
+ */
+#if !EMBEDLET_HAS_SSE2 && !EMBEDLET_HAS_NEON
+static void embedlet_dot_block_c(const float *q, const float *block,
+                                 size_t dims, float *out) {
+  float sum[EMBEDLET_BLOCK_ROWS] = {0.0f};
+  for (size_t d = 0; d < dims; d++) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    for (size_t r = 0; r < EMBEDLET_BLOCK_ROWS; r++) {
+      sum[r] += q[d] * b[r];
+    }
+  }
+  memcpy(out, sum, sizeof(sum));
+}
+#endif
+
+static inline uint32_t embedlet_popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (uint32_t)__builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ull);
+  x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return (uint32_t)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+/* Number of differing bits between two packed sign codes */
+static uint32_t embedlet_hamming_c(const uint64_t *a, const uint64_t *b,
+                                   size_t words) {
+  uint32_t dist = 0;
+  for (size_t i = 0; i < words; i++) {
+    dist += embedlet_popcount64(a[i] ^ b[i]);
+  }
+  return dist;
+}
+
+#if EMBEDLET_HAS_SSE2
+
+static float embedlet_hsum_sse(__m128 v) {
+  __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  __m128 sums = _mm_add_ps(v, shuf);
+  shuf = _mm_movehl_ps(shuf, sums);
+  sums = _mm_add_ss(sums, shuf);
+  return _mm_cvtss_f32(sums);
+}
+
+static float embedlet_dot_sse2(const float *a, const float *b, size_t n) {
+  __m128 s0 = _mm_setzero_ps();
+  __m128 s1 = _mm_setzero_ps();
+  __m128 s2 = _mm_setzero_ps();
+  __m128 s3 = _mm_setzero_ps();
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(
+        s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    s2 = _mm_add_ps(
+        s2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+    s3 = _mm_add_ps(
+        s3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+
+  float result =
+      embedlet_hsum_sse(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+
+  for (; i < n; i++) {
+    result += a[i] * b[i];
+  }
+
+  return result;
+}
+
+#define EMBEDLET_DEFINE_FIXED_DOT_SSE2(dims)                                   \
+  static float embedlet_row_dot_sse2_##dims(const float *a, float a_sum,       \
+                                            const void *row, size_t n) {       \
+    const float *b = (const float *)row;                                       \
+    (void)a_sum;                                                               \
+    (void)n;                                                                   \
+    __m128 s0 = _mm_setzero_ps();                                              \
+    __m128 s1 = _mm_setzero_ps();                                              \
+    __m128 s2 = _mm_setzero_ps();                                              \
+    __m128 s3 = _mm_setzero_ps();                                              \
+    EMBEDLET_UNROLL                                                            \
+    for (size_t i = 0; i < dims; i += 16) {                                    \
+      s0 = _mm_add_ps(s0,                                                      \
+                      _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));   \
+      s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),                  \
+                                     _mm_loadu_ps(b + i + 4)));                \
+      s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a + i + 8),                  \
+                                     _mm_loadu_ps(b + i + 8)));                \
+      s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a + i + 12),                 \
+                                     _mm_loadu_ps(b + i + 12)));               \
+    }                                                                          \
+    return embedlet_hsum_sse(                                                  \
+        _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));                   \
+  }
+
+#if EMBEDLET_FIXED_DIMS
+EMBEDLET_DEFINE_FIXED_DOT_SSE2(384)
+EMBEDLET_DEFINE_FIXED_DOT_SSE2(768)
+EMBEDLET_DEFINE_FIXED_DOT_SSE2(1024)
+#endif
+
+static float embedlet_norm_sse2(const float *a, size_t n) {
+  return sqrtf(embedlet_dot_sse2(a, a, n));
+}
+
+/* Two dimensions per step, each into its own set of four accumulators */
+static void embedlet_dot_block_sse2(const float *q, const float *block,
+                                    size_t dims, float *out) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+  __m128 t0 = _mm_setzero_ps(), t1 = _mm_setzero_ps();
+  __m128 t2 = _mm_setzero_ps(), t3 = _mm_setzero_ps();
+  size_t d = 0;
+
+  for (; d + 2 <= dims; d += 2) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    __m128 q0 = _mm_set1_ps(q[d]);
+    __m128 q1 = _mm_set1_ps(q[d + 1]);
+    s0 = _mm_add_ps(s0, _mm_mul_ps(q0, _mm_loadu_ps(b)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(q0, _mm_loadu_ps(b + 4)));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(q0, _mm_loadu_ps(b + 8)));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(q0, _mm_loadu_ps(b + 12)));
+    t0 = _mm_add_ps(t0, _mm_mul_ps(q1, _mm_loadu_ps(b + 16)));
+    t1 = _mm_add_ps(t1, _mm_mul_ps(q1, _mm_loadu_ps(b + 20)));
+    t2 = _mm_add_ps(t2, _mm_mul_ps(q1, _mm_loadu_ps(b + 24)));
+    t3 = _mm_add_ps(t3, _mm_mul_ps(q1, _mm_loadu_ps(b + 28)));
+  }
+  if (d < dims) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    __m128 q0 = _mm_set1_ps(q[d]);
+    s0 = _mm_add_ps(s0, _mm_mul_ps(q0, _mm_loadu_ps(b)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(q0, _mm_loadu_ps(b + 4)));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(q0, _mm_loadu_ps(b + 8)));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(q0, _mm_loadu_ps(b + 12)));
+  }
+
+  _mm_storeu_ps(out, _mm_add_ps(s0, t0));
+  _mm_storeu_ps(out + 4, _mm_add_ps(s1, t1));
+  _mm_storeu_ps(out + 8, _mm_add_ps(s2, t2));
+  _mm_storeu_ps(out + 12, _mm_add_ps(s3, t3));
+}
+
+/*
+ * Converting kernels: same accumulation as the float32 kernel, with each row
+ * chunk widened to float32 lanes by `load`. There is no half-precision
+ * conversion in SSE2, so f16 rows use the C kernel on this backend.
+ */
+#define EMBEDLET_DEFINE_DOT_SSE2(name, type, load, scalar)                     \
+  static float name(const float *a, const type *b, size_t n) {                \
+    __m128 s0 = _mm_setzero_ps();                                              \
+    __m128 s1 = _mm_setzero_ps();                                              \
+    __m128 s2 = _mm_setzero_ps();                                              \
+    __m128 s3 = _mm_setzero_ps();                                              \
+    size_t i = 0;                                                              \
+    for (; i + 16 <= n; i += 16) {                                             \
+      s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), load(b + i)));      \
+      s1 = _mm_add_ps(s1,                                                      \
+                      _mm_mul_ps(_mm_loadu_ps(a + i + 4), load(b + i + 4)));   \
+      s2 = _mm_add_ps(s2,                                                      \
+                      _mm_mul_ps(_mm_loadu_ps(a + i + 8), load(b + i + 8)));   \
+      s3 = _mm_add_ps(s3,                                                      \
+                      _mm_mul_ps(_mm_loadu_ps(a + i + 12), load(b + i + 12))); \
+    }                                                                          \
+    for (; i + 4 <= n; i += 4) {                                               \
+      s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), load(b + i)));      \
+    }                                                                          \
+    float result =                                                             \
+        embedlet_hsum_sse(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3))); \
+    for (; i < n; i++) {                                                       \
+      result += a[i] * scalar(b[i]);                                           \
+    }                                                                          \
+    return result;                                                             \
+  }
+
+static inline __m128 embedlet_load_bf16_sse2(const uint16_t *p) {
+  __m128i h = _mm_loadl_epi64((const __m128i *)p);
+  return _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), h));
+}
+
+static inline __m128 embedlet_load_i8_sse2(const int8_t *p) {
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  __m128i x = _mm_cvtsi32_si128(v);
+  x = _mm_unpacklo_epi8(x, x);
+  x = _mm_unpacklo_epi16(x, x);
+  return _mm_cvtepi32_ps(_mm_srai_epi32(x, 24));
+}
+
+EMBEDLET_DEFINE_DOT_SSE2(embedlet_dot_bf16_sse2, uint16_t,
+                         embedlet_load_bf16_sse2, embedlet_bf16_to_f32)
+EMBEDLET_DEFINE_DOT_SSE2(embedlet_dot_i8_sse2, int8_t, embedlet_load_i8_sse2,
+                         embedlet_i8_to_f32)
+
+#endif /* EMBEDLET_HAS_SSE2 */
+
+#if EMBEDLET_HAS_AVX
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EMBEDLET_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define EMBEDLET_TARGET_AVX512 __attribute__((target("avx512f")))
+#define EMBEDLET_TARGET_POPCNT __attribute__((target("popcnt")))
+#else
+#define EMBEDLET_TARGET_AVX2
+#define EMBEDLET_TARGET_AVX512
+#define EMBEDLET_TARGET_POPCNT
+#endif
+
+/* Hardware popcount; baseline x86-64 only guarantees SSE2 */
+EMBEDLET_TARGET_POPCNT
+static uint32_t embedlet_hamming_popcnt(const uint64_t *a, const uint64_t *b,
+                                        size_t words) {
+  uint64_t d0 = 0;
+  uint64_t d1 = 0;
+  size_t i = 0;
+
+  for (; i + 2 <= words; i += 2) {
+#if defined(__x86_64__) || defined(_M_X64)
+    d0 += (uint64_t)_mm_popcnt_u64(a[i] ^ b[i]);
+    d1 += (uint64_t)_mm_popcnt_u64(a[i + 1] ^ b[i + 1]);
+#else
+    uint64_t x0 = a[i] ^ b[i];
+    uint64_t x1 = a[i + 1] ^ b[i + 1];
+    d0 += (uint64_t)(_mm_popcnt_u32((unsigned int)x0) +
+                     _mm_popcnt_u32((unsigned int)(x0 >> 32)));
+    d1 += (uint64_t)(_mm_popcnt_u32((unsigned int)x1) +
+                     _mm_popcnt_u32((unsigned int)(x1 >> 32)));
+#endif
+  }
+  if (i < words)
+    d0 += embedlet_popcount64(a[i] ^ b[i]);
+
+  return (uint32_t)(d0 + d1);
+}
+
+EMBEDLET_TARGET_AVX2
+static inline float embedlet_hsum_avx(__m256 v) {
+  __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+  x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+  return _mm_cvtss_f32(x);
+}
+
+EMBEDLET_TARGET_AVX2
+static float embedlet_dot_avx2(const float *a, const float *b, size_t n) {
+  __m256 s0 = _mm256_setzero_ps();
+  __m256 s1 = _mm256_setzero_ps();
+  __m256 s2 = _mm256_setzero_ps();
+  __m256 s3 = _mm256_setzero_ps();
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8),
+                         s1);
+    s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16),
+                         _mm256_loadu_ps(b + i + 16), s2);
+    s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24),
+                         _mm256_loadu_ps(b + i + 24), s3);
+  }
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+  }
+
+  float result = embedlet_hsum_avx(
+      _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+
+  for (; i < n; i++) {
+    result += a[i] * b[i];
+  }
+
+  return result;
+}
+
+#define EMBEDLET_DEFINE_FIXED_DOT_AVX2(dims)                                   \
+  EMBEDLET_TARGET_AVX2                                                         \
+  static float embedlet_row_dot_avx2_##dims(const float *a, float a_sum,       \
+                                            const void *row, size_t n) {       \
+    const float *b = (const float *)row;                                       \
+    (void)a_sum;                                                               \
+    (void)n;                                                                   \
+    __m256 s0 = _mm256_setzero_ps();                                           \
+    __m256 s1 = _mm256_setzero_ps();                                           \
+    __m256 s2 = _mm256_setzero_ps();                                           \
+    __m256 s3 = _mm256_setzero_ps();                                           \
+    EMBEDLET_UNROLL                                                            \
+    for (size_t i = 0; i < dims; i += 32) {                                    \
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),     \
+                           s0);                                                \
+      s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),                         \
+                           _mm256_loadu_ps(b + i + 8), s1);                    \
+      s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16),                        \
+                           _mm256_loadu_ps(b + i + 16), s2);                   \
+      s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24),                        \
+                           _mm256_loadu_ps(b + i + 24), s3);                   \
+    }                                                                          \
+    return embedlet_hsum_avx(                                                  \
+        _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));          \
+  }
+
+#if EMBEDLET_FIXED_DIMS
+EMBEDLET_DEFINE_FIXED_DOT_AVX2(384)
+EMBEDLET_DEFINE_FIXED_DOT_AVX2(768)
+EMBEDLET_DEFINE_FIXED_DOT_AVX2(1024)
+#endif
+
+EMBEDLET_TARGET_AVX2
+static float embedlet_norm_avx2(const float *a, size_t n) {
+  return sqrtf(embedlet_dot_avx2(a, a, n));
+}
+
+/* Four dimensions per step; each dimension keeps a pair of accumulators */
+EMBEDLET_TARGET_AVX2
+static void embedlet_dot_block_avx2(const float *q, const float *block,
+                                    size_t dims, float *out) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  __m256 s4 = _mm256_setzero_ps(), s5 = _mm256_setzero_ps();
+  __m256 s6 = _mm256_setzero_ps(), s7 = _mm256_setzero_ps();
+  size_t d = 0;
+
+  for (; d + 4 <= dims; d += 4) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    __m256 q0 = _mm256_broadcast_ss(q + d);
+    __m256 q1 = _mm256_broadcast_ss(q + d + 1);
+    __m256 q2 = _mm256_broadcast_ss(q + d + 2);
+    __m256 q3 = _mm256_broadcast_ss(q + d + 3);
+    s0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(b), s0);
+    s1 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(b + 8), s1);
+    s2 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(b + 16), s2);
+    s3 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(b + 24), s3);
+    s4 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(b + 32), s4);
+    s5 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(b + 40), s5);
+    s6 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(b + 48), s6);
+    s7 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(b + 56), s7);
+  }
+  for (; d < dims; d++) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    __m256 q0 = _mm256_broadcast_ss(q + d);
+    s0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(b), s0);
+    s1 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(b + 8), s1);
+  }
+
+  _mm256_storeu_ps(out, _mm256_add_ps(_mm256_add_ps(s0, s2),
+                                      _mm256_add_ps(s4, s6)));
+  _mm256_storeu_ps(out + 8, _mm256_add_ps(_mm256_add_ps(s1, s3),
+                                          _mm256_add_ps(s5, s7)));
+}
+
+#define EMBEDLET_DEFINE_DOT_AVX2(name, type, load, scalar)                     \
+  EMBEDLET_TARGET_AVX2                                                         \
+  static float name(const float *a, const type *b, size_t n) {                \
+    __m256 s0 = _mm256_setzero_ps();                                           \
+    __m256 s1 = _mm256_setzero_ps();                                           \
+    __m256 s2 = _mm256_setzero_ps();                                           \
+    __m256 s3 = _mm256_setzero_ps();                                           \
+    size_t i = 0;                                                              \
+    for (; i + 32 <= n; i += 32) {                                             \
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), load(b + i), s0);          \
+      s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), load(b + i + 8), s1);  \
+      s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), load(b + i + 16), s2); \
+      s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), load(b + i + 24), s3); \
+    }                                                                          \
+    for (; i + 8 <= n; i += 8) {                                               \
+      s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), load(b + i), s0);          \
+    }                                                                          \
+    float result = embedlet_hsum_avx(                                          \
+        _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));          \
+    for (; i < n; i++) {                                                       \
+      result += a[i] * scalar(b[i]);                                           \
+    }                                                                          \
+    return result;                                                             \
+  }
+
+EMBEDLET_TARGET_AVX2
+static inline __m256 embedlet_load_f16_avx2(const uint16_t *p) {
+  return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)p));
+}
+
+EMBEDLET_TARGET_AVX2
+static inline __m256 embedlet_load_bf16_avx2(const uint16_t *p) {
+  __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+}
+
+EMBEDLET_TARGET_AVX2
+static inline __m256 embedlet_load_i8_avx2(const int8_t *p) {
+  __m256i w = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)p));
+  return _mm256_cvtepi32_ps(w);
+}
+
+EMBEDLET_DEFINE_DOT_AVX2(embedlet_dot_f16_avx2, uint16_t,
+                         embedlet_load_f16_avx2, embedlet_f16_to_f32)
+EMBEDLET_DEFINE_DOT_AVX2(embedlet_dot_bf16_avx2, uint16_t,
+                         embedlet_load_bf16_avx2, embedlet_bf16_to_f32)
+EMBEDLET_DEFINE_DOT_AVX2(embedlet_dot_i8_avx2, int8_t, embedlet_load_i8_avx2,
+                         embedlet_i8_to_f32)
+
+EMBEDLET_TARGET_AVX512
+static inline float embedlet_hsum_avx512(__m512 v) {
+  __m256 lo = _mm512_castps512_ps256(v);
+  __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+  __m256 s = _mm256_add_ps(lo, hi);
+  __m128 x = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+  x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+  return _mm_cvtss_f32(x);
+}
+
+EMBEDLET_TARGET_AVX512
+static float embedlet_dot_avx512(const float *a, const float *b, size_t n) {
+  __m512 s0 = _mm512_setzero_ps();
+  __m512 s1 = _mm512_setzero_ps();
+  __m512 s2 = _mm512_setzero_ps();
+  __m512 s3 = _mm512_setzero_ps();
+  size_t i = 0;
+
+  for (; i + 64 <= n; i += 64) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16),
+                         _mm512_loadu_ps(b + i + 16), s1);
+    s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32),
+                         _mm512_loadu_ps(b + i + 32), s2);
+    s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48),
+                         _mm512_loadu_ps(b + i + 48), s3);
+  }
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+  }
+  if (i < n) {
+    __mmask16 mask = (__mmask16)((1u << (n - i)) - 1u);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                         _mm512_maskz_loadu_ps(mask, b + i), s1);
+  }
+
+  return embedlet_hsum_avx512(
+      _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+#define EMBEDLET_DEFINE_FIXED_DOT_AVX512(dims)                                 \
+  EMBEDLET_TARGET_AVX512                                                       \
+  static float embedlet_row_dot_avx512_##dims(const float *a, float a_sum,     \
+                                              const void *row, size_t n) {     \
+    const float *b = (const float *)row;                                       \
+    (void)a_sum;                                                               \
+    (void)n;                                                                   \
+    __m512 s0 = _mm512_setzero_ps();                                           \
+    __m512 s1 = _mm512_setzero_ps();                                           \
+    __m512 s2 = _mm512_setzero_ps();                                           \
+    __m512 s3 = _mm512_setzero_ps();                                           \
+    EMBEDLET_UNROLL                                                            \
+    for (size_t i = 0; i < dims; i += 64) {                                    \
+      s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i),     \
+                           s0);                                                \
+      s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16),                        \
+                           _mm512_loadu_ps(b + i + 16), s1);                   \
+      s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32),                        \
+                           _mm512_loadu_ps(b + i + 32), s2);                   \
+      s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48),                        \
+                           _mm512_loadu_ps(b + i + 48), s3);                   \
+    }                                                                          \
+    return embedlet_hsum_avx512(                                               \
+        _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));          \
+  }
+
+#if EMBEDLET_FIXED_DIMS
+EMBEDLET_DEFINE_FIXED_DOT_AVX512(384)
+EMBEDLET_DEFINE_FIXED_DOT_AVX512(768)
+EMBEDLET_DEFINE_FIXED_DOT_AVX512(1024)
+#endif
+
+EMBEDLET_TARGET_AVX512
+static float embedlet_norm_avx512(const float *a, size_t n) {
+  return sqrtf(embedlet_dot_avx512(a, a, n));
+}
+
+/* A block row is one ZMM register; four dimensions per step */
+EMBEDLET_TARGET_AVX512
+static void embedlet_dot_block_avx512(const float *q, const float *block,
+                                      size_t dims, float *out) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  size_t d = 0;
+
+  for (; d + 4 <= dims; d += 4) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    s0 = _mm512_fmadd_ps(_mm512_set1_ps(q[d]), _mm512_loadu_ps(b), s0);
+    s1 = _mm512_fmadd_ps(_mm512_set1_ps(q[d + 1]), _mm512_loadu_ps(b + 16),
+                         s1);
+    s2 = _mm512_fmadd_ps(_mm512_set1_ps(q[d + 2]), _mm512_loadu_ps(b + 32),
+                         s2);
+    s3 = _mm512_fmadd_ps(_mm512_set1_ps(q[d + 3]), _mm512_loadu_ps(b + 48),
+                         s3);
+  }
+  for (; d < dims; d++) {
+    s0 = _mm512_fmadd_ps(_mm512_set1_ps(q[d]),
+                         _mm512_loadu_ps(block + d * EMBEDLET_BLOCK_ROWS), s0);
+  }
+
+  _mm512_storeu_ps(out,
+                   _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+/* Masked 16-bit/8-bit tail loads need AVX-512BW, so tails stay scalar */
+#define EMBEDLET_DEFINE_DOT_AVX512(name, type, load, scalar)                   \
+  EMBEDLET_TARGET_AVX512                                                       \
+  static float name(const float *a, const type *b, size_t n) {                \
+    __m512 s0 = _mm512_setzero_ps();                                           \
+    __m512 s1 = _mm512_setzero_ps();                                           \
+    __m512 s2 = _mm512_setzero_ps();                                           \
+    __m512 s3 = _mm512_setzero_ps();                                           \
+    size_t i = 0;                                                              \
+    for (; i + 64 <= n; i += 64) {                                             \
+      s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), load(b + i), s0);          \
+      s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), load(b + i + 16), s1); \
+      s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), load(b + i + 32), s2); \
+      s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), load(b + i + 48), s3); \
+    }                                                                          \
+    for (; i + 16 <= n; i += 16) {                                             \
+      s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), load(b + i), s0);          \
+    }                                                                          \
+    float result = embedlet_hsum_avx512(                                       \
+        _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));          \
+    for (; i < n; i++) {                                                       \
+      result += a[i] * scalar(b[i]);                                           \
+    }                                                                          \
+    return result;                                                             \
+  }
+
+EMBEDLET_TARGET_AVX512
+static inline __m512 embedlet_load_f16_avx512(const uint16_t *p) {
+  return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)p));
+}
+
+EMBEDLET_TARGET_AVX512
+static inline __m512 embedlet_load_bf16_avx512(const uint16_t *p) {
+  __m512i w = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)p));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(w, 16));
+}
+
+EMBEDLET_TARGET_AVX512
+static inline __m512 embedlet_load_i8_avx512(const int8_t *p) {
+  __m512i w = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)p));
+  return _mm512_cvtepi32_ps(w);
+}
+
+EMBEDLET_DEFINE_DOT_AVX512(embedlet_dot_f16_avx512, uint16_t,
+                           embedlet_load_f16_avx512, embedlet_f16_to_f32)
+EMBEDLET_DEFINE_DOT_AVX512(embedlet_dot_bf16_avx512, uint16_t,
+                           embedlet_load_bf16_avx512, embedlet_bf16_to_f32)
+EMBEDLET_DEFINE_DOT_AVX512(embedlet_dot_i8_avx512, int8_t,
+                           embedlet_load_i8_avx512, embedlet_i8_to_f32)
+
+#endif /* EMBEDLET_HAS_AVX */
+
+#if EMBEDLET_HAS_NEON
+
+static float embedlet_dot_neon(const float *a, const float *b, size_t n) {
+  float32x4_t s0 = vdupq_n_f32(0.0f);
+  float32x4_t s1 = vdupq_n_f32(0.0f);
+  float32x4_t s2 = vdupq_n_f32(0.0f);
+  float32x4_t s3 = vdupq_n_f32(0.0f);
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+    s1 = vfmaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    s2 = vfmaq_f32(s2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+    s3 = vfmaq_f32(s3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+
+  float result = vaddvq_f32(vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3)));
+
+  for (; i < n; i++) {
+    result += a[i] * b[i];
+  }
+
+  return result;
+}
+
+#define EMBEDLET_DEFINE_FIXED_DOT_NEON(dims)                                   \
+  static float embedlet_row_dot_neon_##dims(const float *a, float a_sum,       \
+                                            const void *row, size_t n) {       \
+    const float *b = (const float *)row;                                       \
+    (void)a_sum;                                                               \
+    (void)n;                                                                   \
+    float32x4_t s0 = vdupq_n_f32(0.0f);                                        \
+    float32x4_t s1 = vdupq_n_f32(0.0f);                                        \
+    float32x4_t s2 = vdupq_n_f32(0.0f);                                        \
+    float32x4_t s3 = vdupq_n_f32(0.0f);                                        \
+    EMBEDLET_UNROLL                                                            \
+    for (size_t i = 0; i < dims; i += 16) {                                    \
+      s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));                  \
+      s1 = vfmaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));          \
+      s2 = vfmaq_f32(s2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));          \
+      s3 = vfmaq_f32(s3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));        \
+    }                                                                          \
+    return vaddvq_f32(vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3)));        \
+  }
+
+#if EMBEDLET_FIXED_DIMS
+EMBEDLET_DEFINE_FIXED_DOT_NEON(384)
+EMBEDLET_DEFINE_FIXED_DOT_NEON(768)
+EMBEDLET_DEFINE_FIXED_DOT_NEON(1024)
+#endif
+
+static float embedlet_norm_neon(const float *a, size_t n) {
+  return sqrtf(embedlet_dot_neon(a, a, n));
+}
+
+/* Two dimensions per step, each into its own set of four accumulators */
+static void embedlet_dot_block_neon(const float *q, const float *block,
+                                    size_t dims, float *out) {
+  float32x4_t s0 = vdupq_n_f32(0.0f), s1 = vdupq_n_f32(0.0f);
+  float32x4_t s2 = vdupq_n_f32(0.0f), s3 = vdupq_n_f32(0.0f);
+  float32x4_t t0 = vdupq_n_f32(0.0f), t1 = vdupq_n_f32(0.0f);
+  float32x4_t t2 = vdupq_n_f32(0.0f), t3 = vdupq_n_f32(0.0f);
+  size_t d = 0;
+
+  for (; d + 2 <= dims; d += 2) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    float32x4_t q0 = vdupq_n_f32(q[d]);
+    float32x4_t q1 = vdupq_n_f32(q[d + 1]);
+    s0 = vfmaq_f32(s0, q0, vld1q_f32(b));
+    s1 = vfmaq_f32(s1, q0, vld1q_f32(b + 4));
+    s2 = vfmaq_f32(s2, q0, vld1q_f32(b + 8));
+    s3 = vfmaq_f32(s3, q0, vld1q_f32(b + 12));
+    t0 = vfmaq_f32(t0, q1, vld1q_f32(b + 16));
+    t1 = vfmaq_f32(t1, q1, vld1q_f32(b + 20));
+    t2 = vfmaq_f32(t2, q1, vld1q_f32(b + 24));
+    t3 = vfmaq_f32(t3, q1, vld1q_f32(b + 28));
+  }
+  if (d < dims) {
+    const float *b = block + d * EMBEDLET_BLOCK_ROWS;
+    float32x4_t q0 = vdupq_n_f32(q[d]);
+    s0 = vfmaq_f32(s0, q0, vld1q_f32(b));
+    s1 = vfmaq_f32(s1, q0, vld1q_f32(b + 4));
+    s2 = vfmaq_f32(s2, q0, vld1q_f32(b + 8));
+    s3 = vfmaq_f32(s3, q0, vld1q_f32(b + 12));
+  }
+
+  vst1q_f32(out, vaddq_f32(s0, t0));
+  vst1q_f32(out + 4, vaddq_f32(s1, t1));
+  vst1q_f32(out + 8, vaddq_f32(s2, t2));
+  vst1q_f32(out + 12, vaddq_f32(s3, t3));
+}
+
+#define EMBEDLET_DEFINE_DOT_NEON(name, type, load, scalar)                     \
+  static float name(const float *a, const type *b, size_t n) {                \
+    float32x4_t s0 = vdupq_n_f32(0.0f);                                        \
+    float32x4_t s1 = vdupq_n_f32(0.0f);                                        \
+    float32x4_t s2 = vdupq_n_f32(0.0f);                                        \
+    float32x4_t s3 = vdupq_n_f32(0.0f);                                        \
+    size_t i = 0;                                                              \
+    for (; i + 16 <= n; i += 16) {                                             \
+      s0 = vfmaq_f32(s0, vld1q_f32(a + i), load(b + i));                       \
+      s1 = vfmaq_f32(s1, vld1q_f32(a + i + 4), load(b + i + 4));               \
+      s2 = vfmaq_f32(s2, vld1q_f32(a + i + 8), load(b + i + 8));               \
+      s3 = vfmaq_f32(s3, vld1q_f32(a + i + 12), load(b + i + 12));             \
+    }                                                                          \
+    for (; i + 4 <= n; i += 4) {                                               \
+      s0 = vfmaq_f32(s0, vld1q_f32(a + i), load(b + i));                       \
+    }                                                                          \
+    float result =                                                             \
+        vaddvq_f32(vaddq_f32(vaddq_f32(s0, s1), vaddq_f32(s2, s3)));           \
+    for (; i < n; i++) {                                                       \
+      result += a[i] * scalar(b[i]);                                           \
+    }                                                                          \
+    return result;                                                             \
+  }
+
+static inline float32x4_t embedlet_load_f16_neon(const uint16_t *p) {
+  return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(p)));
+}
+
+static inline float32x4_t embedlet_load_bf16_neon(const uint16_t *p) {
+  return vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(p), 16));
+}
+
+static inline float32x4_t embedlet_load_i8_neon(const int8_t *p) {
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  int16x8_t w = vmovl_s8(vreinterpret_s8_s32(vdup_n_s32(v)));
+  return vcvtq_f32_s32(vmovl_s16(vget_low_s16(w)));
+}
+
+EMBEDLET_DEFINE_DOT_NEON(embedlet_dot_f16_neon, uint16_t,
+                         embedlet_load_f16_neon, embedlet_f16_to_f32)
+EMBEDLET_DEFINE_DOT_NEON(embedlet_dot_bf16_neon, uint16_t,
+                         embedlet_load_bf16_neon, embedlet_bf16_to_f32)
+EMBEDLET_DEFINE_DOT_NEON(embedlet_dot_i8_neon, int8_t, embedlet_load_i8_neon,
+                         embedlet_i8_to_f32)
+
+#endif /* EMBEDLET_HAS_NEON */
+
+#if EMBEDLET_HAS_SVE
+
+static float embedlet_dot_sve(const float *a, const float *b, size_t n) {
+  svbool_t all = svptrue_b32();
+  svfloat32_t s0 = svdup_n_f32(0.0f);
+  svfloat32_t s1 = svdup_n_f32(0.0f);
+  size_t step = (size_t)svcntw();
+  size_t i = 0;
+
+  for (; i + 2 * step <= n; i += 2 * step) {
+    s0 = svmla_f32_x(all, s0, svld1_f32(all, a + i), svld1_f32(all, b + i));
+    s1 = svmla_f32_x(all, s1, svld1_f32(all, a + i + step),
+                     svld1_f32(all, b + i + step));
+  }
+  for (; i < n; i += step) {
+    svbool_t pg = svwhilelt_b32_u64((uint64_t)i, (uint64_t)n);
+    s0 = svmla_f32_m(pg, s0, svld1_f32(pg, a + i), svld1_f32(pg, b + i));
+  }
+
+  return svaddv_f32(all, svadd_f32_x(all, s0, s1));
+}
+
+static float embedlet_norm_sve(const float *a, size_t n) {
+  return sqrtf(embedlet_dot_sve(a, a, n));
+}
+
+#endif /* EMBEDLET_HAS_SVE */
+
+/*----------------------------------------------------------------------------
+ * Runtime Kernel Selection
+ *----------------------------------------------------------------------------*/
+
+typedef struct embedlet_kernels {
+  const char *name;
+  float (*dot)(const float *a, const float *b, size_t n);
+  float (*norm)(const float *a, size_t n);
+  float (*dot_f16)(const float *a, const uint16_t *b, size_t n);
+  float (*dot_bf16)(const float *a, const uint16_t *b, size_t n);
+  float (*dot_i8)(const float *a, const int8_t *b, size_t n);
+  void (*dot_block)(const float *q, const float *block, size_t dims,
+                    float *out);
+  uint32_t (*hamming)(const uint64_t *a, const uint64_t *b, size_t words);
+#if EMBEDLET_FIXED_DIMS
+  embedlet_row_dot_fn row_dot_fixed[3]; /* float32 rows of 384, 768 and
+                                           1024 dims */
+#endif
+} embedlet_kernels_t;
+
+/* Compile-time default; upgraded by embedlet_simd_init() */
+static embedlet_kernels_t embedlet_kernels = {
+#if EMBEDLET_HAS_SSE2
+    "sse2",
+    embedlet_dot_sse2,
+    embedlet_norm_sse2,
+    embedlet_dot_f16_c,
+    embedlet_dot_bf16_sse2,
+    embedlet_dot_i8_sse2,
+    embedlet_dot_block_sse2,
+    embedlet_hamming_c,
+#if EMBEDLET_FIXED_DIMS
+    {embedlet_row_dot_sse2_384, embedlet_row_dot_sse2_768,
+     embedlet_row_dot_sse2_1024}
+#endif
+#elif EMBEDLET_HAS_NEON
+    "neon",
+    embedlet_dot_neon,
+    embedlet_norm_neon,
+    embedlet_dot_f16_neon,
+    embedlet_dot_bf16_neon,
+    embedlet_dot_i8_neon,
+    embedlet_dot_block_neon,
+    embedlet_hamming_c,
+#if EMBEDLET_FIXED_DIMS
+    {embedlet_row_dot_neon_384, embedlet_row_dot_neon_768,
+     embedlet_row_dot_neon_1024}
+#endif
+#else
+    "c",
+    embedlet_dot_c,
+    embedlet_norm_c,
+    embedlet_dot_f16_c,
+    embedlet_dot_bf16_c,
+    embedlet_dot_i8_c,
+    embedlet_dot_block_c,
+    embedlet_hamming_c,
+#if EMBEDLET_FIXED_DIMS
+    {embedlet_row_dot_c_384, embedlet_row_dot_c_768,
+     embedlet_row_dot_c_1024}
+#endif
+#endif
+};
+
+#if EMBEDLET_HAS_AVX
+
+static void embedlet_cpuid(unsigned int leaf, unsigned int sub,
+                           unsigned int regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int r[4];
+  __cpuidex(r, (int)leaf, (int)sub);
+  for (int i = 0; i < 4; i++)
+    regs[i] = (unsigned int)r[i];
+#else
+  __asm__ __volatile__("cpuid"
+                       : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]),
+                         "=d"(regs[3])
+                       : "a"(leaf), "c"(sub));
+#endif
+}
+
+static uint64_t embedlet_xgetbv(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return (uint64_t)_xgetbv(0);
+#else
+  unsigned int lo, hi;
+  __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+#endif /* EMBEDLET_HAS_AVX */
+
+static void embedlet_simd_detect(void) {
+#if EMBEDLET_HAS_AVX
+  unsigned int r[4];
+  embedlet_cpuid(0, 0, r);
+  unsigned int max_leaf = r[0];
+  embedlet_cpuid(1, 0, r);
+  bool osxsave = (r[2] & (1u << 27)) != 0;
+  bool avx = (r[2] & (1u << 28)) != 0;
+  bool fma = (r[2] & (1u << 12)) != 0;
+  bool f16c = (r[2] & (1u << 29)) != 0;
+  if (r[2] & (1u << 23))
+    embedlet_kernels.hamming = embedlet_hamming_popcnt;
+  if (!osxsave || !avx || max_leaf < 7)
+    return;
+
+  /* The OS must save YMM (bits 1-2) and ZMM/opmask (bits 5-7) state */
+  uint64_t xcr0 = embedlet_xgetbv();
+  bool ymm_ok = (xcr0 & 0x6) == 0x6;
+  bool zmm_ok = (xcr0 & 0xE6) == 0xE6;
+
+  embedlet_cpuid(7, 0, r);
+  bool avx2 = (r[1] & (1u << 5)) != 0;
+  bool avx512f = (r[1] & (1u << 16)) != 0;
+
+  if (avx512f && zmm_ok) {
+    embedlet_kernels.name = "avx512";
+    embedlet_kernels.dot = embedlet_dot_avx512;
+    embedlet_kernels.norm = embedlet_norm_avx512;
+    embedlet_kernels.dot_f16 = embedlet_dot_f16_avx512;
+    embedlet_kernels.dot_bf16 = embedlet_dot_bf16_avx512;
+    embedlet_kernels.dot_i8 = embedlet_dot_i8_avx512;
+    embedlet_kernels.dot_block = embedlet_dot_block_avx512;
+#if EMBEDLET_FIXED_DIMS
+    embedlet_kernels.row_dot_fixed[0] = embedlet_row_dot_avx512_384;
+    embedlet_kernels.row_dot_fixed[1] = embedlet_row_dot_avx512_768;
+    embedlet_kernels.row_dot_fixed[2] = embedlet_row_dot_avx512_1024;
+#endif
+  } else if (avx2 && fma && f16c && ymm_ok) {
+    embedlet_kernels.name = "avx2";
+    embedlet_kernels.dot = embedlet_dot_avx2;
+    embedlet_kernels.norm = embedlet_norm_avx2;
+    embedlet_kernels.dot_f16 = embedlet_dot_f16_avx2;
+    embedlet_kernels.dot_bf16 = embedlet_dot_bf16_avx2;
+    embedlet_kernels.dot_i8 = embedlet_dot_i8_avx2;
+    embedlet_kernels.dot_block = embedlet_dot_block_avx2;
+#if EMBEDLET_FIXED_DIMS
+    embedlet_kernels.row_dot_fixed[0] = embedlet_row_dot_avx2_384;
+    embedlet_kernels.row_dot_fixed[1] = embedlet_row_dot_avx2_768;
+    embedlet_kernels.row_dot_fixed[2] = embedlet_row_dot_avx2_1024;
+#endif
+  }
+#elif EMBEDLET_HAS_SVE
+  /* SVE kernels are only compiled in when the build targets SVE; converting
+   * kernels keep their NEON versions */
+  embedlet_kernels.name = "sve";
+  embedlet_kernels.dot = embedlet_dot_sve;
+  embedlet_kernels.norm = embedlet_norm_sve;
+#if EMBEDLET_FIXED_DIMS
+  for (int i = 0; i < 3; i++) /* vector length is only known at run time */
+    embedlet_kernels.row_dot_fixed[i] = NULL;
+#endif
+#endif
+}
+
+#if EMBEDLET_WINDOWS
+static INIT_ONCE embedlet_simd_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK embedlet_simd_once_cb(PINIT_ONCE once, PVOID param,
+                                           PVOID *ctx) {
+  (void)once;
+  (void)param;
+  (void)ctx;
+  embedlet_simd_detect();
+  return TRUE;
+}
+
+static void embedlet_simd_init(void) {
+  InitOnceExecuteOnce(&embedlet_simd_once, embedlet_simd_once_cb, NULL, NULL);
+}
+#else
+static pthread_once_t embedlet_simd_once = PTHREAD_ONCE_INIT;
+
+static void embedlet_simd_init(void) {
+  pthread_once(&embedlet_simd_once, embedlet_simd_detect);
+}
+#endif
+
+static inline float embedlet_dot(const float *a, const float *b, size_t n) {
+  return embedlet_kernels.dot(a, b, n);
+}
+
+static inline float embedlet_norm(const float *a, size_t n) {
+  return embedlet_kernels.norm(a, n);
+}
+
+/* Per-element-type row kernels, chosen once per store at open */
+
+static float embedlet_row_dot_f32(const float *query, float query_sum,
+                                  const void *row, size_t dims) {
+  (void)query_sum;
+  return embedlet_kernels.dot(query, (const float *)row, dims);
+}
+
+static float embedlet_row_dot_f16(const float *query, float query_sum,
+                                  const void *row, size_t dims) {
+  (void)query_sum;
+  return embedlet_kernels.dot_f16(query, (const uint16_t *)row, dims);
+}
+
+static float embedlet_row_dot_bf16(const float *query, float query_sum,
+                                   const void *row, size_t dims) {
+  (void)query_sum;
+  return embedlet_kernels.dot_bf16(query, (const uint16_t *)row, dims);
+}
+
+/* sum(q * (offset + scale * c)) = offset * sum(q) + scale * sum(q * c) */
+static float embedlet_row_dot_i8(const float *query, float query_sum,
+                                 const void *row, size_t dims) {
+  const float *params = (const float *)row;
+  const int8_t *codes = (const int8_t *)row + EMBEDLET_I8_PREFIX;
+  return params[1] * query_sum +
+         params[0] * embedlet_kernels.dot_i8(query, codes, dims);
+}
+
+/*----------------------------------------------------------------------------
+ * Platform-Specific File/Mmap Operations
+ *----------------------------------------------------------------------------*/
+
+#if EMBEDLET_WINDOWS
+
+/* Open (or create, unless the map is read-only) the file behind a map */
+static int embedlet_file_open(embedlet_map_t *map, const char *path) {
+  /* A reader shares the file with the writer that already holds it */
+  if (map->read_only)
+    map->file_handle = CreateFileA(path, GENERIC_READ,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  else
+    map->file_handle =
+        CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (map->file_handle == INVALID_HANDLE_VALUE) {
+    return EMBEDLET_ERR_FILE_OPEN;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(map->file_handle, &size)) {
+    CloseHandle(map->file_handle);
+    map->file_handle = INVALID_HANDLE_VALUE;
+    return EMBEDLET_ERR_FILE_OPEN;
+  }
+  map->size = (size_t)size.QuadPart;
+
+  return EMBEDLET_OK;
+}
+
+/* Re-read the file size, which another process may have grown */
+static int embedlet_file_sync_size(embedlet_map_t *map) {
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(map->file_handle, &size))
+    return EMBEDLET_ERR_FILE_OPEN;
+  map->size = (size_t)size.QuadPart;
+  return EMBEDLET_OK;
+}
+
+static size_t embedlet_page_size(void) {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (size_t)info.dwPageSize;
+}
+
+/* Apply `advice` to the current view, undoing what `previous` set */
+static int embedlet_map_apply(embedlet_map_t *map, int advice, int previous) {
+  if (!map->data || (advice | previous) == 0)
+    return EMBEDLET_OK;
+  if (advice & EMBEDLET_ADVISE_LOCK) {
+    if (!VirtualLock(map->data, map->capacity))
+      return EMBEDLET_ERR_MMAP;
+  } else if (previous & EMBEDLET_ADVISE_LOCK) {
+    VirtualUnlock(map->data, map->capacity);
+  }
+  return EMBEDLET_OK;
+}
+
+static void embedlet_unmap_all(embedlet_map_t *map) {
+  if (map->data) {
+    embedlet_map_apply(map, 0, map->advice);
+    UnmapViewOfFile(map->data);
+    map->data = NULL;
+  }
+  if (map->map_handle) {
+    CloseHandle(map->map_handle);
+    map->map_handle = NULL;
+  }
+  while (map->retired) {
+    embedlet_retired_view_t *r = map->retired;
+    map->retired = r->next;
+    UnmapViewOfFile(r->data);
+    CloseHandle(r->map_handle);
+    free(r);
+  }
+  map->capacity = 0;
+}
+
+/*
+ * Map a new view of new_capacity bytes. Windows cannot extend a view in
+ * place, so the previous view is retired instead of unmapped: readers still
+ * holding it see the same file pages until the map is closed.
+ */
+static int embedlet_mmap_update(embedlet_map_t *map, size_t new_capacity) {
+  if (new_capacity == 0) {
+    embedlet_unmap_all(map);
+    return EMBEDLET_OK;
+  }
+
+  embedlet_retired_view_t *retired = NULL;
+  if (map->data) {
+    retired =
+        (embedlet_retired_view_t *)malloc(sizeof(embedlet_retired_view_t));
+    if (!retired)
+      return EMBEDLET_ERR_ALLOC;
+  }
+
+  LARGE_INTEGER li;
+  li.QuadPart = (LONGLONG)new_capacity;
+
+  HANDLE map_handle = CreateFileMappingA(
+      map->file_handle, NULL, map->read_only ? PAGE_READONLY : PAGE_READWRITE,
+      li.HighPart, li.LowPart, NULL);
+  void *data =
+      map_handle ? MapViewOfFile(map_handle,
+                                 map->read_only ? FILE_MAP_READ
+                                                : FILE_MAP_ALL_ACCESS,
+                                 0, 0, new_capacity)
+                 : NULL;
+  if (!data) {
+    if (map_handle)
+      CloseHandle(map_handle);
+    free(retired);
+    return EMBEDLET_ERR_MMAP;
+  }
+
+  if (retired) {
+    /* Readers may still use the old view, but it stops holding memory */
+    embedlet_map_apply(map, 0, map->advice);
+    retired->data = map->data;
+    retired->size = map->capacity;
+    retired->map_handle = map->map_handle;
+    retired->next = map->retired;
+    map->retired = retired;
+  }
+  map->map_handle = map_handle;
+  map->data = data;
+  map->capacity = new_capacity;
+  embedlet_map_apply(map, map->advice, 0);
+  return EMBEDLET_OK;
+}
+
+static int embedlet_file_resize(embedlet_map_t *map, size_t new_size) {
+  /* A file cannot shrink under a mapped view; growing can stay mapped */
+  if (new_size < map->size)
+    embedlet_unmap_all(map);
+
+  LARGE_INTEGER li;
+  li.QuadPart = (LONGLONG)new_size;
+  if (!SetFilePointerEx(map->file_handle, li, NULL, FILE_BEGIN)) {
+    return EMBEDLET_ERR_TRUNCATE;
+  }
+  if (!SetEndOfFile(map->file_handle)) {
+    return EMBEDLET_ERR_TRUNCATE;
+  }
+
+  map->size = new_size;
+  return EMBEDLET_OK;
+}
+
+/*
+ * Followers hold a shared lock on the store file for as long as they map it,
+ * and the writer shrinks files only while it holds the lock exclusively. The
+ * lock covers one byte far past any end of file, so it blocks no I/O.
+ */
+static void embedlet_file_lock_shared(embedlet_map_t *map) {
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.OffsetHigh = 0x80000000u;
+  LockFileEx(map->file_handle, 0, 0, 1, 0, &ov);
+}
+
+static bool embedlet_file_try_lock(embedlet_map_t *map) {
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.OffsetHigh = 0x80000000u;
+  return LockFileEx(map->file_handle,
+                    LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1,
+                    0, &ov) != 0;
+}
+
+static void embedlet_file_unlock(embedlet_map_t *map) {
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.OffsetHigh = 0x80000000u;
+  UnlockFileEx(map->file_handle, 0, 1, 0, &ov);
+}
+
+static void embedlet_file_close(embedlet_map_t *map) {
+  embedlet_unmap_all(map);
+  if (map->file_handle != INVALID_HANDLE_VALUE) {
+    CloseHandle(map->file_handle);
+    map->file_handle = INVALID_HANDLE_VALUE;
+  }
+}
+
+#else /* POSIX */
+
+/* Open (or create, unless the map is read-only) the file behind a map */
+static int embedlet_file_open(embedlet_map_t *map, const char *path) {
+  map->fd = map->read_only ? open(path, O_RDONLY)
+                           : open(path, O_RDWR | O_CREAT, 0644);
+  if (map->fd < 0) {
+    return EMBEDLET_ERR_FILE_OPEN;
+  }
+
+  struct stat st;
+  if (fstat(map->fd, &st) < 0) {
+    close(map->fd);
+    map->fd = -1;
+    return EMBEDLET_ERR_FILE_OPEN;
+  }
+  map->size = (size_t)st.st_size;
+
+  return EMBEDLET_OK;
+}
+
+/* Re-read the file size, which another process may have grown */
+static int embedlet_file_sync_size(embedlet_map_t *map) {
+  struct stat st;
+  if (fstat(map->fd, &st) < 0)
+    return EMBEDLET_ERR_FILE_OPEN;
+  map->size = (size_t)st.st_size;
+  return EMBEDLET_OK;
+}
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static void embedlet_unmap_all(embedlet_map_t *map) {
+  if (map->data) {
+    munmap(map->data, map->reserved);
+    map->data = NULL;
+  }
+  while (map->retired) {
+    embedlet_retired_view_t *r = map->retired;
+    map->retired = r->next;
+    munmap(r->data, r->size);
+    free(r);
+  }
+  map->capacity = 0;
+  map->reserved = 0;
+}
+
+static size_t embedlet_page_size(void) {
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Apply `advice` to the current view, undoing what `previous` set. Hints
+ * the kernel does not support are ignored; only a failed lock is reported.
+ */
+static int embedlet_map_apply(embedlet_map_t *map, int advice, int previous) {
+  if (!map->data || map->capacity == 0 || (advice | previous) == 0)
+    return EMBEDLET_OK;
+  int pattern = MADV_NORMAL;
+  if (advice & EMBEDLET_ADVISE_SEQUENTIAL)
+    pattern = MADV_SEQUENTIAL;
+  else if (advice & EMBEDLET_ADVISE_RANDOM)
+    pattern = MADV_RANDOM;
+  madvise(map->data, map->capacity, pattern);
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  if (advice & EMBEDLET_ADVISE_HUGEPAGE)
+    madvise(map->data, map->capacity, MADV_HUGEPAGE);
+  else if (previous & EMBEDLET_ADVISE_HUGEPAGE)
+    madvise(map->data, map->capacity, MADV_NOHUGEPAGE);
+#endif
+  if (advice & EMBEDLET_ADVISE_WILLNEED)
+    madvise(map->data, map->capacity, MADV_WILLNEED);
+  if (advice & EMBEDLET_ADVISE_LOCK) {
+    if (mlock(map->data, map->capacity) != 0)
+      return EMBEDLET_ERR_MMAP;
+  } else if (previous & EMBEDLET_ADVISE_LOCK) {
+    munlock(map->data, map->capacity);
+  }
+  return EMBEDLET_OK;
+}
+
+static void *embedlet_reserve_range(size_t bytes) {
+  void *p = mmap(NULL, bytes, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * Map the first new_capacity bytes of the file. The view lives inside an
+ * address range reserved once (PROT_NONE) and is remapped in place with
+ * MAP_FIXED, which swaps in the same file pages atomically: a concurrent
+ * reader never sees the mapping disappear. Only when the file outgrows the
+ * reservation does the view move, and then the old range is retired rather
+ * than unmapped.
+ */
+static int embedlet_mmap_update(embedlet_map_t *map, size_t new_capacity) {
+  if (new_capacity == 0) {
+    embedlet_unmap_all(map);
+    return EMBEDLET_OK;
+  }
+
+  size_t page = embedlet_page_size();
+  int prot = map->read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+  if (map->data && new_capacity <= map->reserved) {
+    if (mmap(map->data, new_capacity, prot, MAP_SHARED | MAP_FIXED, map->fd,
+             0) == MAP_FAILED)
+      return EMBEDLET_ERR_MMAP;
+
+    /* Hand pages past a shrunk end back to the reservation */
+    size_t keep = (new_capacity + page - 1) / page * page;
+    size_t old = (map->capacity + page - 1) / page * page;
+    if (keep < old)
+      mmap((char *)map->data + keep, old - keep, PROT_NONE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    map->capacity = new_capacity;
+    /* MAP_FIXED replaced the pages' advice along with the view */
+    embedlet_map_apply(map, map->advice, 0);
+    return EMBEDLET_OK;
+  }
+
+  size_t reserve = map->reserve_hint ? map->reserve_hint
+                                     : EMBEDLET_DEFAULT_RESERVE_BYTES;
+  if (reserve < new_capacity * 2)
+    reserve = new_capacity * 2;
+  reserve = (reserve + page - 1) / page * page;
+
+  embedlet_retired_view_t *retired = NULL;
+  if (map->data) {
+    retired =
+        (embedlet_retired_view_t *)malloc(sizeof(embedlet_retired_view_t));
+    if (!retired)
+      return EMBEDLET_ERR_ALLOC;
+  }
+
+  void *base = embedlet_reserve_range(reserve);
+  if (!base) {
+    /* Address space is short: reserve only what is mapped */
+    reserve = (new_capacity + page - 1) / page * page;
+    base = embedlet_reserve_range(reserve);
+  }
+  if (!base || mmap(base, new_capacity, prot, MAP_SHARED | MAP_FIXED,
+                    map->fd, 0) == MAP_FAILED) {
+    if (base)
+      munmap(base, reserve);
+    free(retired);
+    return EMBEDLET_ERR_MMAP;
+  }
+
+  if (retired) {
+    retired->data = map->data;
+    retired->size = map->reserved;
+    retired->next = map->retired;
+    map->retired = retired;
+  }
+  map->data = base;
+  map->capacity = new_capacity;
+  map->reserved = reserve;
+  embedlet_map_apply(map, map->advice, 0);
+  return EMBEDLET_OK;
+}
+
+/* Resize the file; callers remap to match before touching pages past EOF */
+static int embedlet_file_resize(embedlet_map_t *map, size_t new_size) {
+  if (ftruncate(map->fd, (off_t)new_size) < 0) {
+    return EMBEDLET_ERR_TRUNCATE;
+  }
+
+  map->size = new_size;
+  return EMBEDLET_OK;
+}
+
+/*
+ * Followers hold a shared lock on the store file for as long as they map it,
+ * and the writer shrinks files only while it holds the lock exclusively.
+ * Closing the file drops the lock.
+ */
+static void embedlet_file_lock_shared(embedlet_map_t *map) {
+  while (flock(map->fd, LOCK_SH) < 0 && errno == EINTR) {
+  }
+}
+
+static bool embedlet_file_try_lock(embedlet_map_t *map) {
+  return flock(map->fd, LOCK_EX | LOCK_NB) == 0;
+}
+
+static void embedlet_file_unlock(embedlet_map_t *map) {
+  flock(map->fd, LOCK_UN);
+}
+
+static void embedlet_file_close(embedlet_map_t *map) {
+  embedlet_unmap_all(map);
+  if (map->fd >= 0) {
+    close(map->fd);
+    map->fd = -1;
+  }
+}
+
+#endif /* EMBEDLET_WINDOWS/POSIX */
+
+static void embedlet_map_init(embedlet_map_t *map) {
+  memset(map, 0, sizeof(*map));
+#if EMBEDLET_WINDOWS
+  map->file_handle = INVALID_HANDLE_VALUE;
+  map->map_handle = NULL;
+#else
+  map->fd = -1;
+#endif
+}
+
+/* Grow a mapping (doubling) until it covers needed_bytes */
+static int embedlet_map_reserve(embedlet_map_t *map, size_t needed_bytes) {
+  if (needed_bytes <= map->capacity) {
+    return EMBEDLET_OK;
+  }
+
+  size_t new_cap = map->capacity ? map->capacity * 2 : 4096;
+  while (new_cap < needed_bytes) {
+    new_cap *= 2;
+  }
+
+  int err = embedlet_file_resize(map, new_cap);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  return embedlet_mmap_update(map, new_cap);
+}
+
+/* Build "<path><suffix>" for a sidecar file; caller frees */
+static char *embedlet_sidecar_path(const char *path, const char *suffix) {
+  size_t plen = strlen(path);
+  size_t slen = strlen(suffix);
+  char *out = (char *)malloc(plen + slen + 1);
+  if (!out)
+    return NULL;
+  memcpy(out, path, plen);
+  memcpy(out + plen, suffix, slen + 1);
+  return out;
+}
+
+/*----------------------------------------------------------------------------
+ * Element Types (row encoding, decoding and scoring per EMBEDLET_DTYPE_*)
+ *----------------------------------------------------------------------------*/
+
+static bool embedlet_advice_valid(int advice) {
+  int all = EMBEDLET_ADVISE_SEQUENTIAL | EMBEDLET_ADVISE_RANDOM |
+            EMBEDLET_ADVISE_WILLNEED | EMBEDLET_ADVISE_HUGEPAGE |
+            EMBEDLET_ADVISE_LOCK;
+  int both = EMBEDLET_ADVISE_SEQUENTIAL | EMBEDLET_ADVISE_RANDOM;
+  return (advice & ~all) == 0 && (advice & both) != both;
+}
+
+static bool embedlet_dtype_valid(int dtype) {
+  return dtype >= EMBEDLET_DTYPE_F32 && dtype <= EMBEDLET_DTYPE_I8;
+}
+
+static size_t embedlet_row_bytes_for(int dtype, size_t dims) {
+  switch (dtype) {
+  case EMBEDLET_DTYPE_F16:
+  case EMBEDLET_DTYPE_BF16:
+    return (dims * sizeof(uint16_t) + 3) & ~(size_t)3;
+  case EMBEDLET_DTYPE_I8:
+    return EMBEDLET_I8_PREFIX + ((dims + 3) & ~(size_t)3);
+  default:
+    return dims * sizeof(float);
+  }
+}
+
+/* Generic row kernels, indexed by EMBEDLET_DTYPE_* */
+static const embedlet_row_dot_fn embedlet_row_dots[] = {
+    embedlet_row_dot_f32, embedlet_row_dot_f16, embedlet_row_dot_bf16,
+    embedlet_row_dot_i8};
+
+static void embedlet_set_dtype(embedlet_store_t *store, int dtype) {
+  store->dtype = dtype;
+  store->row_bytes = embedlet_row_bytes_for(dtype, store->dims);
+  store->row_dot = embedlet_row_dots[dtype];
+#if EMBEDLET_FIXED_DIMS
+  embedlet_row_dot_fn fixed = NULL;
+  if (dtype == EMBEDLET_DTYPE_F32) {
+    switch (store->dims) {
+    case 384:
+      fixed = embedlet_kernels.row_dot_fixed[0];
+      break;
+    case 768:
+      fixed = embedlet_kernels.row_dot_fixed[1];
+      break;
+    case 1024:
+      fixed = embedlet_kernels.row_dot_fixed[2];
+      break;
+    }
+  }
+  if (fixed)
+    store->row_dot = fixed;
+#endif
+}
+
+static inline const void *embedlet_row_ptr(const embedlet_store_t *store,
+                                           size_t id) {
+  return (const char *)store->data + id * store->row_bytes;
+}
+
+/* Sum of query elements; the int8 kernel needs it to apply row offsets */
+static float embedlet_query_sum(const float *query, size_t dims) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < dims; i++)
+    sum += query[i];
+  return sum;
+}
+
+/*
+ * Encode a float32 vector into row `id`. Returns the L2 norm of the row as
+ * stored (after rounding), which is what search divides by.
+ */
+static float embedlet_row_encode(embedlet_store_t *store, size_t id,
+                                 const float *src) {
+  size_t dims = store->dims;
+  void *row = (char *)store->data + id * store->row_bytes;
+  float sum = 0.0f;
+
+  if (store->dtype == EMBEDLET_DTYPE_F32) {
+    memcpy(row, src, dims * sizeof(float));
+    return embedlet_norm(src, dims);
+  }
+
+  memset(row, 0, store->row_bytes);
+  if (store->dtype == EMBEDLET_DTYPE_F16 ||
+      store->dtype == EMBEDLET_DTYPE_BF16) {
+    bool half = store->dtype == EMBEDLET_DTYPE_F16;
+    uint16_t *out = (uint16_t *)row;
+    for (size_t i = 0; i < dims; i++) {
+      float v;
+      if (half) {
+        out[i] = embedlet_f32_to_f16(src[i]);
+        v = embedlet_f16_to_f32(out[i]);
+      } else {
+        out[i] = embedlet_f32_to_bf16(src[i]);
+        v = embedlet_bf16_to_f32(out[i]);
+      }
+      sum += v * v;
+    }
+    return sqrtf(sum);
+  }
+
+  /* int8: map [min, max] symmetrically onto codes [-127, 127] */
+  float lo = src[0];
+  float hi = src[0];
+  for (size_t i = 1; i < dims; i++) {
+    if (src[i] < lo)
+      lo = src[i];
+    if (src[i] > hi)
+      hi = src[i];
+  }
+  float offset = 0.5f * (lo + hi);
+  float scale = (hi - lo) / 254.0f;
+  float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+
+  float *params = (float *)row;
+  int8_t *codes = (int8_t *)row + EMBEDLET_I8_PREFIX;
+  params[0] = scale;
+  params[1] = offset;
+  for (size_t i = 0; i < dims; i++) {
+    float c = roundf((src[i] - offset) * inv);
+    c = c < -127.0f ? -127.0f : (c > 127.0f ? 127.0f : c);
+    codes[i] = (int8_t)c;
+    float v = offset + scale * c;
+    sum += v * v;
+  }
+  return sqrtf(sum);
+}
+
+static void embedlet_row_decode(const embedlet_store_t *store, size_t id,
+                                float *out) {
+  size_t dims = store->dims;
+  const void *row = embedlet_row_ptr(store, id);
+
+  switch (store->dtype) {
+  case EMBEDLET_DTYPE_F16:
+    for (size_t i = 0; i < dims; i++)
+      out[i] = embedlet_f16_to_f32(((const uint16_t *)row)[i]);
+    break;
+  case EMBEDLET_DTYPE_BF16:
+    for (size_t i = 0; i < dims; i++)
+      out[i] = embedlet_bf16_to_f32(((const uint16_t *)row)[i]);
+    break;
+  case EMBEDLET_DTYPE_I8: {
+    const float *params = (const float *)row;
+    const int8_t *codes = (const int8_t *)row + EMBEDLET_I8_PREFIX;
+    for (size_t i = 0; i < dims; i++)
+      out[i] = params[1] + params[0] * (float)codes[i];
+    break;
+  }
+  default:
+    memcpy(out, row, dims * sizeof(float));
+    break;
+  }
+}
+
+/* Deleted rows are zero-filled; encoded rows of any type are never all-zero
+ * bytes unless the input vector was all zeros */
+static bool embedlet_row_is_zero(const embedlet_store_t *store, size_t id) {
+  if (store->dtype == EMBEDLET_DTYPE_F32) {
+    const float *row = (const float *)embedlet_row_ptr(store, id);
+    for (size_t i = 0; i < store->dims; i++) {
+      if (row[i] != 0.0f)
+        return false;
+    }
+    return true;
+  }
+  const unsigned char *bytes =
+      (const unsigned char *)embedlet_row_ptr(store, id);
+  for (size_t i = 0; i < store->row_bytes; i++) {
+    if (bytes[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+/*----------------------------------------------------------------------------
+ * Helper Functions
+ *----------------------------------------------------------------------------*/
+
+static size_t embedlet_embedding_size(const embedlet_store_t *store) {
+  return store->row_bytes;
+}
+
+static bool embedlet_is_zeroed_ptr(const float *data, size_t dims) {
+  for (size_t i = 0; i < dims; i++) {
+    if (data[i] != 0.0f)
+      return false;
+  }
+  return true;
+}
+
+/* Re-derive typed pointers after any remap of the store's files */
+/* Byte offsets of the IVF sidecar sections, in layout order; [6] is the end */
+static void embedlet_ivf_layout(size_t dims, size_t nlist, size_t pq_m,
+                                size_t rows, size_t off[7]) {
+  off[0] = sizeof(embedlet_ivf_header_t);
+  off[1] = off[0] + nlist * dims * sizeof(float);
+  off[2] = off[1] + EMBEDLET_PQ_KSUB * dims * sizeof(float);
+  off[2] = (off[2] + 7) & ~(size_t)7;
+  off[3] = off[2] + (nlist + 1) * sizeof(uint64_t);
+  off[4] = off[3] + rows * sizeof(uint32_t);
+  off[5] = off[4] + rows * sizeof(uint32_t);
+  off[6] = off[5] + rows * pq_m;
+}
+
+static void embedlet_ivf_refresh(embedlet_store_t *store) {
+  embedlet_ivf_header_t *h = (embedlet_ivf_header_t *)store->ivf_file.data;
+  store->ivf_header = h;
+  if (!h || h->nlist == 0) {
+    store->ivf_centroids = NULL;
+    store->ivf_codebooks = NULL;
+    store->ivf_offsets = NULL;
+    store->ivf_slot_rows = NULL;
+    store->ivf_slot_of = NULL;
+    store->ivf_codes = NULL;
+    return;
+  }
+  size_t off[7];
+  char *base = (char *)h;
+  embedlet_ivf_layout(store->dims, h->nlist, h->pq_m, (size_t)h->rows, off);
+  store->ivf_centroids = (float *)(base + off[0]);
+  store->ivf_codebooks = (float *)(base + off[1]);
+  store->ivf_offsets = (uint64_t *)(base + off[2]);
+  store->ivf_slot_rows = (uint32_t *)(base + off[3]);
+  store->ivf_slot_of = (uint32_t *)(base + off[4]);
+  store->ivf_codes = (uint8_t *)(base + off[5]);
+}
+
+static void embedlet_refresh_pointers(embedlet_store_t *store) {
+  if (store->file.data) {
+    store->header = (embedlet_file_header_t *)store->file.data;
+    store->data = (float *)((char *)store->file.data + EMBEDLET_HEADER_SIZE);
+  } else {
+    store->header = NULL;
+    store->data = NULL;
+  }
+  if (store->norms_file.data) {
+    store->norms_header = (embedlet_sidecar_header_t *)store->norms_file.data;
+    store->norms = (float *)(store->norms_header + 1);
+  } else {
+    store->norms_header = NULL;
+    store->norms = NULL;
+  }
+  if (store->live_file.data) {
+    store->live_header = (embedlet_sidecar_header_t *)store->live_file.data;
+    store->live = (uint64_t *)(store->live_header + 1);
+  } else {
+    store->live_header = NULL;
+    store->live = NULL;
+  }
+  if (store->bits_file.data) {
+    store->bits_header = (embedlet_sidecar_header_t *)store->bits_file.data;
+    store->bits = (uint64_t *)(store->bits_header + 1);
+  } else {
+    store->bits_header = NULL;
+    store->bits = NULL;
+  }
+  if (store->hnsw_file.data && store->hnsw_upper_file.data) {
+    store->hnsw_header = (embedlet_hnsw_header_t *)store->hnsw_file.data;
+    store->hnsw_nodes = (uint32_t *)(store->hnsw_header + 1);
+    store->hnsw_upper = (uint32_t *)((embedlet_sidecar_header_t *)
+                                         store->hnsw_upper_file.data +
+                                     1);
+  } else {
+    store->hnsw_header = NULL;
+    store->hnsw_nodes = NULL;
+    store->hnsw_upper = NULL;
+  }
+  embedlet_ivf_refresh(store);
+  if (store->moves_file.data) {
+    store->moves_header = (embedlet_sidecar_header_t *)store->moves_file.data;
+    store->moves = (uint64_t *)(store->moves_header + 1);
+  } else {
+    store->moves_header = NULL;
+    store->moves = NULL;
+  }
+  if (store->prefix_file.data) {
+    store->prefix_header = (embedlet_sidecar_header_t *)store->prefix_file.data;
+    store->prefix = (uint8_t *)(store->prefix_header + 1);
+  } else {
+    store->prefix_header = NULL;
+    store->prefix = NULL;
+  }
+  if (store->blocks_file.data) {
+    store->blocks_header = (embedlet_sidecar_header_t *)store->blocks_file.data;
+    store->blocks = (float *)(store->blocks_header + 1);
+  } else {
+    store->blocks_header = NULL;
+    store->blocks = NULL;
+  }
+}
+
+static size_t embedlet_norms_bytes(size_t rows) {
+  return sizeof(embedlet_sidecar_header_t) + rows * sizeof(float);
+}
+
+static size_t embedlet_live_bytes(size_t rows) {
+  return sizeof(embedlet_sidecar_header_t) +
+         ((rows + 63) / 64) * sizeof(uint64_t);
+}
+
+static size_t embedlet_bits_bytes(const embedlet_store_t *store, size_t rows) {
+  return sizeof(embedlet_sidecar_header_t) +
+         rows * store->bits_words * sizeof(uint64_t);
+}
+
+static size_t embedlet_file_bytes(const embedlet_store_t *store, size_t rows) {
+  return EMBEDLET_HEADER_SIZE + rows * embedlet_embedding_size(store);
+}
+
+static size_t embedlet_prefix_bytes(const embedlet_store_t *store,
+                                    size_t rows) {
+  return sizeof(embedlet_sidecar_header_t) + rows * store->prefix_row_bytes;
+}
+
+/* Whole blocks only, so a block's last rows never need a bounds check */
+static size_t embedlet_blocks_bytes(const embedlet_store_t *store,
+                                    size_t rows) {
+  size_t blocks = (rows + EMBEDLET_BLOCK_ROWS - 1) / EMBEDLET_BLOCK_ROWS;
+  return sizeof(embedlet_sidecar_header_t) +
+         blocks * EMBEDLET_BLOCK_ROWS * store->dims * sizeof(float);
+}
+
+/*
+ * Address space for a sidecar that takes `bytes` for every `rows` rows: what
+ * it needs to cover as many rows as the store file's reservation holds, so
+ * the sidecars grow in place for as long as the store file does
+ */
+static size_t embedlet_sidecar_reserve(const embedlet_store_t *store,
+                                       size_t bytes, size_t rows) {
+  size_t reserve = store->file.reserve_hint ? store->file.reserve_hint
+                                            : EMBEDLET_DEFAULT_RESERVE_BYTES;
+  size_t units = (reserve / embedlet_embedding_size(store) + rows - 1) / rows;
+  size_t limit = SIZE_MAX / 4 - sizeof(embedlet_sidecar_header_t);
+  if (bytes && units > limit / bytes)
+    units = limit / bytes; /* reserving fails and falls back to the size */
+  return sizeof(embedlet_sidecar_header_t) + units * bytes;
+}
+
+/* Rows the current views of the store file and all its sidecars cover */
+static size_t embedlet_mapped_rows(const embedlet_store_t *store) {
+  size_t head = sizeof(embedlet_sidecar_header_t);
+  if (store->file.capacity < EMBEDLET_HEADER_SIZE ||
+      store->norms_file.capacity < head || store->live_file.capacity < head ||
+      store->bits_file.capacity < head)
+    return 0;
+  size_t covered[4] = {
+      (store->file.capacity - EMBEDLET_HEADER_SIZE) /
+          embedlet_embedding_size(store),
+      (store->norms_file.capacity - head) / sizeof(float),
+      (store->live_file.capacity - head) / sizeof(uint64_t) * 64,
+      (store->bits_file.capacity - head) /
+          (store->bits_words * sizeof(uint64_t))};
+  size_t rows = covered[0];
+  for (int i = 1; i < 4; i++) {
+    if (covered[i] < rows)
+      rows = covered[i];
+  }
+  return rows;
+}
+
+/* Make room for `rows` rows in the store file and its sidecars */
+static int embedlet_ensure_capacity(embedlet_store_t *store, size_t rows) {
+  size_t capacity = store->file.capacity;
+  void *data = store->file.data;
+  int err =
+      embedlet_map_reserve(&store->file, embedlet_file_bytes(store, rows));
+  if (store->file.capacity != capacity)
+    embedlet_atomic_add_u64(&store->stats.grow_events, 1);
+  if (data && store->file.data != data)
+    embedlet_atomic_add_u64(&store->stats.remap_events, 1);
+  if (err == EMBEDLET_OK)
+    err = embedlet_map_reserve(&store->norms_file, embedlet_norms_bytes(rows));
+  if (err == EMBEDLET_OK)
+    err = embedlet_map_reserve(&store->live_file, embedlet_live_bytes(rows));
+  if (err == EMBEDLET_OK)
+    err = embedlet_map_reserve(&store->bits_file,
+                               embedlet_bits_bytes(store, rows));
+  if (err == EMBEDLET_OK && store->prefix_header)
+    err = embedlet_map_reserve(&store->prefix_file,
+                               embedlet_prefix_bytes(store, rows));
+  if (err == EMBEDLET_OK && store->blocks_header)
+    err = embedlet_map_reserve(&store->blocks_file,
+                               embedlet_blocks_bytes(store, rows));
+  embedlet_refresh_pointers(store);
+  return err;
+}
+
+/* Drop the (all deleted) rows past `rows` from every header */
+static void embedlet_trim_rows(embedlet_store_t *store, size_t rows) {
+  embedlet_atomic_release_u64(&store->header->count, rows);
+  store->norms_header->rows = rows;
+  store->live_header->rows = rows;
+  store->bits_header->rows = rows;
+  /* Trimmed rows are all deleted, so their graph nodes have no links */
+  if (store->hnsw_header && store->hnsw_header->rows > rows)
+    store->hnsw_header->rows = rows;
+  if (store->ivf_header && store->ivf_header->covered > rows)
+    store->ivf_header->covered = rows;
+  if (store->prefix_header && store->prefix_header->rows > rows)
+    store->prefix_header->rows = rows;
+  if (store->blocks_header && store->blocks_header->rows > rows)
+    store->blocks_header->rows = rows;
+}
+
+/*
+ * Truncate the store and its sidecars to exactly `rows` rows. While any
+ * follower maps them the files keep their size (shrinking them under its
+ * views would fault), and the rows are only dropped from the headers.
+ */
+static int embedlet_truncate_rows(embedlet_store_t *store, size_t rows) {
+  if (!embedlet_file_try_lock(&store->file)) {
+    embedlet_trim_rows(store, rows);
+    return EMBEDLET_OK;
+  }
+
+  embedlet_map_t *maps[6] = {&store->file,        &store->norms_file,
+                             &store->live_file,   &store->bits_file,
+                             &store->prefix_file, &store->blocks_file};
+  size_t sizes[6] = {embedlet_file_bytes(store, rows),
+                     embedlet_norms_bytes(rows),
+                     embedlet_live_bytes(rows),
+                     embedlet_bits_bytes(store, rows),
+                     embedlet_prefix_bytes(store, rows),
+                     embedlet_blocks_bytes(store, rows)};
+  int err = EMBEDLET_OK;
+
+  for (int i = 0; i < 6 && err == EMBEDLET_OK; i++) {
+    if (!maps[i]->data) /* optional copy not kept */
+      continue;
+    err = embedlet_file_resize(maps[i], sizes[i]);
+    if (err == EMBEDLET_OK)
+      err = embedlet_mmap_update(maps[i], sizes[i]);
+  }
+  embedlet_file_unlock(&store->file);
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  embedlet_trim_rows(store, rows);
+  return EMBEDLET_OK;
+}
+
+/* Fill a header page (EMBEDLET_HEADER_SIZE bytes) for `count` rows */
+static void embedlet_header_init(const embedlet_store_t *store,
+                                 embedlet_file_header_t *h, size_t count) {
+  memset(h, 0, EMBEDLET_HEADER_SIZE);
+  memcpy(h->magic, EMBEDLET_FILE_MAGIC, sizeof(h->magic));
+  h->version = EMBEDLET_FILE_VERSION;
+  h->header_size = EMBEDLET_HEADER_SIZE;
+  h->dims = store->dims;
+  h->elem_type = (uint32_t)store->dtype;
+  h->flags = 0;
+  h->count = count;
+  h->row_bytes = embedlet_embedding_size(store);
+  h->metric = (uint32_t)store->metric;
+}
+
+/*
+ * Upgrade a headerless store (raw float32 rows, as written by earlier
+ * versions): write a header page and the rows, less the zero padding that
+ * capacity doubling left at the end of the file, to "<path>.migrate", then
+ * rename that over the store and map it. Until the rename the old file is
+ * untouched, so a failed or interrupted upgrade loses nothing. A file that
+ * is not a whole number of rows is no such store.
+ */
+static int embedlet_header_migrate(embedlet_store_t *store) {
+  embedlet_set_dtype(store, EMBEDLET_DTYPE_F32);
+  size_t emb_size = embedlet_embedding_size(store);
+  if (store->file.size % emb_size != 0)
+    return EMBEDLET_ERR_FORMAT;
+  const float *old = (const float *)store->file.data;
+  size_t rows = store->file.size / emb_size;
+  while (rows > 0 &&
+         embedlet_is_zeroed_ptr(old + (rows - 1) * store->dims, store->dims)) {
+    rows--;
+  }
+
+  char *tmp = embedlet_sidecar_path(store->path, ".migrate");
+  embedlet_file_header_t *h =
+      (embedlet_file_header_t *)malloc(EMBEDLET_HEADER_SIZE);
+  if (!tmp || !h) {
+    free(tmp);
+    free(h);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  embedlet_header_init(store, h, rows);
+  FILE *f = fopen(tmp, "wb");
+  bool ok = f && fwrite(h, EMBEDLET_HEADER_SIZE, 1, f) == 1 &&
+            (rows == 0 || fwrite(old, emb_size, rows, f) == rows);
+  ok = f && fclose(f) == 0 && ok;
+  free(h);
+
+  /* Windows renames no file it has open; the store is mapped again below */
+  embedlet_file_close(&store->file);
+  embedlet_refresh_pointers(store);
+#if EMBEDLET_WINDOWS
+  ok = ok && MoveFileExA(tmp, store->path, MOVEFILE_REPLACE_EXISTING);
+#else
+  ok = ok && rename(tmp, store->path) == 0;
+#endif
+  if (!ok)
+    remove(tmp);
+  free(tmp);
+  if (!ok)
+    return EMBEDLET_ERR_FILE_OPEN;
+
+  int err = embedlet_file_open(&store->file, store->path);
+  if (err == EMBEDLET_OK)
+    err = embedlet_mmap_update(&store->file, store->file.size);
+  embedlet_refresh_pointers(store);
+  return err;
+}
+
+/* Map the store file and validate (or create) its header */
+static int embedlet_header_open(embedlet_store_t *store) {
+  int err;
+  if (store->read_only && store->file.size < EMBEDLET_HEADER_SIZE)
+    return EMBEDLET_ERR_FORMAT; /* nothing to create or migrate here */
+  if (store->file.size == 0) {
+    err = embedlet_map_reserve(&store->file, EMBEDLET_HEADER_SIZE);
+    embedlet_refresh_pointers(store);
+    if (err == EMBEDLET_OK)
+      embedlet_header_init(store, store->header, 0);
+    return err;
+  }
+
+  err = embedlet_mmap_update(&store->file, store->file.size);
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  const embedlet_file_header_t *h = store->header;
+  if (store->file.size < sizeof(*h) ||
+      memcmp(h->magic, EMBEDLET_FILE_MAGIC, sizeof(h->magic)) != 0) {
+    if (store->read_only)
+      return EMBEDLET_ERR_FORMAT;
+    return embedlet_header_migrate(store);
+  }
+
+  if (h->version != EMBEDLET_FILE_VERSION ||
+      h->header_size != EMBEDLET_HEADER_SIZE ||
+      !embedlet_dtype_valid((int)h->elem_type) ||
+      h->metric > EMBEDLET_METRIC_HAMMING) {
+    return EMBEDLET_ERR_FORMAT;
+  }
+  if (h->dims != store->dims) {
+    return EMBEDLET_ERR_DIMS_MISMATCH;
+  }
+  embedlet_set_dtype(store, (int)h->elem_type);
+  store->metric = (int)h->metric;
+  /* A writer may publish rows past the size seen here; readers clamp */
+  if (h->row_bytes != embedlet_embedding_size(store) ||
+      (!store->read_only &&
+       store->file.size < embedlet_file_bytes(store, (size_t)h->count))) {
+    return EMBEDLET_ERR_FORMAT;
+  }
+  return EMBEDLET_OK;
+}
+
+/*
+ * Open (or create) a sidecar and make sure it covers `needed` bytes. Returns
+ * with *valid set if the file already carried the expected magic; otherwise
+ * the sidecar is reset to an empty header with zero rows. A read-only
+ * sidecar is mapped as it is, and not valid if it is shorter than `needed`.
+ */
+static int embedlet_sidecar_open(const embedlet_store_t *store,
+                                 embedlet_map_t *map, const char *suffix,
+                                 const char *magic, size_t needed,
+                                 bool *valid) {
+  char *path = embedlet_sidecar_path(store->path, suffix);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  int err = embedlet_file_open(map, path);
+  free(path);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  *valid = false;
+  if (map->size >= sizeof(embedlet_sidecar_header_t)) {
+    err = embedlet_mmap_update(map, map->size);
+    if (err != EMBEDLET_OK)
+      return err;
+    *valid = memcmp(map->data, magic, 8) == 0;
+  }
+  if (map->read_only) {
+    *valid = *valid && map->capacity >= needed;
+    return EMBEDLET_OK;
+  }
+
+  err = embedlet_map_reserve(map, needed);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  if (!*valid) {
+    memset(map->data, 0, map->capacity);
+    memcpy(map->data, magic, 8);
+  }
+  return EMBEDLET_OK;
+}
+
+/* Store the cached norm of row id, extending the valid range if needed */
+static void embedlet_norms_set(embedlet_store_t *store, size_t id,
+                               float norm) {
+  store->norms[id] = norm;
+  if (store->norms_header->rows <= id)
+    store->norms_header->rows = id + 1;
+}
+
+static inline bool embedlet_live_test(const uint64_t *live, size_t id) {
+  return (live[id >> 6] >> (id & 63)) & 1u;
+}
+
+static void embedlet_live_set(embedlet_store_t *store, size_t id, bool on) {
+  uint64_t bit = (uint64_t)1 << (id & 63);
+  if (on)
+    store->live[id >> 6] |= bit;
+  else
+    store->live[id >> 6] &= ~bit;
+  if (store->live_header->rows <= id)
+    store->live_header->rows = id + 1;
+}
+
+/* Pack the sign bits of a vector (1 = positive) into words */
+static void embedlet_sign_bits(const float *src, size_t dims, uint64_t *out) {
+  size_t words = (dims + 63) / 64;
+  memset(out, 0, words * sizeof(uint64_t));
+  for (size_t i = 0; i < dims; i++) {
+    if (src[i] > 0.0f)
+      out[i >> 6] |= (uint64_t)1 << (i & 63);
+  }
+}
+
+/* Store the prefilter code of row id; a NULL vector clears it */
+static void embedlet_bits_set(embedlet_store_t *store, size_t id,
+                              const float *src) {
+  uint64_t *out = store->bits + id * store->bits_words;
+  if (src)
+    embedlet_sign_bits(src, store->dims, out);
+  else
+    memset(out, 0, store->bits_words * sizeof(uint64_t));
+  if (store->bits_header->rows <= id)
+    store->bits_header->rows = id + 1;
+}
+
+/*----------------------------------------------------------------------------
+ * Free-Slot List (min-heap of deleted ids, rebuilt from the bitmap on open)
+ *----------------------------------------------------------------------------*/
+
+static int embedlet_free_push(embedlet_store_t *store, size_t id) {
+  if (store->free_count == store->free_capacity) {
+    size_t new_cap = store->free_capacity ? store->free_capacity * 2 : 64;
+    size_t *ids = (size_t *)realloc(store->free_ids, new_cap * sizeof(size_t));
+    if (!ids)
+      return EMBEDLET_ERR_ALLOC;
+    store->free_ids = ids;
+    store->free_capacity = new_cap;
+  }
+
+  size_t *heap = store->free_ids;
+  size_t i = store->free_count++;
+  heap[i] = id;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (heap[parent] <= heap[i])
+      break;
+    size_t tmp = heap[parent];
+    heap[parent] = heap[i];
+    heap[i] = tmp;
+    i = parent;
+  }
+  return EMBEDLET_OK;
+}
+
+static size_t embedlet_free_pop_raw(embedlet_store_t *store) {
+  size_t *heap = store->free_ids;
+  size_t top = heap[0];
+  size_t size = --store->free_count;
+  heap[0] = heap[size];
+  size_t i = 0;
+  for (;;) {
+    size_t left = 2 * i + 1;
+    size_t right = 2 * i + 2;
+    size_t smallest = i;
+    if (left < size && heap[left] < heap[smallest])
+      smallest = left;
+    if (right < size && heap[right] < heap[smallest])
+      smallest = right;
+    if (smallest == i)
+      break;
+    size_t tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+    i = smallest;
+  }
+  return top;
+}
+
+/*
+ * Pop the lowest deleted slot. Entries are discarded lazily when the slot was
+ * revived by embedlet_replace or trimmed away by compaction.
+ */
+static bool embedlet_free_pop(embedlet_store_t *store, size_t count,
+                              size_t *id_out) {
+  while (store->free_count > 0) {
+    size_t id = embedlet_free_pop_raw(store);
+    if (id < count && !embedlet_live_test(store->live, id)) {
+      *id_out = id;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Open the norm, live and sign-bit sidecars. Rows they do not cover yet (a
+ * store written before the sidecars existed, or after one was lost) are
+ * recomputed from the vectors, treating all-zero rows as deleted.
+ */
+static int embedlet_sidecars_open(embedlet_store_t *store) {
+  size_t count = embedlet_count(store);
+  bool valid;
+
+  int err = embedlet_sidecar_open(store, &store->norms_file,
+                                  EMBEDLET_NORMS_SUFFIX, EMBEDLET_NORMS_MAGIC,
+                                  embedlet_norms_bytes(count), &valid);
+  if (err != EMBEDLET_OK)
+    return err;
+  err = embedlet_sidecar_open(store, &store->live_file, EMBEDLET_LIVE_SUFFIX,
+                              EMBEDLET_LIVE_MAGIC, embedlet_live_bytes(count),
+                              &valid);
+  if (err != EMBEDLET_OK)
+    return err;
+  err = embedlet_sidecar_open(store, &store->bits_file, EMBEDLET_BITS_SUFFIX,
+                              EMBEDLET_BITS_MAGIC,
+                              embedlet_bits_bytes(store, count), &valid);
+  if (err != EMBEDLET_OK)
+    return err;
+  embedlet_refresh_pointers(store);
+
+  size_t norms_start = (size_t)store->norms_header->rows;
+  size_t bits_start = (size_t)store->bits_header->rows;
+  size_t start = norms_start < bits_start ? norms_start : bits_start;
+  if (start < count) {
+    /* Quantized rows are decoded into a scratch vector first */
+    float *scratch = NULL;
+    if (store->dtype != EMBEDLET_DTYPE_F32) {
+      scratch = (float *)malloc(store->dims * sizeof(float));
+      if (!scratch)
+        return EMBEDLET_ERR_ALLOC;
+    }
+    for (size_t i = start; i < count; i++) {
+      const float *row = (const float *)embedlet_row_ptr(store, i);
+      if (scratch) {
+        embedlet_row_decode(store, i, scratch);
+        row = scratch;
+      }
+      if (i >= norms_start)
+        store->norms[i] = embedlet_norm(row, store->dims);
+      if (i >= bits_start)
+        embedlet_sign_bits(row, store->dims,
+                           store->bits + i * store->bits_words);
+    }
+    free(scratch);
+  }
+  store->norms_header->rows = count;
+  store->bits_header->rows = count;
+
+  start = (size_t)store->live_header->rows;
+  for (size_t i = start < count ? start : count; i < count; i++) {
+    embedlet_live_set(store, i, !embedlet_row_is_zero(store, i));
+  }
+  store->live_header->rows = count;
+
+  for (size_t w = 0; w * 64 < count; w++) {
+    uint64_t word = store->live[w];
+    if (word == UINT64_MAX)
+      continue;
+    for (size_t b = 0; b < 64 && w * 64 + b < count; b++) {
+      if (!((word >> b) & 1u)) {
+        err = embedlet_free_push(store, w * 64 + b);
+        if (err != EMBEDLET_OK)
+          return err;
+      }
+    }
+  }
+
+  return EMBEDLET_OK;
+}
+
+/*
+ * Map the sidecars of a read-only store. Nothing can be recomputed without
+ * write access, so sidecars the writer has not brought up to date (or never
+ * created) make the store unreadable until a writer opens it once.
+ */
+static int embedlet_sidecars_attach(embedlet_store_t *store) {
+  /* The writer fills the sidecars before it publishes a row */
+  size_t count = (size_t)embedlet_atomic_acquire_u64(&store->header->count);
+  embedlet_map_t *maps[3] = {&store->norms_file, &store->live_file,
+                             &store->bits_file};
+  static const char *const suffixes[3] = {
+      EMBEDLET_NORMS_SUFFIX, EMBEDLET_LIVE_SUFFIX, EMBEDLET_BITS_SUFFIX};
+  static const char *const magics[3] = {
+      EMBEDLET_NORMS_MAGIC, EMBEDLET_LIVE_MAGIC, EMBEDLET_BITS_MAGIC};
+
+  for (int i = 0; i < 3; i++) {
+    bool valid;
+    int err = embedlet_sidecar_open(store, maps[i], suffixes[i], magics[i],
+                                    sizeof(embedlet_sidecar_header_t),
+                                    &valid);
+    if (err != EMBEDLET_OK)
+      return err;
+    if (!valid)
+      return EMBEDLET_ERR_FORMAT;
+  }
+  embedlet_refresh_pointers(store);
+
+  if (store->norms_header->rows < count || store->live_header->rows < count ||
+      store->bits_header->rows < count)
+    return EMBEDLET_ERR_FORMAT;
+  embedlet_atomic_release_u64(&store->mapped_rows,
+                              embedlet_mapped_rows(store));
+  return EMBEDLET_OK;
+}
+
+/*----------------------------------------------------------------------------
+ * Min-Heap for Top-N (most similar)
+ *----------------------------------------------------------------------------*/
+
+static void embedlet_heap_push_min(embedlet_result_t *heap, size_t *size,
+                                   size_t max_size, size_t id, float score) {
+  if (*size < max_size) {
+    heap[*size].id = id;
+    heap[*size].score = score;
+    (*size)++;
+    size_t i = *size - 1;
+    while (i > 0) {
+      size_t parent = (i - 1) / 2;
+      if (heap[parent].score <= heap[i].score)
+        break;
+      embedlet_result_t tmp = heap[parent];
+      heap[parent] = heap[i];
+      heap[i] = tmp;
+      i = parent;
+    }
+  } else if (score > heap[0].score) {
+    heap[0].id = id;
+    heap[0].score = score;
+    size_t i = 0;
+    for (;;) {
+      size_t left = 2 * i + 1;
+      size_t right = 2 * i + 2;
+      size_t smallest = i;
+      if (left < max_size && heap[left].score < heap[smallest].score)
+        smallest = left;
+      if (right < max_size && heap[right].score < heap[smallest].score)
+        smallest = right;
+      if (smallest == i)
+        break;
+      embedlet_result_t tmp = heap[i];
+      heap[i] = heap[smallest];
+      heap[smallest] = tmp;
+      i = smallest;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ * Max-Heap for Top-N (least similar)
+ *----------------------------------------------------------------------------*/
+
+static void embedlet_heap_push_max(embedlet_result_t *heap, size_t *size,
+                                   size_t max_size, size_t id, float score) {
+  if (*size < max_size) {
+    heap[*size].id = id;
+    heap[*size].score = score;
+    (*size)++;
+    size_t i = *size - 1;
+    while (i > 0) {
+      size_t parent = (i - 1) / 2;
+      if (heap[parent].score >= heap[i].score)
+        break;
+      embedlet_result_t tmp = heap[parent];
+      heap[parent] = heap[i];
+      heap[i] = tmp;
+      i = parent;
+    }
+  } else if (score < heap[0].score) {
+    heap[0].id = id;
+    heap[0].score = score;
+    size_t i = 0;
+    for (;;) {
+      size_t left = 2 * i + 1;
+      size_t right = 2 * i + 2;
+      size_t largest = i;
+      if (left < max_size && heap[left].score > heap[largest].score)
+        largest = left;
+      if (right < max_size && heap[right].score > heap[largest].score)
+        largest = right;
+      if (largest == i)
+        break;
+      embedlet_result_t tmp = heap[i];
+      heap[i] = heap[largest];
+      heap[largest] = tmp;
+      i = largest;
+    }
+  }
+}
+
+static inline void embedlet_heap_push(embedlet_result_t *heap, size_t *size,
+                                      size_t max_size, size_t id, float score,
+                                      bool most_similar) {
+  if (most_similar) {
+    embedlet_heap_push_min(heap, size, max_size, id, score);
+  } else {
+    embedlet_heap_push_max(heap, size, max_size, id, score);
+  }
+}
+
+/*----------------------------------------------------------------------------
+ * Top-N Collector
+ *----------------------------------------------------------------------------*/
+
+/* From this n up, top-n selection buffers candidates instead of a heap */
+#define EMBEDLET_SELECT_MIN_N 128
+
+/*
+ * Collects the n best of a stream of scores. Scores are kept multiplied by
+ * `sign` so that "best" is always "highest", and one comparison against
+ * `bound` (the worst score that can still make the cut) rejects most
+ * candidates. Below EMBEDLET_SELECT_MIN_N the n kept form a min-heap; from
+ * there on candidates are appended to a buffer of 2n and cut back to the
+ * best n with quickselect when it fills, so each costs O(1) amortized
+ * rather than a heap sift with cache misses across a large heap.
+ */
+typedef struct {
+  embedlet_result_t *items; /* embedlet_topn_capacity(n) entries */
+  size_t count;
+  size_t n;
+  float sign;  /* 1 keeps the highest scores, -1 the lowest */
+  float bound; /* candidates must score above it */
+  bool select; /* buffered selection rather than a heap */
+} embedlet_topn_t;
+
+static inline size_t embedlet_topn_capacity(size_t n) {
+  return n >= EMBEDLET_SELECT_MIN_N ? 2 * n : n;
+}
+
+static inline void embedlet_topn_init(embedlet_topn_t *top,
+                                      embedlet_result_t *items, size_t n,
+                                      bool highest) {
+  top->items = items;
+  top->count = 0;
+  top->n = n;
+  top->sign = highest ? 1.0f : -1.0f;
+  top->bound = -INFINITY;
+  top->select = n >= EMBEDLET_SELECT_MIN_N;
+}
+
+/* Reorder r so that r[0..k) hold the k highest scores (0 < k < count) */
+static void embedlet_select_highest(embedlet_result_t *r, size_t count,
+                                    size_t k) {
+  size_t lo = 0, hi = count - 1;
+  while (lo < hi && lo < k) {
+    /* Median of three as the pivot, then a Hoare partition */
+    size_t mid = lo + (hi - lo) / 2;
+    float a = r[lo].score, b = r[mid].score, c = r[hi].score;
+    float pivot = a < b ? (b < c ? b : (a < c ? c : a))
+                        : (a < c ? a : (b < c ? c : b));
+    size_t i = lo, j = hi;
+    for (;;) {
+      while (r[i].score > pivot)
+        i++;
+      while (r[j].score < pivot)
+        j--;
+      if (i >= j)
+        break;
+      embedlet_result_t tmp = r[i];
+      r[i] = r[j];
+      r[j] = tmp;
+      i++;
+      j--;
+    }
+    /* r[lo..j] >= pivot >= r[j+1..hi]: keep the side holding r[k - 1] */
+    if (k <= j)
+      hi = j;
+    else
+      lo = j + 1;
+  }
+}
+
+/* Cut the buffer back to its best n and raise the bound to the n-th */
+static void embedlet_topn_cut(embedlet_topn_t *top) {
+  embedlet_select_highest(top->items, top->count, top->n);
+  top->count = top->n;
+  float worst = top->items[0].score;
+  for (size_t i = 1; i < top->n; i++) {
+    if (top->items[i].score < worst)
+      worst = top->items[i].score;
+  }
+  top->bound = worst;
+}
+
+static void embedlet_topn_insert(embedlet_topn_t *top, size_t id,
+                                 float score) {
+  if (!top->select) {
+    embedlet_heap_push_min(top->items, &top->count, top->n, id, score);
+    if (top->count == top->n)
+      top->bound = top->items[0].score;
+    return;
+  }
+  top->items[top->count].id = id;
+  top->items[top->count].score = score;
+  if (++top->count == 2 * top->n)
+    embedlet_topn_cut(top);
+}
+
+static inline void embedlet_topn_push(embedlet_topn_t *top, size_t id,
+                                      float score) {
+  float key = score * top->sign;
+  if (key > top->bound)
+    embedlet_topn_insert(top, id, key);
+}
+
+/* Settle on the best n (unsorted) with their real scores; returns count */
+static size_t embedlet_topn_finish(embedlet_topn_t *top) {
+  if (top->select && top->count > top->n)
+    embedlet_topn_cut(top);
+  for (size_t i = 0; i < top->count; i++)
+    top->items[i].score *= top->sign;
+  return top->count;
+}
+
+/* Sort orders for embedlet_sort_by(); ties in score are broken by id */
+#define EMBEDLET_ORDER_DESC 0
+#define EMBEDLET_ORDER_ASC 1
+#define EMBEDLET_ORDER_ID 2
+
+static inline bool embedlet_result_after(const embedlet_result_t *a,
+                                         const embedlet_result_t *b,
+                                         int order) {
+  if (order != EMBEDLET_ORDER_ID && a->score != b->score)
+    return order == EMBEDLET_ORDER_DESC ? a->score < b->score
+                                        : a->score > b->score;
+  return a->id > b->id;
+}
+
+static void embedlet_sift_down(embedlet_result_t *r, size_t i, size_t end,
+                               int order) {
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= end)
+      return;
+    if (child + 1 < end &&
+        embedlet_result_after(&r[child + 1], &r[child], order))
+      child++;
+    if (!embedlet_result_after(&r[child], &r[i], order))
+      return;
+    embedlet_result_t tmp = r[i];
+    r[i] = r[child];
+    r[child] = tmp;
+    i = child;
+  }
+}
+
+/*
+ * In-place heapsort. Unlike qsort (which may allocate a merge buffer) it
+ * never touches the heap, keeping the search path allocation-free.
+ */
+static void embedlet_sort_by(embedlet_result_t *r, size_t count, int order) {
+  for (size_t i = count / 2; i-- > 0;)
+    embedlet_sift_down(r, i, count, order);
+  for (size_t end = count; end > 1;) {
+    end--;
+    embedlet_result_t tmp = r[0];
+    r[0] = r[end];
+    r[end] = tmp;
+    embedlet_sift_down(r, 0, end, order);
+  }
+}
+
+static void embedlet_sort_results(embedlet_result_t *results, size_t count,
+                                  bool most_similar) {
+  embedlet_sort_by(results, count,
+                   most_similar ? EMBEDLET_ORDER_DESC : EMBEDLET_ORDER_ASC);
+}
+
+/* Exact cosine similarity of a query against stored row id */
+static inline float embedlet_score_row(const embedlet_store_t *store,
+                                       const float *query, float query_norm,
+                                       float query_sum, size_t id) {
+  float dot = store->row_dot(query, query_sum, embedlet_row_ptr(store, id),
+                             store->dims);
+  float emb_norm = store->norms[id];
+  return (query_norm > FLT_EPSILON && emb_norm > FLT_EPSILON)
+             ? dot / (query_norm * emb_norm)
+             : 0.0f;
+}
+
+/*----------------------------------------------------------------------------
+ * Scratch Arenas
+ *----------------------------------------------------------------------------*/
+
+static embedlet_arena_block_t *embedlet_arena_block_create(size_t cap) {
+  embedlet_arena_block_t *b = (embedlet_arena_block_t *)malloc(
+      sizeof(embedlet_arena_block_t) + cap + EMBEDLET_ARENA_ALIGN - 1);
+  if (!b)
+    return NULL;
+  uintptr_t start = (uintptr_t)(b + 1);
+  start = (start + EMBEDLET_ARENA_ALIGN - 1) &
+          ~(uintptr_t)(EMBEDLET_ARENA_ALIGN - 1);
+  b->next = NULL;
+  b->data = (uint8_t *)start;
+  b->cap = cap;
+  b->used = 0;
+  return b;
+}
+
+static void embedlet_arena_blocks_free(embedlet_arena_block_t *b) {
+  while (b) {
+    embedlet_arena_block_t *next = b->next;
+    free(b);
+    b = next;
+  }
+}
+
+/* Take an idle arena from the store, or a new empty one */
+static embedlet_arena_t *embedlet_arena_acquire(embedlet_store_t *store) {
+  embedlet_mutex_lock(&store->arena_mutex);
+  embedlet_arena_t *a = store->arenas;
+  if (a)
+    store->arenas = a->next;
+  embedlet_mutex_unlock(&store->arena_mutex);
+  if (!a)
+    a = (embedlet_arena_t *)calloc(1, sizeof(embedlet_arena_t));
+  return a;
+}
+
+/* Aligned scratch that lives until the arena is released */
+static void *embedlet_arena_alloc(embedlet_arena_t *a, size_t bytes) {
+  bytes = (bytes + EMBEDLET_ARENA_ALIGN - 1) &
+          ~(size_t)(EMBEDLET_ARENA_ALIGN - 1);
+  embedlet_arena_block_t *b = a->blocks;
+  if (!b || b->cap - b->used < bytes) {
+    size_t cap = b ? 2 * b->cap : EMBEDLET_ARENA_MIN_BYTES;
+    if (cap < bytes)
+      cap = bytes;
+    b = embedlet_arena_block_create(cap);
+    if (!b)
+      return NULL;
+    b->next = a->blocks;
+    a->blocks = b;
+  }
+  void *p = b->data + b->used;
+  b->used += bytes;
+  return p;
+}
+
+/* Reset an arena and return it to the store's free list */
+static void embedlet_arena_release(embedlet_store_t *store,
+                                   embedlet_arena_t *a) {
+  if (!a)
+    return;
+  if (a->blocks && a->blocks->next) {
+    /* Fold an overflowed arena into one block big enough for the query */
+    size_t cap = 0;
+    for (embedlet_arena_block_t *b = a->blocks; b; b = b->next)
+      cap += b->cap;
+    embedlet_arena_blocks_free(a->blocks);
+    a->blocks = embedlet_arena_block_create(cap);
+  } else if (a->blocks) {
+    a->blocks->used = 0;
+  }
+  embedlet_mutex_lock(&store->arena_mutex);
+  a->next = store->arenas;
+  store->arenas = a;
+  embedlet_mutex_unlock(&store->arena_mutex);
+}
+
+static void embedlet_arenas_free(embedlet_store_t *store) {
+  embedlet_arena_t *a = store->arenas;
+  while (a) {
+    embedlet_arena_t *next = a->next;
+    embedlet_arena_blocks_free(a->blocks);
+    free(a);
+    a = next;
+  }
+  store->arenas = NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * Search Task Worker
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Row scorers, one per metric. The search workers below are stamped out
+ * once per scorer, so the metric is fixed at compile time and the scan
+ * loop never branches on it.
+ */
+static inline float embedlet_score_cosine(const embedlet_store_t *store,
+                                          const float *query,
+                                          float query_norm, float query_sum,
+                                          const uint64_t *query_bits,
+                                          size_t i) {
+  (void)query_bits;
+  float dot = store->row_dot(query, query_sum, embedlet_row_ptr(store, i),
+                             store->dims);
+  float emb_norm = store->norms[i];
+  return (query_norm > FLT_EPSILON && emb_norm > FLT_EPSILON)
+             ? dot / (query_norm * emb_norm)
+             : 0.0f;
+}
+
+static inline float embedlet_score_inner_product(
+    const embedlet_store_t *store, const float *query, float query_norm,
+    float query_sum, const uint64_t *query_bits, size_t i) {
+  (void)query_norm;
+  (void)query_bits;
+  return store->row_dot(query, query_sum, embedlet_row_ptr(store, i),
+                        store->dims);
+}
+
+/* |q - r|^2 = |q|^2 + |r|^2 - 2 q.r, from the stored row norm */
+static inline float embedlet_score_l2(const embedlet_store_t *store,
+                                      const float *query, float query_norm,
+                                      float query_sum,
+                                      const uint64_t *query_bits, size_t i) {
+  (void)query_bits;
+  float dot = store->row_dot(query, query_sum, embedlet_row_ptr(store, i),
+                             store->dims);
+  float emb_norm = store->norms[i];
+  float dist = query_norm * query_norm + emb_norm * emb_norm - 2.0f * dot;
+  return dist > 0.0f ? dist : 0.0f;
+}
+
+static inline float embedlet_score_hamming(const embedlet_store_t *store,
+                                           const float *query,
+                                           float query_norm, float query_sum,
+                                           const uint64_t *query_bits,
+                                           size_t i) {
+  (void)query;
+  (void)query_norm;
+  (void)query_sum;
+  size_t words = store->bits_words;
+  return (float)embedlet_kernels.hamming(query_bits, store->bits + i * words,
+                                         words);
+}
+
+/* Rows of the 64 starting at word * 64 that a filter's bitset lets through */
+static inline uint64_t embedlet_filter_mask(const embedlet_filter_t *filter,
+                                            size_t word) {
+  if (!filter->bits)
+    return ~(uint64_t)0;
+  uint64_t bits = 0;
+  size_t first = word * 64;
+  if (first < filter->num_bits) {
+    bits = filter->bits[word];
+    if (filter->num_bits - first < 64)
+      bits &= ((uint64_t)1 << (filter->num_bits - first)) - 1;
+  }
+  return filter->deny ? ~bits : bits;
+}
+
+/*----------------------------------------------------------------------------
+ * Scan Prefetch
+ *----------------------------------------------------------------------------*/
+
+static inline void embedlet_prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(p, 0, 3);
+#elif EMBEDLET_HAS_SSE2
+  _mm_prefetch((const char *)p, _MM_HINT_T0);
+#else
+  (void)p;
+#endif
+}
+
+/* Start of the per-row data a scan reads under the store's metric */
+static inline const uint8_t *
+embedlet_scan_base(const embedlet_store_t *store) {
+  return store->metric == EMBEDLET_METRIC_HAMMING
+             ? (const uint8_t *)store->bits
+             : (const uint8_t *)store->data;
+}
+
+/*
+ * Prefetch the first line of the row EMBEDLET_PREFETCH_ROWS past row i
+ * (within the block ending at `end`). Rows of a few KB each start a new
+ * page, where the hardware prefetcher stops; this starts the next one.
+ */
+static inline void embedlet_scan_prefetch(const uint8_t *base,
+                                          size_t row_bytes, size_t i,
+                                          size_t end) {
+  if (EMBEDLET_PREFETCH_ROWS > 0 && i + EMBEDLET_PREFETCH_ROWS < end)
+    embedlet_prefetch(base + (i + EMBEDLET_PREFETCH_ROWS) * row_bytes);
+}
+
+/*----------------------------------------------------------------------------
+ * Search Statistics
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Zero `delta` and return it when the store collects stats, else NULL. A
+ * search passes the result down so its tasks are timed only when it is set.
+ */
+static inline embedlet_stats_t *embedlet_stats_begin(embedlet_store_t *store,
+                                                     embedlet_stats_t *delta) {
+  if (!embedlet_atomic_load_u64(&store->stats_enabled))
+    return NULL;
+  memset(delta, 0, sizeof(*delta));
+  return delta;
+}
+
+/* Start a task's scan; returns its start time, 0 when it is not timed */
+static inline uint64_t embedlet_scan_begin(embedlet_scan_stats_t *s) {
+  if (!s->posted_ns)
+    return 0;
+  uint64_t now = embedlet_now_ns();
+  s->wait_ns = now - s->posted_ns;
+  return now;
+}
+
+static inline void embedlet_scan_end(embedlet_scan_stats_t *s, uint64_t began,
+                                     size_t visited, size_t scanned) {
+  s->visited = visited;
+  s->scanned = scanned;
+  if (began)
+    s->kernel_ns = embedlet_now_ns() - began;
+}
+
+/* Add one finished task's counters; each scored row reads row_bytes */
+static void embedlet_scan_collect(embedlet_stats_t *delta,
+                                  const embedlet_scan_stats_t *s,
+                                  size_t row_bytes) {
+  delta->rows_scanned += s->scanned;
+  delta->rows_skipped += s->visited - s->scanned;
+  delta->bytes_touched += (uint64_t)s->scanned * row_bytes;
+  delta->kernel_ns += s->kernel_ns;
+  delta->queue_wait_ns += s->wait_ns;
+}
+
+/* Bytes one scored row reads under the store's metric */
+static inline size_t embedlet_scan_row_bytes(const embedlet_store_t *store) {
+  return store->metric == EMBEDLET_METRIC_HAMMING
+             ? store->bits_words * sizeof(uint64_t)
+             : store->row_bytes;
+}
+
+/* Fold one search's counters into the store's totals and export them */
+static void embedlet_stats_commit(embedlet_store_t *store,
+                                  const char *operation,
+                                  embedlet_stats_t *delta) {
+  delta->searches = 1;
+  delta->simd_backend = embedlet_kernels.name;
+  embedlet_stats_t *t = &store->stats;
+  embedlet_atomic_add_u64(&t->searches, 1);
+  embedlet_atomic_add_u64(&t->rows_scanned, delta->rows_scanned);
+  embedlet_atomic_add_u64(&t->rows_skipped, delta->rows_skipped);
+  embedlet_atomic_add_u64(&t->bytes_touched, delta->bytes_touched);
+  embedlet_atomic_add_u64(&t->kernel_ns, delta->kernel_ns);
+  embedlet_atomic_add_u64(&t->queue_wait_ns, delta->queue_wait_ns);
+  embedlet_atomic_add_u64(&t->merge_ns, delta->merge_ns);
+  if (store->stats_hook)
+    store->stats_hook(store->stats_hook_data, operation, delta);
+}
+
+/*
+ * Scan worker over rows of `row_bytes(store)` bytes starting at
+ * `base(store)`, which the scan prefetches ahead of `score`.
+ */
+#define EMBEDLET_DEFINE_SCAN_WORKER(name, score, base, row_bytes)              \
+  static void name(void *arg) {                                                \
+    embedlet_search_task_t *task = (embedlet_search_task_t *)arg;              \
+    const embedlet_store_t *store = task->store;                               \
+    const float *query = task->query;                                          \
+    float query_norm = task->query_norm;                                       \
+    float query_sum = task->query_sum;                                         \
+    const uint64_t *query_bits = task->query_bits;                             \
+    const uint64_t *live = store->live;                                        \
+    const embedlet_filter_t *filter = task->filter;                            \
+    const uint8_t *scan_base = base(store);                                    \
+    size_t scan_bytes = row_bytes(store);                                      \
+                                                                               \
+    embedlet_topn_t top;                                                       \
+    embedlet_topn_init(&top, task->local_results, task->n,                     \
+                       task->most_similar);                                    \
+    uint64_t began = embedlet_scan_begin(&task->stats);                        \
+    size_t start, end, visited = 0, scanned = 0;                               \
+                                                                               \
+    while (embedlet_steal_next(task->steal, task->slot, &start, &end)) {       \
+      visited += end - start;                                                  \
+      for (size_t i = start; i < end; i++) {                                   \
+        uint64_t word = live[i >> 6];                                          \
+        if (filter)                                                            \
+          word &= embedlet_filter_mask(filter, i >> 6);                        \
+        if (word == 0) {                                                       \
+          i |= 63; /* whole word excluded: jump to the next one */             \
+          continue;                                                            \
+        }                                                                      \
+        if (!((word >> (i & 63)) & 1u))                                        \
+          continue;                                                            \
+        if (filter && filter->predicate &&                                     \
+            !filter->predicate(filter->user_data, i))                          \
+          continue;                                                            \
+                                                                               \
+        embedlet_scan_prefetch(scan_base, scan_bytes, i, end);                 \
+        float sim = score(store, query, query_norm, query_sum, query_bits, i); \
+        embedlet_topn_push(&top, i, sim);                                      \
+        scanned++;                                                             \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    task->result_count = embedlet_topn_finish(&top);                           \
+    embedlet_scan_end(&task->stats, began, visited, scanned);                  \
+  }
+
+#define EMBEDLET_DEFINE_SEARCH_WORKER(name, score)                             \
+  EMBEDLET_DEFINE_SCAN_WORKER(name, score, embedlet_scan_base,                 \
+                              embedlet_scan_row_bytes)
+
+EMBEDLET_DEFINE_SEARCH_WORKER(embedlet_search_worker_cosine,
+                              embedlet_score_cosine)
+EMBEDLET_DEFINE_SEARCH_WORKER(embedlet_search_worker_inner_product,
+                              embedlet_score_inner_product)
+EMBEDLET_DEFINE_SEARCH_WORKER(embedlet_search_worker_l2, embedlet_score_l2)
+EMBEDLET_DEFINE_SEARCH_WORKER(embedlet_search_worker_hamming,
+                              embedlet_score_hamming)
+
+/* Exact search workers, indexed by EMBEDLET_METRIC_* */
+static void (*const embedlet_search_workers[])(void *) = {
+    embedlet_search_worker_cosine, embedlet_search_worker_inner_product,
+    embedlet_search_worker_l2, embedlet_search_worker_hamming};
+
+/* Exact score of row i under the store's metric, for rescoring candidates */
+static float embedlet_score_exact(const embedlet_store_t *store,
+                                  const float *query, float query_norm,
+                                  float query_sum, size_t i) {
+  switch (store->metric) {
+  case EMBEDLET_METRIC_INNER_PRODUCT:
+    return embedlet_score_inner_product(store, query, query_norm, query_sum,
+                                        NULL, i);
+  case EMBEDLET_METRIC_L2:
+    return embedlet_score_l2(store, query, query_norm, query_sum, NULL, i);
+  default:
+    return embedlet_score_cosine(store, query, query_norm, query_sum, NULL, i);
+  }
+}
+
+/*
+ * Prefix scorers: the same metrics on the leading prefix_dims of row i, read
+ * from the prefix copy. The query norm and sum cover those dims only.
+ */
+static inline const uint8_t *
+embedlet_prefix_base(const embedlet_store_t *store) {
+  return store->prefix;
+}
+
+static inline size_t embedlet_prefix_stride(const embedlet_store_t *store) {
+  return store->prefix_row_bytes;
+}
+
+static inline float embedlet_prefix_dot(const embedlet_store_t *store,
+                                        const float *query, float query_sum,
+                                        size_t i, float *norm_out) {
+  const uint8_t *row = store->prefix + i * store->prefix_row_bytes;
+  *norm_out = *(const float *)(row + store->prefix_row_bytes - sizeof(float));
+  return embedlet_row_dots[store->dtype](query, query_sum, row,
+                                         store->prefix_dims);
+}
+
+static inline float embedlet_prefix_cosine(const embedlet_store_t *store,
+                                           const float *query,
+                                           float query_norm, float query_sum,
+                                           const uint64_t *query_bits,
+                                           size_t i) {
+  (void)query_bits;
+  float emb_norm;
+  float dot = embedlet_prefix_dot(store, query, query_sum, i, &emb_norm);
+  return (query_norm > FLT_EPSILON && emb_norm > FLT_EPSILON)
+             ? dot / (query_norm * emb_norm)
+             : 0.0f;
+}
+
+static inline float embedlet_prefix_inner_product(
+    const embedlet_store_t *store, const float *query, float query_norm,
+    float query_sum, const uint64_t *query_bits, size_t i) {
+  (void)query_norm;
+  (void)query_bits;
+  float emb_norm;
+  return embedlet_prefix_dot(store, query, query_sum, i, &emb_norm);
+}
+
+static inline float embedlet_prefix_l2(const embedlet_store_t *store,
+                                       const float *query, float query_norm,
+                                       float query_sum,
+                                       const uint64_t *query_bits, size_t i) {
+  (void)query_bits;
+  float emb_norm;
+  float dot = embedlet_prefix_dot(store, query, query_sum, i, &emb_norm);
+  float dist = query_norm * query_norm + emb_norm * emb_norm - 2.0f * dot;
+  return dist > 0.0f ? dist : 0.0f;
+}
+
+EMBEDLET_DEFINE_SCAN_WORKER(embedlet_prefix_worker_cosine,
+                            embedlet_prefix_cosine, embedlet_prefix_base,
+                            embedlet_prefix_stride)
+EMBEDLET_DEFINE_SCAN_WORKER(embedlet_prefix_worker_inner_product,
+                            embedlet_prefix_inner_product,
+                            embedlet_prefix_base, embedlet_prefix_stride)
+EMBEDLET_DEFINE_SCAN_WORKER(embedlet_prefix_worker_l2, embedlet_prefix_l2,
+                            embedlet_prefix_base, embedlet_prefix_stride)
+
+/* Prefix scan workers, indexed by EMBEDLET_METRIC_* (Hamming never scans) */
+static void (*const embedlet_prefix_workers[])(void *) = {
+    embedlet_prefix_worker_cosine, embedlet_prefix_worker_inner_product,
+    embedlet_prefix_worker_l2};
+
+/* Blocked scorers: a metric's score from a row's dot product and its norm */
+static inline float embedlet_block_cosine(float dot, float query_norm,
+                                          float emb_norm) {
+  return (query_norm > FLT_EPSILON && emb_norm > FLT_EPSILON)
+             ? dot / (query_norm * emb_norm)
+             : 0.0f;
+}
+
+static inline float embedlet_block_inner_product(float dot, float query_norm,
+                                                 float emb_norm) {
+  (void)query_norm;
+  (void)emb_norm;
+  return dot;
+}
+
+static inline float embedlet_block_l2(float dot, float query_norm,
+                                      float emb_norm) {
+  float dist = query_norm * query_norm + emb_norm * emb_norm - 2.0f * dot;
+  return dist > 0.0f ? dist : 0.0f;
+}
+
+/*
+ * Blocked scan worker: claims ranges of blocks of the blocked copy and
+ * scores all rows of a block with one dot_block call, skipping blocks
+ * without a live row that passes the filter bits.
+ */
+#define EMBEDLET_DEFINE_BLOCK_WORKER(name, score)                              \
+  static void name(void *arg) {                                                \
+    embedlet_search_task_t *task = (embedlet_search_task_t *)arg;              \
+    const embedlet_store_t *store = task->store;                               \
+    const uint64_t *live = store->live;                                        \
+    const embedlet_filter_t *filter = task->filter;                            \
+    size_t dims = store->dims;                                                 \
+    float dots[EMBEDLET_BLOCK_ROWS];                                           \
+                                                                               \
+    embedlet_topn_t top;                                                       \
+    embedlet_topn_init(&top, task->local_results, task->n,                     \
+                       task->most_similar);                                    \
+    uint64_t began = embedlet_scan_begin(&task->stats);                        \
+    size_t start, end, visited = 0, scanned = 0;                               \
+                                                                               \
+    while (embedlet_steal_next(task->steal, task->slot, &start, &end)) {       \
+      for (size_t b = start; b < end; b++) {                                   \
+        size_t first = b * EMBEDLET_BLOCK_ROWS;                                \
+        size_t rows = task->rows - first;                                      \
+        if (rows > EMBEDLET_BLOCK_ROWS)                                        \
+          rows = EMBEDLET_BLOCK_ROWS;                                          \
+        visited += rows;                                                       \
+        uint64_t word = live[first >> 6];                                      \
+        if (filter)                                                            \
+          word &= embedlet_filter_mask(filter, first >> 6);                    \
+        uint64_t lanes = (word >> (first & 63)) &                              \
+                         (((uint64_t)1 << rows) - 1u);                         \
+        if (lanes == 0)                                                        \
+          continue;                                                            \
+                                                                               \
+        embedlet_kernels.dot_block(task->query, store->blocks + first * dims,  \
+                                   dims, dots);                                \
+        for (size_t r = 0; r < rows; r++) {                                    \
+          size_t i = first + r;                                                \
+          if (!((lanes >> r) & 1u))                                            \
+            continue;                                                          \
+          if (filter && filter->predicate &&                                   \
+              !filter->predicate(filter->user_data, i))                        \
+            continue;                                                          \
+          embedlet_topn_push(&top, i,                                          \
+                             score(dots[r], task->query_norm,                  \
+                                   store->norms[i]));                          \
+          scanned++;                                                           \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    task->result_count = embedlet_topn_finish(&top);                           \
+    embedlet_scan_end(&task->stats, began, visited, scanned);                  \
+  }
+
+EMBEDLET_DEFINE_BLOCK_WORKER(embedlet_block_worker_cosine,
+                             embedlet_block_cosine)
+EMBEDLET_DEFINE_BLOCK_WORKER(embedlet_block_worker_inner_product,
+                             embedlet_block_inner_product)
+EMBEDLET_DEFINE_BLOCK_WORKER(embedlet_block_worker_l2, embedlet_block_l2)
+
+/* Blocked scan workers, indexed by EMBEDLET_METRIC_* (not for Hamming) */
+static void (*const embedlet_block_workers[])(void *) = {
+    embedlet_block_worker_cosine, embedlet_block_worker_inner_product,
+    embedlet_block_worker_l2};
+
+/*
+ * Batch worker: rows are claimed in blocks sized to stay in cache, and every
+ * query is scored against a block before moving on, so each row is streamed
+ * from memory once per batch rather than once per query.
+ */
+#define EMBEDLET_DEFINE_BATCH_WORKER(name, score)                              \
+  static void name(void *arg) {                                                \
+    embedlet_batch_task_t *task = (embedlet_batch_task_t *)arg;                \
+    const embedlet_store_t *store = task->store;                               \
+    size_t dims = store->dims;                                                 \
+    size_t words = store->bits_words;                                          \
+    const uint64_t *live = store->live;                                        \
+    size_t n = task->n;                                                        \
+    uint64_t began = embedlet_scan_begin(&task->stats);                        \
+    size_t b0, b1, visited = 0, scanned = 0;                                   \
+                                                                               \
+    while (embedlet_steal_next(task->steal, task->slot, &b0, &b1)) {           \
+      visited += (b1 - b0) * task->num_queries;                                \
+      for (size_t q = 0; q < task->num_queries; q++) {                         \
+        const float *query = task->queries + q * dims;                         \
+        float query_norm = task->query_norms[q];                               \
+        float query_sum = task->query_sums[q];                                 \
+        const uint64_t *query_bits =                                           \
+            task->query_bits ? task->query_bits + q * words : NULL;            \
+        embedlet_result_t *heap = task->local_results + q * n;                 \
+        size_t *heap_size = &task->result_counts[q];                           \
+                                                                               \
+        for (size_t i = b0; i < b1; i++) {                                     \
+          uint64_t word = live[i >> 6];                                        \
+          if (word == 0) {                                                     \
+            i |= 63;                                                           \
+            continue;                                                          \
+          }                                                                    \
+          if (!((word >> (i & 63)) & 1u))                                      \
+            continue;                                                          \
+                                                                               \
+          float sim =                                                          \
+              score(store, query, query_norm, query_sum, query_bits, i);       \
+          embedlet_heap_push(heap, heap_size, n, i, sim, task->most_similar);  \
+          scanned++;                                                           \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    embedlet_scan_end(&task->stats, began, visited, scanned);                  \
+  }
+
+EMBEDLET_DEFINE_BATCH_WORKER(embedlet_batch_worker_cosine,
+                             embedlet_score_cosine)
+EMBEDLET_DEFINE_BATCH_WORKER(embedlet_batch_worker_inner_product,
+                             embedlet_score_inner_product)
+EMBEDLET_DEFINE_BATCH_WORKER(embedlet_batch_worker_l2, embedlet_score_l2)
+EMBEDLET_DEFINE_BATCH_WORKER(embedlet_batch_worker_hamming,
+                             embedlet_score_hamming)
+
+/* Batch search workers, indexed by EMBEDLET_METRIC_* */
+static void (*const embedlet_batch_workers[])(void *) = {
+    embedlet_batch_worker_cosine, embedlet_batch_worker_inner_product,
+    embedlet_batch_worker_l2, embedlet_batch_worker_hamming};
+
+/* Double a range task's buffer; on failure the task is marked failed */
+static bool embedlet_range_grow(embedlet_threshold_task_t *task) {
+  size_t cap = task->cap ? 2 * task->cap : 256;
+  embedlet_result_t *results = (embedlet_result_t *)realloc(
+      task->results, cap * sizeof(embedlet_result_t));
+  if (!results) {
+    task->failed = true;
+    return false;
+  }
+  task->results = results;
+  task->cap = cap;
+  return true;
+}
+
+/*
+ * Record a range hit; false when the scan should stop, because the shared
+ * limit was reached or the buffer could not grow.
+ */
+static inline bool embedlet_range_add(embedlet_threshold_task_t *task,
+                                      size_t id, float score) {
+  if (task->count == task->cap && !embedlet_range_grow(task)) {
+    embedlet_atomic_fetch_add(task->steal->stop, 1);
+    return false;
+  }
+  if (task->limit &&
+      embedlet_atomic_fetch_add(task->hits, 1) >= task->limit) {
+    embedlet_atomic_fetch_add(task->steal->stop, 1);
+    return false;
+  }
+  task->results[task->count].id = id;
+  task->results[task->count].score = score;
+  task->count++;
+  return true;
+}
+
+/*
+ * Range worker: keep every row scoring within the threshold in a growable
+ * per-task buffer. Scores are multiplied by `sign` (-1 for distances) so a
+ * single comparison serves both directions. With a limit, hits are counted
+ * across tasks and the scan stops once it is reached.
+ */
+#define EMBEDLET_DEFINE_RANGE_WORKER(name, score)                              \
+  static void name(void *arg) {                                                \
+    embedlet_threshold_task_t *task = (embedlet_threshold_task_t *)arg;        \
+    const embedlet_store_t *store = task->store;                               \
+    const float *query = task->query;                                          \
+    float query_norm = task->query_norm;                                       \
+    float query_sum = task->query_sum;                                         \
+    const uint64_t *query_bits = task->query_bits;                             \
+    const uint64_t *live = store->live;                                        \
+    float sign = task->sign;                                                   \
+    float bound = task->threshold * sign;                                      \
+    const uint8_t *scan_base = embedlet_scan_base(store);                      \
+    size_t scan_bytes = embedlet_scan_row_bytes(store);                        \
+    uint64_t began = embedlet_scan_begin(&task->stats);                        \
+    size_t start, end, visited = 0, scanned = 0;                               \
+    bool running = true;                                                       \
+                                                                               \
+    while (running &&                                                          \
+           embedlet_steal_next(task->steal, task->slot, &start, &end)) {       \
+      visited += end - start;                                                  \
+      for (size_t i = start; i < end; i++) {                                   \
+        uint64_t word = live[i >> 6];                                          \
+        if (word == 0) {                                                       \
+          i |= 63;                                                             \
+          continue;                                                            \
+        }                                                                      \
+        if (!((word >> (i & 63)) & 1u))                                        \
+          continue;                                                            \
+                                                                               \
+        embedlet_scan_prefetch(scan_base, scan_bytes, i, end);                 \
+        float sim = score(store, query, query_norm, query_sum, query_bits, i); \
+        scanned++;                                                             \
+        if (sim * sign < bound)                                                \
+          continue;                                                            \
+        if (!embedlet_range_add(task, i, sim)) {                               \
+          running = false;                                                     \
+          break;                                                               \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    embedlet_scan_end(&task->stats, began, visited, scanned);                  \
+  }
+
+EMBEDLET_DEFINE_RANGE_WORKER(embedlet_range_worker_cosine,
+                             embedlet_score_cosine)
+EMBEDLET_DEFINE_RANGE_WORKER(embedlet_range_worker_inner_product,
+                             embedlet_score_inner_product)
+EMBEDLET_DEFINE_RANGE_WORKER(embedlet_range_worker_l2, embedlet_score_l2)
+EMBEDLET_DEFINE_RANGE_WORKER(embedlet_range_worker_hamming,
+                             embedlet_score_hamming)
+
+/* Range search workers, indexed by EMBEDLET_METRIC_* */
+static void (*const embedlet_range_workers[])(void *) = {
+    embedlet_range_worker_cosine, embedlet_range_worker_inner_product,
+    embedlet_range_worker_l2, embedlet_range_worker_hamming};
+
+/*
+ * Prefilter worker: rank rows by how many sign bits they share with the
+ * query (dims - 2 * Hamming distance, a coarse proxy for the angle).
+ */
+static void embedlet_prefilter_worker(void *arg) {
+  embedlet_search_task_t *task = (embedlet_search_task_t *)arg;
+  const embedlet_store_t *store = task->store;
+  const uint64_t *query_bits = task->query_bits;
+  const uint64_t *live = store->live;
+  const uint64_t *bits = store->bits;
+  size_t words = store->bits_words;
+  float dims = (float)store->dims;
+
+  embedlet_topn_t top;
+  embedlet_topn_init(&top, task->local_results, task->n, task->most_similar);
+  uint64_t began = embedlet_scan_begin(&task->stats);
+  size_t start, end, visited = 0, scanned = 0;
+
+  while (embedlet_steal_next(task->steal, task->slot, &start, &end)) {
+    visited += end - start;
+    for (size_t i = start; i < end; i++) {
+      uint64_t word = live[i >> 6];
+      if (word == 0) {
+        i |= 63;
+        continue;
+      }
+      if (!((word >> (i & 63)) & 1u))
+        continue;
+
+      embedlet_scan_prefetch((const uint8_t *)bits, words * sizeof(uint64_t),
+                             i, end);
+      uint32_t dist =
+          embedlet_kernels.hamming(query_bits, bits + i * words, words);
+      embedlet_topn_push(&top, i, dims - 2.0f * (float)dist);
+      scanned++;
+    }
+  }
+
+  task->result_count = embedlet_topn_finish(&top);
+  embedlet_scan_end(&task->stats, began, visited, scanned);
+}
+
+/*----------------------------------------------------------------------------
+ * Search Helpers
+ *----------------------------------------------------------------------------*/
+
+/* Whether a search keeps the highest scores: distances rank the other way */
+static inline bool embedlet_keep_highest(int metric, bool most_similar) {
+  bool distance =
+      metric == EMBEDLET_METRIC_L2 || metric == EMBEDLET_METRIC_HAMMING;
+  return most_similar != distance;
+}
+
+/*
+ * Sign codes of `count` queries for the Hamming metric, carved from
+ * `arena`; *bits_out is NULL under any other metric.
+ */
+static int embedlet_query_codes(const embedlet_store_t *store,
+                                embedlet_arena_t *arena, const float *queries,
+                                size_t count, uint64_t **bits_out) {
+  *bits_out = NULL;
+  if (store->metric != EMBEDLET_METRIC_HAMMING)
+    return EMBEDLET_OK;
+  size_t words = store->bits_words;
+  uint64_t *bits = (uint64_t *)embedlet_arena_alloc(
+      arena, count * words * sizeof(uint64_t));
+  if (!bits)
+    return EMBEDLET_ERR_ALLOC;
+  for (size_t q = 0; q < count; q++)
+    embedlet_sign_bits(queries + q * store->dims, store->dims,
+                       bits + q * words);
+  *bits_out = bits;
+  return EMBEDLET_OK;
+}
+
+static int embedlet_resolve_threads(int num_threads, size_t total) {
+  int threads = num_threads;
+  if (threads == EMBEDLET_AUTO_THREADS)
+    threads = embedlet_get_cpu_count();
+  if (threads < 1)
+    threads = 1;
+  if ((size_t)threads > total)
+    threads = (int)total;
+  return threads;
+}
+
+/*
+ * Lazily create the store's private pool on first parallel search, and grow
+ * it when a later search asks for more threads. *threads is clamped to the
+ * workers the pool has, which for a shared pool is fixed. The pool is held
+ * until embedlet_return_pool(), so embedlet_attach_pool() cannot release it
+ * under the caller.
+ */
+static int embedlet_acquire_pool(embedlet_store_t *store, int *threads,
+                                 embedlet_pool_t **pool_out) {
+  embedlet_mutex_lock(&store->mutex);
+  while (store->pool_swap)
+    embedlet_cond_wait(&store->pool_idle, &store->mutex);
+  if (!store->pool) {
+    store->pool = embedlet_pool_start(*threads, EMBEDLET_MAX_THREADS,
+                                      store->pin_threads);
+    if (!store->pool) {
+      embedlet_mutex_unlock(&store->mutex);
+      return EMBEDLET_ERR_THREAD;
+    }
+  } else if (store->pool->num_threads < *threads) {
+    embedlet_pool_grow(store->pool, *threads);
+  }
+  if (*threads > store->pool->num_threads)
+    *threads = store->pool->num_threads;
+  *pool_out = store->pool;
+  store->pool_users++;
+  embedlet_mutex_unlock(&store->mutex);
+  return EMBEDLET_OK;
+}
+
+/* Drop a hold taken by embedlet_acquire_pool() (none if pool is NULL) */
+static void embedlet_return_pool(embedlet_store_t *store,
+                                 embedlet_pool_t *pool) {
+  if (!pool)
+    return;
+  embedlet_mutex_lock(&store->mutex);
+  if (--store->pool_users == 0)
+    embedlet_cond_broadcast(&store->pool_idle);
+  embedlet_mutex_unlock(&store->mutex);
+}
+
+/* Rows of row_bytes each in one block claimed by a search worker */
+static size_t embedlet_block_rows(size_t row_bytes) {
+  size_t rows = EMBEDLET_STEAL_BLOCK_BYTES / row_bytes;
+  return rows ? rows : 1;
+}
+
+/*
+ * Run a search worker over [0, total) with `threads` participants, each
+ * collecting its own best proto->n, and merge them into `results`
+ * (unsorted). Participants claim `grain` items at a time, starting with
+ * their own slice and then stealing from the others. `proto` supplies the
+ * query fields. Tasks, slices and buffers are carved from `arena`. With
+ * `stats`, the tasks are timed and their counters, plus the merge time, are
+ * added to it; each scored row counts row_bytes.
+ */
+static int embedlet_run_search(embedlet_store_t *store,
+                               const embedlet_search_task_t *proto,
+                               void (*worker)(void *), int threads,
+                               size_t total, size_t grain,
+                               embedlet_arena_t *arena,
+                               embedlet_result_t *results, size_t *count_out,
+                               embedlet_stats_t *stats, size_t row_bytes) {
+  size_t n = proto->n;
+  size_t cap = embedlet_topn_capacity(n);
+
+  /* No more participants than blocks to hand out */
+  size_t blocks = (total + grain - 1) / grain;
+  if ((size_t)threads > blocks)
+    threads = blocks > 0 ? (int)blocks : 1;
+
+  if (threads == 1) {
+    embedlet_slice_t slice;
+    embedlet_steal_t steal;
+    embedlet_steal_init(&steal, &slice, 1, total, total);
+    embedlet_search_task_t task = *proto;
+    task.steal = &steal;
+    task.slot = 0;
+    task.local_results = results;
+    if (cap > n) {
+      task.local_results = (embedlet_result_t *)embedlet_arena_alloc(
+          arena, cap * sizeof(embedlet_result_t));
+      if (!task.local_results)
+        return EMBEDLET_ERR_ALLOC;
+    }
+    task.result_count = 0;
+    task.stats.posted_ns = stats ? embedlet_now_ns() : 0;
+    worker(&task);
+    if (stats)
+      embedlet_scan_collect(stats, &task.stats, row_bytes);
+    if (task.local_results != results)
+      memcpy(results, task.local_results,
+             task.result_count * sizeof(embedlet_result_t));
+    *count_out = task.result_count;
+    return EMBEDLET_OK;
+  }
+
+  embedlet_pool_t *pool;
+  int err = embedlet_acquire_pool(store, &threads, &pool);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  embedlet_search_task_t *tasks =
+      (embedlet_search_task_t *)embedlet_arena_alloc(
+          arena, (size_t)threads * sizeof(embedlet_search_task_t));
+  embedlet_slice_t *slices = (embedlet_slice_t *)embedlet_arena_alloc(
+      arena, (size_t)threads * sizeof(embedlet_slice_t));
+  if (!tasks || !slices) {
+    embedlet_return_pool(store, pool);
+    return EMBEDLET_ERR_ALLOC;
+  }
+
+  embedlet_steal_t steal;
+  embedlet_steal_init(&steal, slices, threads, total, grain);
+  for (int i = 0; i < threads; i++) {
+    tasks[i] = *proto;
+    tasks[i].steal = &steal;
+    tasks[i].slot = i;
+    tasks[i].result_count = 0;
+    tasks[i].local_results = (embedlet_result_t *)embedlet_arena_alloc(
+        arena, cap * sizeof(embedlet_result_t));
+    if (!tasks[i].local_results) {
+      embedlet_return_pool(store, pool);
+      return EMBEDLET_ERR_ALLOC;
+    }
+  }
+  embedlet_result_t *merged = results;
+  if (cap > n) {
+    merged = (embedlet_result_t *)embedlet_arena_alloc(
+        arena, cap * sizeof(embedlet_result_t));
+    if (!merged) {
+      embedlet_return_pool(store, pool);
+      return EMBEDLET_ERR_ALLOC;
+    }
+  }
+
+  uint64_t posted = stats ? embedlet_now_ns() : 0;
+  for (int i = 0; i < threads; i++)
+    tasks[i].stats.posted_ns = posted;
+  embedlet_pool_run(pool, &store->pool_client, worker, tasks,
+                    sizeof(embedlet_search_task_t), threads);
+  embedlet_return_pool(store, pool);
+  uint64_t merge_start = 0;
+  if (stats) {
+    for (int i = 0; i < threads; i++)
+      embedlet_scan_collect(stats, &tasks[i].stats, row_bytes);
+    merge_start = embedlet_now_ns();
+  }
+
+  /* Linear for large n: each cut of the buffer settles n candidates */
+  embedlet_topn_t top;
+  embedlet_topn_init(&top, merged, n, proto->most_similar);
+  for (int i = 0; i < threads; i++) {
+    for (size_t j = 0; j < tasks[i].result_count; j++)
+      embedlet_topn_push(&top, tasks[i].local_results[j].id,
+                         tasks[i].local_results[j].score);
+  }
+  *count_out = embedlet_topn_finish(&top);
+  if (merged != results)
+    memcpy(results, merged, *count_out * sizeof(embedlet_result_t));
+  if (stats)
+    stats->merge_ns += embedlet_now_ns() - merge_start;
+  return EMBEDLET_OK;
+}
+
+/*----------------------------------------------------------------------------
+ * HNSW Index (optional approximate nearest-neighbour graph)
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Score the graph ranks rows by, higher being closer: the store's metric,
+ * with L2 distances negated so that search and link selection need not
+ * know the direction
+ */
+static inline float embedlet_hnsw_score(const embedlet_store_t *store,
+                                        const float *query, float query_norm,
+                                        float query_sum, size_t id) {
+  float score = embedlet_score_exact(store, query, query_norm, query_sum, id);
+  return store->metric == EMBEDLET_METRIC_L2 ? -score : score;
+}
+
+static inline size_t embedlet_hnsw_record_words(uint32_t m) {
+  return 3 + 2 * (size_t)m;
+}
+
+static inline size_t embedlet_hnsw_cap(const embedlet_store_t *store,
+                                       uint32_t level) {
+  return level ? store->hnsw_header->m : 2 * (size_t)store->hnsw_header->m;
+}
+
+static inline uint32_t *embedlet_hnsw_record(const embedlet_store_t *store,
+                                             size_t id) {
+  return store->hnsw_nodes +
+         id * embedlet_hnsw_record_words(store->hnsw_header->m);
+}
+
+/* Link list {count, ids...} of a node at a level, NULL above its level */
+static uint32_t *embedlet_hnsw_list(const embedlet_store_t *store, size_t id,
+                                    uint32_t level) {
+  uint32_t *rec = embedlet_hnsw_record(store, id);
+  if (level == 0)
+    return rec + 2;
+  if (level > rec[0])
+    return NULL;
+  return store->hnsw_upper +
+         ((size_t)rec[1] + level - 1) * (1 + (size_t)store->hnsw_header->m);
+}
+
+/* Stateless 64-bit hash (splitmix64 finalizer) for deterministic sampling */
+static inline uint64_t embedlet_splitmix64(uint64_t x) {
+  uint64_t z = x + 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+/* Deterministic geometric level per row: floor(-ln(u) / ln(M)) */
+static uint32_t embedlet_hnsw_random_level(size_t id, uint32_t m) {
+  uint64_t z = embedlet_splitmix64((uint64_t)id);
+  double u = (double)(z >> 11) * (1.0 / 9007199254740992.0);
+  double level = -log(1.0 - u) / log((double)m);
+  return level >= EMBEDLET_HNSW_MAX_LEVEL ? EMBEDLET_HNSW_MAX_LEVEL
+                                          : (uint32_t)level;
+}
+
+/* Body of embedlet_hnsw_add_records(), under the graph lock */
+static int embedlet_hnsw_grow(embedlet_store_t *store, size_t rows) {
+  uint32_t m = store->hnsw_header->m;
+  size_t block_bytes = (1 + (size_t)m) * sizeof(uint32_t);
+  int err = embedlet_map_reserve(
+      &store->hnsw_file,
+      sizeof(embedlet_hnsw_header_t) +
+          rows * embedlet_hnsw_record_words(m) * sizeof(uint32_t));
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  while (store->hnsw_header->rows < rows) {
+    embedlet_hnsw_header_t *h = store->hnsw_header;
+    size_t id = (size_t)h->rows;
+    uint32_t level = embedlet_hnsw_random_level(id, m);
+
+    err = embedlet_map_reserve(&store->hnsw_upper_file,
+                               sizeof(embedlet_sidecar_header_t) +
+                                   ((size_t)h->upper_blocks + level) *
+                                       block_bytes);
+    embedlet_refresh_pointers(store);
+    if (err != EMBEDLET_OK)
+      return err;
+    h = store->hnsw_header;
+
+    uint32_t *rec = embedlet_hnsw_record(store, id);
+    rec[0] = level;
+    rec[1] = (uint32_t)h->upper_blocks;
+    rec[2] = 0;
+    for (uint32_t l = 1; l <= level; l++)
+      embedlet_hnsw_list(store, id, l)[0] = 0;
+    h->upper_blocks += level;
+    h->rows = id + 1;
+  }
+  return EMBEDLET_OK;
+}
+
+/*
+ * Give rows [hnsw rows, rows) a node record with no links. Growing may move
+ * the mappings searches walk, so it holds the graph lock exclusively.
+ */
+static int embedlet_hnsw_add_records(embedlet_store_t *store, size_t rows) {
+  if (rows <= store->hnsw_header->rows)
+    return EMBEDLET_OK;
+  if (rows > UINT32_MAX)
+    return EMBEDLET_ERR_INVALID_ID;
+  embedlet_rwlock_write(&store->hnsw_lock);
+  int err = embedlet_hnsw_grow(store, rows);
+  embedlet_rwlock_write_unlock(&store->hnsw_lock);
+  return err;
+}
+
+static void embedlet_hnsw_ctx_destroy(embedlet_hnsw_ctx_t *ctx) {
+  if (!ctx)
+    return;
+  free(ctx->visited);
+  free(ctx->cand);
+  free(ctx->top);
+  free(ctx->eps);
+  free(ctx->sel);
+  free(ctx->ids);
+  free(ctx->picked);
+  free(ctx->query);
+  free(ctx);
+}
+
+static embedlet_hnsw_ctx_t *
+embedlet_hnsw_ctx_create(const embedlet_store_t *store, size_t ef) {
+  size_t m = store->hnsw_header->m;
+  embedlet_hnsw_ctx_t *ctx =
+      (embedlet_hnsw_ctx_t *)calloc(1, sizeof(embedlet_hnsw_ctx_t));
+  if (!ctx)
+    return NULL;
+
+  ctx->ef = ef;
+  ctx->ef_cap = ef;
+  ctx->top = (embedlet_result_t *)malloc(ef * sizeof(embedlet_result_t));
+  ctx->eps = (uint32_t *)malloc(ef * sizeof(uint32_t));
+  ctx->sel = (embedlet_result_t *)malloc((4 * m + 2) *
+                                         sizeof(embedlet_result_t));
+  ctx->ids = (uint32_t *)malloc((4 * m + 2) * sizeof(uint32_t));
+  ctx->picked = (uint32_t *)malloc(2 * m * sizeof(uint32_t));
+  ctx->query = (float *)malloc(3 * store->dims * sizeof(float));
+  if (!ctx->top || !ctx->eps || !ctx->sel || !ctx->ids || !ctx->picked ||
+      !ctx->query) {
+    embedlet_hnsw_ctx_destroy(ctx);
+    return NULL;
+  }
+  ctx->base = ctx->query + store->dims;
+  ctx->scratch = ctx->base + store->dims;
+  return ctx;
+}
+
+/* Take an idle search context from the store, or a new one */
+static embedlet_hnsw_ctx_t *embedlet_hnsw_acquire(embedlet_store_t *store) {
+  embedlet_mutex_lock(&store->arena_mutex);
+  embedlet_hnsw_ctx_t *ctx = store->hnsw_idle;
+  if (ctx)
+    store->hnsw_idle = ctx->next;
+  embedlet_mutex_unlock(&store->arena_mutex);
+  if (!ctx)
+    ctx = embedlet_hnsw_ctx_create(store, store->hnsw_ctx->ef);
+  return ctx;
+}
+
+/* Return a search context, visited set and all, for the next search */
+static void embedlet_hnsw_release(embedlet_store_t *store,
+                                  embedlet_hnsw_ctx_t *ctx) {
+  embedlet_mutex_lock(&store->arena_mutex);
+  ctx->next = store->hnsw_idle;
+  store->hnsw_idle = ctx;
+  embedlet_mutex_unlock(&store->arena_mutex);
+}
+
+static void embedlet_hnsw_idle_free(embedlet_store_t *store) {
+  while (store->hnsw_idle) {
+    embedlet_hnsw_ctx_t *next = store->hnsw_idle->next;
+    embedlet_hnsw_ctx_destroy(store->hnsw_idle);
+    store->hnsw_idle = next;
+  }
+}
+
+/* Grow a context's top and eps arrays to hold `ef` nodes */
+static int embedlet_hnsw_ctx_reserve(embedlet_hnsw_ctx_t *ctx, size_t ef) {
+  if (ef <= ctx->ef_cap)
+    return EMBEDLET_OK;
+  embedlet_result_t *top =
+      (embedlet_result_t *)realloc(ctx->top, ef * sizeof(embedlet_result_t));
+  if (!top)
+    return EMBEDLET_ERR_ALLOC;
+  ctx->top = top;
+  uint32_t *eps = (uint32_t *)realloc(ctx->eps, ef * sizeof(uint32_t));
+  if (!eps)
+    return EMBEDLET_ERR_ALLOC;
+  ctx->eps = eps;
+  ctx->ef_cap = ef;
+  return EMBEDLET_OK;
+}
+
+/* Start a new visited set covering `rows` rows */
+static int embedlet_hnsw_visit_begin(embedlet_hnsw_ctx_t *ctx, size_t rows) {
+  if (rows > ctx->visited_cap) {
+    size_t cap = ctx->visited_cap * 2 > rows ? ctx->visited_cap * 2 : rows;
+    uint8_t *v = (uint8_t *)realloc(ctx->visited, cap);
+    if (!v)
+      return EMBEDLET_ERR_ALLOC;
+    memset(v + ctx->visited_cap, 0, cap - ctx->visited_cap);
+    ctx->visited = v;
+    ctx->visited_cap = cap;
+  }
+  if (++ctx->epoch == 0) {
+    memset(ctx->visited, 0, ctx->visited_cap);
+    ctx->epoch = 1;
+  }
+  return EMBEDLET_OK;
+}
+
+static inline bool embedlet_hnsw_visit(embedlet_hnsw_ctx_t *ctx, size_t id) {
+  if (ctx->visited[id] == ctx->epoch)
+    return false;
+  ctx->visited[id] = ctx->epoch;
+  return true;
+}
+
+static int embedlet_hnsw_cand_push(embedlet_hnsw_ctx_t *ctx, size_t id,
+                                   float score) {
+  if (ctx->cand_size == ctx->cand_cap) {
+    size_t cap = ctx->cand_cap ? ctx->cand_cap * 2 : 256;
+    embedlet_result_t *c = (embedlet_result_t *)realloc(
+        ctx->cand, cap * sizeof(embedlet_result_t));
+    if (!c)
+      return EMBEDLET_ERR_ALLOC;
+    ctx->cand = c;
+    ctx->cand_cap = cap;
+  }
+  embedlet_result_t *heap = ctx->cand;
+  size_t i = ctx->cand_size++;
+  heap[i].id = id;
+  heap[i].score = score;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (heap[parent].score >= heap[i].score)
+      break;
+    embedlet_result_t tmp = heap[parent];
+    heap[parent] = heap[i];
+    heap[i] = tmp;
+    i = parent;
+  }
+  return EMBEDLET_OK;
+}
+
+static embedlet_result_t embedlet_hnsw_cand_pop(embedlet_hnsw_ctx_t *ctx) {
+  embedlet_result_t *heap = ctx->cand;
+  embedlet_result_t top = heap[0];
+  size_t size = --ctx->cand_size;
+  heap[0] = heap[size];
+  size_t i = 0;
+  for (;;) {
+    size_t left = 2 * i + 1;
+    size_t right = 2 * i + 2;
+    size_t largest = i;
+    if (left < size && heap[left].score > heap[largest].score)
+      largest = left;
+    if (right < size && heap[right].score > heap[largest].score)
+      largest = right;
+    if (largest == i)
+      break;
+    embedlet_result_t tmp = heap[i];
+    heap[i] = heap[largest];
+    heap[largest] = tmp;
+    i = largest;
+  }
+  return top;
+}
+
+/* A row as float32: the mapped row itself, or decoded into `buf` */
+static const float *embedlet_hnsw_vector(const embedlet_store_t *store,
+                                         size_t id, float *buf) {
+  if (store->dtype == EMBEDLET_DTYPE_F32)
+    return (const float *)embedlet_row_ptr(store, id);
+  embedlet_row_decode(store, id, buf);
+  return buf;
+}
+
+static inline float embedlet_hnsw_sum(const embedlet_store_t *store,
+                                      const float *v) {
+  return store->dtype == EMBEDLET_DTYPE_I8 ? embedlet_query_sum(v, store->dims)
+                                           : 0.0f;
+}
+
+/*
+ * Beam search of one layer from `eps`, leaving the best `ef` live nodes in
+ * ctx->top (a min-heap). Row `skip` is never visited.
+ */
+static int embedlet_hnsw_search_layer(const embedlet_store_t *store,
+                                      embedlet_hnsw_ctx_t *ctx,
+                                      const float *q, float q_norm,
+                                      float q_sum, const uint32_t *eps,
+                                      size_t neps, size_t ef, uint32_t level,
+                                      size_t skip) {
+  size_t rows = (size_t)store->hnsw_header->rows;
+  const uint64_t *live = store->live;
+  int err = embedlet_hnsw_visit_begin(ctx, rows);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  ctx->cand_size = 0;
+  ctx->top_size = 0;
+  if (skip < rows)
+    embedlet_hnsw_visit(ctx, skip);
+
+  for (size_t i = 0; i < neps; i++) {
+    if (eps[i] >= rows || !embedlet_hnsw_visit(ctx, eps[i]))
+      continue;
+    float s = embedlet_hnsw_score(store, q, q_norm, q_sum, eps[i]);
+    err = embedlet_hnsw_cand_push(ctx, eps[i], s);
+    if (err != EMBEDLET_OK)
+      return err;
+    embedlet_heap_push_min(ctx->top, &ctx->top_size, ef, eps[i], s);
+  }
+
+  size_t cap = embedlet_hnsw_cap(store, level);
+  while (ctx->cand_size > 0) {
+    embedlet_result_t c = embedlet_hnsw_cand_pop(ctx);
+    if (ctx->top_size == ef && c.score < ctx->top[0].score)
+      break;
+
+    const uint32_t *list = embedlet_hnsw_list(store, c.id, level);
+    if (!list)
+      continue;
+    size_t count = list[0] < cap ? list[0] : cap;
+    for (size_t j = 0; j < count; j++) {
+      size_t e = list[1 + j];
+      if (e >= rows || !embedlet_hnsw_visit(ctx, e) ||
+          !embedlet_live_test(live, e))
+        continue;
+      float s = embedlet_hnsw_score(store, q, q_norm, q_sum, e);
+      if (ctx->top_size < ef || s > ctx->top[0].score) {
+        err = embedlet_hnsw_cand_push(ctx, e, s);
+        if (err != EMBEDLET_OK)
+          return err;
+        embedlet_heap_push_min(ctx->top, &ctx->top_size, ef, e, s);
+      }
+    }
+  }
+  return EMBEDLET_OK;
+}
+
+/*
+ * Neighbour selection heuristic: take candidates best-first (cands sorted by
+ * descending score to the base), skipping any that is closer to an already
+ * selected neighbour than to the base. Keeps links spread across directions.
+ */
+static size_t embedlet_hnsw_select(const embedlet_store_t *store,
+                                   embedlet_hnsw_ctx_t *ctx,
+                                   const embedlet_result_t *cands,
+                                   size_t ncands, size_t m, uint32_t *out) {
+  size_t k = 0;
+  for (size_t i = 0; i < ncands && k < m; i++) {
+    size_t id = cands[i].id;
+    bool keep = true;
+    if (k > 0) {
+      const float *v = embedlet_hnsw_vector(store, id, ctx->scratch);
+      float v_sum = embedlet_hnsw_sum(store, v);
+      for (size_t j = 0; j < k && keep; j++) {
+        keep = embedlet_hnsw_score(store, v, store->norms[id], v_sum,
+                                   out[j]) <= cands[i].score;
+      }
+    }
+    if (keep)
+      out[k++] = (uint32_t)id;
+  }
+  return k;
+}
+
+/* Replace node's links at `level` with the best of `ids` (not aliasing) */
+static void embedlet_hnsw_relink(const embedlet_store_t *store,
+                                 embedlet_hnsw_ctx_t *ctx, size_t node,
+                                 uint32_t level, const uint32_t *ids,
+                                 size_t count) {
+  uint32_t *list = embedlet_hnsw_list(store, node, level);
+  size_t cap = embedlet_hnsw_cap(store, level);
+  if (!list)
+    return;
+  if (count <= cap) {
+    memcpy(list + 1, ids, count * sizeof(uint32_t));
+    list[0] = (uint32_t)count;
+    return;
+  }
+
+  const float *base = embedlet_hnsw_vector(store, node, ctx->base);
+  float base_sum = embedlet_hnsw_sum(store, base);
+  for (size_t i = 0; i < count; i++) {
+    ctx->sel[i].id = ids[i];
+    ctx->sel[i].score =
+        embedlet_hnsw_score(store, base, store->norms[node], base_sum, ids[i]);
+  }
+  embedlet_sort_results(ctx->sel, count, true);
+  size_t k = embedlet_hnsw_select(store, ctx, ctx->sel, count, cap,
+                                  ctx->picked);
+  memcpy(list + 1, ctx->picked, k * sizeof(uint32_t));
+  list[0] = (uint32_t)k;
+}
+
+/* Add a back-link node -> add, pruning node's list if it is full */
+static void embedlet_hnsw_connect(const embedlet_store_t *store,
+                                  embedlet_hnsw_ctx_t *ctx, size_t node,
+                                  uint32_t add, uint32_t level) {
+  uint32_t *list = embedlet_hnsw_list(store, node, level);
+  size_t cap = embedlet_hnsw_cap(store, level);
+  if (!list)
+    return;
+  size_t count = list[0] < cap ? list[0] : cap;
+  for (size_t j = 0; j < count; j++) {
+    if (list[1 + j] == add)
+      return;
+  }
+  if (count < cap) {
+    list[1 + count] = add;
+    list[0] = (uint32_t)(count + 1);
+    return;
+  }
+  /* Links to deleted rows may point past rows a vacuum has trimmed */
+  size_t rows = (size_t)store->hnsw_header->rows;
+  size_t n = 0;
+  for (size_t j = 0; j < count; j++) {
+    uint32_t b = list[1 + j];
+    if (b < rows && embedlet_live_test(store->live, b))
+      ctx->ids[n++] = b;
+  }
+  ctx->ids[n++] = add;
+  embedlet_hnsw_relink(store, ctx, node, level, ctx->ids, n);
+}
+
+/* Choose the live, linkable node with the highest level as entry point */
+static void embedlet_hnsw_pick_entry(embedlet_store_t *store, size_t exclude) {
+  embedlet_hnsw_header_t *h = store->hnsw_header;
+  uint64_t best = EMBEDLET_HNSW_NO_ENTRY;
+  uint32_t best_level = 0;
+  for (size_t i = 0; i < h->rows; i++) {
+    if (i == exclude || !embedlet_live_test(store->live, i) ||
+        store->norms[i] <= FLT_EPSILON)
+      continue;
+    uint32_t level = embedlet_hnsw_record(store, i)[0];
+    if (best == EMBEDLET_HNSW_NO_ENTRY || level > best_level) {
+      best = i;
+      best_level = level;
+    }
+  }
+  h->entry = best;
+  h->max_level = best_level;
+}
+
+/* Link row id into the graph; its vector, norm and live bit are written */
+static int embedlet_hnsw_insert(embedlet_store_t *store, size_t id) {
+  embedlet_hnsw_ctx_t *ctx = store->hnsw_ctx;
+  int err = embedlet_hnsw_add_records(store, id + 1);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  float q_norm = store->norms[id];
+  if (q_norm <= FLT_EPSILON)
+    return EMBEDLET_OK; /* a zero vector has no direction to link by */
+
+  embedlet_hnsw_header_t *h = store->hnsw_header;
+  uint32_t level = embedlet_hnsw_record(store, id)[0];
+  if (h->entry == EMBEDLET_HNSW_NO_ENTRY) {
+    embedlet_rwlock_write(&store->hnsw_lock);
+    h->entry = id;
+    h->max_level = level;
+    embedlet_rwlock_write_unlock(&store->hnsw_lock);
+    return EMBEDLET_OK;
+  }
+
+  /*
+   * Only writers change links, and they hold the store mutex, so the walk
+   * needs no lock; searches are shut out while a layer is relinked.
+   */
+  const float *q = embedlet_hnsw_vector(store, id, ctx->query);
+  float q_sum = embedlet_hnsw_sum(store, q);
+  uint32_t m = h->m;
+  size_t neps = 1;
+  ctx->eps[0] = (uint32_t)h->entry;
+
+  /* Greedy descent through the layers above the new node's level */
+  for (uint32_t l = h->max_level; l > level; l--) {
+    err = embedlet_hnsw_search_layer(store, ctx, q, q_norm, q_sum, ctx->eps,
+                                     neps, 1, l, id);
+    if (err != EMBEDLET_OK)
+      return err;
+    if (ctx->top_size > 0)
+      ctx->eps[0] = (uint32_t)ctx->top[0].id;
+  }
+
+  uint32_t top_level = level < h->max_level ? level : h->max_level;
+  for (uint32_t l = top_level + 1; l-- > 0;) {
+    err = embedlet_hnsw_search_layer(store, ctx, q, q_norm, q_sum, ctx->eps,
+                                     neps, ctx->ef, l, id);
+    if (err != EMBEDLET_OK)
+      return err;
+    embedlet_sort_results(ctx->top, ctx->top_size, true);
+
+    size_t k = embedlet_hnsw_select(store, ctx, ctx->top, ctx->top_size, m,
+                                    ctx->picked);
+    embedlet_rwlock_write(&store->hnsw_lock);
+    uint32_t *list = embedlet_hnsw_list(store, id, l);
+    memcpy(list + 1, ctx->picked, k * sizeof(uint32_t));
+    list[0] = (uint32_t)k;
+    for (uint32_t j = 0; j < list[0]; j++)
+      embedlet_hnsw_connect(store, ctx, list[1 + j], (uint32_t)id, l);
+    embedlet_rwlock_write_unlock(&store->hnsw_lock);
+
+    for (size_t j = 0; j < ctx->top_size; j++)
+      ctx->eps[j] = (uint32_t)ctx->top[j].id;
+    if (ctx->top_size > 0)
+      neps = ctx->top_size;
+  }
+
+  if (level > h->max_level) {
+    embedlet_rwlock_write(&store->hnsw_lock);
+    h->entry = id;
+    h->max_level = level;
+    embedlet_rwlock_write_unlock(&store->hnsw_lock);
+  }
+  return EMBEDLET_OK;
+}
+
+/*
+ * Link a stored row into the graph. The row stays stored whatever happens
+ * here, so a failure marks the graph stale for a rebuild on the next open
+ * instead of failing the write that stored it.
+ */
+static void embedlet_hnsw_link(embedlet_store_t *store, size_t id) {
+  if (store->hnsw_ctx && embedlet_hnsw_insert(store, id) != EMBEDLET_OK)
+    store->hnsw_header->stale = 1;
+}
+
+/*
+ * Take row id out of the graph before it is deleted or overwritten. Each of
+ * its neighbours is relinked over the union of its own links and the removed
+ * node's, so paths through the node survive.
+ */
+static void embedlet_hnsw_unlink(embedlet_store_t *store, size_t id) {
+  embedlet_hnsw_ctx_t *ctx = store->hnsw_ctx;
+  embedlet_hnsw_header_t *h = store->hnsw_header;
+  if (id >= h->rows)
+    return;
+
+  embedlet_rwlock_write(&store->hnsw_lock);
+  uint32_t level = embedlet_hnsw_record(store, id)[0];
+  for (uint32_t l = 0; l <= level; l++) {
+    uint32_t *dl = embedlet_hnsw_list(store, id, l);
+    size_t cap = embedlet_hnsw_cap(store, l);
+    size_t dcount = dl[0] < cap ? dl[0] : cap;
+
+    for (size_t j = 0; j < dcount; j++) {
+      size_t a = dl[1 + j];
+      if (a == id || a >= h->rows || !embedlet_live_test(store->live, a))
+        continue;
+      uint32_t *al = embedlet_hnsw_list(store, a, l);
+      if (!al)
+        continue;
+
+      size_t n = 0;
+      size_t acount = al[0] < cap ? al[0] : cap;
+      for (size_t k = 0; k < acount; k++) {
+        if (al[1 + k] != id)
+          ctx->ids[n++] = al[1 + k];
+      }
+      for (size_t k = 0; k < dcount; k++) {
+        uint32_t b = dl[1 + k];
+        if (b == a || b == id || b >= h->rows ||
+            !embedlet_live_test(store->live, b))
+          continue;
+        bool dup = false;
+        for (size_t t = 0; t < n && !dup; t++)
+          dup = ctx->ids[t] == b;
+        if (!dup)
+          ctx->ids[n++] = b;
+      }
+      embedlet_hnsw_relink(store, ctx, a, l, ctx->ids, n);
+    }
+    dl[0] = 0;
+  }
+
+  if (h->entry == id)
+    embedlet_hnsw_pick_entry(store, id);
+  embedlet_rwlock_write_unlock(&store->hnsw_lock);
+}
+
+static bool embedlet_file_exists(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  fclose(f);
+  return true;
+}
+
+/*
+ * Open the HNSW sidecars if they exist or options ask for an index, then
+ * link in any rows the index does not cover yet (building it from scratch
+ * for an existing store).
+ */
+static int embedlet_hnsw_open(embedlet_store_t *store,
+                              const embedlet_options_t *options) {
+  int m = options ? options->hnsw_m : 0;
+  int ef_construction = options ? options->hnsw_ef_construction : 0;
+  /* Sign bits are already the cheap scan; the metric may be the recorded
+   * one rather than the options' */
+  if (store->metric == EMBEDLET_METRIC_HAMMING)
+    return m ? EMBEDLET_ERR_INVALID_ARG : EMBEDLET_OK;
+
+  char *path = embedlet_sidecar_path(store->path, EMBEDLET_HNSW_SUFFIX);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  bool exists = embedlet_file_exists(path);
+  free(path);
+  if (!exists && m == 0)
+    return EMBEDLET_OK;
+
+  bool valid, upper_valid;
+  int err = embedlet_sidecar_open(store, &store->hnsw_file,
+                                  EMBEDLET_HNSW_SUFFIX, EMBEDLET_HNSW_MAGIC,
+                                  sizeof(embedlet_hnsw_header_t), &valid);
+  if (err == EMBEDLET_OK)
+    err = embedlet_sidecar_open(
+        store, &store->hnsw_upper_file, EMBEDLET_HNSW_UPPER_SUFFIX,
+        EMBEDLET_HNSW_UPPER_MAGIC, sizeof(embedlet_sidecar_header_t),
+        &upper_valid);
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  embedlet_hnsw_header_t *h = store->hnsw_header;
+  if (!valid || !upper_valid || h->m < 2 || h->ef_construction == 0 ||
+      h->rows > embedlet_count(store) ||
+      h->metric != (uint32_t)store->metric || h->stale) {
+    /* Missing, partial, foreign or stale index: start over */
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, EMBEDLET_HNSW_MAGIC, sizeof(h->magic));
+    h->m = (uint32_t)(m ? m : EMBEDLET_DEFAULT_HNSW_M);
+    h->ef_construction = (uint32_t)(ef_construction
+                                        ? ef_construction
+                                        : EMBEDLET_DEFAULT_EF_CONSTRUCTION);
+    h->entry = EMBEDLET_HNSW_NO_ENTRY;
+    h->metric = (uint32_t)store->metric;
+  }
+
+  store->hnsw_ctx = embedlet_hnsw_ctx_create(store, h->ef_construction);
+  if (!store->hnsw_ctx)
+    return EMBEDLET_ERR_ALLOC;
+
+  size_t count = embedlet_count(store);
+  for (size_t id = (size_t)store->hnsw_header->rows; id < count; id++) {
+    err = embedlet_live_test(store->live, id)
+              ? embedlet_hnsw_insert(store, id)
+              : embedlet_hnsw_add_records(store, id + 1);
+    if (err != EMBEDLET_OK)
+      return err;
+  }
+  return EMBEDLET_OK;
+}
+
+/*----------------------------------------------------------------------------
+ * IVF-PQ Index (optional coarse partitions with product-quantized rows)
+ *----------------------------------------------------------------------------*/
+
+static void embedlet_range_worker(void *arg) {
+  embedlet_range_task_t *task = (embedlet_range_task_t *)arg;
+  size_t start, end;
+  task->err = EMBEDLET_OK;
+  while (task->err == EMBEDLET_OK &&
+         embedlet_steal_next(task->steal, task->slot, &start, &end))
+    task->err = task->fn(task->ctx, start, end);
+}
+
+/* Run fn over [0, total) split across the pool (inline without one) */
+static int embedlet_run_ranges(embedlet_pool_t *pool, int threads,
+                               size_t total,
+                               int (*fn)(void *ctx, size_t start, size_t end),
+                               void *ctx) {
+  if (!pool || threads <= 1 || total <= 1)
+    return fn(ctx, 0, total);
+
+  if ((size_t)threads > total)
+    threads = (int)total;
+  embedlet_range_task_t *tasks = (embedlet_range_task_t *)calloc(
+      (size_t)threads, sizeof(embedlet_range_task_t));
+  embedlet_slice_t *slices =
+      (embedlet_slice_t *)calloc((size_t)threads, sizeof(embedlet_slice_t));
+  if (!tasks || !slices) {
+    free(tasks);
+    free(slices);
+    return EMBEDLET_ERR_ALLOC;
+  }
+
+  /* About eight blocks per thread, so uneven ranges even out */
+  embedlet_steal_t steal;
+  embedlet_steal_init(&steal, slices, threads, total,
+                      total / ((size_t)threads * 8));
+  for (int i = 0; i < threads; i++) {
+    tasks[i].fn = fn;
+    tasks[i].ctx = ctx;
+    tasks[i].steal = &steal;
+    tasks[i].slot = i;
+  }
+  embedlet_pool_run(pool, NULL, embedlet_range_worker, tasks,
+                    sizeof(embedlet_range_task_t), threads);
+
+  int err = EMBEDLET_OK;
+  for (int i = 0; i < threads && err == EMBEDLET_OK; i++)
+    err = tasks[i].err;
+  free(tasks);
+  free(slices);
+  return err;
+}
+
+/* Index of the centroid with the largest dot product with x */
+static uint32_t embedlet_ivf_nearest_ip(const float *x, const float *cents,
+                                        size_t k, size_t d) {
+  uint32_t best = 0;
+  float best_score = -FLT_MAX;
+  for (size_t c = 0; c < k; c++) {
+    float s = embedlet_dot(x, cents + c * d, d);
+    if (s > best_score) {
+      best_score = s;
+      best = (uint32_t)c;
+    }
+  }
+  return best;
+}
+
+/*
+ * Index of the codeword nearest to x in squared L2. The codebook is
+ * transposed ([d][256]), so the inner loop runs over all 256 codewords at
+ * once and vectorizes.
+ */
+static uint32_t embedlet_pq_nearest_l2(const float *x, const float *cbt,
+                                       size_t d) {
+  float dist[EMBEDLET_PQ_KSUB];
+  memset(dist, 0, sizeof(dist));
+  for (size_t i = 0; i < d; i++) {
+    const float *w = cbt + i * EMBEDLET_PQ_KSUB;
+    float xi = x[i];
+    for (size_t c = 0; c < EMBEDLET_PQ_KSUB; c++) {
+      float t = xi - w[c];
+      dist[c] += t * t;
+    }
+  }
+
+  /* Eight-lane minimum first (vectorizes), then the first index holding it */
+  float lanes[8];
+  memcpy(lanes, dist, sizeof(lanes));
+  for (size_t c = 8; c < EMBEDLET_PQ_KSUB; c += 8) {
+    for (size_t l = 0; l < 8; l++)
+      lanes[l] = dist[c + l] < lanes[l] ? dist[c + l] : lanes[l];
+  }
+  float min = lanes[0];
+  for (size_t l = 1; l < 8; l++)
+    min = lanes[l] < min ? lanes[l] : min;
+  uint32_t best = 0;
+  while (best < EMBEDLET_PQ_KSUB - 1 && dist[best] != min)
+    best++;
+  return best;
+}
+
+/* [k][d] centroids to the [d][k] layout embedlet_pq_nearest_l2 reads */
+static void embedlet_transpose(const float *src, size_t k, size_t d,
+                               float *dst) {
+  for (size_t c = 0; c < k; c++) {
+    for (size_t i = 0; i < d; i++)
+      dst[i * k + c] = src[c * d + i];
+  }
+}
+
+typedef struct {
+  const float *data;
+  size_t n;
+  size_t d;
+  size_t k;
+  bool spherical; /* assign by dot product to unit centroids, else L2 */
+  const float *cents;
+  const float *cents_t; /* L2 only: transposed centroids, k == 256 */
+  uint32_t *assign;
+} embedlet_kmeans_ctx_t;
+
+static int embedlet_kmeans_assign(void *arg, size_t start, size_t end) {
+  embedlet_kmeans_ctx_t *km = (embedlet_kmeans_ctx_t *)arg;
+  for (size_t i = start; i < end; i++) {
+    const float *x = km->data + i * km->d;
+    km->assign[i] = km->spherical
+                        ? embedlet_ivf_nearest_ip(x, km->cents, km->k, km->d)
+                        : embedlet_pq_nearest_l2(x, km->cents_t, km->d);
+  }
+  return EMBEDLET_OK;
+}
+
+/*
+ * Lloyd's k-means of n points into k centroids, seeded from hashed sample
+ * points; empty clusters are reseeded the same way. Leaves the final
+ * assignment of every point in `assign`. L2 clustering is only used for PQ
+ * codebooks and requires k == EMBEDLET_PQ_KSUB.
+ */
+static int embedlet_kmeans(embedlet_pool_t *pool, int threads,
+                           const float *data, size_t n, size_t d, size_t k,
+                           int iterations, bool spherical, uint64_t seed,
+                           float *cents, uint32_t *assign) {
+  size_t *counts = (size_t *)malloc(k * sizeof(size_t));
+  float *cents_t =
+      spherical ? NULL : (float *)malloc(k * d * sizeof(float));
+  if (!counts || (!spherical && !cents_t)) {
+    free(counts);
+    free(cents_t);
+    return EMBEDLET_ERR_ALLOC;
+  }
+
+  for (size_t c = 0; c < k; c++) {
+    size_t pick = (size_t)(embedlet_splitmix64(seed + c) % n);
+    memcpy(cents + c * d, data + pick * d, d * sizeof(float));
+  }
+
+  embedlet_kmeans_ctx_t km;
+  km.data = data;
+  km.n = n;
+  km.d = d;
+  km.k = k;
+  km.spherical = spherical;
+  km.cents = cents;
+  km.cents_t = cents_t;
+  km.assign = assign;
+  int err = EMBEDLET_OK;
+  for (int it = 0; it <= iterations && err == EMBEDLET_OK; it++) {
+    if (cents_t)
+      embedlet_transpose(cents, k, d, cents_t);
+    err = embedlet_run_ranges(pool, threads, n, embedlet_kmeans_assign, &km);
+    if (err != EMBEDLET_OK || it == iterations)
+      break;
+
+    memset(cents, 0, k * d * sizeof(float));
+    memset(counts, 0, k * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+      float *c = cents + (size_t)assign[i] * d;
+      const float *x = data + i * d;
+      for (size_t j = 0; j < d; j++)
+        c[j] += x[j];
+      counts[assign[i]]++;
+    }
+
+    for (size_t c = 0; c < k; c++) {
+      float *cent = cents + c * d;
+      if (counts[c] == 0) {
+        size_t pick =
+            (size_t)(embedlet_splitmix64(seed ^ ((uint64_t)it << 32) ^ c) % n);
+        memcpy(cent, data + pick * d, d * sizeof(float));
+        continue;
+      }
+      float scale = spherical ? embedlet_norm(cent, d) : (float)counts[c];
+      if (scale > FLT_EPSILON) {
+        for (size_t j = 0; j < d; j++)
+          cent[j] /= scale;
+      }
+    }
+  }
+
+  free(counts);
+  free(cents_t);
+  return err;
+}
+
+/* Unit-length copy of row id (zeros for an empty row) */
+static void embedlet_ivf_unit_row(const embedlet_store_t *store, size_t id,
+                                  float *out) {
+  embedlet_row_decode(store, id, out);
+  float norm = store->norms[id];
+  float inv = norm > FLT_EPSILON ? 1.0f / norm : 0.0f;
+  for (size_t i = 0; i < store->dims; i++)
+    out[i] *= inv;
+}
+
+/*
+ * PQ-encode the residual of unit vector x against centroid `cent` into
+ * pq_m one-byte codes, using `resid` (dims floats) as scratch. Codebooks
+ * are in the sidecar's transposed [pq_m][dsub][256] layout.
+ */
+static void embedlet_pq_encode(const float *x, const float *cent,
+                               const float *codebooks, size_t dims,
+                               size_t pq_m, float *resid, uint8_t *code) {
+  size_t dsub = dims / pq_m;
+  for (size_t i = 0; i < dims; i++)
+    resid[i] = x[i] - cent[i];
+  for (size_t j = 0; j < pq_m; j++) {
+    code[j] = (uint8_t)embedlet_pq_nearest_l2(
+        resid + j * dsub, codebooks + j * EMBEDLET_PQ_KSUB * dsub, dsub);
+  }
+}
+
+typedef struct {
+  const embedlet_store_t *store;
+  const float *residuals; /* training sample residuals, n x dims */
+  size_t n;
+  size_t pq_m;
+  int iterations;
+  const float *cents;
+  size_t nlist;
+  float *codebooks;
+  uint32_t *lists; /* encode: list of every row */
+  uint8_t *codes;  /* encode: PQ code of every row */
+} embedlet_ivf_train_ctx_t;
+
+/* Train sub-quantizers [start, end) on their slices of the residuals */
+static int embedlet_ivf_train_pq(void *arg, size_t start, size_t end) {
+  embedlet_ivf_train_ctx_t *t = (embedlet_ivf_train_ctx_t *)arg;
+  size_t dims = t->store->dims;
+  size_t dsub = dims / t->pq_m;
+  float *sub = (float *)malloc(t->n * dsub * sizeof(float));
+  float *cb = (float *)malloc(EMBEDLET_PQ_KSUB * dsub * sizeof(float));
+  uint32_t *assign = (uint32_t *)malloc(t->n * sizeof(uint32_t));
+  int err = sub && cb && assign ? EMBEDLET_OK : EMBEDLET_ERR_ALLOC;
+
+  for (size_t j = start; j < end && err == EMBEDLET_OK; j++) {
+    for (size_t i = 0; i < t->n; i++)
+      memcpy(sub + i * dsub, t->residuals + i * dims + j * dsub,
+             dsub * sizeof(float));
+    err = embedlet_kmeans(NULL, 1, sub, t->n, dsub, EMBEDLET_PQ_KSUB,
+                          t->iterations, false, 0x5eed0000ull + j, cb,
+                          assign);
+    embedlet_transpose(cb, EMBEDLET_PQ_KSUB, dsub,
+                       t->codebooks + j * EMBEDLET_PQ_KSUB * dsub);
+  }
+
+  free(sub);
+  free(cb);
+  free(assign);
+  return err;
+}
+
+/* Assign and encode rows [start, end) */
+static int embedlet_ivf_train_encode(void *arg, size_t start, size_t end) {
+  embedlet_ivf_train_ctx_t *t = (embedlet_ivf_train_ctx_t *)arg;
+  size_t dims = t->store->dims;
+  float *unit = (float *)malloc(2 * dims * sizeof(float));
+  if (!unit)
+    return EMBEDLET_ERR_ALLOC;
+
+  for (size_t id = start; id < end; id++) {
+    embedlet_ivf_unit_row(t->store, id, unit);
+    uint32_t list = embedlet_ivf_nearest_ip(unit, t->cents, t->nlist, dims);
+    t->lists[id] = list;
+    embedlet_pq_encode(unit, t->cents + (size_t)list * dims, t->codebooks,
+                       dims, t->pq_m, unit + dims, t->codes + id * t->pq_m);
+  }
+
+  free(unit);
+  return EMBEDLET_OK;
+}
+
+/*
+ * Scratch for embedlet_ivf_update(), taken once the sidecar is mapped so
+ * that updating a stored row's code cannot fail
+ */
+static int embedlet_ivf_scratch(embedlet_store_t *store) {
+  if (!store->ivf_unit)
+    store->ivf_unit = (float *)malloc(2 * store->dims * sizeof(float));
+  return store->ivf_unit ? EMBEDLET_OK : EMBEDLET_ERR_ALLOC;
+}
+
+/* Lay the encoded rows out list by list in the .ivf sidecar */
+static int embedlet_ivf_write(embedlet_store_t *store, size_t rows,
+                              size_t nlist, size_t pq_m, const float *cents,
+                              const float *codebooks, const uint32_t *lists,
+                              const uint8_t *codes) {
+  size_t dims = store->dims;
+  size_t off[7];
+  embedlet_ivf_layout(dims, nlist, pq_m, rows, off);
+
+  int err;
+  if (store->ivf_file.data) {
+    err = embedlet_map_reserve(&store->ivf_file, off[6]);
+  } else {
+    bool valid;
+    err = embedlet_sidecar_open(store, &store->ivf_file, EMBEDLET_IVF_SUFFIX,
+                                EMBEDLET_IVF_MAGIC, off[6], &valid);
+  }
+  if (err == EMBEDLET_OK)
+    err = embedlet_ivf_scratch(store);
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  /* The index reads as absent until every section is in place */
+  embedlet_ivf_header_t *h = store->ivf_header;
+  h->nlist = 0;
+  char *base = (char *)h;
+  uint64_t *offsets = (uint64_t *)(base + off[2]);
+  uint32_t *slot_rows = (uint32_t *)(base + off[3]);
+  uint32_t *slot_of = (uint32_t *)(base + off[4]);
+  uint8_t *slot_codes = (uint8_t *)(base + off[5]);
+
+  memcpy(base + off[0], cents, nlist * dims * sizeof(float));
+  memcpy(base + off[1], codebooks, EMBEDLET_PQ_KSUB * dims * sizeof(float));
+
+  /* Counting sort of rows by list */
+  memset(offsets, 0, (nlist + 1) * sizeof(uint64_t));
+  for (size_t id = 0; id < rows; id++)
+    offsets[lists[id] + 1]++;
+  for (size_t l = 0; l < nlist; l++)
+    offsets[l + 1] += offsets[l];
+  for (size_t id = 0; id < rows; id++) {
+    size_t slot = (size_t)offsets[lists[id]]++;
+    slot_rows[slot] = (uint32_t)id;
+    slot_of[id] = (uint32_t)slot;
+    memcpy(slot_codes + slot * pq_m, codes + id * pq_m, pq_m);
+  }
+  for (size_t l = nlist; l > 0; l--)
+    offsets[l] = offsets[l - 1];
+  offsets[0] = 0;
+
+  h->rows = rows;
+  h->covered = rows;
+  h->dims = dims;
+  h->pq_m = (uint32_t)pq_m;
+  h->nlist = (uint32_t)nlist;
+  embedlet_refresh_pointers(store);
+  return EMBEDLET_OK;
+}
+
+/* Re-encode row id in its trained slot after it was rewritten */
+static void embedlet_ivf_update(embedlet_store_t *store, size_t id,
+                                const float *data) {
+  const embedlet_ivf_header_t *h = store->ivf_header;
+  if (!h || h->nlist == 0 || id >= h->covered)
+    return;
+
+  size_t dims = store->dims;
+  float *unit = store->ivf_unit;
+  float norm = embedlet_norm(data, dims);
+  float inv = norm > FLT_EPSILON ? 1.0f / norm : 0.0f;
+  for (size_t i = 0; i < dims; i++)
+    unit[i] = data[i] * inv;
+
+  /* The row keeps its slot; find the list that slot belongs to */
+  size_t slot = store->ivf_slot_of[id];
+  size_t lo = 0, hi = h->nlist;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (store->ivf_offsets[mid] <= slot)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  embedlet_pq_encode(unit, store->ivf_centroids + lo * dims,
+                     store->ivf_codebooks, dims, h->pq_m, unit + dims,
+                     store->ivf_codes + slot * h->pq_m);
+}
+
+/* Open an existing .ivf sidecar, dropping it if it does not fit the store */
+static int embedlet_ivf_open(embedlet_store_t *store) {
+  if (store->metric != EMBEDLET_METRIC_COSINE)
+    return EMBEDLET_OK; /* the quantizer scores unit vectors */
+  char *path = embedlet_sidecar_path(store->path, EMBEDLET_IVF_SUFFIX);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  bool exists = embedlet_file_exists(path);
+  free(path);
+  if (!exists)
+    return EMBEDLET_OK;
+
+  bool valid;
+  int err = embedlet_sidecar_open(store, &store->ivf_file, EMBEDLET_IVF_SUFFIX,
+                                  EMBEDLET_IVF_MAGIC,
+                                  sizeof(embedlet_ivf_header_t), &valid);
+  if (err == EMBEDLET_OK)
+    err = embedlet_ivf_scratch(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  embedlet_ivf_header_t *h = (embedlet_ivf_header_t *)store->ivf_file.data;
+  if (valid && h->nlist > 0) {
+    size_t off[7];
+    bool fits = h->dims == store->dims && h->pq_m > 0 &&
+                store->dims % h->pq_m == 0 && h->rows <= UINT32_MAX &&
+                h->covered <= h->rows;
+    if (fits) {
+      embedlet_ivf_layout(store->dims, h->nlist, h->pq_m, (size_t)h->rows,
+                          off);
+      fits = store->ivf_file.capacity >= off[6];
+    }
+    if (!fits)
+      h->nlist = 0;
+  }
+  if (h->covered > embedlet_count(store))
+    h->covered = embedlet_count(store);
+  embedlet_refresh_pointers(store);
+  return EMBEDLET_OK;
+}
+
+/* Map the move log, creating it if asked to */
+static int embedlet_moves_open(embedlet_store_t *store, bool create) {
+  if (store->moves_file.data)
+    return EMBEDLET_OK;
+  char *path = embedlet_sidecar_path(store->path, EMBEDLET_MOVES_SUFFIX);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  bool exists = embedlet_file_exists(path);
+  free(path);
+  if (!exists && !create)
+    return EMBEDLET_OK;
+
+  bool valid;
+  int err = embedlet_sidecar_open(store, &store->moves_file,
+                                  EMBEDLET_MOVES_SUFFIX, EMBEDLET_MOVES_MAGIC,
+                                  sizeof(embedlet_sidecar_header_t), &valid);
+  if (err == EMBEDLET_OK && store->read_only && !valid)
+    embedlet_file_close(&store->moves_file); /* not a log; show none */
+  embedlet_refresh_pointers(store);
+  return err;
+}
+
+/* Score the rows of probed lists [start, end) from their PQ codes */
+static void embedlet_ivf_worker(void *arg) {
+  embedlet_search_task_t *task = (embedlet_search_task_t *)arg;
+  const embedlet_store_t *store = task->store;
+  const embedlet_ivf_probe_t *probe = task->ivf;
+  const uint64_t *live = store->live;
+  const uint64_t *offsets = store->ivf_offsets;
+  const uint32_t *slot_rows = store->ivf_slot_rows;
+  size_t pq_m = store->ivf_header->pq_m;
+
+  size_t start, end;
+  task->result_count = 0;
+  while (embedlet_steal_next(task->steal, task->slot, &start, &end)) {
+    for (size_t p = start; p < end; p++) {
+      size_t list = probe->lists[p].id;
+      float base = probe->lists[p].score;
+      for (size_t slot = (size_t)offsets[list]; slot < offsets[list + 1];
+           slot++) {
+        size_t id = slot_rows[slot];
+        if (id >= probe->covered || !embedlet_live_test(live, id))
+          continue;
+        const uint8_t *code = store->ivf_codes + slot * pq_m;
+        const float *lut = probe->lut;
+        float score = base;
+        for (size_t j = 0; j < pq_m; j++, lut += EMBEDLET_PQ_KSUB)
+          score += lut[code[j]];
+        embedlet_heap_push_min(task->local_results, &task->result_count,
+                               task->n, id, score);
+      }
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ * Similarity Joins (all-pairs kNN graph and similarity matrix)
+ *----------------------------------------------------------------------------*/
+
+/* Scores from a dot product and both rows' norms, indexed by metric */
+static float (*const embedlet_dot_scores[])(float, float, float) = {
+    embedlet_block_cosine, embedlet_block_inner_product, embedlet_block_l2};
+
+/*
+ * A self-join of `count` rows, join row r being store row ids[r] (r itself
+ * without ids). The rows are cut into tiles of `tile` rows, and every pair
+ * of tiles I <= J is scored once, in that order: pair p of tile I is (I,
+ * I + p), so the pairs claimed together share their first tile.
+ */
+typedef struct {
+  embedlet_store_t *store;
+  const size_t *ids; /* NULL: join row r is row r */
+  size_t count;
+  size_t tile;
+  size_t tiles;
+  bool self; /* also score each row against itself */
+
+  /* kNN graph: lists of k, guarded by the lock of their rows' tile */
+  size_t k;
+  bool highest;
+  embedlet_result_t *lists;
+  size_t *sizes;
+  embedlet_mutex_t *locks;
+
+  /* Similarity matrix, count x count */
+  float *matrix;
+} embedlet_join_t;
+
+static inline size_t embedlet_join_row(const embedlet_join_t *join,
+                                       size_t r) {
+  return join->ids ? join->ids[r] : r;
+}
+
+/* Row pairs (a, b) of tiles I and J that the join scores */
+static inline bool embedlet_join_wants(const embedlet_join_t *join, size_t I,
+                                       size_t J, size_t a, size_t b) {
+  if (I == J && (b < a || (b == a && !join->self)))
+    return false;
+  const uint64_t *live = join->store->live;
+  return embedlet_live_test(live, embedlet_join_row(join, a)) &&
+         embedlet_live_test(live, embedlet_join_row(join, b));
+}
+
+/*
+ * Score tile I against tile J into scores[(a - i0) * tile + (b - j0)].
+ * `rows` and `sums` hold tile I decoded, or are NULL when the rows are
+ * float32 (or the metric reads only sign bits) and serve as queries as is.
+ */
+static void embedlet_join_score(const embedlet_join_t *join, size_t I,
+                                size_t J, const float *rows,
+                                const float *sums, float *scores) {
+  const embedlet_store_t *store = join->store;
+  size_t dims = store->dims, words = store->bits_words, tile = join->tile;
+  size_t i0 = I * tile, i1 = i0 + tile < join->count ? i0 + tile : join->count;
+  size_t j0 = J * tile, j1 = j0 + tile < join->count ? j0 + tile : join->count;
+  bool hamming = store->metric == EMBEDLET_METRIC_HAMMING;
+
+  for (size_t a = i0; a < i1; a++) {
+    size_t ri = embedlet_join_row(join, a);
+    const float *query = rows ? rows + (a - i0) * dims
+                              : (const float *)embedlet_row_ptr(store, ri);
+    float query_sum = sums ? sums[a - i0] : 0.0f;
+    float *out = scores + (a - i0) * tile;
+    for (size_t b = j0; b < j1; b++) {
+      if (!embedlet_join_wants(join, I, J, a, b))
+        continue;
+      size_t rj = embedlet_join_row(join, b);
+      if (hamming) {
+        out[b - j0] = (float)embedlet_kernels.hamming(
+            store->bits + ri * words, store->bits + rj * words, words);
+      } else {
+        float dot = store->row_dot(query, query_sum,
+                                   embedlet_row_ptr(store, rj), dims);
+        out[b - j0] = embedlet_dot_scores[store->metric](
+            dot, store->norms[ri], store->norms[rj]);
+      }
+    }
+  }
+}
+
+/* Hand a scored pair of tiles to the kNN lists or the matrix */
+static void embedlet_join_emit(embedlet_join_t *join, size_t I, size_t J,
+                               const float *scores) {
+  size_t tile = join->tile, count = join->count, k = join->k;
+  size_t i0 = I * tile, i1 = i0 + tile < count ? i0 + tile : count;
+  size_t j0 = J * tile, j1 = j0 + tile < count ? j0 + tile : count;
+
+  if (join->matrix) {
+    for (size_t a = i0; a < i1; a++)
+      for (size_t b = j0; b < j1; b++)
+        if (embedlet_join_wants(join, I, J, a, b)) {
+          float s = scores[(a - i0) * tile + (b - j0)];
+          join->matrix[a * count + b] = s;
+          join->matrix[b * count + a] = s;
+        }
+    return;
+  }
+
+  /* Tile I's rows take their scores against J, and J's rows the same ones
+   * transposed; one lock at a time, so no lock order is needed */
+  embedlet_mutex_lock(&join->locks[I]);
+  for (size_t a = i0; a < i1; a++)
+    for (size_t b = j0; b < j1; b++)
+      if (embedlet_join_wants(join, I, J, a, b)) {
+        float s = scores[(a - i0) * tile + (b - j0)];
+        embedlet_heap_push(join->lists + a * k, &join->sizes[a], k, b, s,
+                           join->highest);
+        if (I == J)
+          embedlet_heap_push(join->lists + b * k, &join->sizes[b], k, a, s,
+                             join->highest);
+      }
+  embedlet_mutex_unlock(&join->locks[I]);
+  if (I == J)
+    return;
+  embedlet_mutex_lock(&join->locks[J]);
+  for (size_t b = j0; b < j1; b++)
+    for (size_t a = i0; a < i1; a++)
+      if (embedlet_join_wants(join, I, J, a, b))
+        embedlet_heap_push(join->lists + b * k, &join->sizes[b], k, a,
+                           scores[(a - i0) * tile + (b - j0)], join->highest);
+  embedlet_mutex_unlock(&join->locks[J]);
+}
+
+/* embedlet_run_ranges() callback over pairs [start, end) of the join */
+static int embedlet_join_range(void *ctx, size_t start, size_t end) {
+  embedlet_join_t *join = (embedlet_join_t *)ctx;
+  const embedlet_store_t *store = join->store;
+  size_t dims = store->dims, tile = join->tile, tiles = join->tiles;
+  bool decode = store->dtype != EMBEDLET_DTYPE_F32 &&
+                store->metric != EMBEDLET_METRIC_HAMMING;
+
+  float *scores = (float *)malloc(tile * tile * sizeof(float));
+  float *rows = decode ? (float *)malloc(tile * dims * sizeof(float)) : NULL;
+  float *sums = decode ? (float *)malloc(tile * sizeof(float)) : NULL;
+  if (!scores || (decode && (!rows || !sums))) {
+    free(scores);
+    free(rows);
+    free(sums);
+    return EMBEDLET_ERR_ALLOC;
+  }
+
+  size_t I = 0, first = 0;
+  while (first + (tiles - I) <= start) {
+    first += tiles - I;
+    I++;
+  }
+  size_t J = I + (start - first);
+  size_t decoded = SIZE_MAX;
+  for (size_t p = start; p < end; p++) {
+    if (decode && decoded != I) {
+      size_t i0 = I * tile;
+      for (size_t a = i0; a < i0 + tile && a < join->count; a++) {
+        float *row = rows + (a - i0) * dims;
+        embedlet_row_decode(store, embedlet_join_row(join, a), row);
+        sums[a - i0] = embedlet_query_sum(row, dims);
+      }
+      decoded = I;
+    }
+    embedlet_join_score(join, I, J, rows, sums, scores);
+    embedlet_join_emit(join, I, J, scores);
+    if (++J == tiles) {
+      I++;
+      J = I;
+    }
+  }
+
+  free(scores);
+  free(rows);
+  free(sums);
+  return EMBEDLET_OK;
+}
+
+/* Tile the join to keep two tiles in L2, then score all its pairs */
+static int embedlet_join_run(embedlet_join_t *join, int num_threads) {
+  size_t tile = embedlet_block_rows(embedlet_scan_row_bytes(join->store));
+  join->tile = tile < 16 ? 16 : tile > 256 ? 256 : tile;
+  join->tiles = (join->count + join->tile - 1) / join->tile;
+  size_t pairs = join->tiles * (join->tiles + 1) / 2;
+  if (pairs == 0)
+    return EMBEDLET_OK;
+
+  int threads = embedlet_resolve_threads(num_threads, pairs);
+  embedlet_pool_t *pool = NULL;
+  if (threads > 1) {
+    int err = embedlet_acquire_pool(join->store, &threads, &pool);
+    if (err != EMBEDLET_OK)
+      return err;
+  }
+  int err = embedlet_run_ranges(pool, threads, pairs, embedlet_join_range,
+                                join);
+  embedlet_return_pool(join->store, pool);
+  return err;
+}
+
+/*----------------------------------------------------------------------------
+ * Prefix Copy (optional leading dimensions of every row, stored contiguously)
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Copy the leading dims of row id (already encoded) into the prefix copy,
+ * with their norm taken from the source vector (NULL for a deleted row).
+ */
+static void embedlet_prefix_set(embedlet_store_t *store, size_t id,
+                                const float *data) {
+  if (!store->prefix_header)
+    return;
+  size_t bytes = store->prefix_row_bytes - sizeof(float);
+  uint8_t *row = store->prefix + id * store->prefix_row_bytes;
+  memcpy(row, (const uint8_t *)store->data + id * store->row_bytes, bytes);
+  *(float *)(row + bytes) =
+      data ? embedlet_norm(data, store->prefix_dims) : 0.0f;
+  if (store->prefix_header->rows <= id)
+    store->prefix_header->rows = id + 1;
+}
+
+/*
+ * Open the prefix copy if it exists or options ask for one, then fill in the
+ * rows it does not cover yet. A copy of another width than the one asked
+ * for is rebuilt.
+ */
+static int embedlet_prefix_open(embedlet_store_t *store,
+                                const embedlet_options_t *options) {
+  size_t want = options ? options->prefix_dims : 0;
+  char *path = embedlet_sidecar_path(store->path, EMBEDLET_PREFIX_SUFFIX);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  bool exists = embedlet_file_exists(path);
+  free(path);
+  if (!exists && want == 0)
+    return EMBEDLET_OK;
+
+  bool valid;
+  int err = embedlet_sidecar_open(store, &store->prefix_file,
+                                  EMBEDLET_PREFIX_SUFFIX, EMBEDLET_PREFIX_MAGIC,
+                                  sizeof(embedlet_sidecar_header_t), &valid);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  embedlet_sidecar_header_t *h =
+      (embedlet_sidecar_header_t *)store->prefix_file.data;
+  size_t dims = (size_t)h->reserved[0];
+  if (!valid || dims == 0 || dims >= store->dims ||
+      (want != 0 && dims != want)) {
+    if (want == 0) {
+      embedlet_file_close(&store->prefix_file); /* unusable; ignore it */
+      embedlet_refresh_pointers(store);
+      return EMBEDLET_OK;
+    }
+    dims = want;
+    h->rows = 0;
+    h->reserved[0] = dims;
+  }
+
+  size_t count = embedlet_count(store);
+  store->prefix_dims = dims;
+  store->prefix_row_bytes =
+      embedlet_row_bytes_for(store->dtype, dims) + sizeof(float);
+  err = embedlet_map_reserve(&store->prefix_file,
+                             embedlet_prefix_bytes(store, count));
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  size_t first = (size_t)store->prefix_header->rows;
+  if (first > count)
+    store->prefix_header->rows = first = count;
+  if (first == count)
+    return EMBEDLET_OK;
+
+  float *row = (float *)malloc(store->dims * sizeof(float));
+  if (!row)
+    return EMBEDLET_ERR_ALLOC;
+  for (size_t id = first; id < count; id++) {
+    bool live = embedlet_live_test(store->live, id);
+    if (live)
+      embedlet_row_decode(store, id, row);
+    embedlet_prefix_set(store, id, live ? row : NULL);
+  }
+  free(row);
+  return EMBEDLET_OK;
+}
+
+/*----------------------------------------------------------------------------
+ * Blocked Copy (optional float32 rows interleaved EMBEDLET_BLOCK_ROWS at a
+ * time)
+ *----------------------------------------------------------------------------*/
+
+/* Copy stored row id into its lane of its block (deleted rows are zeros) */
+static void embedlet_blocks_set(embedlet_store_t *store, size_t id) {
+  if (!store->blocks_header)
+    return;
+  size_t dims = store->dims;
+  size_t lane = id % EMBEDLET_BLOCK_ROWS;
+  const float *row = (const float *)embedlet_row_ptr(store, id);
+  float *block = store->blocks + (id - lane) * dims + lane;
+  for (size_t d = 0; d < dims; d++)
+    block[d * EMBEDLET_BLOCK_ROWS] = row[d];
+  if (store->blocks_header->rows <= id)
+    store->blocks_header->rows = id + 1;
+}
+
+/*
+ * Open the blocked copy if it exists or options ask for one, then fill in
+ * the rows it does not cover yet. Only float32 stores keep one; the other
+ * encodings are scanned row by row.
+ */
+static int embedlet_blocks_open(embedlet_store_t *store,
+                                const embedlet_options_t *options) {
+  bool want = options && options->blocked;
+  if (store->dtype != EMBEDLET_DTYPE_F32)
+    return EMBEDLET_OK;
+  char *path = embedlet_sidecar_path(store->path, EMBEDLET_BLOCKS_SUFFIX);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  bool exists = embedlet_file_exists(path);
+  free(path);
+  if (!exists && !want)
+    return EMBEDLET_OK;
+
+  bool valid;
+  int err = embedlet_sidecar_open(store, &store->blocks_file,
+                                  EMBEDLET_BLOCKS_SUFFIX, EMBEDLET_BLOCKS_MAGIC,
+                                  sizeof(embedlet_sidecar_header_t), &valid);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  embedlet_sidecar_header_t *h =
+      (embedlet_sidecar_header_t *)store->blocks_file.data;
+  if (!valid || h->reserved[0] != store->dims) {
+    if (!want) {
+      embedlet_file_close(&store->blocks_file); /* unusable; ignore it */
+      embedlet_refresh_pointers(store);
+      return EMBEDLET_OK;
+    }
+    h->rows = 0;
+    h->reserved[0] = store->dims;
+  }
+
+  size_t count = embedlet_count(store);
+  err = embedlet_map_reserve(&store->blocks_file,
+                             embedlet_blocks_bytes(store, count));
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
+
+  size_t first = (size_t)store->blocks_header->rows;
+  if (first > count)
+    store->blocks_header->rows = first = count;
+  for (size_t id = first; id < count; id++)
+    embedlet_blocks_set(store, id);
+  return EMBEDLET_OK;
+}
+
+/*----------------------------------------------------------------------------
+ * Offload (optional device backend mirroring the rows)
+ *----------------------------------------------------------------------------*/
+
+/*
+ * Detach the backend (under the store mutex). Searches still inside its
+ * search() hold references, so the ctx is only handed to detach() once
+ * they are out; new ones see bit 0 clear and stay on the CPU.
+ */
+static void embedlet_offload_detach(embedlet_store_t *store) {
+  if (!(embedlet_atomic_load(&store->offload_refs) & 1))
+    return;
+  embedlet_atomic_fetch_add(&store->offload_refs, (size_t)-1);
+  while (embedlet_atomic_load(&store->offload_refs) != 0)
+    embedlet_thread_yield();
+  if (store->offload.detach)
+    store->offload.detach(store->offload.ctx);
+}
+
+/*
+ * Send rows [first, first + count) to the backend, in runs of live rows
+ * (decoded unless float32, which is sent straight from the mapping) and of
+ * deleted ones. A failed write detaches the backend.
+ */
+static int embedlet_offload_write(embedlet_store_t *store, size_t first,
+                                  size_t count) {
+  if (!(embedlet_atomic_load(&store->offload_refs) & 1) || count == 0)
+    return EMBEDLET_OK;
+  size_t dims = store->dims, end = first + count;
+  size_t chunk = embedlet_block_rows(dims * sizeof(float));
+  if (chunk > count)
+    chunk = count;
+  float *scratch = NULL;
+  if (store->dtype != EMBEDLET_DTYPE_F32) {
+    scratch = (float *)malloc(chunk * dims * sizeof(float));
+    if (!scratch) {
+      embedlet_offload_detach(store);
+      return EMBEDLET_ERR_ALLOC;
+    }
+  }
+
+  int err = EMBEDLET_OK;
+  for (size_t id = first; id < end && err == EMBEDLET_OK;) {
+    bool live = embedlet_live_test(store->live, id);
+    size_t run = id + 1;
+    while (run < end && embedlet_live_test(store->live, run) == live &&
+           (!scratch || !live || run - id < chunk))
+      run++;
+    const float *rows = NULL;
+    if (live && scratch) {
+      for (size_t r = id; r < run; r++)
+        embedlet_row_decode(store, r, scratch + (r - id) * dims);
+      rows = scratch;
+    } else if (live) {
+      rows = (const float *)embedlet_row_ptr(store, id);
+    }
+    err = store->offload.write(store->offload.ctx, id, run - id, rows);
+    id = run;
+  }
+  free(scratch);
+  if (err != EMBEDLET_OK)
+    embedlet_offload_detach(store);
+  return err;
+}
+
+/*
+ * Search on the backend if one is attached and the batch is big enough for
+ * it. Anything but EMBEDLET_OK leaves the search to the CPU.
+ */
+static int embedlet_offload_search(embedlet_store_t *store,
+                                   const float *queries, size_t num_queries,
+                                   size_t n, bool most_similar,
+                                   embedlet_result_t *results,
+                                   size_t *counts) {
+  if (!(embedlet_atomic_load(&store->offload_refs) & 1))
+    return EMBEDLET_ERR_NOT_FOUND;
+  /* The reference keeps the backend attached; recheck once it is held */
+  size_t refs = embedlet_atomic_fetch_add(&store->offload_refs, 2);
+  int err = EMBEDLET_ERR_NOT_FOUND;
+  if ((refs & 1) && num_queries >= store->offload.min_batch)
+    err = store->offload.search(
+        store->offload.ctx, store->metric, queries, num_queries, n,
+        embedlet_keep_highest(store->metric, most_similar), results, counts);
+  embedlet_atomic_fetch_add(&store->offload_refs, (size_t)-2);
+  return err;
+}
+
+/*
+ * Size every sidecar's reservation from the store file's. The HNSW degree
+ * and prefix length come from the options, or their defaults and the full
+ * row; a sidecar that outgrows its estimate moves to a larger range.
+ */
+static void embedlet_reserve_hints(embedlet_store_t *store,
+                                   const embedlet_options_t *options) {
+  size_t m = options && options->hnsw_m ? (size_t)options->hnsw_m
+                                        : EMBEDLET_DEFAULT_HNSW_M;
+  size_t prefix = options && options->prefix_dims ? options->prefix_dims
+                                                  : store->dims;
+  store->norms_file.reserve_hint =
+      embedlet_sidecar_reserve(store, sizeof(float), 1);
+  store->live_file.reserve_hint =
+      embedlet_sidecar_reserve(store, sizeof(uint64_t), 64);
+  store->bits_file.reserve_hint = embedlet_sidecar_reserve(
+      store, store->bits_words * sizeof(uint64_t), 1);
+  store->hnsw_file.reserve_hint = embedlet_sidecar_reserve(
+      store, embedlet_hnsw_record_words((uint32_t)m) * sizeof(uint32_t), 1);
+  /* A node has 1 / (m - 1) upper levels on average */
+  store->hnsw_upper_file.reserve_hint =
+      embedlet_sidecar_reserve(store, (1 + m) * sizeof(uint32_t), m - 1);
+  /* PQ codes take at most a byte per dimension */
+  store->ivf_file.reserve_hint = embedlet_sidecar_reserve(
+      store, store->dims + 2 * sizeof(uint32_t), 1);
+  store->moves_file.reserve_hint =
+      embedlet_sidecar_reserve(store, 2 * sizeof(uint64_t), 1);
+  store->prefix_file.reserve_hint = embedlet_sidecar_reserve(
+      store, embedlet_row_bytes_for(store->dtype, prefix) + sizeof(float), 1);
+  store->blocks_file.reserve_hint =
+      embedlet_sidecar_reserve(store, store->dims * sizeof(float), 1);
+}
+
+/*----------------------------------------------------------------------------
+ * Public API Implementation
+ *----------------------------------------------------------------------------*/
+
+int embedlet_open(const char *path, size_t dims, embedlet_store_t **store_out) {
+  return embedlet_open_ex(path, dims, NULL, store_out);
+}
+
+int embedlet_open_ex(const char *path, size_t dims,
+                     const embedlet_options_t *options,
+                     embedlet_store_t **store_out) {
+  int dtype = options ? options->dtype : EMBEDLET_DTYPE_F32;
+  int metric = options ? options->metric : EMBEDLET_METRIC_COSINE;
+  if (!path || dims == 0 || !store_out || !embedlet_dtype_valid(dtype) ||
+      metric < EMBEDLET_METRIC_COSINE || metric > EMBEDLET_METRIC_HAMMING) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  if (options && (options->hnsw_ef_construction < 0 ||
+                  (options->hnsw_m != 0 &&
+                   (options->hnsw_m < 2 || options->hnsw_m > 255 ||
+                    metric == EMBEDLET_METRIC_HAMMING)))) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  int advice = options ? options->advice : EMBEDLET_ADVISE_NORMAL;
+  if (!embedlet_advice_valid(advice))
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (options && options->prefix_dims >= dims)
+    return EMBEDLET_ERR_INVALID_ARG;
+
+  embedlet_simd_init();
+
+  embedlet_store_t *store =
+      (embedlet_store_t *)calloc(1, sizeof(embedlet_store_t));
+  if (!store)
+    return EMBEDLET_ERR_ALLOC;
+
+  store->dims = dims;
+  store->bits_words = (dims + 63) / 64;
+  embedlet_set_dtype(store, dtype);
+  store->path = strdup(path);
+  if (!store->path) {
+    free(store);
+    return EMBEDLET_ERR_ALLOC;
+  }
+
+  embedlet_map_init(&store->file);
+  store->file.reserve_hint = options ? options->reserve_bytes : 0;
+  store->pin_threads = options && options->pin_threads;
+  store->metric = metric;
+  embedlet_map_init(&store->norms_file);
+  embedlet_map_init(&store->live_file);
+  embedlet_map_init(&store->bits_file);
+  store->file.advice = advice;
+  store->norms_file.advice = advice;
+  store->live_file.advice = advice;
+  store->bits_file.advice = advice;
+  store->read_only = options && options->read_only;
+  store->file.read_only = store->read_only;
+  store->norms_file.read_only = store->read_only;
+  store->live_file.read_only = store->read_only;
+  store->bits_file.read_only = store->read_only;
+  embedlet_map_init(&store->hnsw_file);
+  embedlet_map_init(&store->hnsw_upper_file);
+  embedlet_map_init(&store->ivf_file);
+  embedlet_map_init(&store->moves_file);
+  store->moves_file.read_only = store->read_only;
+  embedlet_map_init(&store->prefix_file);
+  store->prefix_file.advice = advice;
+  embedlet_map_init(&store->blocks_file);
+  store->blocks_file.advice = advice;
+  store->data = NULL;
+  store->norms = NULL;
+  store->live = NULL;
+  store->bits = NULL;
+  store->norms_header = NULL;
+  store->live_header = NULL;
+  store->bits_header = NULL;
+  store->free_ids = NULL;
+  store->free_count = 0;
+  store->free_capacity = 0;
+  store->pool = NULL;
+
+  store->arenas = NULL;
+
+  embedlet_mutex_init(&store->mutex);
+  embedlet_cond_init(&store->pool_idle);
+  embedlet_mutex_init(&store->arena_mutex);
+  embedlet_rwlock_init(&store->hnsw_lock);
+
+  int err = embedlet_file_open(&store->file, path);
+  if (err == EMBEDLET_OK && store->read_only)
+    embedlet_file_lock_shared(&store->file); /* the writer stops shrinking */
+  if (err != EMBEDLET_OK) {
+    embedlet_rwlock_destroy(&store->hnsw_lock);
+    embedlet_mutex_destroy(&store->arena_mutex);
+    embedlet_cond_destroy(&store->pool_idle);
+    embedlet_mutex_destroy(&store->mutex);
+    free(store->path);
+    free(store);
+    return err;
+  }
+
+  err = embedlet_header_open(store);
+  if (err == EMBEDLET_OK)
+    embedlet_reserve_hints(store, options);
+  if (err == EMBEDLET_OK && store->read_only) {
+    /* The writer relinks the indexes in place; readers scan the rows */
+    err = embedlet_sidecars_attach(store);
+    if (err == EMBEDLET_OK)
+      err = embedlet_moves_open(store, false);
+  } else if (err == EMBEDLET_OK) {
+    err = embedlet_sidecars_open(store);
+    if (err == EMBEDLET_OK)
+      err = embedlet_hnsw_open(store, options);
+    if (err == EMBEDLET_OK)
+      err = embedlet_ivf_open(store);
+    if (err == EMBEDLET_OK)
+      err = embedlet_moves_open(store, false);
+    if (err == EMBEDLET_OK)
+      err = embedlet_prefix_open(store, options);
+    if (err == EMBEDLET_OK)
+      err = embedlet_blocks_open(store, options);
+  }
+
+  if (err != EMBEDLET_OK) {
+    free(store->free_ids);
+    free(store->ivf_unit);
+    embedlet_hnsw_ctx_destroy(store->hnsw_ctx);
+    embedlet_file_close(&store->blocks_file);
+    embedlet_file_close(&store->prefix_file);
+    embedlet_file_close(&store->moves_file);
+    embedlet_file_close(&store->ivf_file);
+    embedlet_file_close(&store->hnsw_upper_file);
+    embedlet_file_close(&store->hnsw_file);
+    embedlet_file_close(&store->bits_file);
+    embedlet_file_close(&store->live_file);
+    embedlet_file_close(&store->norms_file);
+    embedlet_file_close(&store->file);
+    embedlet_rwlock_destroy(&store->hnsw_lock);
+    embedlet_mutex_destroy(&store->arena_mutex);
+    embedlet_cond_destroy(&store->pool_idle);
+    embedlet_mutex_destroy(&store->mutex);
+    free(store->path);
+    free(store);
+    return err;
+  }
+
+  *store_out = store;
+  return EMBEDLET_OK;
+}
+
+int embedlet_close(embedlet_store_t *store, bool compact) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+
+  if (compact && !store->read_only) {
+    embedlet_compact(store);
+  }
+
+  embedlet_pool_release(store->pool);
+  store->pool = NULL;
+  embedlet_offload_detach(store);
+
+  embedlet_hnsw_idle_free(store);
+  embedlet_hnsw_ctx_destroy(store->hnsw_ctx);
+  free(store->ivf_unit);
+  embedlet_file_close(&store->blocks_file);
+  embedlet_file_close(&store->prefix_file);
+  embedlet_file_close(&store->moves_file);
+  embedlet_file_close(&store->ivf_file);
+  embedlet_file_close(&store->hnsw_upper_file);
+  embedlet_file_close(&store->hnsw_file);
+  embedlet_file_close(&store->bits_file);
+  embedlet_file_close(&store->live_file);
+  embedlet_file_close(&store->norms_file);
+  embedlet_file_close(&store->file);
+  embedlet_arenas_free(store);
+  embedlet_rwlock_destroy(&store->hnsw_lock);
+  embedlet_mutex_destroy(&store->arena_mutex);
+  embedlet_cond_destroy(&store->pool_idle);
+  embedlet_mutex_destroy(&store->mutex);
+  free(store->free_ids);
+  free(store->path);
+  free(store);
+
+  return EMBEDLET_OK;
+}
+
+int embedlet_remove(const char *path) {
+  if (!path)
+    return EMBEDLET_ERR_INVALID_ARG;
+
+  static const char *const suffixes[] = {
+      EMBEDLET_NORMS_SUFFIX, EMBEDLET_LIVE_SUFFIX, EMBEDLET_BITS_SUFFIX,
+      EMBEDLET_HNSW_SUFFIX, EMBEDLET_HNSW_UPPER_SUFFIX, EMBEDLET_IVF_SUFFIX,
+      EMBEDLET_MOVES_SUFFIX, EMBEDLET_PREFIX_SUFFIX, EMBEDLET_BLOCKS_SUFFIX};
+  for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+    char *sidecar = embedlet_sidecar_path(path, suffixes[i]);
+    if (!sidecar)
+      return EMBEDLET_ERR_ALLOC;
+    remove(sidecar);
+    free(sidecar);
+  }
+
+  return remove(path) == 0 ? EMBEDLET_OK : EMBEDLET_ERR_NOT_FOUND;
+}
+
+size_t embedlet_count(const embedlet_store_t *store) {
+  if (!store || !store->header)
+    return 0;
+  if (store->read_only) {
+    /* Rows past the views mapped here wait for embedlet_refresh() */
+    uint64_t count = embedlet_atomic_acquire_u64(&store->header->count);
+    uint64_t mapped = embedlet_atomic_acquire_u64(&store->mapped_rows);
+    return (size_t)(count < mapped ? count : mapped);
+  }
+  return (size_t)store->header->count;
+}
+
+int embedlet_refresh(embedlet_store_t *store) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (!store->read_only ||
+      embedlet_atomic_acquire_u64(&store->header->count) <=
+          embedlet_atomic_acquire_u64(&store->mapped_rows))
+    return EMBEDLET_OK;
+
+  /* Map what the writer grew the files to; old views stay valid */
+  embedlet_map_t *maps[4] = {&store->file, &store->norms_file,
+                             &store->live_file, &store->bits_file};
+  int err = EMBEDLET_OK;
+  embedlet_mutex_lock(&store->mutex);
+  for (int i = 0; i < 4 && err == EMBEDLET_OK; i++) {
+    err = embedlet_file_sync_size(maps[i]);
+    if (err == EMBEDLET_OK && maps[i]->size > maps[i]->capacity)
+      err = embedlet_mmap_update(maps[i], maps[i]->size);
+  }
+  embedlet_refresh_pointers(store);
+  embedlet_atomic_release_u64(&store->mapped_rows,
+                              embedlet_mapped_rows(store));
+  embedlet_mutex_unlock(&store->mutex);
+  return err;
+}
+
+/* Rows an exact search covers, mapping new ones into a read-only store */
+static size_t embedlet_search_rows(embedlet_store_t *store) {
+  if (store->read_only)
+    embedlet_refresh(store); /* on failure the mapped rows still serve */
+  return embedlet_count(store);
+}
+
+size_t embedlet_dims(const embedlet_store_t *store) {
+  return store ? store->dims : 0;
+}
+
+size_t embedlet_prefix_dims(const embedlet_store_t *store) {
+  return store && store->prefix_header ? store->prefix_dims : 0;
+}
+
+int embedlet_dtype(const embedlet_store_t *store) {
+  return store ? store->dtype : EMBEDLET_DTYPE_F32;
+}
+
+int embedlet_metric(const embedlet_store_t *store) {
+  return store ? store->metric : EMBEDLET_METRIC_COSINE;
+}
+
+int embedlet_pool_create(int num_threads, bool pin_threads,
+                         embedlet_pool_t **pool_out) {
+  if (num_threads < 0 || !pool_out)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (num_threads == EMBEDLET_AUTO_THREADS)
+    num_threads = embedlet_get_cpu_count();
+  if (num_threads > EMBEDLET_MAX_THREADS)
+    num_threads = EMBEDLET_MAX_THREADS;
+
+  *pool_out = embedlet_pool_start(num_threads, num_threads, pin_threads);
+  return *pool_out ? EMBEDLET_OK : EMBEDLET_ERR_THREAD;
+}
+
+int embedlet_pool_destroy(embedlet_pool_t *pool) {
+  if (!pool)
+    return EMBEDLET_ERR_INVALID_ARG;
+  embedlet_pool_release(pool);
+  return EMBEDLET_OK;
+}
+
+int embedlet_attach_pool(embedlet_store_t *store, embedlet_pool_t *pool) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (pool)
+    embedlet_pool_retain(pool);
+
+  /* New searches wait while the ones holding the old pool finish */
+  embedlet_mutex_lock(&store->mutex);
+  while (store->pool_swap)
+    embedlet_cond_wait(&store->pool_idle, &store->mutex);
+  store->pool_swap = true;
+  while (store->pool_users > 0)
+    embedlet_cond_wait(&store->pool_idle, &store->mutex);
+  embedlet_pool_t *old = store->pool;
+  store->pool = pool;
+  store->pool_swap = false;
+  embedlet_cond_broadcast(&store->pool_idle);
+  embedlet_mutex_unlock(&store->mutex);
+
+  embedlet_pool_release(old);
+  return EMBEDLET_OK;
+}
+
+int embedlet_attach_offload(embedlet_store_t *store,
+                            const embedlet_offload_t *offload) {
+  if (!store || (offload && (!offload->write || !offload->search)))
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (offload && store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+  if (offload && store->metric == EMBEDLET_METRIC_HAMMING)
+    return EMBEDLET_ERR_INVALID_ARG;
+
+  embedlet_mutex_lock(&store->mutex);
+  embedlet_offload_detach(store);
+  int err = EMBEDLET_OK;
+  if (offload) {
+    store->offload = *offload;
+    embedlet_atomic_fetch_add(&store->offload_refs, 1);
+    err = embedlet_offload_write(store, 0, embedlet_count(store));
+  }
+  embedlet_mutex_unlock(&store->mutex);
+  return err;
+}
+
+const char *embedlet_simd_backend(void) {
+  embedlet_simd_init();
+  return embedlet_kernels.name;
+}
+
+int embedlet_enable_stats(embedlet_store_t *store, bool enable) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  embedlet_atomic_store_u64(&store->stats_enabled, enable ? 1 : 0);
+  return EMBEDLET_OK;
+}
+
+int embedlet_get_stats(const embedlet_store_t *store,
+                       embedlet_stats_t *stats_out) {
+  if (!store || !stats_out)
+    return EMBEDLET_ERR_INVALID_ARG;
+  const embedlet_stats_t *t = &store->stats;
+  stats_out->searches = embedlet_atomic_load_u64(&t->searches);
+  stats_out->rows_scanned = embedlet_atomic_load_u64(&t->rows_scanned);
+  stats_out->rows_skipped = embedlet_atomic_load_u64(&t->rows_skipped);
+  stats_out->bytes_touched = embedlet_atomic_load_u64(&t->bytes_touched);
+  stats_out->kernel_ns = embedlet_atomic_load_u64(&t->kernel_ns);
+  stats_out->queue_wait_ns = embedlet_atomic_load_u64(&t->queue_wait_ns);
+  stats_out->merge_ns = embedlet_atomic_load_u64(&t->merge_ns);
+  stats_out->grow_events = embedlet_atomic_load_u64(&t->grow_events);
+  stats_out->remap_events = embedlet_atomic_load_u64(&t->remap_events);
+  stats_out->simd_backend = embedlet_simd_backend();
+  return EMBEDLET_OK;
+}
+
+int embedlet_reset_stats(embedlet_store_t *store) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  embedlet_stats_t *t = &store->stats;
+  uint64_t *counters[] = {
+      &t->searches,      &t->rows_scanned, &t->rows_skipped,
+      &t->bytes_touched, &t->kernel_ns,    &t->queue_wait_ns,
+      &t->merge_ns,      &t->grow_events,  &t->remap_events};
+  for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+    embedlet_atomic_store_u64(counters[i], 0);
+  return EMBEDLET_OK;
+}
+
+int embedlet_set_stats_hook(embedlet_store_t *store,
+                            embedlet_stats_hook_t hook, void *user_data) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  store->stats_hook = hook;
+  store->stats_hook_data = user_data;
+  return EMBEDLET_OK;
+}
+
+int embedlet_append(embedlet_store_t *store, const float *data, bool reuse,
+                    size_t *id_out) {
+  if (!store || !data || !id_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+
+  embedlet_mutex_lock(&store->mutex);
+
+  size_t count = embedlet_count(store);
+  size_t target_id = count;
+
+  if (reuse && !embedlet_free_pop(store, count, &target_id)) {
+    target_id = count;
+  }
+
+  if (target_id == count) {
+    int err = embedlet_ensure_capacity(store, count + 1);
+    if (err != EMBEDLET_OK) {
+      embedlet_mutex_unlock(&store->mutex);
+      return err;
+    }
+  }
+
+  embedlet_norms_set(store, target_id,
+                     embedlet_row_encode(store, target_id, data));
+  embedlet_bits_set(store, target_id, data);
+  embedlet_prefix_set(store, target_id, data);
+  embedlet_blocks_set(store, target_id);
+  embedlet_live_set(store, target_id, true);
+  embedlet_offload_write(store, target_id, 1);
+
+  /* Publish the new row only once its data and metadata are written */
+  if (target_id == count)
+    embedlet_atomic_release_u64(&store->header->count, count + 1);
+
+  *id_out = target_id;
+
+  /* The row is stored: the indexes catch up or are marked for a rebuild */
+  embedlet_hnsw_link(store, target_id);
+  embedlet_ivf_update(store, target_id, data);
+
+  embedlet_mutex_unlock(&store->mutex);
+  return EMBEDLET_OK;
+}
+
+int embedlet_append_batch(embedlet_store_t *store, const float *data,
+                          size_t count, size_t *ids_out) {
+  if (!store || (!data && count > 0)) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+  if (count == 0)
+    return EMBEDLET_OK;
+
+  embedlet_mutex_lock(&store->mutex);
+
+  size_t dims = store->dims;
+  size_t first = embedlet_count(store);
+  int err = embedlet_ensure_capacity(store, first + count);
+  if (err != EMBEDLET_OK) {
+    embedlet_mutex_unlock(&store->mutex);
+    return err;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    size_t id = first + i;
+    embedlet_norms_set(store, id,
+                       embedlet_row_encode(store, id, data + i * dims));
+    embedlet_bits_set(store, id, data + i * dims);
+    embedlet_prefix_set(store, id, data + i * dims);
+    embedlet_blocks_set(store, id);
+    embedlet_live_set(store, id, true);
+  }
+  embedlet_offload_write(store, first, count);
+
+  /* Publish the whole batch at once */
+  embedlet_atomic_release_u64(&store->header->count, first + count);
+
+  for (size_t i = 0; store->hnsw_ctx && i < count; i++)
+    embedlet_hnsw_link(store, first + i);
+
+  embedlet_mutex_unlock(&store->mutex);
+
+  if (ids_out) {
+    for (size_t i = 0; i < count; i++)
+      ids_out[i] = first + i;
+  }
+  return EMBEDLET_OK;
+}
+
+int embedlet_replace(embedlet_store_t *store, size_t id, const float *data) {
+  if (!store || !data) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+
+  embedlet_mutex_lock(&store->mutex);
+
+  size_t count = embedlet_count(store);
+  if (id >= count) {
+    embedlet_mutex_unlock(&store->mutex);
+    return EMBEDLET_ERR_INVALID_ID;
+  }
+
+  if (store->hnsw_ctx && embedlet_live_test(store->live, id))
+    embedlet_hnsw_unlink(store, id);
+
+  embedlet_norms_set(store, id, embedlet_row_encode(store, id, data));
+  embedlet_bits_set(store, id, data);
+  embedlet_prefix_set(store, id, data);
+  embedlet_blocks_set(store, id);
+  embedlet_live_set(store, id, true);
+  embedlet_offload_write(store, id, 1);
+
+  embedlet_hnsw_link(store, id);
+  embedlet_ivf_update(store, id, data);
+
+  embedlet_mutex_unlock(&store->mutex);
+  return EMBEDLET_OK;
+}
+
+int embedlet_delete(embedlet_store_t *store, size_t id) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+
+  embedlet_mutex_lock(&store->mutex);
+
+  size_t count = embedlet_count(store);
+  if (id >= count) {
+    embedlet_mutex_unlock(&store->mutex);
+    return EMBEDLET_ERR_INVALID_ID;
+  }
+
+  if (!embedlet_live_test(store->live, id)) {
+    embedlet_mutex_unlock(&store->mutex);
+    return EMBEDLET_OK;
+  }
+
+  int err = embedlet_free_push(store, id);
+  if (err != EMBEDLET_OK) {
+    embedlet_mutex_unlock(&store->mutex);
+    return err;
+  }
+
+  if (store->hnsw_ctx)
+    embedlet_hnsw_unlink(store, id);
+
+  memset((char *)store->data + id * store->row_bytes, 0,
+         embedlet_embedding_size(store));
+  embedlet_norms_set(store, id, 0.0f);
+  embedlet_bits_set(store, id, NULL);
+  embedlet_prefix_set(store, id, NULL);
+  embedlet_blocks_set(store, id);
+  embedlet_live_set(store, id, false);
+  embedlet_offload_write(store, id, 1);
+
+  embedlet_mutex_unlock(&store->mutex);
+  return EMBEDLET_OK;
+}
+
+const float *embedlet_get(const embedlet_store_t *store, size_t id) {
+  if (!store || !store->data || store->dtype != EMBEDLET_DTYPE_F32)
+    return NULL;
+  size_t count = embedlet_count(store);
+  if (id >= count)
+    return NULL;
+  return store->data + id * store->dims;
+}
+
+int embedlet_get_copy(const embedlet_store_t *store, size_t id, float *out) {
+  if (!store || !store->data || !out)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (id >= embedlet_count(store))
+    return EMBEDLET_ERR_INVALID_ID;
+  embedlet_row_decode(store, id, out);
+  return EMBEDLET_OK;
+}
+
+bool embedlet_is_zeroed(const embedlet_store_t *store, size_t id) {
+  if (!store || !store->data || id >= embedlet_count(store))
+    return true;
+  return !embedlet_live_test(store->live, id);
+}
+
+float embedlet_similarity(const embedlet_store_t *store, const float *a,
+                          const float *b) {
+  if (!store || !a || !b)
+    return 0.0f;
+  return embedlet_similarity_raw(a, b, store->dims);
+}
+
+float embedlet_similarity_raw(const float *a, const float *b, size_t dims) {
+  if (!a || !b || dims == 0)
+    return 0.0f;
 
-#if EMBEDLET_WINDOWS
-static DWORD WINAPI embedlet_pool_worker(LPVOID arg) {
-#else
-static void *embedlet_pool_worker(void *arg) {
-#endif
-  embedlet_pool_t *pool = (embedlet_pool_t *)arg;
+  embedlet_simd_init();
 
-  for (;;) {
-#if EMBEDLET_WINDOWS
-    EnterCriticalSection(&pool->mutex);
-    while (!pool->shutdown && pool->work_head == NULL) {
-      SleepConditionVariableCS(&pool->cond_work, &pool->mutex, INFINITE);
-    }
-#else
-    pthread_mutex_lock(&pool->mutex);
-    while (!pool->shutdown && pool->work_head == NULL) {
-      pthread_cond_wait(&pool->cond_work, &pool->mutex);
-    }
-#endif
-    if (pool->shutdown && pool->work_head == NULL) {
-#if EMBEDLET_WINDOWS
-      LeaveCriticalSection(&pool->mutex);
-      return 0;
-#else
-      pthread_mutex_unlock(&pool->mutex);
-      return NULL;
-#endif
-    }
+  float dot = embedlet_dot(a, b, dims);
+  float na = embedlet_norm(a, dims);
+  float nb = embedlet_norm(b, dims);
 
-    embedlet_work_t *work = pool->work_head;
-    if (work) {
-      pool->work_head = work->next;
-      if (!pool->work_head)
-        pool->work_tail = NULL;
-      pool->active_count++;
-    }
-#if EMBEDLET_WINDOWS
-    LeaveCriticalSection(&pool->mutex);
-#else
-    pthread_mutex_unlock(&pool->mutex);
-#endif
+  if (na < FLT_EPSILON || nb < FLT_EPSILON)
+    return 0.0f;
+  return dot / (na * nb);
+}
 
-    if (work) {
-      work->func(work->arg);
-      free(work);
+float embedlet_score_raw(const float *a, const float *b, size_t dims,
+                         int metric) {
+  if (!a || !b || dims == 0)
+    return 0.0f;
 
-#if EMBEDLET_WINDOWS
-      EnterCriticalSection(&pool->mutex);
-      pool->active_count--;
-      pool->pending_count--;
-      if (pool->pending_count == 0 && pool->active_count == 0) {
-        WakeAllConditionVariable(&pool->cond_done);
-      }
-      LeaveCriticalSection(&pool->mutex);
-#else
-      pthread_mutex_lock(&pool->mutex);
-      pool->active_count--;
-      pool->pending_count--;
-      if (pool->pending_count == 0 && pool->active_count == 0) {
-        pthread_cond_broadcast(&pool->cond_done);
-      }
-      pthread_mutex_unlock(&pool->mutex);
-#endif
+  embedlet_simd_init();
+
+  switch (metric) {
+  case EMBEDLET_METRIC_COSINE:
+    return embedlet_similarity_raw(a, b, dims);
+  case EMBEDLET_METRIC_INNER_PRODUCT:
+    return embedlet_dot(a, b, dims);
+  case EMBEDLET_METRIC_L2: {
+    float dist = 0.0f;
+    for (size_t i = 0; i < dims; i++)
+      dist += (a[i] - b[i]) * (a[i] - b[i]);
+    return dist;
+  }
+  case EMBEDLET_METRIC_HAMMING: {
+    uint32_t dist = 0;
+    for (size_t i = 0; i < dims; i++)
+      dist += (a[i] > 0.0f) != (b[i] > 0.0f);
+    return (float)dist;
+  }
+  default:
+    return 0.0f;
+  }
+}
+
+/* One past the last live row below `end`, from the bitmap a word at a time */
+static size_t embedlet_live_end(const embedlet_store_t *store, size_t end) {
+  while (end > 0) {
+    size_t i = end - 1;
+    uint64_t word = store->live[i >> 6] & (UINT64_MAX >> (63 - (i & 63)));
+    if (word != 0) {
+      while (!((word >> (end - 1 - (i & ~(size_t)63))) & 1u))
+        end--;
+      break;
     }
+    end = i & ~(size_t)63;
   }
+  return end;
 }
 
-static embedlet_pool_t *embedlet_pool_create(int num_threads) {
-  if (num_threads <= 0)
-    return NULL;
+int embedlet_compact(embedlet_store_t *store) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
 
-  embedlet_pool_t *pool = (embedlet_pool_t *)calloc(1, sizeof(embedlet_pool_t));
-  if (!pool)
-    return NULL;
+  embedlet_mutex_lock(&store->mutex);
 
-  pool->num_threads = num_threads;
-  pool->shutdown = false;
-  pool->active_count = 0;
-  pool->pending_count = 0;
-  pool->work_head = NULL;
-  pool->work_tail = NULL;
+  size_t count = embedlet_count(store);
+  size_t last_live = embedlet_live_end(store, count);
 
-#if EMBEDLET_WINDOWS
-  InitializeCriticalSection(&pool->mutex);
-  InitializeConditionVariable(&pool->cond_work);
-  InitializeConditionVariable(&pool->cond_done);
-  pool->threads = (HANDLE *)calloc((size_t)num_threads, sizeof(HANDLE));
-  if (!pool->threads) {
-    DeleteCriticalSection(&pool->mutex);
-    free(pool);
-    return NULL;
+  /* Doubling never leaves a file twice its rows; a vacuum can */
+  if (last_live < count ||
+      embedlet_file_bytes(store, count) * 2 < store->file.size) {
+    int err = embedlet_truncate_rows(store, last_live);
+    if (err != EMBEDLET_OK) {
+      embedlet_mutex_unlock(&store->mutex);
+      return err;
+    }
   }
 
-  int created = 0;
-  for (int i = 0; i < num_threads; i++) {
-    pool->threads[i] =
-        CreateThread(NULL, 0, embedlet_pool_worker, pool, 0, NULL);
-    if (pool->threads[i] == NULL) {
-      EnterCriticalSection(&pool->mutex);
-      pool->shutdown = true;
-      WakeAllConditionVariable(&pool->cond_work);
-      LeaveCriticalSection(&pool->mutex);
+  embedlet_mutex_unlock(&store->mutex);
+  return EMBEDLET_OK;
+}
 
-      for (int j = 0; j < created; j++) {
-        WaitForSingleObject(pool->threads[j], INFINITE);
-        CloseHandle(pool->threads[j]);
-      }
+/*
+ * Copy live row `from` into deleted slot `to`, log it, then delete `from`.
+ * Nothing waits for searches in flight, which may miss the row (see
+ * embedlet_vacuum()).
+ */
+static int embedlet_move_row(embedlet_store_t *store, size_t from, size_t to,
+                             float *scratch) {
+  uint64_t entries = store->moves_header->rows;
+  int err = embedlet_map_reserve(&store->moves_file,
+                                 sizeof(embedlet_sidecar_header_t) +
+                                     (entries + 1) * 2 * sizeof(uint64_t));
+  embedlet_refresh_pointers(store);
+  if (err != EMBEDLET_OK)
+    return err;
 
-      DeleteCriticalSection(&pool->mutex);
-      free(pool->threads);
-      free(pool);
-      return NULL;
-    }
-    created++;
+  /* The encoded row is copied as is, so scores do not change */
+  size_t words = store->bits_words;
+  memcpy((char *)store->data + to * store->row_bytes,
+         (const char *)store->data + from * store->row_bytes,
+         store->row_bytes);
+  store->norms[to] = store->norms[from];
+  memcpy(store->bits + to * words, store->bits + from * words,
+         words * sizeof(uint64_t));
+  if (store->prefix_header)
+    memcpy(store->prefix + to * store->prefix_row_bytes,
+           store->prefix + from * store->prefix_row_bytes,
+           store->prefix_row_bytes);
+  embedlet_blocks_set(store, to);
+  embedlet_live_set(store, to, true);
+  embedlet_offload_write(store, to, 1);
+
+  if (store->hnsw_ctx)
+    err = embedlet_hnsw_insert(store, to);
+  if (err != EMBEDLET_OK)
+    return err; /* both copies stay live; the next vacuum retries */
+  if (scratch) {
+    embedlet_row_decode(store, to, scratch);
+    embedlet_ivf_update(store, to, scratch);
   }
-#else
-  pthread_mutex_init(&pool->mutex, NULL);
-  pthread_cond_init(&pool->cond_work, NULL);
-  pthread_cond_init(&pool->cond_done, NULL);
-  pool->threads = (pthread_t *)calloc((size_t)num_threads, sizeof(pthread_t));
-  if (!pool->threads) {
-    pthread_mutex_destroy(&pool->mutex);
-    pthread_cond_destroy(&pool->cond_work);
-    pthread_cond_destroy(&pool->cond_done);
-    free(pool);
-    return NULL;
+
+  store->moves[2 * entries] = from;
+  store->moves[2 * entries + 1] = to;
+  store->moves_header->rows = entries + 1;
+
+  if (store->hnsw_ctx)
+    embedlet_hnsw_unlink(store, from);
+  memset((char *)store->data + from * store->row_bytes, 0, store->row_bytes);
+  embedlet_norms_set(store, from, 0.0f);
+  embedlet_bits_set(store, from, NULL);
+  embedlet_prefix_set(store, from, NULL);
+  embedlet_blocks_set(store, from);
+  embedlet_live_set(store, from, false);
+  embedlet_offload_write(store, from, 1);
+  return EMBEDLET_OK;
+}
+
+int embedlet_vacuum(embedlet_store_t *store, size_t max_moves,
+                    size_t *moved_out) {
+  if (moved_out)
+    *moved_out = 0;
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+
+  /* Rows scored from the IVF index are re-encoded from a decoded copy */
+  float *scratch = NULL;
+  if (store->ivf_header && store->ivf_header->nlist > 0) {
+    scratch = (float *)malloc(store->dims * sizeof(float));
+    if (!scratch)
+      return EMBEDLET_ERR_ALLOC;
   }
-  for (int i = 0; i < num_threads; i++) {
-    int ret =
-        pthread_create(&pool->threads[i], NULL, embedlet_pool_worker, pool);
-    if (ret != 0) {
-      pthread_mutex_lock(&pool->mutex);
-      pool->shutdown = true;
-      pthread_cond_broadcast(&pool->cond_work);
-      pthread_mutex_unlock(&pool->mutex);
-
-      for (int j = 0; j < i; j++) {
-        pthread_join(pool->threads[j], NULL);
-      }
-      pthread_mutex_destroy(&pool->mutex);
-      pthread_cond_destroy(&pool->cond_work);
-      pthread_cond_destroy(&pool->cond_done);
-      free(pool->threads);
-      free(pool);
-      return NULL;
+
+  embedlet_mutex_lock(&store->mutex);
+  int err = embedlet_moves_open(store, true);
+  size_t count = embedlet_count(store);
+  size_t end = embedlet_live_end(store, count);
+  size_t moved = 0;
+  size_t hole;
+  while (err == EMBEDLET_OK && (max_moves == 0 || moved < max_moves) &&
+         embedlet_free_pop(store, end, &hole)) {
+    /* The last live row fills the lowest hole below it */
+    err = embedlet_move_row(store, end - 1, hole, scratch);
+    if (err != EMBEDLET_OK) {
+      if (!embedlet_live_test(store->live, hole))
+        embedlet_free_push(store, hole);
+      break;
     }
+    moved++;
+    end = embedlet_live_end(store, end - 1);
   }
-#endif
 
-  return pool;
+  /* Searches that start from here on stop at the last live row */
+  if (end < count)
+    embedlet_trim_rows(store, end);
+  embedlet_mutex_unlock(&store->mutex);
+
+  free(scratch);
+  if (moved_out)
+    *moved_out = moved;
+  return err;
 }
 
-static void embedlet_pool_submit(embedlet_pool_t *pool, void (*func)(void *),
-                                 void *arg) {
-  embedlet_work_t *work = (embedlet_work_t *)malloc(sizeof(embedlet_work_t));
-  if (!work)
-    return;
+size_t embedlet_move_count(const embedlet_store_t *store) {
+  if (!store || !store->moves_header)
+    return 0;
+  return (size_t)store->moves_header->rows;
+}
 
-  work->func = func;
-  work->arg = arg;
-  work->next = NULL;
+int embedlet_get_moves(const embedlet_store_t *store, size_t first,
+                       size_t max, embedlet_move_t *moves_out,
+                       size_t *count_out) {
+  if (!store || (!moves_out && max > 0) || !count_out)
+    return EMBEDLET_ERR_INVALID_ARG;
 
-#if EMBEDLET_WINDOWS
-  EnterCriticalSection(&pool->mutex);
-  if (pool->work_tail) {
-    pool->work_tail->next = work;
-  } else {
-    pool->work_head = work;
-  }
-  pool->work_tail = work;
-  pool->pending_count++;
-  WakeConditionVariable(&pool->cond_work);
-  LeaveCriticalSection(&pool->mutex);
-#else
-  pthread_mutex_lock(&pool->mutex);
-  if (pool->work_tail) {
-    pool->work_tail->next = work;
-  } else {
-    pool->work_head = work;
+  /* A reader only sees the entries its view of the log covers */
+  size_t total = embedlet_move_count(store);
+  size_t mapped = store->moves_file.capacity >
+                          sizeof(embedlet_sidecar_header_t)
+                      ? (store->moves_file.capacity -
+                         sizeof(embedlet_sidecar_header_t)) /
+                            (2 * sizeof(uint64_t))
+                      : 0;
+  if (total > mapped)
+    total = mapped;
+  size_t count = first < total ? total - first : 0;
+  if (count > max)
+    count = max;
+  for (size_t i = 0; i < count; i++) {
+    moves_out[i].from = (size_t)store->moves[2 * (first + i)];
+    moves_out[i].to = (size_t)store->moves[2 * (first + i) + 1];
   }
-  pool->work_tail = work;
-  pool->pending_count++;
-  pthread_cond_signal(&pool->cond_work);
-  pthread_mutex_unlock(&pool->mutex);
-#endif
+  *count_out = count;
+  return EMBEDLET_OK;
 }
 
-static void embedlet_pool_wait(embedlet_pool_t *pool) {
-#if EMBEDLET_WINDOWS
-  EnterCriticalSection(&pool->mutex);
-  while (pool->pending_count > 0 || pool->active_count > 0) {
-    SleepConditionVariableCS(&pool->cond_done, &pool->mutex, INFINITE);
-  }
-  LeaveCriticalSection(&pool->mutex);
-#else
-  pthread_mutex_lock(&pool->mutex);
-  while (pool->pending_count > 0 || pool->active_count > 0) {
-    pthread_cond_wait(&pool->cond_done, &pool->mutex);
-  }
-  pthread_mutex_unlock(&pool->mutex);
-#endif
+int embedlet_clear_moves(embedlet_store_t *store) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+  embedlet_mutex_lock(&store->mutex);
+  if (store->moves_header)
+    store->moves_header->rows = 0;
+  embedlet_mutex_unlock(&store->mutex);
+  return EMBEDLET_OK;
 }
 
-static void embedlet_pool_destroy(embedlet_pool_t *pool) {
-  if (!pool)
-    return;
-
-#if EMBEDLET_WINDOWS
-  EnterCriticalSection(&pool->mutex);
-  pool->shutdown = true;
-  WakeAllConditionVariable(&pool->cond_work);
-  LeaveCriticalSection(&pool->mutex);
+int embedlet_advise(embedlet_store_t *store, int advice) {
+  if (!store || !embedlet_advice_valid(advice))
+    return EMBEDLET_ERR_INVALID_ARG;
 
-  for (int i = 0; i < pool->num_threads; i++) {
-    WaitForSingleObject(pool->threads[i], INFINITE);
-    CloseHandle(pool->threads[i]);
+  embedlet_map_t *maps[6] = {&store->file,        &store->norms_file,
+                             &store->live_file,   &store->bits_file,
+                             &store->prefix_file, &store->blocks_file};
+  int err = EMBEDLET_OK;
+  embedlet_mutex_lock(&store->mutex);
+  for (int i = 0; i < 6; i++) {
+    int e = embedlet_map_apply(maps[i], advice, maps[i]->advice);
+    if (err == EMBEDLET_OK)
+      err = e;
+    maps[i]->advice = advice;
   }
-  DeleteCriticalSection(&pool->mutex);
-#else
-  pthread_mutex_lock(&pool->mutex);
-  pool->shutdown = true;
-  pthread_cond_broadcast(&pool->cond_work);
-  pthread_mutex_unlock(&pool->mutex);
+  embedlet_mutex_unlock(&store->mutex);
+  return err;
+}
 
-  for (int i = 0; i < pool->num_threads; i++) {
-    pthread_join(pool->threads[i], NULL);
-  }
-  pthread_mutex_destroy(&pool->mutex);
-  pthread_cond_destroy(&pool->cond_work);
-  pthread_cond_destroy(&pool->cond_done);
-#endif
+/* Pages of one mapping for embedlet_warm() */
+typedef struct {
+  const volatile uint8_t *base;
+  size_t page;
+} embedlet_warm_ctx_t;
+
+static int embedlet_warm_pages(void *ctx, size_t start, size_t end) {
+  const embedlet_warm_ctx_t *w = (const embedlet_warm_ctx_t *)ctx;
+  for (size_t p = start; p < end; p++)
+    (void)w->base[p * w->page]; /* a read fault maps the page cache page */
+  return EMBEDLET_OK;
+}
 
-  embedlet_work_t *work = pool->work_head;
-  while (work) {
-    embedlet_work_t *next = work->next;
-    free(work);
-    work = next;
+int embedlet_warm(embedlet_store_t *store, int num_threads) {
+  if (!store)
+    return EMBEDLET_ERR_INVALID_ARG;
+
+  /* Snapshot the views; growth keeps the old pages mapped meanwhile */
+  embedlet_mutex_lock(&store->mutex);
+  size_t count = embedlet_count(store);
+  embedlet_warm_ctx_t ctx[6];
+  size_t bytes[6] = {embedlet_file_bytes(store, count),
+                     embedlet_norms_bytes(count),
+                     embedlet_live_bytes(count),
+                     embedlet_bits_bytes(store, count),
+                     embedlet_prefix_bytes(store, count),
+                     embedlet_blocks_bytes(store, count)};
+  const embedlet_map_t *maps[6] = {&store->file,        &store->norms_file,
+                                   &store->live_file,   &store->bits_file,
+                                   &store->prefix_file, &store->blocks_file};
+  size_t page = embedlet_page_size();
+  for (int i = 0; i < 6; i++) {
+    ctx[i].base = (const volatile uint8_t *)maps[i]->data;
+    ctx[i].page = page;
+    if (!ctx[i].base || bytes[i] > maps[i]->capacity)
+      bytes[i] = 0;
   }
+  embedlet_mutex_unlock(&store->mutex);
 
-  free(pool->threads);
-  free(pool);
+  size_t pages = (bytes[0] + page - 1) / page;
+  int threads = embedlet_resolve_threads(num_threads, pages ? pages : 1);
+  embedlet_pool_t *pool = NULL;
+  int err = EMBEDLET_OK;
+  if (threads > 1)
+    err = embedlet_acquire_pool(store, &threads, &pool);
+  for (int i = 0; i < 6 && err == EMBEDLET_OK; i++) {
+    if (bytes[i] > 0)
+      err = embedlet_run_ranges(pool, threads, (bytes[i] + page - 1) / page,
+                                embedlet_warm_pages, &ctx[i]);
+  }
+  embedlet_return_pool(store, pool);
+  return err;
 }
 
-static int embedlet_get_cpu_count(void) {
-#if EMBEDLET_WINDOWS
-  SYSTEM_INFO sysinfo;
-  GetSystemInfo(&sysinfo);
-  return (int)sysinfo.dwNumberOfProcessors;
-#else
-  long count = sysconf(_SC_NPROCESSORS_ONLN);
-  return count > 0 ? (int)count : 1;
-#endif
+int embedlet_search(embedlet_store_t *store, const float *query, size_t n,
+                    bool most_similar, int num_threads,
+                    embedlet_result_t *results, size_t *count_out) {
+  return embedlet_search_filtered(store, query, n, most_similar, num_threads,
+                                  NULL, results, count_out);
 }
 
-/*----------------------------------------------------------------------------
- * Similarity Functions (C + optional SSE2)
- *----------------------------------------------------------------------------*/
+int embedlet_search_filtered(embedlet_store_t *store, const float *query,
+                             size_t n, bool most_similar, int num_threads,
+                             const embedlet_filter_t *filter,
+                             embedlet_result_t *results, size_t *count_out) {
+  if (!store || !query || n == 0 || !results || !count_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  if (filter && !filter->bits && !filter->predicate)
+    filter = NULL;
 
-#if EMBEDLET_HAS_SSE2
+  size_t total = embedlet_search_rows(store);
+  if (total == 0) {
+    *count_out = 0;
+    return EMBEDLET_OK;
+  }
+  if (!filter && embedlet_offload_search(store, query, 1, n, most_similar,
+                                         results, count_out) == EMBEDLET_OK)
+    return EMBEDLET_OK;
 
-static float embedlet_hsum_sse(__m128 v) {
-  __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
-  __m128 sums = _mm_add_ps(v, shuf);
-  shuf = _mm_movehl_ps(shuf, sums);
-  sums = _mm_add_ss(sums, shuf);
-  return _mm_cvtss_f32(sums);
-}
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
 
-static float embedlet_dot_sse2(const float *a, const float *b, size_t n) {
-  __m128 sum = _mm_setzero_ps();
-  size_t i = 0;
+  bool highest = embedlet_keep_highest(store->metric, most_similar);
+  embedlet_search_task_t task;
+  task.store = store;
+  task.query = query;
+  task.query_norm = embedlet_norm(query, store->dims);
+  task.query_sum = embedlet_query_sum(query, store->dims);
+  task.ivf = NULL;
+  task.filter = filter;
+  task.n = n;
+  task.most_similar = highest;
+  memset(&task.stats, 0, sizeof(task.stats));
+
+  embedlet_stats_t delta;
+  embedlet_stats_t *stats = embedlet_stats_begin(store, &delta);
+  int threads = embedlet_resolve_threads(num_threads, total);
+  uint64_t *query_bits;
+  int err = embedlet_query_codes(store, arena, query, 1, &query_bits);
+  task.query_bits = query_bits;
+  task.rows = total;
+  if (err == EMBEDLET_OK && store->blocks_header &&
+      store->metric != EMBEDLET_METRIC_HAMMING) {
+    /* Blocks of the blocked copy are claimed like rows of the store */
+    size_t blocks = (total + EMBEDLET_BLOCK_ROWS - 1) / EMBEDLET_BLOCK_ROWS;
+    size_t grain = embedlet_block_rows(store->row_bytes) / EMBEDLET_BLOCK_ROWS;
+    err = embedlet_run_search(store, &task,
+                              embedlet_block_workers[store->metric], threads,
+                              blocks, grain ? grain : 1, arena, results,
+                              count_out, stats, store->row_bytes);
+  } else if (err == EMBEDLET_OK) {
+    err = embedlet_run_search(store, &task,
+                              embedlet_search_workers[store->metric], threads,
+                              total, embedlet_block_rows(store->row_bytes),
+                              arena, results, count_out, stats,
+                              embedlet_scan_row_bytes(store));
+  }
+  embedlet_arena_release(store, arena);
+  if (err != EMBEDLET_OK)
+    return err;
 
-  for (; i + 4 <= n; i += 4) {
-    __m128 va = _mm_loadu_ps(a + i);
-    __m128 vb = _mm_loadu_ps(b + i);
-    sum = _mm_add_ps(sum, _mm_mul_ps(va, vb));
+  uint64_t sort_start = stats ? embedlet_now_ns() : 0;
+  embedlet_sort_results(results, *count_out, highest);
+  if (stats) {
+    stats->merge_ns += embedlet_now_ns() - sort_start;
+    embedlet_stats_commit(store, filter ? "search_filtered" : "search",
+                          stats);
   }
+  return EMBEDLET_OK;
+}
 
-  float result = embedlet_hsum_sse(sum);
+/*----------------------------------------------------------------------------
+ * Asynchronous Search
+ *----------------------------------------------------------------------------*/
 
-  for (; i < n; i++) {
-    result += a[i] * b[i];
+/*
+ * Merge the participants' heaps, publish the result and notify. Run by
+ * whichever participant finishes last; a job without a handle is freed
+ * here, otherwise embedlet_job_release() frees it.
+ */
+static void embedlet_job_finish(embedlet_job_t *job) {
+  embedlet_topn_t top;
+  embedlet_topn_init(&top, job->merged, job->n, job->most_similar);
+  for (int i = 0; i < job->num_parts; i++) {
+    const embedlet_search_task_t *task = &job->parts[i].task;
+    for (size_t j = 0; j < task->result_count; j++)
+      embedlet_topn_push(&top, task->local_results[j].id,
+                         task->local_results[j].score);
+  }
+  size_t count = embedlet_topn_finish(&top);
+  if (job->merged != job->results)
+    memcpy(job->results, job->merged, count * sizeof(embedlet_result_t));
+  embedlet_sort_results(job->results, count, job->most_similar);
+
+  int status = embedlet_atomic_load(&job->cancel) ? EMBEDLET_ERR_CANCELLED
+                                                  : EMBEDLET_OK;
+  if (job->callback)
+    job->callback(job->user_data, status, job->results, count);
+
+  if (!job->has_handle) {
+    embedlet_return_pool(job->store, job->pool);
+    embedlet_arena_release(job->store, job->arena);
+    return;
   }
+  embedlet_pool_t *pool = job->pool;
+  if (pool)
+    embedlet_mutex_lock(&pool->mutex);
+  job->status = status;
+  job->count = count;
+  job->done = true;
+  if (pool) {
+    embedlet_cond_broadcast(&pool->cond_done);
+    embedlet_mutex_unlock(&pool->mutex);
+  }
+}
 
-  return result;
+static void embedlet_job_run(void *arg) {
+  embedlet_job_part_t *part = (embedlet_job_part_t *)arg;
+  embedlet_job_t *job = part->job;
+  embedlet_search_workers[job->store->metric](&part->task);
+  if (embedlet_atomic_fetch_add(&job->remaining, (size_t)-1) == 1)
+    embedlet_job_finish(job);
 }
 
-static float embedlet_norm_sse2(const float *a, size_t n) {
-  __m128 sum = _mm_setzero_ps();
-  size_t i = 0;
+int embedlet_search_async(embedlet_store_t *store, const float *query,
+                          size_t n, bool most_similar, int num_threads,
+                          embedlet_result_t *results,
+                          embedlet_search_callback_t callback, void *user_data,
+                          embedlet_job_t **job_out) {
+  if (!store || !query || n == 0 || !results || (!callback && !job_out)) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
 
-  for (; i + 4 <= n; i += 4) {
-    __m128 va = _mm_loadu_ps(a + i);
-    sum = _mm_add_ps(sum, _mm_mul_ps(va, va));
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
+  embedlet_job_t *job =
+      (embedlet_job_t *)embedlet_arena_alloc(arena, sizeof(embedlet_job_t));
+  float *query_copy =
+      (float *)embedlet_arena_alloc(arena, store->dims * sizeof(float));
+  if (!job || !query_copy) {
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  memcpy(query_copy, query, store->dims * sizeof(float));
+  memset(job, 0, sizeof(*job));
+  job->store = store;
+  job->arena = arena;
+  job->results = results;
+  job->merged = results;
+  job->n = n;
+  job->most_similar = embedlet_keep_highest(store->metric, most_similar);
+  job->callback = callback;
+  job->user_data = user_data;
+  job->has_handle = job_out != NULL;
+
+  size_t total = embedlet_search_rows(store);
+  if (total == 0) {
+    if (job_out)
+      *job_out = job;
+    embedlet_job_finish(job);
+    return EMBEDLET_OK;
   }
 
-  float result = embedlet_hsum_sse(sum);
+  size_t grain = embedlet_block_rows(store->row_bytes);
+  size_t blocks = (total + grain - 1) / grain;
+  int threads = embedlet_resolve_threads(num_threads, blocks);
+  int err = embedlet_acquire_pool(store, &threads, &job->pool);
+  if (err != EMBEDLET_OK) {
+    embedlet_arena_release(store, arena);
+    return err;
+  }
 
-  for (; i < n; i++) {
-    result += a[i] * a[i];
+  size_t cap = embedlet_topn_capacity(n);
+  job->parts = (embedlet_job_part_t *)embedlet_arena_alloc(
+      arena, (size_t)threads * sizeof(embedlet_job_part_t));
+  embedlet_slice_t *slices = (embedlet_slice_t *)embedlet_arena_alloc(
+      arena, (size_t)threads * sizeof(embedlet_slice_t));
+  if (cap > n)
+    job->merged = (embedlet_result_t *)embedlet_arena_alloc(
+        arena, cap * sizeof(embedlet_result_t));
+  if (!job->parts || !slices || !job->merged) {
+    embedlet_return_pool(store, job->pool);
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  uint64_t *query_bits;
+  err = embedlet_query_codes(store, arena, query_copy, 1, &query_bits);
+  if (err != EMBEDLET_OK) {
+    embedlet_return_pool(store, job->pool);
+    embedlet_arena_release(store, arena);
+    return err;
   }
+  embedlet_steal_init(&job->steal, slices, threads, total, grain);
+  job->steal.stop = &job->cancel;
 
-  return sqrtf(result);
+  for (int i = 0; i < threads; i++) {
+    embedlet_search_task_t *task = &job->parts[i].task;
+    job->parts[i].job = job;
+    task->store = store;
+    task->query = query_copy;
+    task->query_norm = embedlet_norm(query_copy, store->dims);
+    task->query_sum = embedlet_query_sum(query_copy, store->dims);
+    task->query_bits = query_bits;
+    task->ivf = NULL;
+    task->filter = NULL;
+    memset(&task->stats, 0, sizeof(task->stats));
+    task->steal = &job->steal;
+    task->slot = i;
+    task->n = n;
+    task->most_similar = job->most_similar;
+    task->result_count = 0;
+    task->local_results = (embedlet_result_t *)embedlet_arena_alloc(
+        arena, cap * sizeof(embedlet_result_t));
+    if (!task->local_results) {
+      embedlet_return_pool(store, job->pool);
+      embedlet_arena_release(store, arena);
+      return EMBEDLET_ERR_ALLOC;
+    }
+  }
+  job->num_parts = threads;
+  job->remaining = (size_t)threads;
+  if (job_out)
+    *job_out = job;
+
+  /* Parts the pool could not queue run here, before returning */
+  int workers;
+  int queued = embedlet_pool_post(job->pool, &store->pool_client,
+                                  embedlet_job_run, job->parts,
+                                  sizeof(embedlet_job_part_t), threads, NULL,
+                                  &workers);
+  for (int i = queued; i < threads; i++)
+    embedlet_job_run(&job->parts[i]);
+  return EMBEDLET_OK;
 }
 
-#endif /* EMBEDLET_HAS_SSE2 */
-
-static float embedlet_dot_c(const float *a, const float *b, size_t n) {
-  float sum = 0.0f;
-  for (size_t i = 0; i < n; i++) {
-    sum += a[i] * b[i];
-  }
-  return sum;
+int embedlet_job_poll(embedlet_job_t *job, size_t *count_out) {
+  if (!job)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (job->pool)
+    embedlet_mutex_lock(&job->pool->mutex);
+  bool done = job->done;
+  if (job->pool)
+    embedlet_mutex_unlock(&job->pool->mutex);
+  if (!done)
+    return EMBEDLET_PENDING;
+  if (count_out)
+    *count_out = job->count;
+  return job->status;
 }
 
-static float embedlet_norm_c(const float *a, size_t n) {
-  float sum = 0.0f;
-  for (size_t i = 0; i < n; i++) {
-    sum += a[i] * a[i];
+int embedlet_job_wait(embedlet_job_t *job, size_t *count_out) {
+  if (!job)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (job->pool) {
+    embedlet_mutex_lock(&job->pool->mutex);
+    while (!job->done)
+      embedlet_cond_wait(&job->pool->cond_done, &job->pool->mutex);
+    embedlet_mutex_unlock(&job->pool->mutex);
   }
-  return sqrtf(sum);
+  if (count_out)
+    *count_out = job->count;
+  return job->status;
 }
 
-static float embedlet_dot(const float *a, const float *b, size_t n) {
-#if EMBEDLET_HAS_SSE2
-  return embedlet_dot_sse2(a, b, n);
-#else
-  return embedlet_dot_c(a, b, n);
-#endif
+int embedlet_job_cancel(embedlet_job_t *job) {
+  if (!job)
+    return EMBEDLET_ERR_INVALID_ARG;
+  embedlet_atomic_fetch_add(&job->cancel, 1);
+  return EMBEDLET_OK;
 }
 
-static float embedlet_norm(const float *a, size_t n) {
-#if EMBEDLET_HAS_SSE2
-  return embedlet_norm_sse2(a, n);
-#else
-  return embedlet_norm_c(a, n);
-#endif
+int embedlet_job_release(embedlet_job_t *job) {
+  if (!job)
+    return EMBEDLET_ERR_INVALID_ARG;
+  embedlet_job_wait(job, NULL);
+  embedlet_return_pool(job->store, job->pool);
+  embedlet_arena_release(job->store, job->arena);
+  return EMBEDLET_OK;
 }
 
-/*----------------------------------------------------------------------------
- * Platform-Specific File/Mmap Operations
- *----------------------------------------------------------------------------*/
+int embedlet_search_range(embedlet_store_t *store, const float *query,
+                          float threshold, size_t max_results,
+                          int num_threads, embedlet_result_t **results_out,
+                          size_t *count_out) {
+  if (!store || !query || !results_out || !count_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  *results_out = NULL;
+  *count_out = 0;
+
+  size_t total = embedlet_search_rows(store);
+  if (total == 0)
+    return EMBEDLET_OK;
+
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
+
+  size_t grain = embedlet_block_rows(store->row_bytes);
+  size_t blocks = (total + grain - 1) / grain;
+  int threads = embedlet_resolve_threads(num_threads, blocks);
+  embedlet_pool_t *pool = NULL;
+  int err = EMBEDLET_OK;
+  if (threads > 1)
+    err = embedlet_acquire_pool(store, &threads, &pool);
+
+  uint64_t *query_bits = NULL;
+  if (err == EMBEDLET_OK)
+    err = embedlet_query_codes(store, arena, query, 1, &query_bits);
+  embedlet_threshold_task_t *tasks = NULL;
+  embedlet_slice_t *slices = NULL;
+  if (err == EMBEDLET_OK) {
+    tasks = (embedlet_threshold_task_t *)embedlet_arena_alloc(
+        arena, (size_t)threads * sizeof(embedlet_threshold_task_t));
+    slices = (embedlet_slice_t *)embedlet_arena_alloc(
+        arena, (size_t)threads * sizeof(embedlet_slice_t));
+    if (!tasks || !slices)
+      err = EMBEDLET_ERR_ALLOC;
+  }
+  if (err != EMBEDLET_OK) {
+    embedlet_return_pool(store, pool);
+    embedlet_arena_release(store, arena);
+    return err;
+  }
 
-#if EMBEDLET_WINDOWS
+  volatile size_t hits = 0, stop = 0;
+  embedlet_steal_t steal;
+  embedlet_steal_init(&steal, slices, threads, total, grain);
+  steal.stop = &stop;
+  for (int i = 0; i < threads; i++) {
+    memset(&tasks[i], 0, sizeof(tasks[i]));
+    tasks[i].store = store;
+    tasks[i].query = query;
+    tasks[i].query_norm = embedlet_norm(query, store->dims);
+    tasks[i].query_sum = embedlet_query_sum(query, store->dims);
+    tasks[i].query_bits = query_bits;
+    tasks[i].steal = &steal;
+    tasks[i].slot = i;
+    tasks[i].threshold = threshold;
+    tasks[i].sign = embedlet_keep_highest(store->metric, true) ? 1.0f : -1.0f;
+    tasks[i].limit = max_results;
+    tasks[i].hits = &hits;
+  }
 
-static int embedlet_file_open(embedlet_store_t *store, const char *path) {
-  store->file_handle =
-      CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
-                  OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-  if (store->file_handle == INVALID_HANDLE_VALUE) {
-    return EMBEDLET_ERR_FILE_OPEN;
+  embedlet_stats_t delta;
+  embedlet_stats_t *stats = embedlet_stats_begin(store, &delta);
+  uint64_t posted = stats ? embedlet_now_ns() : 0;
+  for (int i = 0; i < threads; i++)
+    tasks[i].stats.posted_ns = posted;
+
+  void (*worker)(void *) = embedlet_range_workers[store->metric];
+  if (threads == 1)
+    worker(&tasks[0]);
+  else
+    embedlet_pool_run(pool, &store->pool_client, worker, tasks,
+                      sizeof(embedlet_threshold_task_t), threads);
+  embedlet_return_pool(store, pool);
+
+  uint64_t merge_start = 0;
+  if (stats) {
+    for (int i = 0; i < threads; i++)
+      embedlet_scan_collect(stats, &tasks[i].stats,
+                            embedlet_scan_row_bytes(store));
+    merge_start = embedlet_now_ns();
   }
 
-  LARGE_INTEGER size;
-  if (!GetFileSizeEx(store->file_handle, &size)) {
-    CloseHandle(store->file_handle);
-    return EMBEDLET_ERR_FILE_OPEN;
+  /* Concatenate the per-task buffers, reusing the largest as the output */
+  size_t count = 0;
+  int largest = 0;
+  for (int i = 0; i < threads; i++) {
+    if (tasks[i].failed)
+      err = EMBEDLET_ERR_ALLOC;
+    count += tasks[i].count;
+    if (tasks[i].cap > tasks[largest].cap)
+      largest = i;
+  }
+  embedlet_result_t *out = NULL;
+  if (err == EMBEDLET_OK && count > 0) {
+    out = tasks[largest].results;
+    if (count > tasks[largest].cap) {
+      out = (embedlet_result_t *)realloc(out,
+                                         count * sizeof(embedlet_result_t));
+      if (!out)
+        err = EMBEDLET_ERR_ALLOC;
+    }
+  }
+  if (out) {
+    tasks[largest].results = NULL;
+    size_t at = tasks[largest].count;
+    for (int i = 0; i < threads; i++) {
+      if (i == largest || tasks[i].count == 0)
+        continue;
+      memcpy(out + at, tasks[i].results,
+             tasks[i].count * sizeof(embedlet_result_t));
+      at += tasks[i].count;
+    }
+  }
+  for (int i = 0; i < threads; i++)
+    free(tasks[i].results);
+  embedlet_arena_release(store, arena);
+  if (err != EMBEDLET_OK) {
+    free(out);
+    return err;
   }
-  store->file_size = (size_t)size.QuadPart;
 
+  *results_out = out;
+  *count_out = count;
+  if (stats) {
+    stats->merge_ns += embedlet_now_ns() - merge_start;
+    embedlet_stats_commit(store, "search_range", stats);
+  }
   return EMBEDLET_OK;
 }
 
-static int embedlet_mmap_update(embedlet_store_t *store, size_t new_capacity) {
-  if (store->map_handle) {
-    if (store->data) {
-      UnmapViewOfFile(store->data);
-      store->data = NULL;
-    }
-    CloseHandle(store->map_handle);
-    store->map_handle = NULL;
+void embedlet_free_results(embedlet_result_t *results) { free(results); }
+
+int embedlet_search_rerank(embedlet_store_t *store, const float *query,
+                           size_t n, size_t oversample, bool most_similar,
+                           int num_threads, embedlet_result_t *results,
+                           size_t *count_out) {
+  if (!store || !query || n == 0 || !results || !count_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
   }
+  if (store->metric == EMBEDLET_METRIC_HAMMING)
+    return embedlet_search(store, query, n, most_similar, num_threads, results,
+                           count_out);
 
-  if (new_capacity == 0) {
-    store->capacity = 0;
+  size_t total = embedlet_search_rows(store);
+  if (total == 0) {
+    *count_out = 0;
     return EMBEDLET_OK;
   }
 
-  LARGE_INTEGER li;
-  li.QuadPart = (LONGLONG)new_capacity;
+  if (oversample == 0)
+    oversample = EMBEDLET_DEFAULT_OVERSAMPLE;
+  size_t keep = oversample > total / n ? total : n * oversample;
 
-  store->map_handle = CreateFileMappingA(
-      store->file_handle, NULL, PAGE_READWRITE, li.HighPart, li.LowPart, NULL);
-  if (!store->map_handle) {
-    return EMBEDLET_ERR_MMAP;
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
+  uint64_t *query_bits = (uint64_t *)embedlet_arena_alloc(
+      arena, store->bits_words * sizeof(uint64_t));
+  embedlet_result_t *candidates = (embedlet_result_t *)embedlet_arena_alloc(
+      arena, keep * sizeof(embedlet_result_t));
+  if (!query_bits || !candidates) {
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
   }
-
-  store->data = (float *)MapViewOfFile(store->map_handle, FILE_MAP_ALL_ACCESS,
-                                       0, 0, new_capacity);
-  if (!store->data) {
-    CloseHandle(store->map_handle);
-    store->map_handle = NULL;
-    return EMBEDLET_ERR_MMAP;
+  embedlet_sign_bits(query, store->dims, query_bits);
+
+  /* Stage 1: Hamming prefilter over the sign-bit sidecar */
+  embedlet_search_task_t task;
+  task.store = store;
+  task.query = query;
+  task.query_norm = 0.0f;
+  task.query_sum = 0.0f;
+  task.query_bits = query_bits;
+  task.ivf = NULL;
+  task.filter = NULL;
+  task.n = keep;
+  task.most_similar = most_similar;
+  memset(&task.stats, 0, sizeof(task.stats));
+
+  embedlet_stats_t delta;
+  embedlet_stats_t *stats = embedlet_stats_begin(store, &delta);
+  size_t num_candidates = 0;
+  int threads = embedlet_resolve_threads(num_threads, total);
+  size_t grain = embedlet_block_rows(store->bits_words * sizeof(uint64_t));
+  int err = embedlet_run_search(store, &task, embedlet_prefilter_worker,
+                                threads, total, grain, arena, candidates,
+                                &num_candidates, stats,
+                                store->bits_words * sizeof(uint64_t));
+  if (err != EMBEDLET_OK) {
+    embedlet_arena_release(store, arena);
+    return err;
   }
 
-  store->capacity = new_capacity;
+  /* Stage 2: exact scores for the survivors, visited in row order */
+  uint64_t rescore_start = stats ? embedlet_now_ns() : 0;
+  embedlet_sort_by(candidates, num_candidates, EMBEDLET_ORDER_ID);
+  float query_norm = embedlet_norm(query, store->dims);
+  float query_sum = embedlet_query_sum(query, store->dims);
+  bool highest = embedlet_keep_highest(store->metric, most_similar);
+  size_t heap_size = 0;
+  for (size_t i = 0; i < num_candidates; i++) {
+    size_t id = candidates[i].id;
+    float score = embedlet_score_exact(store, query, query_norm, query_sum, id);
+    embedlet_heap_push(results, &heap_size, n, id, score, highest);
+  }
+  embedlet_arena_release(store, arena);
+
+  embedlet_sort_results(results, heap_size, highest);
+  *count_out = heap_size;
+  if (stats) {
+    /* The rescoring pass runs on this thread, so it counts as kernel time */
+    stats->rows_scanned += num_candidates;
+    stats->bytes_touched += (uint64_t)num_candidates * store->row_bytes;
+    stats->kernel_ns += embedlet_now_ns() - rescore_start;
+    embedlet_stats_commit(store, "search_rerank", stats);
+  }
   return EMBEDLET_OK;
 }
 
-static int embedlet_file_resize(embedlet_store_t *store, size_t new_size) {
-  if (store->map_handle) {
-    if (store->data) {
-      UnmapViewOfFile(store->data);
-      store->data = NULL;
-    }
-    CloseHandle(store->map_handle);
-    store->map_handle = NULL;
+int embedlet_search_prefix(embedlet_store_t *store, const float *query,
+                           size_t n, size_t oversample, bool most_similar,
+                           int num_threads, embedlet_result_t *results,
+                           size_t *count_out) {
+  if (!store || !query || n == 0 || !results || !count_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
   }
+  if (store->metric == EMBEDLET_METRIC_HAMMING)
+    return embedlet_search(store, query, n, most_similar, num_threads, results,
+                           count_out);
+  if (!store->prefix_header)
+    return EMBEDLET_ERR_NOT_FOUND;
 
-  LARGE_INTEGER li;
-  li.QuadPart = (LONGLONG)new_size;
-  if (!SetFilePointerEx(store->file_handle, li, NULL, FILE_BEGIN)) {
-    return EMBEDLET_ERR_TRUNCATE;
-  }
-  if (!SetEndOfFile(store->file_handle)) {
-    return EMBEDLET_ERR_TRUNCATE;
+  size_t total = embedlet_search_rows(store);
+  if (total == 0) {
+    *count_out = 0;
+    return EMBEDLET_OK;
   }
 
-  store->file_size = new_size;
-  return EMBEDLET_OK;
-}
+  if (oversample == 0)
+    oversample = EMBEDLET_DEFAULT_OVERSAMPLE;
+  size_t keep = oversample > total / n ? total : n * oversample;
 
-static void embedlet_file_close(embedlet_store_t *store) {
-  if (store->data) {
-    UnmapViewOfFile(store->data);
-    store->data = NULL;
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
+  embedlet_result_t *candidates = (embedlet_result_t *)embedlet_arena_alloc(
+      arena, keep * sizeof(embedlet_result_t));
+  if (!candidates) {
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
+  }
+
+  /* Stage 1: the store's metric on the leading dims of the prefix copy */
+  size_t prefix_dims = store->prefix_dims;
+  bool highest = embedlet_keep_highest(store->metric, most_similar);
+  embedlet_search_task_t task;
+  task.store = store;
+  task.query = query;
+  task.query_norm = embedlet_norm(query, prefix_dims);
+  task.query_sum = embedlet_query_sum(query, prefix_dims);
+  task.query_bits = NULL;
+  task.ivf = NULL;
+  task.filter = NULL;
+  task.n = keep;
+  task.most_similar = highest;
+  memset(&task.stats, 0, sizeof(task.stats));
+
+  embedlet_stats_t delta;
+  embedlet_stats_t *stats = embedlet_stats_begin(store, &delta);
+  size_t num_candidates = 0;
+  int threads = embedlet_resolve_threads(num_threads, total);
+  size_t grain = embedlet_block_rows(store->prefix_row_bytes);
+  int err = embedlet_run_search(
+      store, &task, embedlet_prefix_workers[store->metric], threads, total,
+      grain, arena, candidates, &num_candidates, stats,
+      store->prefix_row_bytes);
+  if (err != EMBEDLET_OK) {
+    embedlet_arena_release(store, arena);
+    return err;
   }
-  if (store->map_handle) {
-    CloseHandle(store->map_handle);
-    store->map_handle = NULL;
+
+  /* Stage 2: exact scores on all dims, visited in row order */
+  uint64_t rescore_start = stats ? embedlet_now_ns() : 0;
+  embedlet_sort_by(candidates, num_candidates, EMBEDLET_ORDER_ID);
+  float query_norm = embedlet_norm(query, store->dims);
+  float query_sum = embedlet_query_sum(query, store->dims);
+  size_t heap_size = 0;
+  for (size_t i = 0; i < num_candidates; i++) {
+    size_t id = candidates[i].id;
+    float score = embedlet_score_exact(store, query, query_norm, query_sum, id);
+    embedlet_heap_push(results, &heap_size, n, id, score, highest);
   }
-  if (store->file_handle != INVALID_HANDLE_VALUE) {
-    CloseHandle(store->file_handle);
-    store->file_handle = INVALID_HANDLE_VALUE;
+  embedlet_arena_release(store, arena);
+
+  embedlet_sort_results(results, heap_size, highest);
+  *count_out = heap_size;
+  if (stats) {
+    stats->rows_scanned += num_candidates;
+    stats->bytes_touched += (uint64_t)num_candidates * store->row_bytes;
+    stats->kernel_ns += embedlet_now_ns() - rescore_start;
+    embedlet_stats_commit(store, "search_prefix", stats);
   }
+  return EMBEDLET_OK;
 }
 
-#else /* POSIX */
+int embedlet_knn_graph(embedlet_store_t *store, size_t k, int num_threads,
+                       const char *out_path) {
+  if (!store || k == 0 || !out_path)
+    return EMBEDLET_ERR_INVALID_ARG;
 
-static int embedlet_file_open(embedlet_store_t *store, const char *path) {
-  store->fd = open(path, O_RDWR | O_CREAT, 0644);
-  if (store->fd < 0) {
-    return EMBEDLET_ERR_FILE_OPEN;
+  size_t total = embedlet_search_rows(store);
+  if (total > 0 && k > (SIZE_MAX - sizeof(embedlet_knn_header_t)) / total /
+                           sizeof(embedlet_result_t))
+    return EMBEDLET_ERR_INVALID_ARG;
+  size_t bytes =
+      sizeof(embedlet_knn_header_t) + total * k * sizeof(embedlet_result_t);
+
+  embedlet_join_t join;
+  memset(&join, 0, sizeof(join));
+  join.store = store;
+  join.count = total;
+  join.k = k;
+  join.highest = embedlet_keep_highest(store->metric, true);
+  join.sizes = (size_t *)calloc(total ? total : 1, sizeof(size_t));
+  if (!join.sizes)
+    return EMBEDLET_ERR_ALLOC;
+
+  embedlet_map_t out;
+  embedlet_map_init(&out);
+  int err = embedlet_file_open(&out, out_path);
+  if (err == EMBEDLET_OK)
+    err = embedlet_file_resize(&out, bytes);
+  if (err == EMBEDLET_OK)
+    err = embedlet_mmap_update(&out, bytes);
+  if (err != EMBEDLET_OK) {
+    embedlet_file_close(&out);
+    free(join.sizes);
+    return err;
   }
 
-  struct stat st;
-  if (fstat(store->fd, &st) < 0) {
-    close(store->fd);
-    return EMBEDLET_ERR_FILE_OPEN;
+  embedlet_knn_header_t *h = (embedlet_knn_header_t *)out.data;
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, "EMBKNN01", sizeof(h->magic));
+  h->rows = total;
+  h->k = k;
+  h->metric = (uint64_t)store->metric;
+  join.lists = (embedlet_result_t *)(h + 1);
+
+  size_t tiles = (total + 15) / 16; /* the most embedlet_join_run() cuts */
+  join.locks = (embedlet_mutex_t *)malloc((tiles ? tiles : 1) *
+                                          sizeof(embedlet_mutex_t));
+  if (!join.locks) {
+    embedlet_file_close(&out);
+    free(join.sizes);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  for (size_t t = 0; t < tiles; t++)
+    embedlet_mutex_init(&join.locks[t]);
+
+  err = embedlet_join_run(&join, num_threads);
+  for (size_t i = 0; i < total && err == EMBEDLET_OK; i++) {
+    embedlet_result_t *list = join.lists + i * k;
+    embedlet_sort_results(list, join.sizes[i], join.highest);
+    for (size_t j = join.sizes[i]; j < k; j++) {
+      list[j].id = EMBEDLET_NO_ID;
+      list[j].score = 0.0f;
+    }
   }
-  store->file_size = (size_t)st.st_size;
 
-  return EMBEDLET_OK;
+  for (size_t t = 0; t < tiles; t++)
+    embedlet_mutex_destroy(&join.locks[t]);
+  free(join.locks);
+  free(join.sizes);
+  embedlet_file_close(&out);
+  return err;
 }
 
-static int embedlet_mmap_update(embedlet_store_t *store, size_t new_capacity) {
-  if (store->data && store->capacity > 0) {
-    munmap(store->data, store->capacity);
-    store->data = NULL;
+int embedlet_similarity_matrix(embedlet_store_t *store, const size_t *ids,
+                               size_t count, int num_threads, float *out) {
+  if (!store || (count > 0 && (!ids || !out)))
+    return EMBEDLET_ERR_INVALID_ARG;
+
+  size_t total = embedlet_search_rows(store);
+  for (size_t i = 0; i < count; i++)
+    if (ids[i] >= total || !embedlet_live_test(store->live, ids[i]))
+      return EMBEDLET_ERR_INVALID_ID;
+
+  embedlet_join_t join;
+  memset(&join, 0, sizeof(join));
+  join.store = store;
+  join.ids = ids;
+  join.count = count;
+  join.self = true;
+  join.matrix = out;
+  return embedlet_join_run(&join, num_threads);
+}
+
+int embedlet_search_ann(embedlet_store_t *store, const float *query, size_t n,
+                        size_t ef_search, embedlet_result_t *results,
+                        size_t *count_out) {
+  if (!store || !query || n == 0 || !results || !count_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
   }
+  if (!store->hnsw_ctx)
+    return EMBEDLET_ERR_NOT_FOUND;
 
-  if (new_capacity == 0) {
-    store->capacity = 0;
-    return EMBEDLET_OK;
+  size_t ef = ef_search ? ef_search : EMBEDLET_DEFAULT_EF_SEARCH;
+  if (ef < n)
+    ef = n;
+
+  embedlet_hnsw_ctx_t *ctx = embedlet_hnsw_acquire(store);
+  if (!ctx || embedlet_hnsw_ctx_reserve(ctx, ef) != EMBEDLET_OK) {
+    if (ctx)
+      embedlet_hnsw_release(store, ctx);
+    return EMBEDLET_ERR_ALLOC;
   }
 
-  store->data = (float *)mmap(NULL, new_capacity, PROT_READ | PROT_WRITE,
-                              MAP_SHARED, store->fd, 0);
-  if (store->data == MAP_FAILED) {
-    store->data = NULL;
-    return EMBEDLET_ERR_MMAP;
+  /* Writers relink the graph in place; walk it with them shut out */
+  embedlet_rwlock_read(&store->hnsw_lock);
+  embedlet_hnsw_header_t *h = store->hnsw_header;
+  size_t found = 0;
+  int err = EMBEDLET_OK;
+  if (h->entry != EMBEDLET_HNSW_NO_ENTRY) {
+    float query_norm = embedlet_norm(query, store->dims);
+    float query_sum = embedlet_query_sum(query, store->dims);
+    ctx->eps[0] = (uint32_t)h->entry;
+    for (uint32_t l = h->max_level; l > 0 && err == EMBEDLET_OK; l--) {
+      err = embedlet_hnsw_search_layer(store, ctx, query, query_norm,
+                                       query_sum, ctx->eps, 1, 1, l,
+                                       SIZE_MAX);
+      if (ctx->top_size > 0)
+        ctx->eps[0] = (uint32_t)ctx->top[0].id;
+    }
+    if (err == EMBEDLET_OK)
+      err = embedlet_hnsw_search_layer(store, ctx, query, query_norm,
+                                       query_sum, ctx->eps, 1, ef, 0,
+                                       SIZE_MAX);
+    if (err == EMBEDLET_OK) {
+      embedlet_sort_results(ctx->top, ctx->top_size, true);
+      found = ctx->top_size < n ? ctx->top_size : n;
+      memcpy(results, ctx->top, found * sizeof(embedlet_result_t));
+      if (store->metric == EMBEDLET_METRIC_L2)
+        for (size_t i = 0; i < found; i++)
+          results[i].score = -results[i].score;
+    }
   }
+  embedlet_rwlock_read_unlock(&store->hnsw_lock);
+  embedlet_hnsw_release(store, ctx);
 
-  store->capacity = new_capacity;
-  return EMBEDLET_OK;
+  *count_out = found;
+  return err;
 }
 
-static int embedlet_file_resize(embedlet_store_t *store, size_t new_size) {
-  if (store->data && store->capacity > 0) {
-    munmap(store->data, store->capacity);
-    store->data = NULL;
-    store->capacity = 0;
+int embedlet_ivf_train(embedlet_store_t *store,
+                       const embedlet_ivf_params_t *params, int num_threads) {
+  embedlet_ivf_params_t p = {0};
+  if (params)
+    p = *params;
+  if (!store || p.iterations < 0 || store->metric != EMBEDLET_METRIC_COSINE)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (store->read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+
+  size_t dims = store->dims;
+  if (p.pq_m == 0) {
+    p.pq_m = dims / 8 ? dims / 8 : 1;
+    while (dims % p.pq_m)
+      p.pq_m--;
   }
+  if (p.pq_m > dims || dims % p.pq_m)
+    return EMBEDLET_ERR_INVALID_ARG;
+  if (p.iterations == 0)
+    p.iterations = EMBEDLET_DEFAULT_KMEANS_ITERATIONS;
 
-  if (ftruncate(store->fd, (off_t)new_size) < 0) {
-    return EMBEDLET_ERR_TRUNCATE;
+  size_t count = embedlet_count(store);
+  if (count > UINT32_MAX)
+    return EMBEDLET_ERR_INVALID_ID;
+
+  int threads = embedlet_resolve_threads(num_threads, count ? count : 1);
+  embedlet_pool_t *pool = NULL;
+  if (threads > 1) {
+    int err = embedlet_acquire_pool(store, &threads, &pool);
+    if (err != EMBEDLET_OK)
+      return err;
   }
 
-  store->file_size = new_size;
-  return EMBEDLET_OK;
-}
+  embedlet_mutex_lock(&store->mutex);
 
-static void embedlet_file_close(embedlet_store_t *store) {
-  if (store->data && store->capacity > 0) {
-    munmap(store->data, store->capacity);
-    store->data = NULL;
+  /* Train on live, non-empty rows only */
+  size_t live_rows = 0;
+  for (size_t id = 0; id < count; id++) {
+    live_rows += embedlet_live_test(store->live, id) &&
+                 store->norms[id] > FLT_EPSILON;
   }
-  if (store->fd >= 0) {
-    close(store->fd);
-    store->fd = -1;
+  if (live_rows == 0) {
+    embedlet_mutex_unlock(&store->mutex);
+    embedlet_return_pool(store, pool);
+    return EMBEDLET_ERR_NOT_FOUND;
   }
-}
 
-#endif /* EMBEDLET_WINDOWS/POSIX */
+  size_t nlist = p.nlist ? p.nlist : (size_t)(sqrt((double)live_rows) + 0.5);
+  if (nlist > live_rows)
+    nlist = live_rows;
+  if (nlist == 0)
+    nlist = 1;
+  size_t sample = p.train_size;
+  if (sample == 0)
+    sample = 64 * nlist > 16384 ? 64 * nlist : 16384;
+  if (sample > live_rows)
+    sample = live_rows;
+
+  float *data = (float *)malloc(sample * dims * sizeof(float));
+  uint32_t *assign = (uint32_t *)malloc(sample * sizeof(uint32_t));
+  float *cents = (float *)malloc(nlist * dims * sizeof(float));
+  float *codebooks =
+      (float *)malloc(EMBEDLET_PQ_KSUB * dims * sizeof(float));
+  uint32_t *lists = (uint32_t *)malloc((count ? count : 1) * sizeof(uint32_t));
+  uint8_t *codes = (uint8_t *)malloc((count ? count : 1) * p.pq_m);
+  int err = data && assign && cents && codebooks && lists && codes
+                ? EMBEDLET_OK
+                : EMBEDLET_ERR_ALLOC;
+
+  if (err == EMBEDLET_OK) {
+    /* Evenly strided sample of the live rows, normalized */
+    size_t next = 0, seen = 0;
+    for (size_t id = 0; id < count && next < sample; id++) {
+      if (!embedlet_live_test(store->live, id) ||
+          store->norms[id] <= FLT_EPSILON)
+        continue;
+      if (seen++ == next * live_rows / sample)
+        embedlet_ivf_unit_row(store, id, data + next++ * dims);
+    }
+    err = embedlet_kmeans(pool, threads, data, sample, dims, nlist,
+                          p.iterations, true, 0x1f5eedull, cents, assign);
+  }
 
-/*----------------------------------------------------------------------------
- * Helper Functions
- *----------------------------------------------------------------------------*/
+  embedlet_ivf_train_ctx_t t;
+  t.store = store;
+  t.residuals = data;
+  t.n = sample;
+  t.pq_m = p.pq_m;
+  t.iterations = p.iterations;
+  t.cents = cents;
+  t.nlist = nlist;
+  t.codebooks = codebooks;
+  t.lists = lists;
+  t.codes = codes;
+  if (err == EMBEDLET_OK) {
+    for (size_t i = 0; i < sample; i++) {
+      const float *c = cents + (size_t)assign[i] * dims;
+      float *x = data + i * dims;
+      for (size_t j = 0; j < dims; j++)
+        x[j] -= c[j];
+    }
+    err = embedlet_run_ranges(pool, threads, p.pq_m, embedlet_ivf_train_pq,
+                              &t);
+  }
+  if (err == EMBEDLET_OK)
+    err = embedlet_run_ranges(pool, threads, count, embedlet_ivf_train_encode,
+                              &t);
+  if (err == EMBEDLET_OK)
+    err = embedlet_ivf_write(store, count, nlist, p.pq_m, cents, codebooks,
+                             lists, codes);
 
-static size_t embedlet_embedding_size(const embedlet_store_t *store) {
-  return store->dims * sizeof(float);
+  embedlet_mutex_unlock(&store->mutex);
+  embedlet_return_pool(store, pool);
+
+  free(data);
+  free(assign);
+  free(cents);
+  free(codebooks);
+  free(lists);
+  free(codes);
+  return err;
 }
 
-static bool embedlet_is_zeroed_ptr(const float *data, size_t dims) {
-  for (size_t i = 0; i < dims; i++) {
-    if (data[i] != 0.0f)
-      return false;
+int embedlet_search_ivf(embedlet_store_t *store, const float *query, size_t n,
+                        size_t nprobe, size_t oversample, int num_threads,
+                        embedlet_result_t *results, size_t *count_out) {
+  if (!store || !query || n == 0 || !results || !count_out) {
+    return EMBEDLET_ERR_INVALID_ARG;
   }
-  return true;
-}
+  const embedlet_ivf_header_t *h = store->ivf_header;
+  if (!h || h->nlist == 0)
+    return EMBEDLET_ERR_NOT_FOUND;
 
-static int embedlet_ensure_capacity(embedlet_store_t *store,
-                                    size_t needed_bytes) {
-  if (needed_bytes <= store->capacity) {
-    return EMBEDLET_OK;
+  size_t dims = store->dims;
+  size_t nlist = h->nlist;
+  size_t pq_m = h->pq_m;
+  size_t dsub = dims / pq_m;
+  size_t total = embedlet_count(store);
+  size_t covered = h->covered < total ? (size_t)h->covered : total;
+  if (nprobe == 0)
+    nprobe = EMBEDLET_DEFAULT_NPROBE;
+  if (nprobe > nlist)
+    nprobe = nlist;
+  size_t keep = n;
+  if (oversample)
+    keep = oversample > total / n ? total : n * oversample;
+  if (keep == 0)
+    keep = 1;
+
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
+  float *unit = (float *)embedlet_arena_alloc(arena, dims * sizeof(float));
+  float *lut = (float *)embedlet_arena_alloc(
+      arena, EMBEDLET_PQ_KSUB * pq_m * sizeof(float));
+  embedlet_result_t *lists = (embedlet_result_t *)embedlet_arena_alloc(
+      arena, nprobe * sizeof(embedlet_result_t));
+  embedlet_result_t *candidates = (embedlet_result_t *)embedlet_arena_alloc(
+      arena, keep * sizeof(embedlet_result_t));
+  if (!unit || !lut || !lists || !candidates) {
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
   }
 
-  size_t new_cap = store->capacity ? store->capacity * 2 : 4096;
-  while (new_cap < needed_bytes) {
-    new_cap *= 2;
+  float query_norm = embedlet_norm(query, dims);
+  float query_sum = embedlet_query_sum(query, dims);
+  float inv = query_norm > FLT_EPSILON ? 1.0f / query_norm : 0.0f;
+  for (size_t i = 0; i < dims; i++)
+    unit[i] = query[i] * inv;
+
+  /* Coarse step: the nprobe lists with the closest centroids */
+  size_t num_lists = 0;
+  for (size_t l = 0; l < nlist; l++) {
+    float s = embedlet_dot(unit, store->ivf_centroids + l * dims, dims);
+    embedlet_heap_push_min(lists, &num_lists, nprobe, l, s);
   }
 
-  int err = embedlet_file_resize(store, new_cap);
-  if (err != EMBEDLET_OK)
-    return err;
+  /* Query against every codeword, so a row's score is pq_m table lookups */
+  for (size_t j = 0; j < pq_m; j++) {
+    const float *cbt = store->ivf_codebooks + j * EMBEDLET_PQ_KSUB * dsub;
+    float *row = lut + j * EMBEDLET_PQ_KSUB;
+    memset(row, 0, EMBEDLET_PQ_KSUB * sizeof(float));
+    for (size_t i = 0; i < dsub; i++) {
+      float qi = unit[j * dsub + i];
+      for (size_t k = 0; k < EMBEDLET_PQ_KSUB; k++)
+        row[k] += qi * cbt[i * EMBEDLET_PQ_KSUB + k];
+    }
+  }
 
-  err = embedlet_mmap_update(store, new_cap);
-  if (err != EMBEDLET_OK)
+  embedlet_ivf_probe_t probe = {lists, lut, covered};
+  embedlet_search_task_t task;
+  task.store = store;
+  task.query = query;
+  task.query_norm = query_norm;
+  task.query_sum = query_sum;
+  task.query_bits = NULL;
+  task.ivf = &probe;
+  task.filter = NULL;
+  task.n = keep;
+  task.most_similar = true;
+  memset(&task.stats, 0, sizeof(task.stats));
+
+  size_t num_candidates = 0;
+  int threads = embedlet_resolve_threads(num_threads, num_lists);
+  int err = embedlet_run_search(store, &task, embedlet_ivf_worker, threads,
+                                num_lists, 1, arena, candidates,
+                                &num_candidates, NULL, 0);
+  if (err != EMBEDLET_OK) {
+    embedlet_arena_release(store, arena);
     return err;
-
-  return EMBEDLET_OK;
-}
-
-/*----------------------------------------------------------------------------
- * Min-Heap for Top-N (most similar)
- *----------------------------------------------------------------------------*/
-
-static void embedlet_heap_push_min(embedlet_result_t *heap, size_t *size,
-                                   size_t max_size, size_t id, float score) {
-  if (*size < max_size) {
-    heap[*size].id = id;
-    heap[*size].score = score;
-    (*size)++;
-    size_t i = *size - 1;
-    while (i > 0) {
-      size_t parent = (i - 1) / 2;
-      if (heap[parent].score <= heap[i].score)
-        break;
-      embedlet_result_t tmp = heap[parent];
-      heap[parent] = heap[i];
-      heap[i] = tmp;
-      i = parent;
-    }
-  } else if (score > heap[0].score) {
-    heap[0].id = id;
-    heap[0].score = score;
-    size_t i = 0;
-    for (;;) {
-      size_t left = 2 * i + 1;
-      size_t right = 2 * i + 2;
-      size_t smallest = i;
-      if (left < max_size && heap[left].score < heap[smallest].score)
-        smallest = left;
-      if (right < max_size && heap[right].score < heap[smallest].score)
-        smallest = right;
-      if (smallest == i)
-        break;
-      embedlet_result_t tmp = heap[i];
-      heap[i] = heap[smallest];
-      heap[smallest] = tmp;
-      i = smallest;
-    }
   }
-}
 
-/*----------------------------------------------------------------------------
- * Max-Heap for Top-N (least similar)
- *----------------------------------------------------------------------------*/
+  /* Rows appended since training are not in any list: score them exactly */
+  for (size_t id = covered; id < total; id++) {
+    if (!embedlet_live_test(store->live, id))
+      continue;
+    float sim = embedlet_score_row(store, query, query_norm, query_sum, id);
+    embedlet_heap_push_min(candidates, &num_candidates, keep, id, sim);
+  }
 
-static void embedlet_heap_push_max(embedlet_result_t *heap, size_t *size,
-                                   size_t max_size, size_t id, float score) {
-  if (*size < max_size) {
-    heap[*size].id = id;
-    heap[*size].score = score;
-    (*size)++;
-    size_t i = *size - 1;
-    while (i > 0) {
-      size_t parent = (i - 1) / 2;
-      if (heap[parent].score >= heap[i].score)
-        break;
-      embedlet_result_t tmp = heap[parent];
-      heap[parent] = heap[i];
-      heap[i] = tmp;
-      i = parent;
-    }
-  } else if (score < heap[0].score) {
-    heap[0].id = id;
-    heap[0].score = score;
-    size_t i = 0;
-    for (;;) {
-      size_t left = 2 * i + 1;
-      size_t right = 2 * i + 2;
-      size_t largest = i;
-      if (left < max_size && heap[left].score > heap[largest].score)
-        largest = left;
-      if (right < max_size && heap[right].score > heap[largest].score)
-        largest = right;
-      if (largest == i)
-        break;
-      embedlet_result_t tmp = heap[i];
-      heap[i] = heap[largest];
-      heap[largest] = tmp;
-      i = largest;
+  size_t heap_size = 0;
+  if (oversample) {
+    /* Exact scores for the survivors, visited in row order */
+    embedlet_sort_by(candidates, num_candidates, EMBEDLET_ORDER_ID);
+    for (size_t i = 0; i < num_candidates; i++) {
+      size_t id = candidates[i].id;
+      float sim = embedlet_score_row(store, query, query_norm, query_sum, id);
+      embedlet_heap_push_min(results, &heap_size, n, id, sim);
     }
+  } else {
+    heap_size = num_candidates;
+    memcpy(results, candidates, heap_size * sizeof(embedlet_result_t));
   }
-}
-
-static int embedlet_cmp_desc(const void *a, const void *b) {
-  float sa = ((const embedlet_result_t *)a)->score;
-  float sb = ((const embedlet_result_t *)b)->score;
-  return (sa < sb) ? 1 : (sa > sb) ? -1 : 0;
-}
+  embedlet_arena_release(store, arena);
 
-static int embedlet_cmp_asc(const void *a, const void *b) {
-  float sa = ((const embedlet_result_t *)a)->score;
-  float sb = ((const embedlet_result_t *)b)->score;
-  return (sa > sb) ? 1 : (sa < sb) ? -1 : 0;
+  embedlet_sort_results(results, heap_size, true);
+  *count_out = heap_size;
+  return EMBEDLET_OK;
 }
 
-/*----------------------------------------------------------------------------
- * Search Task Worker
- *----------------------------------------------------------------------------*/
+int embedlet_search_batch(embedlet_store_t *store, const float *queries,
+                          size_t num_queries, size_t n, bool most_similar,
+                          int num_threads, embedlet_result_t *results,
+                          size_t *counts_out) {
+  if (!store || !queries || num_queries == 0 || n == 0 || !results ||
+      !counts_out || num_queries > SIZE_MAX / sizeof(embedlet_result_t) / n) {
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
 
-static void embedlet_search_worker(void *arg) {
-  embedlet_search_task_t *task = (embedlet_search_task_t *)arg;
-  const embedlet_store_t *store = task->store;
-  const float *query = task->query;
-  float query_norm = task->query_norm;
   size_t dims = store->dims;
+  size_t total = embedlet_search_rows(store);
+  memset(counts_out, 0, num_queries * sizeof(size_t));
+  if (total == 0)
+    return EMBEDLET_OK;
+  if (embedlet_offload_search(store, queries, num_queries, n, most_similar,
+                              results, counts_out) == EMBEDLET_OK)
+    return EMBEDLET_OK;
+  memset(counts_out, 0, num_queries * sizeof(size_t));
 
-  size_t heap_size = 0;
+  embedlet_arena_t *arena = embedlet_arena_acquire(store);
+  if (!arena)
+    return EMBEDLET_ERR_ALLOC;
+  float *query_norms = (float *)embedlet_arena_alloc(
+      arena, 2 * num_queries * sizeof(float));
+  if (!query_norms) {
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  float *query_sums = query_norms + num_queries;
+  for (size_t q = 0; q < num_queries; q++) {
+    query_norms[q] = embedlet_norm(queries + q * dims, dims);
+    query_sums[q] = embedlet_query_sum(queries + q * dims, dims);
+  }
+  uint64_t *query_bits;
+  int err = embedlet_query_codes(store, arena, queries, num_queries,
+                                 &query_bits);
+  if (err != EMBEDLET_OK) {
+    embedlet_arena_release(store, arena);
+    return err;
+  }
+
+  int threads = embedlet_resolve_threads(num_threads, total);
+  embedlet_batch_task_t task;
+  task.store = store;
+  task.queries = queries;
+  task.query_norms = query_norms;
+  task.query_sums = query_sums;
+  task.query_bits = query_bits;
+  task.num_queries = num_queries;
+  task.n = n;
+  task.most_similar = embedlet_keep_highest(store->metric, most_similar);
+  memset(&task.stats, 0, sizeof(task.stats));
+  embedlet_stats_t delta;
+  embedlet_stats_t *stats = embedlet_stats_begin(store, &delta);
+  size_t row_bytes = embedlet_scan_row_bytes(store);
+
+  size_t grain = EMBEDLET_BATCH_BLOCK_BYTES / embedlet_embedding_size(store);
+  if (grain == 0)
+    grain = 1;
+  if ((size_t)threads > (total + grain - 1) / grain)
+    threads = (int)((total + grain - 1) / grain);
 
-  for (size_t i = task->start; i < task->end; i++) {
-    const float *emb = store->data + i * dims;
+  if (threads == 1) {
+    embedlet_slice_t slice;
+    embedlet_steal_t steal;
+    embedlet_steal_init(&steal, &slice, 1, total, grain);
+    task.steal = &steal;
+    task.slot = 0;
+    task.local_results = results;
+    task.result_counts = counts_out;
+    task.stats.posted_ns = stats ? embedlet_now_ns() : 0;
+    embedlet_batch_workers[store->metric](&task);
+
+    uint64_t sort_start = stats ? embedlet_now_ns() : 0;
+    for (size_t q = 0; q < num_queries; q++)
+      embedlet_sort_results(results + q * n, counts_out[q],
+                            task.most_similar);
+    embedlet_arena_release(store, arena);
+    if (stats) {
+      embedlet_scan_collect(stats, &task.stats, row_bytes);
+      stats->merge_ns += embedlet_now_ns() - sort_start;
+      embedlet_stats_commit(store, "search_batch", stats);
+    }
+    return EMBEDLET_OK;
+  }
+
+  /* One heap set and count array per thread */
+  if ((size_t)threads >
+      SIZE_MAX / sizeof(embedlet_result_t) / n / num_queries) {
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_INVALID_ARG;
+  }
+  embedlet_pool_t *pool;
+  err = embedlet_acquire_pool(store, &threads, &pool);
+  if (err != EMBEDLET_OK) {
+    embedlet_arena_release(store, arena);
+    return err;
+  }
 
-    if (embedlet_is_zeroed_ptr(emb, dims))
-      continue;
+  embedlet_batch_task_t *tasks = (embedlet_batch_task_t *)embedlet_arena_alloc(
+      arena, (size_t)threads * sizeof(embedlet_batch_task_t));
+  embedlet_slice_t *slices = (embedlet_slice_t *)embedlet_arena_alloc(
+      arena, (size_t)threads * sizeof(embedlet_slice_t));
+  if (!tasks || !slices) {
+    embedlet_return_pool(store, pool);
+    embedlet_arena_release(store, arena);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  embedlet_steal_t steal;
+  embedlet_steal_init(&steal, slices, threads, total, grain);
+  for (int i = 0; i < threads; i++) {
+    tasks[i] = task;
+    tasks[i].steal = &steal;
+    tasks[i].slot = i;
+    tasks[i].local_results = (embedlet_result_t *)embedlet_arena_alloc(
+        arena, num_queries * n * sizeof(embedlet_result_t));
+    tasks[i].result_counts = (size_t *)embedlet_arena_alloc(
+        arena, num_queries * sizeof(size_t));
+    if (!tasks[i].local_results || !tasks[i].result_counts) {
+      embedlet_return_pool(store, pool);
+      embedlet_arena_release(store, arena);
+      return EMBEDLET_ERR_ALLOC;
+    }
+    memset(tasks[i].result_counts, 0, num_queries * sizeof(size_t));
+  }
 
-    float dot = embedlet_dot(query, emb, dims);
-    float emb_norm = embedlet_norm(emb, dims);
-    float sim = (query_norm > 0.0f && emb_norm > 0.0f)
-                    ? dot / (query_norm * emb_norm)
-                    : 0.0f;
+  uint64_t posted = stats ? embedlet_now_ns() : 0;
+  for (int i = 0; i < threads; i++)
+    tasks[i].stats.posted_ns = posted;
+  embedlet_pool_run(pool, &store->pool_client,
+                    embedlet_batch_workers[store->metric], tasks,
+                    sizeof(embedlet_batch_task_t), threads);
+  embedlet_return_pool(store, pool);
+  uint64_t merge_start = 0;
+  if (stats) {
+    for (int i = 0; i < threads; i++)
+      embedlet_scan_collect(stats, &tasks[i].stats, row_bytes);
+    merge_start = embedlet_now_ns();
+  }
 
-    if (task->most_similar) {
-      embedlet_heap_push_min(task->local_results, &heap_size, task->n, i, sim);
-    } else {
-      embedlet_heap_push_max(task->local_results, &heap_size, task->n, i, sim);
+  for (size_t q = 0; q < num_queries; q++) {
+    embedlet_result_t *out = results + q * n;
+    for (int i = 0; i < threads; i++) {
+      const embedlet_result_t *local = tasks[i].local_results + q * n;
+      for (size_t j = 0; j < tasks[i].result_counts[q]; j++) {
+        embedlet_heap_push(out, &counts_out[q], n, local[j].id, local[j].score,
+                           task.most_similar);
+      }
     }
+    embedlet_sort_results(out, counts_out[q], task.most_similar);
   }
 
-  task->result_count = heap_size;
+  embedlet_arena_release(store, arena);
+  if (stats) {
+    stats->merge_ns += embedlet_now_ns() - merge_start;
+    embedlet_stats_commit(store, "search_batch", stats);
+  }
+  return EMBEDLET_OK;
 }
 
 /*----------------------------------------------------------------------------
- * Public API Implementation
+ * Segmented Store (fixed-size segment files behind one id space)
  *----------------------------------------------------------------------------*/
 
-int embedlet_open(const char *path, size_t dims, embedlet_store_t **store_out) {
-  if (!path || dims == 0 || !store_out) {
-    return EMBEDLET_ERR_INVALID_ARG;
+/* Name of segment `index`, round robin over the directories; caller frees */
+static char *embedlet_segment_path(const embedlet_segmented_t *set,
+                                   size_t index) {
+  const char *dir = "";
+  const char *sep = "";
+  const char *name = set->path;
+  if (set->num_dirs > 0) {
+    dir = set->dirs[index % set->num_dirs];
+    size_t len = strlen(dir);
+    sep = len > 0 && dir[len - 1] != '/' && dir[len - 1] != '\\' ? "/" : "";
+    for (const char *c = set->path; *c; c++) {
+      if (*c == '/' || *c == '\\')
+        name = c + 1;
+    }
   }
+  int len = snprintf(NULL, 0, "%s%s%s%s%05zu", dir, sep, name,
+                     EMBEDLET_SEGMENT_SUFFIX, index);
+  char *out = len > 0 ? (char *)malloc((size_t)len + 1) : NULL;
+  if (out)
+    snprintf(out, (size_t)len + 1, "%s%s%s%s%05zu", dir, sep, name,
+             EMBEDLET_SEGMENT_SUFFIX, index);
+  return out;
+}
 
-  embedlet_store_t *store =
-      (embedlet_store_t *)calloc(1, sizeof(embedlet_store_t));
-  if (!store)
-    return EMBEDLET_ERR_ALLOC;
-
-  store->dims = dims;
-  store->path = strdup(path);
-  if (!store->path) {
-    free(store);
+/* Write the manifest next to itself, then rename it into place */
+static int embedlet_manifest_write(const embedlet_segmented_t *set) {
+  char *tmp = embedlet_sidecar_path(set->path, ".tmp");
+  if (!tmp)
     return EMBEDLET_ERR_ALLOC;
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    free(tmp);
+    return EMBEDLET_ERR_FILE_OPEN;
   }
 
+  embedlet_manifest_header_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, EMBEDLET_SEGMENTS_MAGIC, sizeof(h.magic));
+  h.version = EMBEDLET_SEGMENTS_VERSION;
+  h.dims = set->dims;
+  h.segment_rows = set->segment_rows;
+  h.segments = set->num_segments;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  for (size_t i = 0; ok && i < set->num_segments; i++) {
+    uint32_t len = (uint32_t)strlen(set->segment_paths[i]);
+    ok = fwrite(&len, sizeof(len), 1, f) == 1 &&
+         fwrite(set->segment_paths[i], 1, len, f) == len;
+  }
+  ok = fclose(f) == 0 && ok;
 #if EMBEDLET_WINDOWS
-  store->file_handle = INVALID_HANDLE_VALUE;
-  store->map_handle = NULL;
+  ok = ok && MoveFileExA(tmp, set->path, MOVEFILE_REPLACE_EXISTING);
 #else
-  store->fd = -1;
+  ok = ok && rename(tmp, set->path) == 0;
 #endif
-  store->data = NULL;
-  store->capacity = 0;
-  store->pool = NULL;
-
-  embedlet_mutex_init(&store->mutex);
+  if (!ok)
+    remove(tmp);
+  free(tmp);
+  return ok ? EMBEDLET_OK : EMBEDLET_ERR_FILE_OPEN;
+}
 
-  int err = embedlet_file_open(store, path);
-  if (err != EMBEDLET_OK) {
-    embedlet_mutex_destroy(&store->mutex);
-    free(store->path);
-    free(store);
-    return err;
+/* Read a manifest's header and segment names (*paths_out[count]) */
+static int embedlet_manifest_read(const char *path,
+                                  embedlet_manifest_header_t *h,
+                                  char ***paths_out) {
+  *paths_out = NULL;
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return EMBEDLET_ERR_NOT_FOUND;
+
+  int err = EMBEDLET_OK;
+  if (fread(h, sizeof(*h), 1, f) != 1 ||
+      memcmp(h->magic, EMBEDLET_SEGMENTS_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != EMBEDLET_SEGMENTS_VERSION || h->segment_rows == 0 ||
+      h->segments == 0 || h->segments > SIZE_MAX / sizeof(char *)) {
+    fclose(f);
+    return EMBEDLET_ERR_FORMAT;
   }
 
-  if (store->file_size > 0) {
-    err = embedlet_mmap_update(store, store->file_size);
-    if (err != EMBEDLET_OK) {
-      embedlet_file_close(store);
-      embedlet_mutex_destroy(&store->mutex);
-      free(store->path);
-      free(store);
-      return err;
+  char **paths = (char **)calloc((size_t)h->segments, sizeof(char *));
+  if (!paths)
+    err = EMBEDLET_ERR_ALLOC;
+  for (size_t i = 0; err == EMBEDLET_OK && i < h->segments; i++) {
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, f) != 1 || len == 0) {
+      err = EMBEDLET_ERR_FORMAT;
+      break;
+    }
+    paths[i] = (char *)malloc((size_t)len + 1);
+    if (!paths[i]) {
+      err = EMBEDLET_ERR_ALLOC;
+    } else if (fread(paths[i], 1, len, f) != len) {
+      err = EMBEDLET_ERR_FORMAT;
+    } else {
+      paths[i][len] = '\0';
     }
   }
+  fclose(f);
 
-  *store_out = store;
+  if (err != EMBEDLET_OK) {
+    for (size_t i = 0; paths && i < h->segments; i++)
+      free(paths[i]);
+    free(paths);
+    return err;
+  }
+  *paths_out = paths;
   return EMBEDLET_OK;
 }
 
-int embedlet_close(embedlet_store_t *store, bool compact) {
-  if (!store)
-    return EMBEDLET_ERR_INVALID_ARG;
-
-  if (compact) {
-    embedlet_compact(store);
+/* Open the store at `path` (which the set then owns) as the next segment */
+static int embedlet_segment_push(embedlet_segmented_t *set, char *path) {
+  if (set->num_segments == set->segments_capacity) {
+    size_t cap = set->segments_capacity ? set->segments_capacity * 2 : 8;
+    embedlet_store_t **segments = (embedlet_store_t **)realloc(
+        set->segments, cap * sizeof(embedlet_store_t *));
+    if (segments)
+      set->segments = segments;
+    char **paths = segments ? (char **)realloc(set->segment_paths,
+                                               cap * sizeof(char *))
+                            : NULL;
+    if (paths)
+      set->segment_paths = paths;
+    if (!segments || !paths) {
+      free(path);
+      return EMBEDLET_ERR_ALLOC;
+    }
+    set->segments_capacity = cap;
   }
 
-  if (store->pool) {
-    embedlet_pool_destroy(store->pool);
-    store->pool = NULL;
+  embedlet_store_t *store;
+  int err = embedlet_open_ex(path, set->dims, &set->options, &store);
+  if (err == EMBEDLET_OK && set->pool)
+    err = embedlet_attach_pool(store, set->pool);
+  if (err != EMBEDLET_OK) {
+    free(path);
+    return err;
   }
-
-  embedlet_file_close(store);
-  embedlet_mutex_destroy(&store->mutex);
-  free(store->path);
-  free(store);
-
+  set->segments[set->num_segments] = store;
+  set->segment_paths[set->num_segments] = path;
+  set->num_segments++;
   return EMBEDLET_OK;
 }
 
-size_t embedlet_count(const embedlet_store_t *store) {
-  if (!store || store->dims == 0)
-    return 0;
-  return store->file_size / (store->dims * sizeof(float));
-}
+/* Create a new active segment and record it in the manifest */
+static int embedlet_segment_start(embedlet_segmented_t *set) {
+  if (set->options.read_only)
+    return EMBEDLET_ERR_READ_ONLY;
+  char *path = embedlet_segment_path(set, set->num_segments);
+  if (!path)
+    return EMBEDLET_ERR_ALLOC;
+  /* Leftovers of a segment the manifest never recorded are dropped */
+  embedlet_remove(path);
+  int err = embedlet_segment_push(set, path);
+  if (err != EMBEDLET_OK)
+    return err;
 
-size_t embedlet_dims(const embedlet_store_t *store) {
-  return store ? store->dims : 0;
+  err = embedlet_manifest_write(set);
+  if (err != EMBEDLET_OK) {
+    set->num_segments--;
+    embedlet_close(set->segments[set->num_segments], false);
+    embedlet_remove(set->segment_paths[set->num_segments]);
+    free(set->segment_paths[set->num_segments]);
+  }
+  return err;
 }
 
-int embedlet_append(embedlet_store_t *store, const float *data, bool reuse,
-                    size_t *id_out) {
-  if (!store || !data || !id_out) {
-    return EMBEDLET_ERR_INVALID_ARG;
+static void embedlet_segmented_free(embedlet_segmented_t *set) {
+  for (size_t i = 0; i < set->num_segments; i++) {
+    embedlet_close(set->segments[i], false);
+    free(set->segment_paths[i]);
   }
+  for (size_t i = 0; i < set->num_dirs; i++)
+    free(set->dirs[i]);
+  embedlet_pool_release(set->pool);
+  embedlet_mutex_destroy(&set->mutex);
+  free(set->segments);
+  free(set->segment_paths);
+  free(set->dirs);
+  free(set->path);
+  free(set);
+}
 
-  embedlet_mutex_lock(&store->mutex);
+int embedlet_segmented_open(const char *path, size_t dims,
+                            const embedlet_segment_options_t *options,
+                            embedlet_segmented_t **set_out) {
+  if (!path || dims == 0 || !set_out ||
+      (options && options->num_dirs > 0 && !options->dirs))
+    return EMBEDLET_ERR_INVALID_ARG;
 
-  size_t emb_size = embedlet_embedding_size(store);
-  size_t count = store->file_size / emb_size;
-  size_t target_id = count;
+  embedlet_segmented_t *set =
+      (embedlet_segmented_t *)calloc(1, sizeof(embedlet_segmented_t));
+  if (!set)
+    return EMBEDLET_ERR_ALLOC;
+  embedlet_mutex_init(&set->mutex);
+  set->dims = dims;
+  set->segment_rows = options && options->segment_rows
+                          ? options->segment_rows
+                          : EMBEDLET_DEFAULT_SEGMENT_ROWS;
+  if (options)
+    set->options = options->store;
+  set->path = strdup(path);
+  size_t num_dirs = options ? options->num_dirs : 0;
+  set->dirs = num_dirs ? (char **)calloc(num_dirs, sizeof(char *)) : NULL;
+  int err = set->path && (set->dirs || num_dirs == 0) ? EMBEDLET_OK
+                                                       : EMBEDLET_ERR_ALLOC;
+  for (; err == EMBEDLET_OK && set->num_dirs < num_dirs; set->num_dirs++) {
+    const char *dir = options->dirs[set->num_dirs];
+    set->dirs[set->num_dirs] = dir ? strdup(dir) : NULL;
+    if (!set->dirs[set->num_dirs])
+      err = dir ? EMBEDLET_ERR_ALLOC : EMBEDLET_ERR_INVALID_ARG;
+  }
+  if (err != EMBEDLET_OK) {
+    embedlet_segmented_free(set);
+    return err;
+  }
 
-  if (reuse && store->data) {
-    for (size_t i = 0; i < count; i++) {
-      if (embedlet_is_zeroed_ptr(store->data + i * store->dims, store->dims)) {
-        target_id = i;
-        break;
-      }
-    }
+  embedlet_manifest_header_t h;
+  char **paths;
+  err = embedlet_manifest_read(path, &h, &paths);
+  if (err == EMBEDLET_OK) {
+    if (h.dims != dims)
+      err = EMBEDLET_ERR_DIMS_MISMATCH;
+    set->segment_rows = (size_t)h.segment_rows;
+  }
+  /* Reserve each segment's final size up front, so growth never moves it */
+  if (set->options.reserve_bytes == 0) {
+    size_t row_bytes = embedlet_row_bytes_for(
+        embedlet_dtype_valid(set->options.dtype) ? set->options.dtype
+                                                 : EMBEDLET_DTYPE_F32,
+        dims);
+    if (set->segment_rows < (SIZE_MAX / 2 - EMBEDLET_HEADER_SIZE) / row_bytes)
+      set->options.reserve_bytes =
+          2 * (EMBEDLET_HEADER_SIZE + set->segment_rows * row_bytes);
   }
 
-  if (target_id == count) {
-    size_t new_file_size = store->file_size + emb_size;
-    int err = embedlet_ensure_capacity(store, new_file_size);
-    if (err != EMBEDLET_OK) {
-      embedlet_mutex_unlock(&store->mutex);
-      return err;
+  if (err == EMBEDLET_OK) {
+    for (size_t i = 0; i < h.segments; i++) {
+      if (err == EMBEDLET_OK)
+        err = embedlet_segment_push(set, paths[i]);
+      else
+        free(paths[i]);
     }
-    store->file_size = new_file_size;
+    free(paths);
+  } else if (err == EMBEDLET_ERR_NOT_FOUND) {
+    err = set->options.read_only ? EMBEDLET_ERR_FILE_OPEN
+                                 : embedlet_segment_start(set);
+  } else if (paths) {
+    for (size_t i = 0; i < h.segments; i++)
+      free(paths[i]);
+    free(paths);
   }
 
-  memcpy(store->data + target_id * store->dims, data, emb_size);
-
-  *id_out = target_id;
-
-  embedlet_mutex_unlock(&store->mutex);
+  if (err != EMBEDLET_OK) {
+    embedlet_segmented_free(set);
+    return err;
+  }
+  *set_out = set;
   return EMBEDLET_OK;
 }
 
-int embedlet_replace(embedlet_store_t *store, size_t id, const float *data) {
-  if (!store || !data) {
+int embedlet_segmented_close(embedlet_segmented_t *set) {
+  if (!set)
     return EMBEDLET_ERR_INVALID_ARG;
-  }
-
-  embedlet_mutex_lock(&store->mutex);
-
-  size_t count = embedlet_count(store);
-  if (id >= count) {
-    embedlet_mutex_unlock(&store->mutex);
-    return EMBEDLET_ERR_INVALID_ID;
-  }
-
-  memcpy(store->data + id * store->dims, data, embedlet_embedding_size(store));
-
-  embedlet_mutex_unlock(&store->mutex);
+  embedlet_segmented_free(set);
   return EMBEDLET_OK;
 }
 
-int embedlet_delete(embedlet_store_t *store, size_t id) {
-  if (!store)
+int embedlet_segmented_remove(const char *path) {
+  if (!path)
     return EMBEDLET_ERR_INVALID_ARG;
 
-  embedlet_mutex_lock(&store->mutex);
-
-  size_t count = embedlet_count(store);
-  if (id >= count) {
-    embedlet_mutex_unlock(&store->mutex);
-    return EMBEDLET_ERR_INVALID_ID;
+  embedlet_manifest_header_t h;
+  char **paths;
+  int err = embedlet_manifest_read(path, &h, &paths);
+  if (err != EMBEDLET_OK)
+    return err;
+  for (size_t i = 0; i < h.segments; i++) {
+    embedlet_remove(paths[i]);
+    free(paths[i]);
   }
-
-  memset(store->data + id * store->dims, 0, embedlet_embedding_size(store));
-
-  embedlet_mutex_unlock(&store->mutex);
-  return EMBEDLET_OK;
+  free(paths);
+  return remove(path) == 0 ? EMBEDLET_OK : EMBEDLET_ERR_NOT_FOUND;
 }
 
-const float *embedlet_get(const embedlet_store_t *store, size_t id) {
-  if (!store || !store->data)
-    return NULL;
-  size_t count = embedlet_count(store);
-  if (id >= count)
-    return NULL;
-  return store->data + id * store->dims;
+size_t embedlet_segmented_count(const embedlet_segmented_t *set) {
+  if (!set)
+    return 0;
+  embedlet_mutex_t *mutex = (embedlet_mutex_t *)&set->mutex;
+  embedlet_mutex_lock(mutex);
+  size_t last = set->num_segments - 1;
+  size_t count =
+      last * set->segment_rows + embedlet_count(set->segments[last]);
+  embedlet_mutex_unlock(mutex);
+  return count;
 }
 
-bool embedlet_is_zeroed(const embedlet_store_t *store, size_t id) {
-  const float *emb = embedlet_get(store, id);
-  if (!emb)
-    return true;
-  return embedlet_is_zeroed_ptr(emb, store->dims);
+size_t embedlet_segmented_segments(const embedlet_segmented_t *set) {
+  if (!set)
+    return 0;
+  embedlet_mutex_t *mutex = (embedlet_mutex_t *)&set->mutex;
+  embedlet_mutex_lock(mutex);
+  size_t count = set->num_segments;
+  embedlet_mutex_unlock(mutex);
+  return count;
 }
 
-float embedlet_similarity(const embedlet_store_t *store, const float *a,
-                          const float *b) {
-  if (!store || !a || !b)
-    return 0.0f;
-  return embedlet_similarity_raw(a, b, store->dims);
+embedlet_store_t *embedlet_segmented_segment(embedlet_segmented_t *set,
+                                             size_t index) {
+  if (!set)
+    return NULL;
+  embedlet_mutex_lock(&set->mutex);
+  embedlet_store_t *store =
+      index < set->num_segments ? set->segments[index] : NULL;
+  embedlet_mutex_unlock(&set->mutex);
+  return store;
 }
 
-float embedlet_similarity_raw(const float *a, const float *b, size_t dims) {
-  if (!a || !b || dims == 0)
-    return 0.0f;
-
-  float dot = embedlet_dot(a, b, dims);
-  float na = embedlet_norm(a, dims);
-  float nb = embedlet_norm(b, dims);
-
-  if (na < FLT_EPSILON || nb < FLT_EPSILON)
-    return 0.0f;
-  return dot / (na * nb);
+/* The segment holding global id `id`, and the id's row within it */
+static embedlet_store_t *embedlet_segment_of(const embedlet_segmented_t *set,
+                                             size_t id, size_t *row) {
+  embedlet_mutex_t *mutex = (embedlet_mutex_t *)&set->mutex;
+  size_t index = id / set->segment_rows;
+  *row = id % set->segment_rows;
+  embedlet_mutex_lock(mutex);
+  embedlet_store_t *store =
+      index < set->num_segments ? set->segments[index] : NULL;
+  embedlet_mutex_unlock(mutex);
+  return store;
 }
 
-int embedlet_compact(embedlet_store_t *store) {
-  if (!store)
+int embedlet_segmented_append(embedlet_segmented_t *set, const float *data,
+                              size_t *id_out) {
+  if (!set || !data || !id_out)
     return EMBEDLET_ERR_INVALID_ARG;
+  return embedlet_segmented_append_batch(set, data, 1, id_out);
+}
 
-  embedlet_mutex_lock(&store->mutex);
-
-  size_t count = embedlet_count(store);
-  if (count == 0) {
-    embedlet_mutex_unlock(&store->mutex);
-    return EMBEDLET_OK;
-  }
+int embedlet_segmented_append_batch(embedlet_segmented_t *set,
+                                    const float *data, size_t count,
+                                    size_t *ids_out) {
+  if (!set || (!data && count > 0))
+    return EMBEDLET_ERR_INVALID_ARG;
 
-  size_t last_nonzero = count;
-  while (last_nonzero > 0) {
-    if (!embedlet_is_zeroed_ptr(store->data + (last_nonzero - 1) * store->dims,
-                                store->dims)) {
-      break;
+  int err = EMBEDLET_OK;
+  embedlet_mutex_lock(&set->mutex);
+  for (size_t done = 0; done < count && err == EMBEDLET_OK;) {
+    embedlet_store_t *active = set->segments[set->num_segments - 1];
+    size_t used = embedlet_count(active);
+    if (used >= set->segment_rows) {
+      err = embedlet_segment_start(set);
+      continue;
     }
-    last_nonzero--;
+    size_t take = set->segment_rows - used;
+    if (take > count - done)
+      take = count - done;
+    err = embedlet_append_batch(active, data + done * set->dims, take, NULL);
+    size_t first = (set->num_segments - 1) * set->segment_rows + used;
+    for (size_t i = 0; err == EMBEDLET_OK && ids_out && i < take; i++)
+      ids_out[done + i] = first + i;
+    done += take;
   }
+  embedlet_mutex_unlock(&set->mutex);
+  return err;
+}
 
-  if (last_nonzero < count) {
-    size_t new_size = last_nonzero * embedlet_embedding_size(store);
-    int err = embedlet_file_resize(store, new_size);
-    if (err != EMBEDLET_OK) {
-      embedlet_mutex_unlock(&store->mutex);
-      return err;
-    }
-
-    if (new_size > 0) {
-      err = embedlet_mmap_update(store, new_size);
-      if (err != EMBEDLET_OK) {
-        embedlet_mutex_unlock(&store->mutex);
-        return err;
-      }
-    }
-  }
+int embedlet_segmented_replace(embedlet_segmented_t *set, size_t id,
+                               const float *data) {
+  if (!set || !data)
+    return EMBEDLET_ERR_INVALID_ARG;
+  size_t row;
+  embedlet_store_t *store = embedlet_segment_of(set, id, &row);
+  return store ? embedlet_replace(store, row, data) : EMBEDLET_ERR_INVALID_ID;
+}
 
-  embedlet_mutex_unlock(&store->mutex);
-  return EMBEDLET_OK;
+int embedlet_segmented_delete(embedlet_segmented_t *set, size_t id) {
+  if (!set)
+    return EMBEDLET_ERR_INVALID_ARG;
+  size_t row;
+  embedlet_store_t *store = embedlet_segment_of(set, id, &row);
+  return store ? embedlet_delete(store, row) : EMBEDLET_ERR_INVALID_ID;
 }
 
-int embedlet_search(embedlet_store_t *store, const float *query, size_t n,
-                    bool most_similar, int num_threads,
-                    embedlet_result_t *results, size_t *count_out) {
-  if (!store || !query || n == 0 || !results || !count_out) {
+int embedlet_segmented_get_copy(const embedlet_segmented_t *set, size_t id,
+                                float *out) {
+  if (!set || !out)
     return EMBEDLET_ERR_INVALID_ARG;
-  }
+  size_t row;
+  embedlet_store_t *store = embedlet_segment_of(set, id, &row);
+  return store ? embedlet_get_copy(store, row, out) : EMBEDLET_ERR_INVALID_ID;
+}
 
-  size_t total = embedlet_count(store);
-  if (total == 0) {
-    *count_out = 0;
-    return EMBEDLET_OK;
+/* One segmented search: each segment's top n lands in its own slot */
+typedef struct {
+  embedlet_store_t **segments;
+  size_t segment_rows;
+  const float *query;
+  size_t n;
+  bool most_similar;
+  int threads; /* per segment search */
+  embedlet_result_t *found; /* [segments][n] */
+  size_t *counts;
+} embedlet_segmented_ctx_t;
+
+static int embedlet_segmented_scan(void *arg, size_t start, size_t end) {
+  const embedlet_segmented_ctx_t *ctx = (const embedlet_segmented_ctx_t *)arg;
+  for (size_t s = start; s < end; s++) {
+    embedlet_result_t *out = ctx->found + s * ctx->n;
+    int err = embedlet_search(ctx->segments[s], ctx->query, ctx->n,
+                              ctx->most_similar, ctx->threads, out,
+                              &ctx->counts[s]);
+    if (err != EMBEDLET_OK)
+      return err;
+    for (size_t i = 0; i < ctx->counts[s]; i++)
+      out[i].id += s * ctx->segment_rows;
   }
+  return EMBEDLET_OK;
+}
 
-  float query_norm = embedlet_norm(query, store->dims);
-
-  int threads = num_threads;
-  if (threads == EMBEDLET_AUTO_THREADS) {
-    threads = embedlet_get_cpu_count();
-    if (threads > 8)
-      threads = 8;
+/*
+ * The set's pool, created on first use and attached to every segment so
+ * their own parallel searches share it. *threads is clamped to its workers.
+ */
+static int embedlet_segmented_pool(embedlet_segmented_t *set, int *threads) {
+  int err = EMBEDLET_OK;
+  embedlet_mutex_lock(&set->mutex);
+  if (!set->pool) {
+    set->pool = embedlet_pool_start(*threads, EMBEDLET_MAX_THREADS,
+                                    set->options.pin_threads != 0);
+    for (size_t i = 0; set->pool && i < set->num_segments; i++)
+      embedlet_attach_pool(set->segments[i], set->pool);
+    if (!set->pool)
+      err = EMBEDLET_ERR_THREAD;
+  } else if (set->pool->num_threads < *threads) {
+    embedlet_pool_grow(set->pool, *threads);
   }
-  if (threads < 1)
-    threads = 1;
-  if ((size_t)threads > total)
-    threads = (int)total;
-
-  if (threads == 1) {
-    size_t heap_size = 0;
-    for (size_t i = 0; i < total; i++) {
-      const float *emb = store->data + i * store->dims;
-      if (embedlet_is_zeroed_ptr(emb, store->dims))
-        continue;
-
-      float dot = embedlet_dot(query, emb, store->dims);
-      float emb_norm = embedlet_norm(emb, store->dims);
-      float sim = (query_norm > FLT_EPSILON && emb_norm > FLT_EPSILON)
-                      ? dot / (query_norm * emb_norm)
-                      : 0.0f;
-
-      if (most_similar) {
-        embedlet_heap_push_min(results, &heap_size, n, i, sim);
-      } else {
-        embedlet_heap_push_max(results, &heap_size, n, i, sim);
-      }
-    }
+  if (set->pool && *threads > set->pool->num_threads)
+    *threads = set->pool->num_threads;
+  embedlet_mutex_unlock(&set->mutex);
+  return err;
+}
 
-    qsort(results, heap_size, sizeof(embedlet_result_t),
-          most_similar ? embedlet_cmp_desc : embedlet_cmp_asc);
+int embedlet_segmented_search(embedlet_segmented_t *set, const float *query,
+                              size_t n, bool most_similar, int num_threads,
+                              embedlet_result_t *results, size_t *count_out) {
+  if (!set || !query || n == 0 || !results || !count_out)
+    return EMBEDLET_ERR_INVALID_ARG;
+  *count_out = 0;
 
-    *count_out = heap_size;
+  size_t total = embedlet_segmented_count(set);
+  if (total == 0)
     return EMBEDLET_OK;
-  }
-
-  embedlet_mutex_lock(&store->mutex);
-  if (!store->pool) {
-    store->pool = embedlet_pool_create(threads);
-    if (!store->pool) {
-      embedlet_mutex_unlock(&store->mutex);
-      return EMBEDLET_ERR_THREAD;
-    }
-  }
-  embedlet_pool_t *pool = store->pool;
-  embedlet_mutex_unlock(&store->mutex);
+  int threads = embedlet_resolve_threads(num_threads, total);
+  int err = threads > 1 ? embedlet_segmented_pool(set, &threads)
+                        : EMBEDLET_OK;
+  if (err != EMBEDLET_OK)
+    return err;
 
-  embedlet_search_task_t *tasks = (embedlet_search_task_t *)calloc(
-      (size_t)threads, sizeof(embedlet_search_task_t));
-  if (!tasks)
+  /* Snapshot the segment list; segments stay open until the set closes */
+  embedlet_mutex_lock(&set->mutex);
+  size_t segs = set->num_segments;
+  embedlet_store_t **segments =
+      (embedlet_store_t **)malloc(segs * sizeof(embedlet_store_t *));
+  if (segments)
+    memcpy(segments, set->segments, segs * sizeof(embedlet_store_t *));
+  embedlet_mutex_unlock(&set->mutex);
+
+  embedlet_segmented_ctx_t ctx;
+  ctx.segments = segments;
+  ctx.segment_rows = set->segment_rows;
+  ctx.query = query;
+  ctx.n = n;
+  ctx.most_similar = most_similar;
+  ctx.found = segments && segs <= SIZE_MAX / sizeof(embedlet_result_t) / n
+                  ? (embedlet_result_t *)malloc(segs * n *
+                                                sizeof(embedlet_result_t))
+                  : NULL;
+  ctx.counts = (size_t *)calloc(segs, sizeof(size_t));
+  if (!segments || !ctx.found || !ctx.counts) {
+    free(segments);
+    free(ctx.found);
+    free(ctx.counts);
     return EMBEDLET_ERR_ALLOC;
-
-  size_t chunk = total / (size_t)threads;
-  size_t remainder = total % (size_t)threads;
-
-  for (int i = 0; i < threads; i++) {
-    tasks[i].store = store;
-    tasks[i].query = query;
-    tasks[i].query_norm = query_norm;
-    tasks[i].n = n;
-    tasks[i].most_similar = most_similar;
-    tasks[i].start =
-        (size_t)i * chunk + ((size_t)i < remainder ? (size_t)i : remainder);
-    tasks[i].end = tasks[i].start + chunk + ((size_t)i < remainder ? 1 : 0);
-    tasks[i].local_results =
-        (embedlet_result_t *)calloc(n, sizeof(embedlet_result_t));
-    tasks[i].result_count = 0;
-
-    if (!tasks[i].local_results) {
-      for (int j = 0; j < i; j++)
-        free(tasks[j].local_results);
-      free(tasks);
-      return EMBEDLET_ERR_ALLOC;
-    }
-
-    embedlet_pool_submit(pool, embedlet_search_worker, &tasks[i]);
   }
 
-  embedlet_pool_wait(pool);
+  /*
+   * With a segment per thread or more, fan whole segments out over the
+   * pool; with fewer, scan them one at a time with all threads each.
+   */
+  if (segs >= (size_t)threads) {
+    ctx.threads = EMBEDLET_SINGLE_THREAD;
+    err = embedlet_run_ranges(set->pool, threads, segs,
+                              embedlet_segmented_scan, &ctx);
+  } else {
+    ctx.threads = threads;
+    err = embedlet_segmented_scan(&ctx, 0, segs);
+  }
 
-  size_t final_heap_size = 0;
-  for (int i = 0; i < threads; i++) {
-    for (size_t j = 0; j < tasks[i].result_count; j++) {
-      if (most_similar) {
-        embedlet_heap_push_min(results, &final_heap_size, n,
-                               tasks[i].local_results[j].id,
-                               tasks[i].local_results[j].score);
-      } else {
-        embedlet_heap_push_max(results, &final_heap_size, n,
-                               tasks[i].local_results[j].id,
-                               tasks[i].local_results[j].score);
-      }
+  if (err == EMBEDLET_OK) {
+    size_t merged = 0;
+    for (size_t s = 0; s < segs; s++) {
+      memmove(ctx.found + merged, ctx.found + s * n,
+              ctx.counts[s] * sizeof(embedlet_result_t));
+      merged += ctx.counts[s];
     }
-    free(tasks[i].local_results);
+    embedlet_sort_results(
+        ctx.found, merged,
+        embedlet_keep_highest(embedlet_metric(segments[0]), most_similar));
+    *count_out = merged < n ? merged : n;
+    memcpy(results, ctx.found, *count_out * sizeof(embedlet_result_t));
   }
-  free(tasks);
-
-  qsort(results, final_heap_size, sizeof(embedlet_result_t),
-        most_similar ? embedlet_cmp_desc : embedlet_cmp_asc);
-
-  *count_out = final_heap_size;
-  return EMBEDLET_OK;
+  free(segments);
+  free(ctx.found);
+  free(ctx.counts);
+  return err;
 }
 
 #endif /* EMBEDLET_IMPLEMENTATION */
@@ -42,7 +42,7 @@ static void test_open_create(void) {
   printf("Testing open/create...\n");
 
   /* Remove existing test file */
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -61,7 +61,7 @@ static void test_open_create(void) {
   assert(embedlet_count(store) == 0);
 
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -70,7 +70,7 @@ static void test_open_create(void) {
 static void test_append(void) {
   printf("Testing append...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -96,7 +96,7 @@ static void test_append(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -105,7 +105,7 @@ static void test_append(void) {
 static void test_append_reuse(void) {
   printf("Testing append with reuse...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -150,7 +150,7 @@ static void test_append_reuse(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -159,7 +159,7 @@ static void test_append_reuse(void) {
 static void test_replace(void) {
   printf("Testing replace...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -197,7 +197,7 @@ static void test_replace(void) {
   free(emb1);
   free(emb2);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -206,7 +206,7 @@ static void test_replace(void) {
 static void test_delete_compact(void) {
   printf("Testing delete and compact...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -247,7 +247,7 @@ static void test_delete_compact(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -256,7 +256,7 @@ static void test_delete_compact(void) {
 static void test_similarity(void) {
   printf("Testing similarity...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -286,7 +286,43 @@ static void test_similarity(void) {
   free(emb0);
   free(emb1);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: SIMD kernels agree with a double-precision reference */
+static void test_simd_kernels(void) {
+  printf("Testing SIMD kernels (%s)...\n", embedlet_simd_backend());
+
+  float *a = (float *)malloc(TEST_DIMS * sizeof(float));
+  float *b = (float *)malloc(TEST_DIMS * sizeof(float));
+  assert(a && b);
+
+  char path[64];
+  get_embedding_path(0, path, sizeof(path));
+  load_embedding(path, a, TEST_DIMS);
+  get_embedding_path(1, path, sizeof(path));
+  load_embedding(path, b, TEST_DIMS);
+
+  /* Cover every tail length as well as the common embedding sizes */
+  static const size_t sizes[] = {384, 768, 1000, 1024};
+  for (size_t k = 0; k < 70 + sizeof(sizes) / sizeof(sizes[0]); k++) {
+    size_t n = k < 70 ? k + 1 : sizes[k - 70];
+    double ref_dot = 0.0, ref_aa = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      ref_dot += (double)a[i] * b[i];
+      ref_aa += (double)a[i] * a[i];
+    }
+    float dot = embedlet_dot(a, b, n);
+    float norm = embedlet_norm(a, n);
+    assert(fabs(dot - ref_dot) < 1e-4 * (1.0 + fabs(ref_dot)));
+    assert(fabs(norm - sqrt(ref_aa)) < 1e-4 * (1.0 + sqrt(ref_aa)));
+    assert(fabsf(dot - embedlet_dot_c(a, b, n)) < 1e-3f);
+  }
+
+  free(a);
+  free(b);
 
   printf("  PASSED\n");
 }
@@ -295,7 +331,7 @@ static void test_similarity(void) {
 static void test_search_single(void) {
   printf("Testing top-N search (single-threaded)...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -350,7 +386,7 @@ static void test_search_single(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -359,7 +395,7 @@ static void test_search_single(void) {
 static void test_search_multi(void) {
   printf("Testing top-N search (multi-threaded)...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -408,7 +444,80 @@ static void test_search_multi(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: Batched search matches per-query search */
+static void test_search_batch(void) {
+  printf("Testing batched search...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  embedlet_store_t *store = NULL;
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+
+  const size_t num_queries = 12;
+  float *queries = (float *)malloc(num_queries * TEST_DIMS * sizeof(float));
+  float *emb = (float *)malloc(TEST_DIMS * sizeof(float));
+  assert(queries && emb);
+
+  char path[64];
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    load_embedding(path, emb, TEST_DIMS);
+    size_t id;
+    embedlet_append(store, emb, false, &id);
+  }
+  embedlet_delete(store, 33);
+
+  for (size_t q = 0; q < num_queries; q++) {
+    get_embedding_path((int)(q * 11 + 3), path, sizeof(path));
+    load_embedding(path, queries + q * TEST_DIMS, TEST_DIMS);
+  }
+
+  embedlet_result_t batch[12 * 7];
+  size_t counts[12];
+  embedlet_result_t single[7];
+  size_t count;
+
+  int thread_counts[] = {EMBEDLET_SINGLE_THREAD, 3};
+  for (int t = 0; t < 2; t++) {
+    for (int most = 0; most < 2; most++) {
+      int err = embedlet_search_batch(store, queries, num_queries, 7, most != 0,
+                                      thread_counts[t], batch, counts);
+      assert(err == EMBEDLET_OK);
+
+      for (size_t q = 0; q < num_queries; q++) {
+        /* Each query is a stored row, so it must rank itself first */
+        if (most)
+          assert(batch[q * 7].id == q * 11 + 3);
+
+        err = embedlet_search(store, queries + q * TEST_DIMS, 7, most != 0,
+                              EMBEDLET_SINGLE_THREAD, single, &count);
+        assert(err == EMBEDLET_OK);
+        assert(counts[q] == count);
+        for (size_t i = 0; i < count; i++) {
+          assert(batch[q * 7 + i].id == single[i].id);
+          assert(fabsf(batch[q * 7 + i].score - single[i].score) < 1e-5f);
+          assert(batch[q * 7 + i].id != 33);
+        }
+      }
+    }
+  }
+
+  /* Result counts that do not fit a size_t are refused */
+  int err = embedlet_search_batch(store, queries, 2,
+                                  SIZE_MAX / sizeof(embedlet_result_t), true,
+                                  3, batch, counts);
+  (void)err; /* Used for assertion */
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(queries);
+  free(emb);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -417,7 +526,7 @@ static void test_search_multi(void) {
 static void test_thread_safety(void) {
   printf("Testing thread safety...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -450,7 +559,7 @@ static void test_thread_safety(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -459,7 +568,7 @@ static void test_thread_safety(void) {
 static void test_persistence(void) {
   printf("Testing persistence...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   float *emb = (float *)malloc(TEST_DIMS * sizeof(float));
   assert(emb != NULL);
@@ -501,7 +610,7 @@ static void test_persistence(void) {
   }
 
   free(emb);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -510,7 +619,7 @@ static void test_persistence(void) {
 static void test_close_compact(void) {
   printf("Testing close with compact...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   float *emb = (float *)malloc(TEST_DIMS * sizeof(float));
   assert(emb != NULL);
@@ -549,7 +658,230 @@ static void test_close_compact(void) {
   }
 
   free(emb);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: Cached norms follow every write and survive reopen */
+static void test_norm_cache(void) {
+  printf("Testing norm cache...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  float *emb = (float *)malloc(TEST_DIMS * sizeof(float));
+  assert(emb != NULL);
+
+  char path[64];
+  embedlet_store_t *store = NULL;
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+
+  for (int i = 0; i < 10; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    load_embedding(path, emb, TEST_DIMS);
+    size_t id;
+    embedlet_append(store, emb, false, &id);
+  }
+
+  /* Replace with a scaled copy so the norm visibly changes */
+  for (size_t i = 0; i < TEST_DIMS; i++)
+    emb[i] *= 3.0f;
+  embedlet_replace(store, 4, emb);
+  embedlet_delete(store, 7);
+
+  for (size_t i = 0; i < 10; i++) {
+    float expected = embedlet_norm(embedlet_get(store, i), TEST_DIMS);
+    assert(fabsf(store->norms[i] - expected) < 1e-5f);
+  }
+  assert(store->norms[7] == 0.0f);
+  embedlet_close(store, false);
+
+  /* Reopen: norms come from the sidecar */
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(store->norms_header->rows == embedlet_count(store));
+  float norm4 = store->norms[4];
+  assert(fabsf(norm4 - embedlet_norm(embedlet_get(store, 4), TEST_DIMS)) <
+         1e-5f);
+  embedlet_close(store, false);
+
+  /* Losing the sidecar rebuilds it from the vectors */
+  char sidecar[128];
+  snprintf(sidecar, sizeof(sidecar), "%s%s", TEST_STORE_PATH,
+           EMBEDLET_NORMS_SUFFIX);
+  remove(sidecar);
+
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  for (size_t i = 0; i < 10; i++) {
+    float expected = embedlet_norm(embedlet_get(store, i), TEST_DIMS);
+    assert(fabsf(store->norms[i] - expected) < 1e-5f);
+  }
+
+  /* Row 4 holds 3x embedding 9: both must score ~1.0 against embedding 9 */
+  get_embedding_path(9, path, sizeof(path));
+  load_embedding(path, emb, TEST_DIMS);
+  embedlet_result_t results[3];
+  size_t count;
+  int err = embedlet_search(store, emb, 3, true, EMBEDLET_SINGLE_THREAD,
+                            results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 3);
+  assert(results[0].id + results[1].id == 4 + 9);
+  assert(results[1].score > 0.999f);
+
+  free(emb);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: Occupancy bitmap and free-slot reuse */
+static void test_live_bitmap(void) {
+  printf("Testing live bitmap and free-slot reuse...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  float *emb = (float *)malloc(TEST_DIMS * sizeof(float));
+  assert(emb != NULL);
+
+  char path[64];
+  embedlet_store_t *store = NULL;
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+
+  for (int i = 0; i < 100; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    load_embedding(path, emb, TEST_DIMS);
+    size_t id;
+    embedlet_append(store, emb, false, &id);
+  }
+
+  /* Holes at 70, 10 and 40: reuse hands them out lowest first */
+  embedlet_delete(store, 70);
+  embedlet_delete(store, 10);
+  embedlet_delete(store, 40);
+  embedlet_delete(store, 40); /* double delete is harmless */
+
+  /* Reviving 10 via replace removes it from the free list */
+  get_embedding_path(110, path, sizeof(path));
+  load_embedding(path, emb, TEST_DIMS);
+  embedlet_replace(store, 10, emb);
+  assert(!embedlet_is_zeroed(store, 10));
+
+  size_t id;
+  embedlet_append(store, emb, true, &id);
+  assert(id == 40);
+  embedlet_append(store, emb, true, &id);
+  assert(id == 70);
+  embedlet_append(store, emb, true, &id);
+  assert(id == 100);
+
+  /* Deleted rows never show up in results */
+  embedlet_delete(store, 5);
+  get_embedding_path(5, path, sizeof(path));
+  load_embedding(path, emb, TEST_DIMS);
+  embedlet_result_t results[101];
+  size_t count;
+  embedlet_search(store, emb, 101, true, EMBEDLET_SINGLE_THREAD, results,
+                  &count);
+  assert(count == 100);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id != 5);
+
+  /* An all-zero vector is a real, live embedding */
+  memset(emb, 0, TEST_DIMS * sizeof(float));
+  embedlet_append(store, emb, false, &id);
+  assert(id == 101);
+  assert(!embedlet_is_zeroed(store, 101));
+  embedlet_compact(store);
+  assert(embedlet_count(store) == 102);
+  embedlet_close(store, false);
+
+  /* Liveness and the free list come back after reopen */
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(!embedlet_is_zeroed(store, 101));
+  assert(embedlet_is_zeroed(store, 5));
+  embedlet_append(store, emb, true, &id);
+  assert(id == 5);
+
+  free(emb);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: File header validation and legacy (headerless) migration */
+static void test_file_header(void) {
+  printf("Testing file header...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  float *emb = (float *)malloc(TEST_DIMS * sizeof(float));
+  assert(emb != NULL);
+
+  char path[64];
+
+  /* A torn row is no legacy store; the file is left as it is */
+  FILE *f = fopen(TEST_STORE_PATH, "wb");
+  assert(f != NULL);
+  memset(emb, 0, TEST_DIMS * sizeof(float));
+  fwrite(emb, sizeof(float), TEST_DIMS, f);
+  fwrite(emb, 1, 7, f);
+  fclose(f);
+  embedlet_store_t *store = NULL;
+  int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_ERR_FORMAT);
+  f = fopen(TEST_STORE_PATH, "rb");
+  assert(f != NULL);
+  fseek(f, 0, SEEK_END);
+  assert(ftell(f) == (long)(TEST_DIMS * sizeof(float) + 7));
+  fclose(f);
+
+  /* Legacy file: 3 raw rows followed by 2 rows of zero padding */
+  f = fopen(TEST_STORE_PATH, "wb");
+  assert(f != NULL);
+  for (int i = 0; i < 3; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    load_embedding(path, emb, TEST_DIMS);
+    fwrite(emb, sizeof(float), TEST_DIMS, f);
+  }
+  memset(emb, 0, TEST_DIMS * sizeof(float));
+  fwrite(emb, sizeof(float), TEST_DIMS, f);
+  fwrite(emb, sizeof(float), TEST_DIMS, f);
+  fclose(f);
+
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(store) == 3);
+  get_embedding_path(2, path, sizeof(path));
+  load_embedding(path, emb, TEST_DIMS);
+  assert(memcmp(embedlet_get(store, 2), emb, TEST_DIMS * sizeof(float)) == 0);
+  embedlet_close(store, false);
+  f = fopen(TEST_STORE_PATH ".migrate", "rb");
+  assert(f == NULL); /* renamed over the store */
+
+  /* Reopen: header is authoritative, dims are checked */
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(store) == 3);
+  assert(store->header->version == EMBEDLET_FILE_VERSION);
+  embedlet_close(store, false);
+
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS / 2, &store);
+  assert(err == EMBEDLET_ERR_DIMS_MISMATCH);
+
+  /* Unknown future version is rejected rather than misread */
+  f = fopen(TEST_STORE_PATH, "r+b");
+  assert(f != NULL);
+  uint32_t version = EMBEDLET_FILE_VERSION + 1;
+  fseek(f, 8, SEEK_SET);
+  fwrite(&version, sizeof(version), 1, f);
+  fclose(f);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_ERR_FORMAT);
+
+  free(emb);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -558,7 +890,7 @@ static void test_close_compact(void) {
 static void test_edge_cases(void) {
   printf("Testing edge cases...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   int err;
@@ -594,7 +926,7 @@ static void test_edge_cases(void) {
   assert(err == EMBEDLET_ERR_INVALID_ID);
 
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   printf("  PASSED\n");
 }
@@ -603,7 +935,7 @@ static void test_edge_cases(void) {
 static void test_batch_append(void) {
   printf("Testing batch append (all 150 files)...\n");
 
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
 
   embedlet_store_t *store = NULL;
   embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
@@ -633,8 +965,2894 @@ static void test_batch_append(void) {
 
   free(emb);
   embedlet_close(store, false);
-  remove(TEST_STORE_PATH);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: Bulk append API */
+static void test_append_batch(void) {
+  printf("Testing append_batch (all 150 files)...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  embedlet_store_t *store = NULL;
+  embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  size_t *ids = (size_t *)malloc(TEST_NUM_FILES * sizeof(size_t));
+  assert(all && ids);
+
+  char path[64];
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    int err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  /* One row first, so the batch ids start after it */
+  size_t id;
+  embedlet_append(store, all, false, &id);
+
+  clock_t start = clock();
+  int err = embedlet_append_batch(store, all, TEST_NUM_FILES, ids);
+  double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  assert(err == EMBEDLET_OK);
+  printf("  Appended %d embeddings in %.3f seconds\n", TEST_NUM_FILES, elapsed);
+
+  assert(embedlet_count(store) == TEST_NUM_FILES + 1);
+  for (size_t i = 0; i < TEST_NUM_FILES; i++) {
+    assert(ids[i] == i + 1);
+    assert(memcmp(embedlet_get(store, ids[i]), all + i * TEST_DIMS,
+                  TEST_DIMS * sizeof(float)) == 0);
+    assert(fabsf(store->norms[ids[i]] -
+                 embedlet_norm(all + i * TEST_DIMS, TEST_DIMS)) < 1e-5f);
+  }
+
+  /* Empty batch is a no-op; ids_out is optional */
+  err = embedlet_append_batch(store, NULL, 0, NULL);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append_batch(store, all, 2, NULL);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(store) == TEST_NUM_FILES + 3);
+  err = embedlet_append_batch(NULL, all, 2, NULL);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  /* Batch rows are searchable */
+  embedlet_result_t results[1];
+  size_t count;
+  embedlet_search(store, all + 77 * TEST_DIMS, 1, true, EMBEDLET_SINGLE_THREAD,
+                  results, &count);
+  assert(count == 1 && results[0].score > 0.999f);
+
+  free(all);
+  free(ids);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_quantized(void) {
+  printf("Testing quantized storage (f16, bf16, int8)...\n");
+
+  /* Scalar conversions: exact values, rounding, subnormals and overflow */
+  assert(embedlet_f32_to_f16(1.0f) == 0x3c00);
+  assert(embedlet_f32_to_f16(-2.0f) == 0xc000);
+  assert(embedlet_f32_to_f16(65504.0f) == 0x7bff);
+  assert(embedlet_f32_to_f16(70000.0f) == 0x7c00);
+  assert(embedlet_f32_to_f16(1.0f + 1.0f / 4096.0f) == 0x3c00); /* tie: even */
+  assert(embedlet_f16_to_f32(embedlet_f32_to_f16(1e-6f)) > 0.9e-6f);
+  assert(embedlet_f16_to_f32(0x0001) == ldexpf(1.0f, -24));
+  assert(embedlet_f32_to_bf16(1.0f) == 0x3f80);
+  assert(embedlet_bf16_to_f32(embedlet_f32_to_bf16(-3.5f)) == -3.5f);
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  float *exact = (float *)malloc(TEST_NUM_FILES * sizeof(float));
+  float *copy = (float *)malloc(TEST_DIMS * sizeof(float));
+  uint16_t *half = (uint16_t *)malloc(TEST_DIMS * sizeof(uint16_t));
+  int8_t *codes = (int8_t *)malloc(TEST_DIMS);
+  assert(all && exact && copy && half && codes);
+
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  /* Converting kernels agree with the portable loops for every tail */
+  for (size_t i = 0; i < TEST_DIMS; i++) {
+    half[i] = embedlet_f32_to_f16(all[TEST_DIMS + i]);
+    codes[i] = (int8_t)((int)(i * 37) % 255 - 127);
+  }
+  for (size_t n = 1; n <= TEST_DIMS; n = n < 70 ? n + 1 : n * 2) {
+    float ref = embedlet_dot_f16_c(all, half, n);
+    assert(fabsf(embedlet_kernels.dot_f16(all, half, n) - ref) < 1e-3f);
+    float ref_bf16 = 0.0f, ref_i8 = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+      ref_bf16 += all[i] * embedlet_bf16_to_f32(half[i]);
+      ref_i8 += all[i] * (float)codes[i];
+    }
+    assert(fabsf(embedlet_kernels.dot_bf16(all, half, n) - ref_bf16) <
+           1e-3f * (1.0f + fabsf(ref_bf16)));
+    assert(fabsf(embedlet_kernels.dot_i8(all, codes, n) - ref_i8) <
+           1e-3f * (1.0f + fabsf(ref_i8)));
+  }
+
+  static const int dtypes[] = {EMBEDLET_DTYPE_F16, EMBEDLET_DTYPE_BF16,
+                               EMBEDLET_DTYPE_I8};
+  static const float tolerance[] = {2e-3f, 1e-2f, 1e-2f};
+  const float *query = all + 5 * TEST_DIMS;
+  for (int i = 0; i < TEST_NUM_FILES; i++)
+    exact[i] = embedlet_similarity_raw(query, all + i * TEST_DIMS, TEST_DIMS);
+
+  for (size_t t = 0; t < 3; t++) {
+    embedlet_remove(TEST_STORE_PATH);
+
+    embedlet_options_t options = {0};
+    options.dtype = dtypes[t];
+    embedlet_store_t *store = NULL;
+    err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+    assert(err == EMBEDLET_OK);
+    assert(embedlet_dtype(store) == dtypes[t]);
+    err = embedlet_append_batch(store, all, TEST_NUM_FILES, NULL);
+    assert(err == EMBEDLET_OK);
+    assert(store->header->row_bytes < TEST_DIMS * sizeof(float) / 1.5);
+
+    /* Raw pointers are float32-only; copies are decoded */
+    assert(embedlet_get(store, 0) == NULL);
+    err = embedlet_get_copy(store, 3, copy);
+    assert(err == EMBEDLET_OK);
+    assert(embedlet_similarity_raw(copy, all + 3 * TEST_DIMS, TEST_DIMS) >
+           1.0f - tolerance[t]);
+    err = embedlet_get_copy(store, TEST_NUM_FILES, copy);
+    assert(err == EMBEDLET_ERR_INVALID_ID);
+    embedlet_close(store, false);
+
+    /* Element type comes from the header on reopen; rebuilt norms match */
+    char *norms_path = embedlet_sidecar_path(TEST_STORE_PATH,
+                                             EMBEDLET_NORMS_SUFFIX);
+    remove(norms_path);
+    free(norms_path);
+    err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+    assert(err == EMBEDLET_OK);
+    assert(embedlet_dtype(store) == dtypes[t]);
+    assert(embedlet_count(store) == TEST_NUM_FILES);
+
+    embedlet_result_t results[10], batch[10];
+    size_t count, batch_count;
+    embedlet_search(store, query, 10, true, EMBEDLET_AUTO_THREADS, results,
+                    &count);
+    embedlet_search_batch(store, query, 1, 10, true, EMBEDLET_SINGLE_THREAD,
+                          batch, &batch_count);
+    assert(count == 10 && batch_count == 10);
+    assert(results[0].id == 5);
+    for (size_t i = 0; i < count; i++) {
+      assert(fabsf(results[i].score - exact[results[i].id]) < tolerance[t]);
+      assert(batch[i].id == results[i].id);
+    }
+
+    /* Deletes and replaces work on encoded rows */
+    embedlet_delete(store, 5);
+    embedlet_search(store, query, 1, true, EMBEDLET_SINGLE_THREAD, results,
+                    &count);
+    assert(count == 1 && results[0].id != 5);
+    embedlet_replace(store, 7, query);
+    embedlet_search(store, query, 1, true, EMBEDLET_SINGLE_THREAD, results,
+                    &count);
+    assert(results[0].id == 7 && results[0].score > 1.0f - tolerance[t]);
+    embedlet_close(store, false);
+  }
+
+  /* Unknown element types are rejected */
+  embedlet_options_t bad = {0};
+  bad.dtype = 42;
+  embedlet_store_t *store = NULL;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &bad, &store);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(all);
+  free(exact);
+  free(copy);
+  free(half);
+  free(codes);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_search_rerank(void) {
+  printf("Testing two-stage rerank search...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  embedlet_store_t *store = NULL;
+  int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  (void)err; /* Used for assertion */
+  assert(err == EMBEDLET_OK);
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  assert(all != NULL);
+  char path[64];
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+  embedlet_append_batch(store, all, TEST_NUM_FILES, NULL);
+
+  /* Hardware and portable Hamming kernels agree */
+  const uint64_t *codes = store->bits;
+  uint32_t words = (uint32_t)store->bits_words;
+  assert(words == (TEST_DIMS + 63) / 64);
+  assert(embedlet_kernels.hamming(codes, codes + words, words) ==
+         embedlet_hamming_c(codes, codes + words, words));
+  assert(embedlet_hamming_c(codes, codes, words) == 0);
+
+  const float *query = all + 12 * TEST_DIMS;
+  embedlet_result_t exact[10], results[10];
+  size_t exact_count, count;
+  embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD, exact,
+                  &exact_count);
+
+  /* Default oversample: scores are exact, recall is high */
+  err = embedlet_search_rerank(store, query, 10, 0, true,
+                               EMBEDLET_AUTO_THREADS, results, &count);
+  assert(err == EMBEDLET_OK && count == 10);
+  assert(results[0].id == 12);
+  size_t hits = 0;
+  for (size_t i = 0; i < count; i++) {
+    float ref = embedlet_similarity_raw(query, all + results[i].id * TEST_DIMS,
+                                        TEST_DIMS);
+    assert(fabsf(results[i].score - ref) < 1e-5f);
+    for (size_t j = 0; j < exact_count; j++)
+      hits += results[i].id == exact[j].id;
+  }
+  printf("  Recall@10 with oversample %d: %zu/10\n",
+         EMBEDLET_DEFAULT_OVERSAMPLE, hits);
+  assert(hits >= 9);
+
+  /* Oversample covering the whole store equals the exact search */
+  embedlet_search_rerank(store, query, 10, SIZE_MAX, false,
+                         EMBEDLET_SINGLE_THREAD, results, &count);
+  embedlet_search(store, query, 10, false, EMBEDLET_SINGLE_THREAD, exact,
+                  &exact_count);
+  assert(count == exact_count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id == exact[i].id && results[i].score == exact[i].score);
+
+  /* Deleted rows never survive the prefilter */
+  embedlet_delete(store, 12);
+  embedlet_search_rerank(store, query, 10, 2, true, EMBEDLET_SINGLE_THREAD,
+                         results, &count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id != 12);
+
+  /* The sign-bit sidecar is rebuilt from the rows if it goes missing */
+  uint64_t saved[(TEST_DIMS + 63) / 64];
+  memcpy(saved, store->bits + 40 * words, sizeof(saved));
+  embedlet_close(store, false);
+  char *bits_path =
+      embedlet_sidecar_path(TEST_STORE_PATH, EMBEDLET_BITS_SUFFIX);
+  err = remove(bits_path);
+  assert(err == 0);
+  free(bits_path);
+
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(memcmp(store->bits + 40 * words, saved, sizeof(saved)) == 0);
+  assert(store->bits_header->rows == TEST_NUM_FILES);
+
+  err = embedlet_search_rerank(NULL, query, 10, 0, true, 1, results, &count);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(all);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+/* Recall@10 of the ANN search against exact search for stored rows */
+static size_t ann_recall_hits(embedlet_store_t *store, const float *all,
+                              int queries) {
+  size_t hits = 0;
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int q = 0; q < queries; q++) {
+    const float *query = all + (size_t)(q * 7 + 3) * TEST_DIMS;
+    embedlet_result_t exact[10], results[10];
+    size_t exact_count, count;
+    embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD, exact,
+                    &exact_count);
+    err = embedlet_search_ann(store, query, 10, 0, results, &count);
+    assert(err == EMBEDLET_OK);
+    assert(count == exact_count);
+    for (size_t i = 0; i < count; i++) {
+      for (size_t j = 0; j < exact_count; j++)
+        hits += results[i].id == exact[j].id;
+    }
+  }
+  return hits;
+}
+
+typedef struct {
+  embedlet_store_t *store;
+  const float *query;
+  int searches;
+} ann_task_t;
+
+static void ann_worker(void *arg) {
+  ann_task_t *t = (ann_task_t *)arg;
+  for (int i = 0; i < t->searches; i++) {
+    embedlet_result_t results[10];
+    size_t count;
+    int err = embedlet_search_ann(t->store, t->query, 10, 0, results, &count);
+    assert(err == EMBEDLET_OK && count == 10);
+  }
+}
+
+/* Test: HNSW index build, search, updates and persistence */
+static void test_search_ann(void) {
+  printf("Testing HNSW approximate search...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  assert(all != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  /* A store without an index reports it */
+  embedlet_store_t *store = NULL;
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, all, 100, NULL);
+  embedlet_result_t results[10];
+  size_t count;
+  err = embedlet_search_ann(store, all, 10, 0, results, &count);
+  assert(err == EMBEDLET_ERR_NOT_FOUND);
+  embedlet_close(store, false);
+
+  embedlet_options_t options = {0};
+  options.hnsw_m = 300;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  /* Opening with hnsw_m indexes the existing rows, appends extend it */
+  options.hnsw_m = 8;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  assert(store->hnsw_header->rows == 100);
+  for (int i = 100; i < TEST_NUM_FILES; i++) {
+    size_t id;
+    embedlet_append(store, all + (size_t)i * TEST_DIMS, false, &id);
+  }
+  assert(store->hnsw_header->rows == TEST_NUM_FILES);
+
+  /* Links stay within capacity and never point at the node itself */
+  for (size_t id = 0; id < TEST_NUM_FILES; id++) {
+    const uint32_t *list = embedlet_hnsw_list(store, id, 0);
+    assert(list[0] <= 16);
+    for (uint32_t j = 0; j < list[0]; j++)
+      assert(list[1 + j] != id && list[1 + j] < TEST_NUM_FILES);
+  }
+
+  const float *query = all + 12 * TEST_DIMS;
+  err = embedlet_search_ann(store, query, 10, 0, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 10 && results[0].id == 12);
+  for (size_t i = 0; i < count; i++) {
+    float ref = embedlet_similarity_raw(query, all + results[i].id * TEST_DIMS,
+                                        TEST_DIMS);
+    assert(fabsf(results[i].score - ref) < 1e-5f);
+    assert(i == 0 || results[i - 1].score >= results[i].score);
+  }
+  size_t hits = ann_recall_hits(store, all, 20);
+  printf("  Recall@10 over 20 queries: %zu/200\n", hits);
+  assert(hits >= 190);
+
+  /* Deleted rows drop out; neighbours are relinked around them */
+  embedlet_delete(store, 12);
+  embedlet_search_ann(store, query, 10, 0, results, &count);
+  assert(count == 10);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id != 12);
+  hits = ann_recall_hits(store, all, 20);
+  assert(hits >= 180);
+
+  /* Replacing a row moves it in the graph */
+  embedlet_replace(store, 12, all + 40 * TEST_DIMS);
+  embedlet_search_ann(store, all + 40 * TEST_DIMS, 2, 0, results, &count);
+  assert(count == 2);
+  assert((results[0].id == 12 && results[1].id == 40) ||
+         (results[0].id == 40 && results[1].id == 12));
+
+  /* The index persists and is reused untouched on reopen */
+  embedlet_result_t before[10];
+  size_t before_count;
+  embedlet_search_ann(store, query, 10, 32, before, &before_count);
+  embedlet_close(store, false);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(store->hnsw_ctx != NULL && store->hnsw_header->m == 8);
+  embedlet_search_ann(store, query, 10, 32, results, &count);
+  assert(count == before_count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id == before[i].id);
+
+  /* A graph marked stale, by a row that went unlinked, is rebuilt */
+  store->hnsw_header->stale = 1;
+  embedlet_close(store, false);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(!store->hnsw_header->stale &&
+         store->hnsw_header->rows == TEST_NUM_FILES);
+  hits = ann_recall_hits(store, all, 20);
+  assert(hits >= 180);
+
+  /* Searches walk the graph while writers relink it, each with its own
+   * scratch */
+  ann_task_t task = {store, all + 30 * TEST_DIMS, 100};
+  embedlet_pool_t *client = NULL;
+  err = embedlet_pool_create(2, false, &client);
+  assert(err == EMBEDLET_OK);
+  embedlet_pool_submit(client, ann_worker, &task);
+  embedlet_pool_submit(client, ann_worker, &task);
+  for (int i = 0; i < 50; i++) {
+    size_t id;
+    err = embedlet_append(store, all + (size_t)(i % 20) * TEST_DIMS, false,
+                          &id);
+    assert(err == EMBEDLET_OK);
+    err = embedlet_replace(store, (size_t)i, all + (size_t)i * TEST_DIMS);
+    assert(err == EMBEDLET_OK);
+    err = embedlet_delete(store, id);
+    assert(err == EMBEDLET_OK);
+  }
+  embedlet_pool_wait(client);
+  embedlet_pool_destroy(client);
+  assert(store->hnsw_idle != NULL);
+
+  err = embedlet_search_ann(NULL, query, 10, 0, results, &count);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(all);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  char *hnsw_path =
+      embedlet_sidecar_path(TEST_STORE_PATH, EMBEDLET_HNSW_SUFFIX);
+  FILE *f = fopen(hnsw_path, "rb");
+  assert(f == NULL);
+  free(hnsw_path);
+
+  printf("  PASSED\n");
+}
+/* Test: IVF-PQ training, search, updates and persistence */
+static void test_search_ivf(void) {
+  printf("Testing IVF-PQ search...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  embedlet_store_t *store = NULL;
+  int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  (void)err; /* Used for assertion */
+  assert(err == EMBEDLET_OK);
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  assert(all != NULL);
+  char path[64];
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  const float *query = all + 12 * TEST_DIMS;
+  embedlet_result_t exact[10], results[10];
+  size_t exact_count, count;
+  err = embedlet_search_ivf(store, query, 10, 0, 0, 1, results, &count);
+  assert(err == EMBEDLET_ERR_NOT_FOUND);
+  err = embedlet_ivf_train(store, NULL, 1);
+  assert(err == EMBEDLET_ERR_NOT_FOUND);
+  embedlet_append_batch(store, all, TEST_NUM_FILES, NULL);
+
+  embedlet_ivf_params_t params = {0};
+  params.pq_m = 1000;
+  err = embedlet_ivf_train(store, &params, 1);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  params.nlist = 8;
+  params.pq_m = 64;
+  err = embedlet_ivf_train(store, &params, EMBEDLET_AUTO_THREADS);
+  assert(err == EMBEDLET_OK);
+
+  /* Lists partition every row, and slots map back to their rows */
+  const embedlet_ivf_header_t *h = store->ivf_header;
+  assert(h->nlist == 8 && h->pq_m == 64 && h->covered == TEST_NUM_FILES);
+  assert(store->ivf_offsets[0] == 0 &&
+         store->ivf_offsets[8] == TEST_NUM_FILES);
+  for (size_t id = 0; id < TEST_NUM_FILES; id++)
+    assert(store->ivf_slot_rows[store->ivf_slot_of[id]] == id);
+
+  /* Probing every list and rescoring every candidate is the exact search */
+  embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD, exact,
+                  &exact_count);
+  err = embedlet_search_ivf(store, query, 10, 8, SIZE_MAX,
+                            EMBEDLET_AUTO_THREADS, results,
+                            &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == exact_count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id == exact[i].id && results[i].score == exact[i].score);
+
+  /* PQ-only scores approximate cosine similarity */
+  embedlet_search_ivf(store, query, 10, 0, 0, 1, results, &count);
+  assert(count == 10 && results[0].id == 12);
+  size_t hits = 0;
+  for (size_t i = 0; i < count; i++) {
+    float ref = embedlet_similarity_raw(query, all + results[i].id * TEST_DIMS,
+                                        TEST_DIMS);
+    assert(fabsf(results[i].score - ref) < 0.05f);
+    for (size_t j = 0; j < exact_count; j++)
+      hits += results[i].id == exact[j].id;
+  }
+  printf("  Recall@10 with nprobe %d, PQ scores: %zu/10\n",
+         EMBEDLET_DEFAULT_NPROBE, hits);
+  assert(hits >= 7);
+
+  /* Deleted rows are skipped, rewritten rows are re-encoded in place */
+  embedlet_delete(store, 12);
+  embedlet_search_ivf(store, query, 10, 8, 0, 1, results, &count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id != 12);
+  embedlet_replace(store, 12, all + 41 * TEST_DIMS);
+  embedlet_search_ivf(store, all + 41 * TEST_DIMS, 2, 8, 10, 1, results,
+                      &count);
+  assert(count == 2);
+  assert((results[0].id == 12 && results[1].id == 41) ||
+         (results[0].id == 41 && results[1].id == 12));
+
+  /* Rows appended after training are scored exactly */
+  size_t id;
+  embedlet_append(store, all + 40 * TEST_DIMS, false, &id);
+  assert(id == TEST_NUM_FILES);
+  embedlet_search_ivf(store, all + 40 * TEST_DIMS, 2, 1, 0, 1, results,
+                      &count);
+  assert(results[0].id == id && fabsf(results[0].score - 1.0f) < 1e-5f);
+
+  /* The index persists; compaction shrinks the rows it covers */
+  embedlet_close(store, false);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(store->ivf_header && store->ivf_header->nlist == 8);
+  embedlet_search_ivf(store, all + 40 * TEST_DIMS, 2, 1, 0, 1, results,
+                      &count);
+  assert(results[0].id == id);
+  embedlet_delete(store, id);
+  embedlet_delete(store, id - 1);
+  embedlet_compact(store);
+  assert(store->ivf_header->covered == TEST_NUM_FILES - 1);
+  embedlet_search_ivf(store, all + 149 * TEST_DIMS, 10, 8, 0, 1, results,
+                      &count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id < TEST_NUM_FILES - 1);
+
+  err = embedlet_search_ivf(NULL, query, 10, 0, 0, 1, results, &count);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(all);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+typedef struct {
+  embedlet_store_t *store;
+  const float *rows;
+  int count;
+  volatile int done;
+} grow_task_t;
+
+static void grow_worker(void *arg) {
+  grow_task_t *task = (grow_task_t *)arg;
+  for (int i = 0; i < task->count; i++) {
+    size_t id;
+    embedlet_append(task->store, task->rows + (size_t)(i % 50) * TEST_DIMS,
+                    false, &id);
+  }
+  task->done = 1;
+}
+
+/* Test: mappings grow in place while searches keep reading them */
+static void test_stable_mapping(void) {
+  printf("Testing in-place mapping growth...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, rows, 50, NULL);
+  const float *data = store->data;
+  const float *norms = store->norms;
+
+  /* One writer grows every file through many doublings meanwhile */
+  grow_task_t task = {store, rows, 4000, 0};
+  embedlet_pool_t *writer = NULL;
+  err = embedlet_pool_create(1, false, &writer);
+  assert(err == EMBEDLET_OK);
+  embedlet_pool_submit(writer, grow_worker, &task);
+  int searches = 0;
+  do {
+    embedlet_result_t results[5];
+    size_t count;
+    int err = embedlet_search(store, rows + 7 * TEST_DIMS, 5, true,
+                              EMBEDLET_SINGLE_THREAD, results, &count);
+    assert(err == EMBEDLET_OK && count == 5);
+    assert(results[0].id % 50 == 7);
+    searches++;
+  } while (!task.done);
+  embedlet_pool_wait(writer);
+  embedlet_pool_destroy(writer);
+  printf("  %d searches during %d appends\n", searches, task.count);
+
+  assert(embedlet_count(store) == 4050);
+  assert(store->data == data && store->norms == norms);
+  assert(store->file.retired == NULL);
+  assert(store->norms_file.reserve_hint < EMBEDLET_DEFAULT_RESERVE_BYTES);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  /* A file outgrowing a small reservation moves, keeping the old view */
+  embedlet_options_t options = {0};
+  options.reserve_bytes = 64 * 1024;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, rows, 10, NULL);
+  /* Sidecars reserve for as many rows as the store file's range holds */
+  assert(store->norms_file.reserved < options.reserve_bytes);
+  assert(store->bits_file.reserved < options.reserve_bytes);
+  data = store->data;
+  embedlet_append_batch(store, rows, 50, NULL);
+  assert(store->data != data && store->file.retired != NULL);
+  assert(data[7 * TEST_DIMS] == rows[7 * TEST_DIMS]);
+  assert(store->data[17 * TEST_DIMS] == rows[7 * TEST_DIMS]);
+
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+
+
+
+static size_t count_work_items(const embedlet_work_t *work) {
+  size_t count = 0;
+  for (; work; work = work->next)
+    count++;
+  return count;
+}
+
+static void test_search_scratch(void) {
+  printf("Testing search scratch reuse...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+  embedlet_store_t *store = NULL;
+  int err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  (void)err; /* Used for assertion */
+  assert(err == EMBEDLET_OK);
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+  for (int i = 0; i < 40; i++)
+    embedlet_append_batch(store, rows, 50, NULL);
+
+  /* Heaps of 2000 on 4 threads overflow the first block of the arena */
+  size_t n = 2000;
+  embedlet_result_t *results =
+      (embedlet_result_t *)malloc(3 * n * sizeof(embedlet_result_t));
+  size_t counts[3];
+  assert(results != NULL);
+  const embedlet_arena_t *arena = NULL;
+  const embedlet_arena_block_t *block = NULL;
+  size_t work_items = 0;
+  for (int round = 0; round < 3; round++) {
+    for (int q = 0; q < 5; q++) {
+      const float *query = rows + (size_t)q * TEST_DIMS;
+      err = embedlet_search(store, query, n, true, 4, results, &counts[0]);
+      assert(err == EMBEDLET_OK);
+      assert(counts[0] == n && results[0].id % 50 == (size_t)q);
+      err = embedlet_search_rerank(store, query, 5, 0, true, 4, results,
+                                   &counts[0]);
+      assert(err == EMBEDLET_OK);
+      assert(counts[0] == 5 && results[0].id % 50 == (size_t)q);
+      err = embedlet_search_batch(store, query, 3, n, true, 4, results,
+                                  counts);
+      assert(err == EMBEDLET_OK);
+      assert(counts[0] == n && counts[2] == n);
+      assert(results[2 * n].id % 50 == (size_t)q + 2);
+    }
+
+    /* One idle arena in one block and a fixed set of work items */
+    assert(store->arenas != NULL && store->arenas->next == NULL);
+    assert(store->arenas->blocks->next == NULL);
+    assert(store->arenas->blocks->cap >= 4 * n * sizeof(embedlet_result_t));
+    size_t items = count_work_items(store->pool->free_work);
+    assert(items > 0 && items <= 4);
+    if (round > 0) {
+      assert(store->arenas == arena && store->arenas->blocks == block);
+      assert(items == work_items);
+    }
+    arena = store->arenas;
+    block = store->arenas->blocks;
+    work_items = items;
+  }
+
+  free(results);
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_work_stealing(void) {
+  printf("Testing work-stealing search pool...\n");
+
+  embedlet_remove(TEST_STORE_PATH);
+  embedlet_options_t options = {0};
+  options.pin_threads = 1;
+  embedlet_store_t *store = NULL;
+  int err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  (void)err; /* Used for assertion */
+  assert(err == EMBEDLET_OK);
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+  for (int i = 0; i < 60; i++)
+    embedlet_append_batch(store, rows, 50, NULL);
+  for (size_t id = 5; id < 3000; id += 7)
+    embedlet_delete(store, id);
+
+  /* Any split into stolen blocks gives the single-threaded answer */
+  embedlet_result_t expected[20], results[20];
+  size_t expected_count, count;
+  const float *query = rows + 11 * TEST_DIMS;
+  err = embedlet_search(store, query, 20, true, EMBEDLET_SINGLE_THREAD,
+                        expected, &expected_count);
+  assert(err == EMBEDLET_OK);
+  assert(expected_count == 20);
+  int thread_counts[] = {2, 3, 7, 5, 16};
+  int grown = 0;
+  for (size_t t = 0; t < sizeof(thread_counts) / sizeof(int); t++) {
+    err = embedlet_search(store, query, 20, true, thread_counts[t], results,
+                          &count);
+    assert(err == EMBEDLET_OK);
+    assert(count == expected_count);
+    for (size_t i = 0; i < count; i++)
+      assert(results[i].score == expected[i].score);
+
+    /* The pool grows to the largest request and never shrinks */
+    if (thread_counts[t] > grown)
+      grown = thread_counts[t];
+    assert(store->pool->num_threads == grown);
+  }
+#if defined(__linux__)
+  for (int i = 0; i < store->pool->num_threads; i++)
+    assert(store->pool->workers[i]->cpu >= 0);
+#endif
+
+  embedlet_result_t batch[2 * 20];
+  size_t batch_counts[2];
+  err = embedlet_search_batch(store, query, 2, 20, true, 3, batch,
+                              batch_counts);
+  assert(err == EMBEDLET_OK);
+  assert(batch_counts[0] == 20);
+  for (size_t i = 0; i < 20; i++)
+    assert(batch[i].score == expected[i].score);
+
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+typedef struct {
+  embedlet_store_t *store;
+  const float *query;
+  int searches;
+} tenant_task_t;
+
+static void tenant_worker(void *arg) {
+  tenant_task_t *t = (tenant_task_t *)arg;
+  for (int i = 0; i < t->searches; i++) {
+    embedlet_result_t results[3];
+    size_t count;
+    int err = embedlet_search(t->store, t->query, 3, true, 3, results, &count);
+    assert(err == EMBEDLET_OK && count == 3);
+  }
+}
+
+static void test_shared_pool(void) {
+  printf("Testing shared thread pool...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_pool_t *pool = NULL;
+  err = embedlet_pool_create(-1, false, &pool);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  err = embedlet_pool_create(3, false, &pool);
+  assert(err == EMBEDLET_OK);
+
+  const char *paths[] = {"test_tenant0.emb", "test_tenant1.emb"};
+  embedlet_store_t *stores[2];
+  for (int s = 0; s < 2; s++) {
+    embedlet_remove(paths[s]);
+    err = embedlet_open(paths[s], TEST_DIMS, &stores[s]);
+    assert(err == EMBEDLET_OK);
+    for (int i = 0; i < 20; i++)
+      embedlet_append_batch(stores[s], rows + (size_t)s * TEST_DIMS, 40, NULL);
+    err = embedlet_attach_pool(stores[s], pool);
+    assert(err == EMBEDLET_OK);
+    assert(stores[s]->pool == pool);
+  }
+  assert(pool->refs == 3);
+
+  /* The shared pool stays at its size whatever a search asks for */
+  embedlet_result_t expected[5], results[5];
+  size_t expected_count, count;
+  const float *query = rows + 9 * TEST_DIMS;
+  err = embedlet_search(stores[0], query, 5, true, EMBEDLET_SINGLE_THREAD,
+                        expected, &expected_count);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_search(stores[0], query, 5, true, 16, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == expected_count && pool->num_threads == 3);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].score == expected[i].score);
+
+  /* Two tenants querying at once through the same workers */
+  tenant_task_t tenant = {stores[1], query, 50};
+  embedlet_pool_t *client = NULL;
+  err = embedlet_pool_create(1, false, &client);
+  assert(err == EMBEDLET_OK);
+  embedlet_pool_submit(client, tenant_worker, &tenant);
+  for (int i = 0; i < 50; i++) {
+    err = embedlet_search(stores[0], query, 5, true, 3, results, &count);
+    assert(err == EMBEDLET_OK);
+    assert(count == 5 && results[0].score == expected[0].score);
+  }
+  embedlet_pool_wait(client);
+  embedlet_pool_destroy(client);
+  assert(pool->num_threads == 3);
+
+  /* A deque serves the least busy store first, oldest item first */
+  embedlet_pool_client_t busy = {2}, idle = {0};
+  embedlet_work_t items[3];
+  embedlet_pool_client_t *owners[3] = {&busy, &busy, &idle};
+  embedlet_worker_t *w = pool->workers[0];
+  embedlet_mutex_lock(&w->lock);
+  embedlet_work_t *head = w->head, *tail = w->tail;
+  w->head = w->tail = NULL;
+  embedlet_mutex_unlock(&w->lock);
+  for (int i = 0; i < 3; i++) {
+    items[i].latch = NULL;
+    items[i].client = owners[i];
+    embedlet_deque_push(w, &items[i]);
+  }
+  embedlet_work_t *popped[3];
+  for (int i = 0; i < 3; i++)
+    popped[i] = embedlet_deque_pop(w, NULL);
+  assert(popped[0] == &items[2] && popped[1] == &items[0] &&
+         popped[2] == &items[1]);
+  (void)popped;
+  embedlet_mutex_lock(&w->lock);
+  w->head = head;
+  w->tail = tail;
+  embedlet_mutex_unlock(&w->lock);
+
+  /* The pool outlives its creator's reference until the stores let go */
+  err = embedlet_pool_destroy(pool);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_attach_pool(stores[0], NULL);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_search(stores[1], query, 5, true, 3, results, &count);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_search(stores[0], query, 5, true, 2, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(stores[0]->pool != NULL && stores[0]->pool != stores[1]->pool);
+
+  /* Swapping pools waits for the searches still running on the old one */
+  tenant.searches = 200;
+  err = embedlet_pool_create(1, false, &client);
+  assert(err == EMBEDLET_OK);
+  embedlet_pool_submit(client, tenant_worker, &tenant);
+  for (int i = 0; i < 20; i++) {
+    embedlet_pool_t *next = NULL;
+    if (i % 2 == 0) {
+      err = embedlet_pool_create(2, false, &next);
+      assert(err == EMBEDLET_OK);
+    }
+    err = embedlet_attach_pool(stores[1], next);
+    assert(err == EMBEDLET_OK);
+    embedlet_pool_destroy(next);
+  }
+  embedlet_pool_wait(client);
+  embedlet_pool_destroy(client);
+  assert(stores[1]->pool_users == 0 && !stores[1]->pool_swap);
+
+  for (int s = 0; s < 2; s++) {
+    embedlet_close(stores[s], false);
+    embedlet_remove(paths[s]);
+  }
+  free(rows);
+
+  printf("  PASSED\n");
+}
+
+typedef struct {
+  int calls;
+  int status;
+  size_t count;
+  float top;
+} async_seen_t;
+
+static void async_callback(void *user_data, int status,
+                           embedlet_result_t *results, size_t count) {
+  async_seen_t *seen = (async_seen_t *)user_data;
+  seen->calls++;
+  seen->status = status;
+  seen->count = count;
+  seen->top = count ? results[0].score : 0.0f;
+}
+
+/* Holds a pool worker until released, so queued work stays queued */
+typedef struct {
+  embedlet_mutex_t mutex;
+  embedlet_cond_t cond;
+  int started;
+  bool release;
+} async_gate_t;
+
+static void async_blocker(void *arg) {
+  async_gate_t *gate = (async_gate_t *)arg;
+  embedlet_mutex_lock(&gate->mutex);
+  gate->started++;
+  embedlet_cond_broadcast(&gate->cond);
+  while (!gate->release)
+    embedlet_cond_wait(&gate->cond, &gate->mutex);
+  embedlet_mutex_unlock(&gate->mutex);
+}
+
+/* Test: asynchronous search with callbacks, polling and cancellation */
+static void test_search_async(void) {
+  printf("Testing asynchronous search...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+
+  embedlet_result_t results[10];
+  embedlet_job_t *job = NULL;
+  async_seen_t seen = {0};
+  size_t count = 99;
+
+  /* An empty store completes before the call returns */
+  err = embedlet_search_async(store, rows, 10, true, 2, results,
+                              async_callback, &seen, &job);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_job_poll(job, &count);
+  assert(err == EMBEDLET_OK && count == 0);
+  assert(seen.calls == 1 && seen.count == 0);
+  err = embedlet_job_release(job);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_search_async(store, rows, 10, true, 2, results, NULL, NULL,
+                              NULL);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  for (int i = 0; i < 20; i++) {
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+
+  embedlet_result_t expected[10];
+  size_t expected_count;
+  const float *query = rows + 7 * TEST_DIMS;
+  err = embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD,
+                        expected, &expected_count);
+  assert(err == EMBEDLET_OK);
+
+  /* Callback and handle together; the query buffer is copied */
+  float query_copy[TEST_DIMS];
+  memcpy(query_copy, query, sizeof(query_copy));
+  memset(&seen, 0, sizeof(seen));
+  err = embedlet_search_async(store, query_copy, 10, true, 3, results,
+                              async_callback, &seen, &job);
+  assert(err == EMBEDLET_OK);
+  memset(query_copy, 0, sizeof(query_copy));
+  int status;
+  while ((status = embedlet_job_poll(job, &count)) == EMBEDLET_PENDING)
+    ;
+  assert(status == EMBEDLET_OK && count == expected_count);
+  assert(seen.calls == 1 && seen.status == EMBEDLET_OK);
+  assert(seen.top == expected[0].score);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].score == expected[i].score);
+  err = embedlet_job_release(job);
+  assert(err == EMBEDLET_OK);
+
+  /* Fire and forget: the job frees itself after the callback */
+  memset(&seen, 0, sizeof(seen));
+  err = embedlet_search_async(store, query, 10, true, 2, results,
+                              async_callback, &seen, NULL);
+  assert(err == EMBEDLET_OK);
+  embedlet_pool_wait(store->pool);
+  assert(seen.calls == 1 && seen.count == expected_count);
+
+  /* Cancelled while still queued behind busy workers: nothing is scanned */
+  async_gate_t gate;
+  memset(&gate, 0, sizeof(gate));
+  embedlet_mutex_init(&gate.mutex);
+  embedlet_cond_init(&gate.cond);
+  int workers = store->pool->num_threads;
+  for (int i = 0; i < workers; i++)
+    embedlet_pool_submit(store->pool, async_blocker, &gate);
+  embedlet_mutex_lock(&gate.mutex);
+  while (gate.started < workers)
+    embedlet_cond_wait(&gate.cond, &gate.mutex);
+  embedlet_mutex_unlock(&gate.mutex);
+
+  err = embedlet_search_async(store, query, 10, true, 2, results, NULL, NULL,
+                              &job);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_job_poll(job, &count);
+  assert(err == EMBEDLET_PENDING);
+  err = embedlet_job_cancel(job);
+  assert(err == EMBEDLET_OK);
+  embedlet_mutex_lock(&gate.mutex);
+  gate.release = true;
+  embedlet_cond_broadcast(&gate.cond);
+  embedlet_mutex_unlock(&gate.mutex);
+  err = embedlet_job_wait(job, &count);
+  assert(err == EMBEDLET_ERR_CANCELLED);
+  assert(count == 0);
+  err = embedlet_job_release(job);
+  assert(err == EMBEDLET_OK);
+  embedlet_pool_wait(store->pool);
+  embedlet_cond_destroy(&gate.cond);
+  embedlet_mutex_destroy(&gate.mutex);
+
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: exact search under each metric matches a brute-force scan */
+static void test_search_metrics(void) {
+  printf("Testing search metrics...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+  const float *query = rows + 3 * TEST_DIMS;
+
+  embedlet_options_t options;
+  memset(&options, 0, sizeof(options));
+  embedlet_store_t *store = NULL;
+  options.metric = 4;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  const int metrics[] = {EMBEDLET_METRIC_COSINE, EMBEDLET_METRIC_INNER_PRODUCT,
+                         EMBEDLET_METRIC_L2, EMBEDLET_METRIC_HAMMING};
+  for (int m = 0; m < 4; m++) {
+    bool distance = metrics[m] == EMBEDLET_METRIC_L2 ||
+                    metrics[m] == EMBEDLET_METRIC_HAMMING;
+    options.metric = metrics[m];
+    embedlet_remove(TEST_STORE_PATH);
+    err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+    assert(err == EMBEDLET_OK);
+    assert(embedlet_metric(store) == metrics[m]);
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+
+    /* Brute-force scores, best first */
+    float expected[50];
+    for (int i = 0; i < 50; i++)
+      expected[i] = embedlet_score_raw(query, rows + (size_t)i * TEST_DIMS,
+                                       TEST_DIMS, metrics[m]);
+    for (int i = 0; i < 50; i++) {
+      for (int j = i + 1; j < 50; j++) {
+        if (distance ? expected[j] < expected[i] : expected[j] > expected[i]) {
+          float t = expected[i];
+          expected[i] = expected[j];
+          expected[j] = t;
+        }
+      }
+    }
+    if (distance)
+      assert(expected[0] < 1e-3f); /* the query itself is a row */
+
+    embedlet_result_t results[5], batch[5];
+    size_t count, batch_count;
+    for (int threads = 1; threads <= 2; threads++) {
+      err = embedlet_search(store, query, 5, true, threads, results,
+                            &count);
+      assert(err == EMBEDLET_OK);
+      assert(count == 5);
+      for (size_t i = 0; i < count; i++) {
+        float tol = 1e-3f * (fabsf(expected[i]) + 1.0f);
+        assert(fabsf(results[i].score - expected[i]) <= tol);
+        float raw =
+            embedlet_score_raw(query, rows + results[i].id * TEST_DIMS,
+                               TEST_DIMS, metrics[m]);
+        assert(fabsf(results[i].score - raw) <= tol);
+      }
+    }
+    err = embedlet_search_batch(store, query, 1, 5, true, 2, batch,
+                                &batch_count);
+    assert(err == EMBEDLET_OK);
+    assert(batch_count == 5);
+    for (size_t i = 0; i < 5; i++)
+      assert(batch[i].score == results[i].score);
+
+    /* Least similar: the far end of the ranking */
+    err = embedlet_search(store, query, 1, false, 1, results, &count);
+    assert(err == EMBEDLET_OK);
+    assert(fabsf(results[0].score - expected[49]) <=
+           1e-3f * (fabsf(expected[49]) + 1.0f));
+
+    /* Rerank rescores under the metric; with every row a candidate it is
+     * the exact search */
+    err = embedlet_search_rerank(store, query, 5, 50, true, 1, results,
+                                 &count);
+    assert(err == EMBEDLET_OK && count == 5);
+    for (size_t i = 0; i < count; i++)
+      assert(fabsf(results[i].score - batch[i].score) <=
+             1e-5f * (fabsf(batch[i].score) + 1.0f));
+    err = embedlet_search_rerank(store, query, 1, 50, false, 1, results,
+                                 &count);
+    assert(err == EMBEDLET_OK && count == 1);
+    assert(fabsf(results[0].score - expected[49]) <=
+           1e-3f * (fabsf(expected[49]) + 1.0f));
+
+    /* So does the HNSW graph; IVF-PQ indexes cosine stores only */
+    embedlet_ivf_params_t ivf = {0};
+    ivf.nlist = 4;
+    err = embedlet_ivf_train(store, &ivf, 1);
+    assert(metrics[m] == EMBEDLET_METRIC_COSINE
+               ? err == EMBEDLET_OK
+               : err == EMBEDLET_ERR_INVALID_ARG);
+    embedlet_close(store, false);
+
+    /* Reopening keeps the recorded metric, whatever the options ask */
+    options.metric = metrics[(m + 1) % 3];
+    options.hnsw_m = 8;
+    err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+    options.hnsw_m = 0;
+    if (metrics[m] == EMBEDLET_METRIC_HAMMING) {
+      assert(err == EMBEDLET_ERR_INVALID_ARG);
+      err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+      assert(err == EMBEDLET_OK);
+      assert(embedlet_metric(store) == metrics[m]);
+      embedlet_close(store, false);
+      continue;
+    }
+    assert(err == EMBEDLET_OK);
+    assert(embedlet_metric(store) == metrics[m]);
+    assert(store->hnsw_header->metric == (uint32_t)metrics[m]);
+    for (int pass = 0; pass < 2; pass++) {
+      err = embedlet_search_ann(store, query, 5, 50, results, &count);
+      assert(err == EMBEDLET_OK && count == 5);
+      for (size_t i = 0; i < count; i++)
+        assert(fabsf(results[i].score - batch[i].score) <=
+               1e-5f * (fabsf(batch[i].score) + 1.0f));
+
+      /* A graph recorded under another metric is rebuilt */
+      store->hnsw_header->metric = (uint32_t)metrics[(m + 1) % 3];
+      embedlet_close(store, false);
+      err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+      assert(err == EMBEDLET_OK);
+      assert(store->hnsw_header->metric == (uint32_t)metrics[m]);
+    }
+
+    embedlet_close(store, false);
+  }
+
+  free(rows);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+typedef struct {
+  size_t modulus;
+  volatile size_t calls;
+} filter_ctx_t;
+
+static bool filter_multiple(void *user_data, size_t id) {
+  filter_ctx_t *ctx = (filter_ctx_t *)user_data;
+  embedlet_atomic_fetch_add(&ctx->calls, 1);
+  return id % ctx->modulus == 0;
+}
+
+/* Test: filtered search returns the exact top-N among accepted rows */
+static void test_search_filtered(void) {
+  printf("Testing filtered search...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  for (int i = 0; i < 4; i++) {
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  err = embedlet_delete(store, 10);
+  assert(err == EMBEDLET_OK);
+  const float *query = rows + 11 * TEST_DIMS;
+
+  /* The full ranking, filtered afterwards, is the reference */
+  embedlet_result_t all[200];
+  size_t all_count;
+  err = embedlet_search(store, query, 200, true, 1, all, &all_count);
+  assert(err == EMBEDLET_OK);
+  assert(all_count == 199);
+
+  /* Allow rows 0..149 whose id is even; the rest read as excluded */
+  uint64_t bits[4] = {0};
+  for (size_t id = 0; id < 150; id += 2)
+    bits[id >> 6] |= (uint64_t)1 << (id & 63);
+  embedlet_filter_t filter;
+  memset(&filter, 0, sizeof(filter));
+  filter.bits = bits;
+  filter.num_bits = 150;
+
+  embedlet_result_t results[8];
+  size_t count;
+  for (int pass = 0; pass < 2; pass++) {
+    filter.deny = pass == 1;
+    for (int threads = 1; threads <= 3; threads += 2) {
+      err = embedlet_search_filtered(store, query, 8, true, threads, &filter,
+                                     results, &count);
+      assert(err == EMBEDLET_OK);
+      assert(count == 8);
+      size_t j = 0;
+      for (size_t i = 0; i < all_count && j < count; i++) {
+        size_t id = all[i].id;
+        bool allowed = id < 150 && id % 2 == 0;
+        if (allowed == filter.deny)
+          continue;
+        assert(results[j].score == all[i].score);
+        j++;
+      }
+      for (size_t k = 0; k < count; k++) {
+        size_t id = results[k].id;
+        assert((id < 150 && id % 2 == 0) != filter.deny);
+        assert(id != 10);
+      }
+    }
+  }
+
+  /* A predicate, combined with the bitset; only bitset rows reach it */
+  filter_ctx_t ctx = {3, 0};
+  filter.deny = false;
+  filter.predicate = filter_multiple;
+  filter.user_data = &ctx;
+  err = embedlet_search_filtered(store, query, 8, true, 2, &filter, results,
+                                 &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 8 && ctx.calls == 74); /* live even ids below 150 */
+  for (size_t k = 0; k < count; k++)
+    assert(results[k].id % 6 == 0 && results[k].id < 150);
+
+  /* A predicate alone; a filter with neither part accepts every row */
+  filter.bits = NULL;
+  ctx.modulus = 1000;
+  err = embedlet_search_filtered(store, query, 8, true, 2, &filter, results,
+                                 &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 1 && results[0].id == 0);
+  memset(&filter, 0, sizeof(filter));
+  err = embedlet_search_filtered(store, query, 8, true, 2, &filter, results,
+                                 &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 8 && results[0].score == all[0].score);
+
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: range search returns every row within the threshold */
+static void test_search_range(void) {
+  printf("Testing range search...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  for (int i = 0; i < 20; i++) {
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  err = embedlet_delete(store, 5);
+  assert(err == EMBEDLET_OK);
+  const float *query = rows + 5 * TEST_DIMS;
+
+  embedlet_result_t *all = (embedlet_result_t *)malloc(
+      1000 * sizeof(embedlet_result_t));
+  assert(all != NULL);
+  size_t all_count;
+  err = embedlet_search(store, query, 1000, true, 1, all, &all_count);
+  assert(err == EMBEDLET_OK);
+  float threshold = all[100].score;
+  size_t expected = 0;
+  while (expected < all_count && all[expected].score >= threshold)
+    expected++;
+
+  embedlet_result_t *hits = NULL;
+  size_t count;
+  err = embedlet_search_range(store, query, threshold, 0, 1, NULL, &count);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  for (int threads = 1; threads <= 4; threads += 3) {
+    err = embedlet_search_range(store, query, threshold, 0, threads, &hits,
+                                &count);
+    assert(err == EMBEDLET_OK);
+    assert(count == expected);
+    bool seen[1000] = {false};
+    for (size_t i = 0; i < count; i++) {
+      assert(hits[i].score >= threshold && hits[i].id != 5);
+      assert(!seen[hits[i].id]);
+      seen[hits[i].id] = true;
+    }
+    embedlet_free_results(hits);
+  }
+
+  /* Stop after the first K hits */
+  err = embedlet_search_range(store, query, threshold, 7, 4, &hits, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 7);
+  for (size_t i = 0; i < count; i++)
+    assert(hits[i].score >= threshold);
+  embedlet_free_results(hits);
+
+  /* Nothing in range */
+  err = embedlet_search_range(store, query, 1.5f, 0, 4, &hits, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 0 && hits == NULL);
+  embedlet_close(store, false);
+
+  /* Distance metrics keep rows at or below the threshold */
+  embedlet_options_t options;
+  memset(&options, 0, sizeof(options));
+  options.metric = EMBEDLET_METRIC_L2;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  for (int i = 0; i < 20; i++) {
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  err = embedlet_search_range(store, query, 1e-3f, 0, 2, &hits, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 20); /* the query's copies */
+  for (size_t i = 0; i < count; i++)
+    assert(hits[i].id % 50 == 5);
+  embedlet_free_results(hits);
+
+  free(all);
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: top-n selection for large n matches a full sort */
+static void test_large_topn(void) {
+  printf("Testing large top-n selection...\n");
+
+  /* Quickselect keeps the k highest, duplicates included */
+  embedlet_result_t items[997];
+  srand(19);
+  for (size_t k = 1; k < 997; k += 97) {
+    for (size_t i = 0; i < 997; i++) {
+      items[i].id = i;
+      items[i].score = (float)(rand() % 200);
+    }
+    embedlet_select_highest(items, 997, k);
+    float lowest_kept = items[0].score;
+    for (size_t i = 1; i < k; i++)
+      lowest_kept = items[i].score < lowest_kept ? items[i].score : lowest_kept;
+    for (size_t i = k; i < 997; i++)
+      assert(items[i].score <= lowest_kept);
+  }
+
+  float *rows = (float *)malloc(150 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 150; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  for (int i = 0; i < 10; i++) {
+    err = embedlet_append_batch(store, rows, 150, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  const float *query = rows + 42 * TEST_DIMS;
+
+  /* Brute force over the 150 distinct rows; each appears 10 times */
+  float expected[150];
+  for (int i = 0; i < 150; i++)
+    expected[i] = embedlet_similarity_raw(query, rows + (size_t)i * TEST_DIMS,
+                                          TEST_DIMS);
+  for (int i = 0; i < 150; i++) {
+    for (int j = i + 1; j < 150; j++) {
+      if (expected[j] > expected[i]) {
+        float t = expected[i];
+        expected[i] = expected[j];
+        expected[j] = t;
+      }
+    }
+  }
+
+  size_t n = 400;
+  embedlet_result_t *results =
+      (embedlet_result_t *)malloc(n * sizeof(embedlet_result_t));
+  assert(results != NULL);
+  size_t count;
+  for (int threads = 1; threads <= 4; threads += 3) {
+    for (int most = 0; most < 2; most++) {
+      err = embedlet_search(store, query, n, most == 1, threads, results,
+                            &count);
+      assert(err == EMBEDLET_OK);
+      assert(count == n);
+      for (size_t i = 0; i < n; i++) {
+        float want = most ? expected[i / 10] : expected[149 - i / 10];
+        assert(fabsf(results[i].score - want) < 1e-5f);
+      }
+    }
+  }
+
+  /* The asynchronous and prefilter paths use the same selection */
+  embedlet_job_t *job = NULL;
+  err = embedlet_search_async(store, query, n, true, 4, results, NULL, NULL,
+                              &job);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_job_wait(job, &count);
+  assert(err == EMBEDLET_OK && count == n);
+  err = embedlet_job_release(job);
+  assert(err == EMBEDLET_OK);
+  for (size_t i = 0; i < n; i++)
+    assert(fabsf(results[i].score - expected[i / 10]) < 1e-5f);
+  err = embedlet_search_rerank(store, query, 200, 5, true, 4, results,
+                               &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 200);
+  for (size_t i = 1; i < count; i++)
+    assert(results[i].score <= results[i - 1].score);
+  assert(fabsf(results[0].score - expected[0]) < 1e-5f);
+
+  free(results);
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+typedef struct {
+  int calls;
+  const char *operation;
+  uint64_t rows_scanned;
+} stats_seen_t;
+
+static void stats_hook(void *user_data, const char *operation,
+                       const embedlet_stats_t *stats) {
+  stats_seen_t *seen = (stats_seen_t *)user_data;
+  seen->calls++;
+  seen->operation = operation;
+  seen->rows_scanned = stats->rows_scanned;
+}
+
+/* Test: search stats are opt-in, counted across threads and exported */
+static void test_search_stats(void) {
+  printf("Testing search stats...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  for (int i = 0; i < 40; i++) {
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  for (size_t id = 0; id < 2000; id += 10) {
+    err = embedlet_delete(store, id);
+    assert(err == EMBEDLET_OK);
+  }
+
+  /* Growth is always counted; searches only once enabled */
+  embedlet_stats_t stats;
+  err = embedlet_get_stats(store, &stats);
+  assert(err == EMBEDLET_OK);
+  assert(stats.grow_events > 0);
+  assert(strcmp(stats.simd_backend, embedlet_simd_backend()) == 0);
+  embedlet_result_t results[10];
+  size_t count;
+  const float *query = rows + 7 * TEST_DIMS;
+  err = embedlet_search(store, query, 10, true, 4, results, &count);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_get_stats(store, &stats);
+  assert(err == EMBEDLET_OK);
+  assert(stats.searches == 0 && stats.rows_scanned == 0);
+
+  stats_seen_t seen = {0};
+  err = embedlet_enable_stats(store, true);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_set_stats_hook(store, stats_hook, &seen);
+  assert(err == EMBEDLET_OK);
+  for (int threads = 1; threads <= 4; threads += 3) {
+    err = embedlet_search(store, query, 10, true, threads, results,
+                          &count);
+    assert(err == EMBEDLET_OK);
+    assert(seen.calls == (threads == 1 ? 1 : 2));
+    assert(strcmp(seen.operation, "search") == 0);
+    assert(seen.rows_scanned == 1800);
+  }
+  err = embedlet_get_stats(store, &stats);
+  assert(err == EMBEDLET_OK);
+  assert(stats.searches == 2);
+  assert(stats.rows_scanned == 3600 && stats.rows_skipped == 400);
+  assert(stats.bytes_touched == 3600 * (uint64_t)TEST_DIMS * sizeof(float));
+  assert(stats.kernel_ns > 0);
+
+  /* Batch, range and rerank searches report under their own names */
+  size_t counts[2];
+  embedlet_result_t batch[20];
+  err = embedlet_search_batch(store, rows, 2, 10, true, 2, batch, counts);
+  assert(err == EMBEDLET_OK);
+  assert(strcmp(seen.operation, "search_batch") == 0);
+  assert(seen.rows_scanned == 3600);
+  embedlet_result_t *hits = NULL;
+  err = embedlet_search_range(store, query, 0.99f, 0, 2, &hits, &count);
+  assert(err == EMBEDLET_OK);
+  embedlet_free_results(hits);
+  assert(strcmp(seen.operation, "search_range") == 0);
+  assert(seen.rows_scanned == 1800);
+  err = embedlet_search_rerank(store, query, 5, 4, true, 2, results,
+                               &count);
+  assert(err == EMBEDLET_OK);
+  assert(strcmp(seen.operation, "search_rerank") == 0);
+  assert(seen.rows_scanned == 1800 + 20);
+  assert(seen.calls == 5);
+
+  err = embedlet_reset_stats(store);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_get_stats(store, &stats);
+  assert(err == EMBEDLET_OK);
+  assert(stats.searches == 0 && stats.grow_events == 0);
+  err = embedlet_enable_stats(store, false);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_search(store, query, 10, true, 4, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(seen.calls == 5);
+  err = embedlet_get_stats(NULL, &stats);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+/* Test: page-cache advice survives growth and warming leaves rows intact */
+static void test_advise_warm(void) {
+  printf("Testing page-cache advice and warm-up...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_options_t options = {0};
+  options.advice = EMBEDLET_ADVISE_SEQUENTIAL | EMBEDLET_ADVISE_RANDOM;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  options.advice = EMBEDLET_ADVISE_SEQUENTIAL | EMBEDLET_ADVISE_WILLNEED |
+                   EMBEDLET_ADVISE_HUGEPAGE;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  assert(store->file.advice == options.advice);
+  err = embedlet_warm(store, EMBEDLET_AUTO_THREADS);
+  assert(err == EMBEDLET_OK);
+
+  /* Growth remaps the files under the same advice */
+  for (int i = 0; i < 20; i++) {
+    err = embedlet_append_batch(store, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  assert(store->bits_file.advice == options.advice);
+
+  embedlet_result_t expected[10], results[10];
+  size_t expected_count, count;
+  const float *query = rows + 3 * TEST_DIMS;
+  err = embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD,
+                        expected, &expected_count);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_warm(store, EMBEDLET_SINGLE_THREAD);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_warm(store, 4);
+  assert(err == EMBEDLET_OK);
+
+  /* Locking may exceed RLIMIT_MEMLOCK; either way the advice is kept */
+  err = embedlet_advise(store, EMBEDLET_ADVISE_LOCK);
+  assert(err == EMBEDLET_OK || err == EMBEDLET_ERR_MMAP);
+  assert(store->norms_file.advice == EMBEDLET_ADVISE_LOCK);
+  err = embedlet_advise(store, EMBEDLET_ADVISE_RANDOM);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_advise(store, 64);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  err = embedlet_advise(NULL, 0);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  err = embedlet_warm(NULL, 1);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  err = embedlet_search(store, query, 10, true, 4, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == expected_count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].score == expected[i].score);
+
+  free(rows);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_read_only(void) {
+  printf("Testing read-only open...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_options_t options = {0};
+  options.read_only = 1;
+  embedlet_store_t *reader = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &reader);
+  assert(err == EMBEDLET_ERR_FILE_OPEN);
+
+  embedlet_store_t *writer = NULL;
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &writer);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append_batch(writer, rows, 50, NULL);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_delete(writer, 7);
+  assert(err == EMBEDLET_OK);
+
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &reader);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(reader) == 50);
+  assert(reader->hnsw_ctx == NULL && reader->ivf_header == NULL);
+
+  /* Every write call is refused, and the file is left as it was */
+  size_t id;
+  err = embedlet_append(reader, rows, false, &id);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  err = embedlet_append_batch(reader, rows, 2, NULL);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  err = embedlet_replace(reader, 0, rows);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  err = embedlet_delete(reader, 0);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  err = embedlet_compact(reader);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  err = embedlet_ivf_train(reader, NULL, 1);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  assert(embedlet_count(writer) == 50);
+
+  /* The reader sees the writer's deletes through the shared pages */
+  embedlet_result_t results[5];
+  size_t count;
+  err = embedlet_search(reader, rows + 7 * TEST_DIMS, 5, true,
+                        EMBEDLET_SINGLE_THREAD, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 5);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id != 7);
+
+  /* Appends that grow the files are mapped by the next search */
+  for (int i = 0; i < 20; i++) {
+    err = embedlet_append_batch(writer, rows, 50, NULL);
+    assert(err == EMBEDLET_OK);
+  }
+  float mixed[TEST_DIMS], copy[TEST_DIMS];
+  for (size_t j = 0; j < TEST_DIMS; j++)
+    mixed[j] = rows[TEST_DIMS + j] + rows[2 * TEST_DIMS + j];
+  err = embedlet_append(writer, mixed, false, &id);
+  assert(err == EMBEDLET_OK);
+  assert(id == 1050);
+  assert(embedlet_count(reader) <= 1051);
+  err = embedlet_search(reader, mixed, 5, true, 4, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(reader) == 1051);
+  assert(count == 5 && results[0].id == 1050);
+  err = embedlet_get_copy(reader, 1050, copy);
+  assert(err == EMBEDLET_OK);
+  assert(memcmp(copy, mixed, sizeof(copy)) == 0);
+  err = embedlet_refresh(reader);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_refresh(writer);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_refresh(NULL);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  /* While a follower maps the files, compaction only drops the rows */
+  for (size_t i = 1000; i < 1051; i++) {
+    err = embedlet_delete(writer, i);
+    assert(err == EMBEDLET_OK);
+  }
+  size_t file_size = writer->file.size;
+  err = embedlet_compact(writer);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(writer) == 1000 && writer->file.size == file_size);
+  err = embedlet_search(reader, rows + 3 * TEST_DIMS, 5, true, 4, results,
+                        &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 5 && results[0].id % 50 == 3);
+  assert(embedlet_count(reader) == 1000);
+
+  err = embedlet_close(reader, true);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_count(writer) == 1000);
+  err = embedlet_compact(writer);
+  assert(err == EMBEDLET_OK);
+  assert(writer->file.size < file_size);
+  embedlet_close(writer, false);
+
+  /* A store without sidecars needs one writer open first */
+  char *norms = embedlet_sidecar_path(TEST_STORE_PATH, EMBEDLET_NORMS_SUFFIX);
+  assert(norms != NULL);
+  remove(norms);
+  free(norms);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &reader);
+  assert(err == EMBEDLET_ERR_FILE_OPEN);
+
+  free(rows);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_segmented(void) {
+  printf("Testing segmented store...\n");
+
+  const char *manifest = "test_segments.emb";
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  assert(rows != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  /* Reference store with the same rows under the same ids */
+  embedlet_store_t *plain = NULL;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &plain);
+  assert(err == EMBEDLET_OK);
+
+  const char *dirs[2] = {".", "./"};
+  embedlet_segment_options_t options = {0};
+  options.segment_rows = 40;
+  options.dirs = dirs;
+  options.num_dirs = 2;
+  embedlet_segmented_t *set = NULL;
+  embedlet_segmented_remove(manifest);
+  err = embedlet_segmented_open(manifest, TEST_DIMS, &options, &set);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_segmented_count(set) == 0);
+  assert(embedlet_segmented_segments(set) == 1);
+
+  /* A batch spills over segment boundaries with consecutive ids */
+  size_t ids[100];
+  err = embedlet_segmented_append_batch(set, rows, 50, ids);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_segmented_append_batch(set, rows, 50, ids + 50);
+  assert(err == EMBEDLET_OK);
+  for (size_t i = 0; i < 100; i++)
+    assert(ids[i] == i);
+  size_t id;
+  err = embedlet_segmented_append(set, rows + 3 * TEST_DIMS, &id);
+  assert(err == EMBEDLET_OK);
+  assert(id == 100);
+  assert(embedlet_segmented_count(set) == 101);
+  assert(embedlet_segmented_segments(set) == 3);
+  assert(embedlet_count(embedlet_segmented_segment(set, 0)) == 40);
+  assert(embedlet_count(embedlet_segmented_segment(set, 2)) == 21);
+  assert(embedlet_segmented_segment(set, 3) == NULL);
+  err = embedlet_append_batch(plain, rows, 50, NULL);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append_batch(plain, rows, 50, NULL);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append(plain, rows + 3 * TEST_DIMS, false, &id);
+  assert(err == EMBEDLET_OK);
+
+  float copy[TEST_DIMS];
+  err = embedlet_segmented_get_copy(set, 93, copy);
+  assert(err == EMBEDLET_OK);
+  assert(memcmp(copy, rows + 43 * TEST_DIMS, sizeof(copy)) == 0);
+  err = embedlet_segmented_get_copy(set, 101, copy);
+  assert(err == EMBEDLET_ERR_INVALID_ID);
+  err = embedlet_segmented_get_copy(set, 500, copy);
+  assert(err == EMBEDLET_ERR_INVALID_ID);
+  err = embedlet_segmented_delete(set, 500);
+  assert(err == EMBEDLET_ERR_INVALID_ID);
+
+  err = embedlet_segmented_delete(set, 57);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_delete(plain, 57);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_segmented_replace(set, 12, rows + 9 * TEST_DIMS);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_replace(plain, 12, rows + 9 * TEST_DIMS);
+  assert(err == EMBEDLET_OK);
+
+  /* 1 thread, segments fanned out (2) and segments scanned in turn (4) */
+  embedlet_result_t expected[10], results[10];
+  size_t expected_count, count;
+  int threads[3] = {EMBEDLET_SINGLE_THREAD, 2, 4};
+  for (int pass = 0; pass < 2; pass++) {
+    for (int q = 0; q < 3; q++) {
+      const float *query = rows + (size_t)(7 + 2 * q) * TEST_DIMS;
+      bool similar = q != 1;
+      err = embedlet_search(plain, query, 10, similar,
+                            EMBEDLET_SINGLE_THREAD, expected,
+                            &expected_count);
+      assert(err == EMBEDLET_OK);
+      for (int t = 0; t < 3; t++) {
+        err = embedlet_segmented_search(set, query, 10, similar, threads[t],
+                                        results, &count);
+        assert(err == EMBEDLET_OK);
+        assert(count == expected_count);
+        for (size_t i = 0; i < count; i++) {
+          assert(results[i].score == expected[i].score);
+          assert(results[i].id != 57);
+        }
+      }
+    }
+
+    /* Reopen: the manifest keeps the segment size and the segment paths */
+    err = embedlet_segmented_close(set);
+    assert(err == EMBEDLET_OK);
+    options.segment_rows = 999;
+    options.num_dirs = 0;
+    err = embedlet_segmented_open(manifest, 8, &options, &set);
+    assert(err == EMBEDLET_ERR_DIMS_MISMATCH);
+    err = embedlet_segmented_open(manifest, TEST_DIMS, &options, &set);
+    assert(err == EMBEDLET_OK);
+    assert(embedlet_segmented_count(set) == 101);
+    assert(embedlet_segmented_segments(set) == 3);
+  }
+  err = embedlet_segmented_search(set, NULL, 10, true, 1, results, &count);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  /* Appends continue in the last segment; removal takes every file */
+  err = embedlet_segmented_append_batch(set, rows, 20, NULL);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_segmented_segments(set) == 4);
+  assert(embedlet_segmented_count(set) == 121);
+  err = embedlet_segmented_close(set);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_segmented_remove(manifest);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_segmented_remove(manifest);
+  assert(err == EMBEDLET_ERR_NOT_FOUND);
+  FILE *f = fopen("./test_segments.emb.seg00002", "rb");
+  assert(f == NULL);
+  (void)f;
+
+  free(rows);
+  embedlet_close(plain, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_vacuum(void) {
+  printf("Testing vacuum and move log...\n");
+
+  float *rows = (float *)malloc(50 * TEST_DIMS * sizeof(float));
+  size_t *origin = (size_t *)malloc(100 * sizeof(size_t));
+  assert(rows != NULL && origin != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < 50; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, rows + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_options_t options = {0};
+  options.hnsw_m = 8;
+  options.prefix_dims = 128;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append_batch(store, rows, 50, NULL);
+  assert(err == EMBEDLET_OK);
+  for (size_t i = 0; i < 50; i++) {
+    size_t id;
+    err = embedlet_append(store, rows + (49 - i) * TEST_DIMS, false, &id);
+    assert(err == EMBEDLET_OK);
+  }
+  /* origin[id] = sample row held by id; keep every 5th of the first 90 */
+  for (size_t id = 0; id < 100; id++) {
+    origin[id] = id < 50 ? id : 99 - id;
+    if (id < 90 && id % 5 != 0) {
+      err = embedlet_delete(store, id);
+      assert(err == EMBEDLET_OK);
+    }
+  }
+  size_t file_size = store->file.size;
+
+  embedlet_result_t expected[10], results[10];
+  size_t expected_count, count;
+  const float *query = rows + 11 * TEST_DIMS;
+  err = embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD,
+                        expected, &expected_count);
+  assert(err == EMBEDLET_OK);
+
+  /* A bounded step moves the tail into the lowest holes */
+  size_t moved;
+  err = embedlet_vacuum(store, 5, &moved);
+  assert(err == EMBEDLET_OK);
+  assert(moved == 5);
+  assert(embedlet_move_count(store) == 5);
+  assert(embedlet_count(store) == 95);
+  embedlet_move_t moves[100];
+  err = embedlet_get_moves(store, 0, 100, moves, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 5);
+  assert(moves[0].from == 99 && moves[0].to == 1);
+  assert(moves[4].from == 95 && moves[4].to == 6);
+
+  err = embedlet_vacuum(store, 0, &moved);
+  assert(err == EMBEDLET_OK);
+  assert(moved == 17);
+  err = embedlet_vacuum(store, 0, &moved);
+  assert(err == EMBEDLET_OK);
+  assert(moved == 0);
+  assert(embedlet_count(store) == 28);
+  for (size_t id = 0; id < 28; id++)
+    assert(!embedlet_is_zeroed(store, id));
+
+  /* Replaying the log tells where every surviving row went */
+  err = embedlet_get_moves(store, 2, 100, moves, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 20);
+  err = embedlet_get_moves(store, 0, 100, moves, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 22);
+  float copy[TEST_DIMS];
+  for (size_t i = 0; i < count; i++) {
+    assert(moves[i].to < moves[i].from);
+    origin[moves[i].to] = origin[moves[i].from];
+  }
+  for (size_t id = 0; id < 28; id++) {
+    err = embedlet_get_copy(store, id, copy);
+    assert(err == EMBEDLET_OK);
+    assert(memcmp(copy, rows + origin[id] * TEST_DIMS, sizeof(copy)) == 0);
+  }
+
+  /* Scores are unchanged; only ids moved */
+  err = embedlet_search(store, query, 10, true, 4, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == expected_count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].score == expected[i].score);
+  err = embedlet_search_ann(store, rows + 49 * TEST_DIMS, 1, 0, results,
+                            &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 1 && origin[results[0].id] == 49);
+  err = embedlet_search_prefix(store, rows + 30 * TEST_DIMS, 1, 0, true, 1,
+                               results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 1 && origin[results[0].id] == 30);
+
+  /* compact returns the vacated file space; the log survives reopening */
+  err = embedlet_compact(store);
+  assert(err == EMBEDLET_OK);
+  assert(store->file.size < file_size);
+  assert(embedlet_count(store) == 28);
+  embedlet_close(store, false);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_move_count(store) == 22);
+  assert(embedlet_count(store) == 28);
+  size_t id;
+  err = embedlet_append(store, query, false, &id);
+  assert(err == EMBEDLET_OK);
+  assert(id == 28);
+
+  embedlet_options_t reader_options = {0};
+  reader_options.read_only = 1;
+  embedlet_store_t *reader = NULL;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &reader_options,
+                         &reader);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_move_count(reader) == 22);
+  err = embedlet_vacuum(reader, 0, &moved);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  err = embedlet_clear_moves(reader);
+  assert(err == EMBEDLET_ERR_READ_ONLY);
+  embedlet_close(reader, false);
+
+  err = embedlet_clear_moves(store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_move_count(store) == 0);
+  err = embedlet_vacuum(NULL, 0, &moved);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  free(rows);
+  free(origin);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_search_prefix(void) {
+  printf("Testing prefix-dimension search...\n");
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  assert(all != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_options_t options = {0};
+  options.prefix_dims = TEST_DIMS;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+
+  /* Without a prefix copy there is nothing to scan */
+  embedlet_result_t exact[10], results[10];
+  size_t exact_count, count;
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, all, TEST_NUM_FILES, NULL);
+  assert(embedlet_prefix_dims(store) == 0);
+  err = embedlet_search_prefix(store, all, 10, 0, true, 1, results, &count);
+  assert(err == EMBEDLET_ERR_NOT_FOUND);
+  embedlet_close(store, false);
+
+  /* Asking for one builds it from the stored rows */
+  options.prefix_dims = 256;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_prefix_dims(store) == 256);
+
+  const float *query = all + 21 * TEST_DIMS;
+  embedlet_search(store, query, 10, true, EMBEDLET_SINGLE_THREAD, exact,
+                  &exact_count);
+  err = embedlet_search_prefix(store, query, 10, 0, true,
+                               EMBEDLET_AUTO_THREADS, results,
+                               &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 10 && results[0].id == 21);
+  size_t hits = 0;
+  for (size_t i = 0; i < count; i++) {
+    float ref = embedlet_similarity_raw(query, all + results[i].id * TEST_DIMS,
+                                        TEST_DIMS);
+    assert(fabsf(results[i].score - ref) < 1e-5f);
+    for (size_t j = 0; j < exact_count; j++)
+      hits += results[i].id == exact[j].id;
+  }
+  printf("  Recall@10 on 256 of %d dims: %zu/10\n", TEST_DIMS, hits);
+  assert(hits >= 9);
+
+  /* Oversample covering the whole store equals the exact search */
+  embedlet_search_prefix(store, query, 10, SIZE_MAX, false,
+                         EMBEDLET_SINGLE_THREAD, results, &count);
+  embedlet_search(store, query, 10, false, EMBEDLET_SINGLE_THREAD, exact,
+                  &exact_count);
+  assert(count == exact_count);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id == exact[i].id && results[i].score == exact[i].score);
+
+  /* Writes keep the copy current */
+  size_t id;
+  err = embedlet_delete(store, 21);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_replace(store, 3, query);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append(store, query, true, &id);
+  assert(err == EMBEDLET_OK);
+  assert(id == 21);
+  embedlet_search_prefix(store, query, 2, 0, true, 1, results, &count);
+  assert(count == 2);
+  assert((results[0].id == 3 && results[1].id == 21) ||
+         (results[0].id == 21 && results[1].id == 3));
+  embedlet_close(store, false);
+
+  /* Reopening keeps the copy; another width rebuilds it */
+  err = embedlet_open(TEST_STORE_PATH, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_prefix_dims(store) == 256);
+  embedlet_close(store, false);
+  options.prefix_dims = 128;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  assert(embedlet_prefix_dims(store) == 128);
+  embedlet_search_prefix(store, all + 40 * TEST_DIMS, 1, 0, true, 1, results,
+                         &count);
+  assert(count == 1 && results[0].id == 40);
+  embedlet_close(store, false);
+
+  /* Quantized rows under L2 keep their scale and offset in the copy */
+  embedlet_remove(TEST_STORE_PATH);
+  options.dtype = EMBEDLET_DTYPE_I8;
+  options.metric = EMBEDLET_METRIC_L2;
+  err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, all, TEST_NUM_FILES, NULL);
+  query = all + 7 * TEST_DIMS;
+  embedlet_search(store, query, 5, true, EMBEDLET_SINGLE_THREAD, exact,
+                  &exact_count);
+  embedlet_search_prefix(store, query, 5, SIZE_MAX, true, 2, results, &count);
+  assert(count == exact_count && results[0].id == 7);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id == exact[i].id && results[i].score == exact[i].score);
+
+  free(all);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
+
+  printf("  PASSED\n");
+}
+
+static void test_blocked(void) {
+  printf("Testing blocked row layout...\n");
+
+  float *all = (float *)malloc(TEST_NUM_FILES * TEST_DIMS * sizeof(float));
+  assert(all != NULL);
+  char path[64];
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int i = 0; i < TEST_NUM_FILES; i++) {
+    get_embedding_path(i, path, sizeof(path));
+    err = load_embedding(path, all + (size_t)i * TEST_DIMS, TEST_DIMS);
+    assert(err == 0);
+  }
+
+  /* Every metric ranks like the row-by-row scan, up to float rounding */
+  const char *blocked_path = "test_blocked.emb";
+  const float *query = all + 21 * TEST_DIMS;
+  embedlet_store_t *plain = NULL, *store = NULL;
+  embedlet_result_t exact[TEST_NUM_FILES], results[TEST_NUM_FILES];
+  size_t exact_count, count;
+  int metrics[3] = {EMBEDLET_METRIC_COSINE, EMBEDLET_METRIC_INNER_PRODUCT,
+                    EMBEDLET_METRIC_L2};
+  for (int m = 0; m < 3; m++) {
+    embedlet_options_t options = {0};
+    options.metric = metrics[m];
+    embedlet_remove(TEST_STORE_PATH);
+    embedlet_remove(blocked_path);
+    err = embedlet_open_ex(TEST_STORE_PATH, TEST_DIMS, &options, &plain);
+    assert(err == EMBEDLET_OK);
+    embedlet_append_batch(plain, all, TEST_NUM_FILES, NULL);
+    options.blocked = 1;
+    err = embedlet_open_ex(blocked_path, TEST_DIMS, &options, &store);
+    assert(err == EMBEDLET_OK);
+    embedlet_append_batch(store, all, 100, NULL);
+    size_t id;
+    for (size_t i = 100; i < TEST_NUM_FILES; i++) {
+      err = embedlet_append(store, all + i * TEST_DIMS, false, &id);
+      assert(err == EMBEDLET_OK);
+    }
+
+    for (int threads = 1; threads <= 3; threads += 2) {
+      err = embedlet_search(plain, query, TEST_NUM_FILES, true, threads,
+                            exact, &exact_count);
+      assert(err == EMBEDLET_OK);
+      err = embedlet_search(store, query, TEST_NUM_FILES, true, threads,
+                            results, &count);
+      assert(err == EMBEDLET_OK);
+      assert(count == TEST_NUM_FILES && count == exact_count);
+      assert(results[0].id == exact[0].id);
+      for (size_t i = 0; i < count; i++)
+        assert(fabsf(results[i].score - exact[i].score) <=
+               1e-5f * (1.0f + fabsf(exact[i].score)));
+    }
+    embedlet_close(plain, false);
+    embedlet_close(store, false);
+  }
+
+  /* Writes keep the blocks current; a reopen keeps using them */
+  embedlet_options_t options = {0};
+  options.blocked = 1;
+  embedlet_remove(blocked_path);
+  err = embedlet_open_ex(blocked_path, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, all, TEST_NUM_FILES, NULL);
+  embedlet_close(store, false);
+  FILE *f = fopen("test_blocked.emb.blocks", "rb");
+  assert(f != NULL);
+  fclose(f);
+  err = embedlet_open(blocked_path, TEST_DIMS, &store);
+  assert(err == EMBEDLET_OK);
+
+  size_t id;
+  err = embedlet_delete(store, 21);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_replace(store, 3, query);
+  assert(err == EMBEDLET_OK);
+  err = embedlet_append(store, query, true, &id);
+  assert(err == EMBEDLET_OK);
+  assert(id == 21);
+  embedlet_search(store, query, 2, true, 1, results, &count);
+  assert(count == 2);
+  assert((results[0].id == 3 && results[1].id == 21) ||
+         (results[0].id == 21 && results[1].id == 3));
+
+  /* A whole deleted block is skipped; filters apply per row */
+  for (size_t i = 32; i < 48; i++) {
+    err = embedlet_delete(store, i);
+    assert(err == EMBEDLET_OK);
+  }
+  embedlet_search(store, all + 40 * TEST_DIMS, TEST_NUM_FILES, true, 2,
+                  results, &count);
+  assert(count == TEST_NUM_FILES - 16);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id < 32 || results[i].id >= 48);
+  uint64_t bits[3] = {0};
+  for (size_t i = 0; i < TEST_NUM_FILES; i += 2)
+    bits[i >> 6] |= (uint64_t)1 << (i & 63);
+  embedlet_filter_t filter;
+  memset(&filter, 0, sizeof(filter));
+  filter.bits = bits;
+  filter.num_bits = TEST_NUM_FILES;
+  err = embedlet_search_filtered(store, all + 50 * TEST_DIMS, 8, true, 2,
+                                 &filter, results, &count);
+  assert(err == EMBEDLET_OK);
+  assert(count == 8 && results[0].id == 50);
+  for (size_t i = 0; i < count; i++)
+    assert(results[i].id % 2 == 0);
+
+  /* Rows a vacuum moves into the holes move in the blocks too */
+  size_t moved;
+  err = embedlet_vacuum(store, 0, &moved);
+  assert(err == EMBEDLET_OK);
+  assert(moved == 16);
+  embedlet_search(store, all + 149 * TEST_DIMS, 1, true, 1, results, &count);
+  assert(count == 1 && results[0].id < 48 && results[0].score > 0.9999f);
+  embedlet_close(store, true);
+
+  /* Only float32 stores keep blocks */
+  embedlet_remove(blocked_path);
+  f = fopen("test_blocked.emb.blocks", "rb");
+  assert(f == NULL);
+  options.dtype = EMBEDLET_DTYPE_F16;
+  err = embedlet_open_ex(blocked_path, TEST_DIMS, &options, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_append_batch(store, all, 20, NULL);
+  embedlet_search(store, all + 5 * TEST_DIMS, 1, true, 1, results, &count);
+  assert(count == 1 && results[0].id == 5);
+  embedlet_close(store, false);
+  f = fopen("test_blocked.emb.blocks", "rb");
+  assert(f == NULL);
+  embedlet_remove(blocked_path);
+  embedlet_remove(TEST_STORE_PATH);
+
+  free(all);
+  printf("  PASSED\n");
+}
+
+static void test_fixed_dims(void) {
+  printf("Testing fixed-size kernels...\n");
+
+  /* Specialized sizes score bit-identically to the generic kernel */
+  size_t sizes[4] = {384, 768, 1024, 1000};
+  float *rows = (float *)malloc(64 * 1024 * sizeof(float));
+  assert(rows != NULL);
+  srand(28);
+  for (size_t i = 0; i < 64 * 1024; i++)
+    rows[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int s = 0; s < 4; s++) {
+    size_t dims = sizes[s];
+    embedlet_store_t *store = NULL;
+    embedlet_options_t options = {0};
+    options.metric = EMBEDLET_METRIC_INNER_PRODUCT;
+    embedlet_remove(TEST_STORE_PATH);
+    err = embedlet_open_ex(TEST_STORE_PATH, dims, &options, &store);
+    assert(err == EMBEDLET_OK);
+    for (size_t i = 0; i < 64; i++) {
+      size_t id;
+      err = embedlet_append(store, rows + i * dims, false, &id);
+      assert(err == EMBEDLET_OK);
+    }
+
+    const float *query = rows + 5 * dims;
+    embedlet_result_t results[64];
+    size_t count;
+    err = embedlet_search(store, query, 64, true, EMBEDLET_SINGLE_THREAD,
+                          results, &count);
+    assert(err == EMBEDLET_OK);
+    assert(count == 64 && results[0].id == 5);
+    for (size_t i = 0; i < count; i++)
+      assert(results[i].score ==
+             embedlet_score_raw(query, rows + results[i].id * dims, dims,
+                                EMBEDLET_METRIC_INNER_PRODUCT));
+    embedlet_close(store, false);
+  }
+  embedlet_remove(TEST_STORE_PATH);
+
+  free(rows);
+  printf("  PASSED\n");
+}
+
+static void test_knn_graph(void) {
+  printf("Testing kNN graph and similarity matrix...\n");
+
+  const char *graph_path = "test_knn_graph.knn";
+  size_t dims = 256, rows = 300, k = 8;
+  float *data = (float *)malloc(rows * dims * sizeof(float));
+  float *query = (float *)malloc(dims * sizeof(float));
+  assert(data != NULL && query != NULL);
+  srand(29);
+  for (size_t i = 0; i < rows * dims; i++)
+    data[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+
+  int metrics[3] = {EMBEDLET_METRIC_COSINE, EMBEDLET_METRIC_L2,
+                    EMBEDLET_METRIC_HAMMING};
+  int dtypes[3] = {EMBEDLET_DTYPE_F32, EMBEDLET_DTYPE_I8,
+                   EMBEDLET_DTYPE_F32};
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int m = 0; m < 3; m++) {
+    embedlet_store_t *store = NULL;
+    embedlet_options_t options = {0};
+    options.metric = metrics[m];
+    options.dtype = dtypes[m];
+    embedlet_remove(TEST_STORE_PATH);
+    err = embedlet_open_ex(TEST_STORE_PATH, dims, &options, &store);
+    assert(err == EMBEDLET_OK);
+    for (size_t i = 0; i < rows; i++) {
+      size_t id;
+      err = embedlet_append(store, data + i * dims, false, &id);
+      assert(err == EMBEDLET_OK);
+    }
+    for (size_t i = 0; i < rows; i += 7) {
+      err = embedlet_delete(store, i);
+      assert(err == EMBEDLET_OK);
+    }
+
+    int threads[2] = {EMBEDLET_SINGLE_THREAD, 3};
+    for (int t = 0; t < 2; t++) {
+      err = embedlet_knn_graph(store, k, threads[t], graph_path);
+      assert(err == EMBEDLET_OK);
+      FILE *f = fopen(graph_path, "rb");
+      assert(f != NULL);
+      embedlet_knn_header_t header;
+      size_t got = fread(&header, sizeof(header), 1, f);
+      (void)got; /* Used for assertion */
+      assert(got == 1);
+      assert(memcmp(header.magic, "EMBKNN01", 8) == 0);
+      assert(header.rows == rows && header.k == k &&
+             header.metric == (uint64_t)metrics[m]);
+      embedlet_result_t *lists =
+          (embedlet_result_t *)malloc(rows * k * sizeof(embedlet_result_t));
+      assert(lists != NULL);
+      got = fread(lists, sizeof(embedlet_result_t), rows * k, f);
+      assert(got == rows * k);
+      fclose(f);
+
+      /* Every list scores as a search from the row, less the row itself */
+      for (size_t i = 0; i < rows; i++) {
+        const embedlet_result_t *list = lists + i * k;
+        if (i % 7 == 0) {
+          for (size_t j = 0; j < k; j++)
+            assert(list[j].id == EMBEDLET_NO_ID);
+          continue;
+        }
+        embedlet_result_t results[16];
+        size_t count;
+        err = embedlet_get_copy(store, i, query);
+        assert(err == EMBEDLET_OK);
+        err = embedlet_search(store, query, k + 1, true,
+                              EMBEDLET_SINGLE_THREAD, results,
+                              &count);
+        assert(err == EMBEDLET_OK);
+        size_t r = 0;
+        for (size_t j = 0; j < k; j++, r++) {
+          if (results[r].id == i)
+            r++;
+          assert(list[j].id != i && list[j].id < rows &&
+                 list[j].id % 7 != 0);
+          assert(fabsf(list[j].score - results[r].score) <=
+                 1e-5f * (1.0f + fabsf(results[r].score)));
+        }
+      }
+      free(lists);
+    }
+
+    /* A row's k exceeds the other live rows: the tail is padding */
+    err = embedlet_knn_graph(store, rows, 2, graph_path);
+    assert(err == EMBEDLET_OK);
+    FILE *f = fopen(graph_path, "rb");
+    assert(f != NULL);
+    embedlet_result_t entry;
+    size_t live = rows - (rows + 6) / 7;
+    fseek(f, (long)(sizeof(embedlet_knn_header_t) +
+                    (rows + live - 2) * sizeof(entry)),
+          SEEK_SET);
+    size_t got = fread(&entry, sizeof(entry), 1, f);
+    (void)got; /* Used for assertion */
+    assert(got == 1 && entry.id != EMBEDLET_NO_ID);
+    got = fread(&entry, sizeof(entry), 1, f);
+    assert(got == 1 && entry.id == EMBEDLET_NO_ID);
+    fclose(f);
+
+    /* The matrix is symmetric and scores as a search does */
+    size_t ids[40];
+    for (size_t i = 0; i < 40; i++)
+      ids[i] = 1 + (i * 37) % (rows - 1);
+    for (size_t i = 0; i < 40; i++)
+      if (ids[i] % 7 == 0)
+        ids[i]++;
+    float *matrix = (float *)malloc(40 * 40 * sizeof(float));
+    assert(matrix != NULL);
+    err = embedlet_similarity_matrix(store, ids, 40, 3, matrix);
+    assert(err == EMBEDLET_OK);
+    for (size_t a = 0; a < 40; a++) {
+      embedlet_result_t results[300];
+      size_t count;
+      err = embedlet_get_copy(store, ids[a], query);
+      assert(err == EMBEDLET_OK);
+      err = embedlet_search(store, query, rows, true,
+                            EMBEDLET_SINGLE_THREAD, results,
+                            &count);
+      assert(err == EMBEDLET_OK);
+      for (size_t b = 0; b < 40; b++) {
+        assert(matrix[a * 40 + b] == matrix[b * 40 + a]);
+        for (size_t r = 0; r < count; r++)
+          if (results[r].id == ids[b])
+            assert(fabsf(matrix[a * 40 + b] - results[r].score) <=
+                   1e-4f * (1.0f + fabsf(results[r].score)));
+      }
+    }
+    free(matrix);
+
+    ids[3] = 14;
+    err = embedlet_similarity_matrix(store, ids, 40, 1, query);
+    assert(err == EMBEDLET_ERR_INVALID_ID);
+    ids[3] = rows;
+    err = embedlet_similarity_matrix(store, ids, 40, 1, query);
+    assert(err == EMBEDLET_ERR_INVALID_ID);
+    err = embedlet_knn_graph(store, 0, 1, graph_path);
+    assert(err == EMBEDLET_ERR_INVALID_ARG);
+    embedlet_close(store, false);
+  }
+  embedlet_remove(TEST_STORE_PATH);
+  remove(graph_path);
+
+  free(query);
+  free(data);
+  printf("  PASSED\n");
+}
+
+/* Offload backend mirroring the rows in host memory, scored row by row */
+typedef struct {
+  size_t dims;
+  size_t rows;
+  float *data;
+  bool *live;
+  int writes;
+  int searches;
+  int detached;
+  bool fail_search;
+  bool fail_write;
+  volatile size_t in_search; /* searches inside the device, atomic */
+} test_device_t;
+
+static int test_device_write(void *ctx, size_t first, size_t count,
+                             const float *rows) {
+  test_device_t *dev = (test_device_t *)ctx;
+  dev->writes++;
+  if (dev->fail_write)
+    return EMBEDLET_ERR_ALLOC;
+  if (first + count > dev->rows) {
+    dev->data = (float *)realloc(dev->data, (first + count) * dev->dims *
+                                                sizeof(float));
+    dev->live = (bool *)realloc(dev->live, (first + count) * sizeof(bool));
+    assert(dev->data != NULL && dev->live != NULL);
+    for (size_t i = dev->rows; i < first + count; i++)
+      dev->live[i] = false;
+    dev->rows = first + count;
+  }
+  for (size_t i = 0; i < count; i++) {
+    dev->live[first + i] = rows != NULL;
+    if (rows)
+      memcpy(dev->data + (first + i) * dev->dims, rows + i * dev->dims,
+             dev->dims * sizeof(float));
+  }
+  return EMBEDLET_OK;
+}
+
+static int test_device_search(void *ctx, int metric, const float *queries,
+                              size_t num_queries, size_t n, bool highest,
+                              embedlet_result_t *results, size_t *counts) {
+  test_device_t *dev = (test_device_t *)ctx;
+  embedlet_atomic_fetch_add(&dev->in_search, 1);
+  dev->searches++;
+  if (dev->fail_search) {
+    embedlet_atomic_fetch_add(&dev->in_search, (size_t)-1);
+    return EMBEDLET_ERR_ALLOC;
+  }
+  for (size_t q = 0; q < num_queries; q++) {
+    embedlet_result_t *top = results + q * n;
+    size_t count = 0;
+    for (size_t i = 0; i < dev->rows; i++) {
+      if (!dev->live[i])
+        continue;
+      float score = embedlet_score_raw(queries + q * dev->dims,
+                                       dev->data + i * dev->dims, dev->dims,
+                                       metric);
+      size_t at = count < n ? count++ : n;
+      while (at > 0 && (highest ? score > top[at - 1].score
+                                : score < top[at - 1].score)) {
+        if (at < n)
+          top[at] = top[at - 1];
+        at--;
+      }
+      if (at < n) {
+        top[at].id = i;
+        top[at].score = score;
+      }
+    }
+    counts[q] = count;
+  }
+  embedlet_atomic_fetch_add(&dev->in_search, (size_t)-1);
+  return EMBEDLET_OK;
+}
+
+static void test_device_detach(void *ctx) {
+  test_device_t *dev = (test_device_t *)ctx;
+  assert(embedlet_atomic_load(&dev->in_search) == 0);
+  dev->detached++;
+}
+
+typedef struct {
+  embedlet_store_t *store;
+  const float *queries;
+  int searches;
+} offload_task_t;
+
+static void offload_worker(void *arg) {
+  offload_task_t *t = (offload_task_t *)arg;
+  for (int i = 0; i < t->searches; i++) {
+    embedlet_result_t results[4 * 10];
+    size_t counts[4];
+    int err = embedlet_search_batch(t->store, t->queries, 4, 10, true,
+                                    EMBEDLET_SINGLE_THREAD, results, counts);
+    assert(err == EMBEDLET_OK && counts[0] == 10);
+  }
+}
+
+/* Batch search on the CPU, for the results the device must match */
+static void test_offload_expect(embedlet_store_t *store,
+                                const embedlet_offload_t *offload,
+                                const float *queries, size_t num_queries,
+                                size_t n, test_device_t *dev) {
+  embedlet_result_t cpu[4 * 10], out[4 * 10];
+  size_t cpu_counts[4], counts[4];
+  int err = embedlet_attach_offload(store, NULL);
+  (void)err; /* Used for assertion */
+  assert(err == EMBEDLET_OK);
+  err = embedlet_search_batch(store, queries, num_queries, n, true,
+                              EMBEDLET_SINGLE_THREAD, cpu,
+                              cpu_counts);
+  assert(err == EMBEDLET_OK);
+  dev->rows = 0;
+  err = embedlet_attach_offload(store, offload);
+  assert(err == EMBEDLET_OK);
+  int searches = dev->searches;
+  err = embedlet_search_batch(store, queries, num_queries, n, true,
+                              EMBEDLET_SINGLE_THREAD, out,
+                              counts);
+  assert(err == EMBEDLET_OK);
+  assert(dev->searches == searches + 1);
+  for (size_t q = 0; q < num_queries; q++) {
+    assert(counts[q] == cpu_counts[q]);
+    for (size_t i = 0; i < counts[q]; i++)
+      assert(fabsf(out[q * n + i].score - cpu[q * n + i].score) <= 1e-4f);
+  }
+}
+
+static void test_offload(void) {
+  printf("Testing offload backend...\n");
+
+  size_t dims = 64, rows = 200;
+  float *data = (float *)malloc(rows * dims * sizeof(float));
+  assert(data != NULL);
+  srand(30);
+  for (size_t i = 0; i < rows * dims; i++)
+    data[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+
+  int dtypes[2] = {EMBEDLET_DTYPE_F32, EMBEDLET_DTYPE_I8};
+  int err = EMBEDLET_OK;
+  (void)err; /* Used for assertion */
+  for (int t = 0; t < 2; t++) {
+    embedlet_store_t *store = NULL;
+    embedlet_options_t options = {0};
+    options.dtype = dtypes[t];
+    embedlet_remove(TEST_STORE_PATH);
+    err = embedlet_open_ex(TEST_STORE_PATH, dims, &options, &store);
+    assert(err == EMBEDLET_OK);
+    err = embedlet_append_batch(store, data, rows - 10, NULL);
+    assert(err == EMBEDLET_OK);
+    err = embedlet_delete(store, 3);
+    assert(err == EMBEDLET_OK);
+
+    test_device_t dev;
+    memset(&dev, 0, sizeof(dev));
+    dev.dims = dims;
+    embedlet_offload_t offload = {0};
+    offload.ctx = &dev;
+    offload.write = test_device_write;
+    offload.search = test_device_search;
+    offload.detach = test_device_detach;
+    offload.min_batch = 4;
+    err = embedlet_attach_offload(store, &offload);
+    assert(err == EMBEDLET_OK);
+
+    /* The mirror holds the decoded rows and the deletions */
+    float row[64];
+    assert(dev.rows == rows - 10 && !dev.live[3] && dev.live[4]);
+    err = embedlet_get_copy(store, 17, row);
+    assert(err == EMBEDLET_OK);
+    assert(memcmp(dev.data + 17 * dims, row, sizeof(row)) == 0);
+
+    /* Below min_batch the CPU searches */
+    embedlet_result_t results[10];
+    size_t count;
+    err = embedlet_search(store, data + 5 * dims, 10, true,
+                          EMBEDLET_SINGLE_THREAD, results,
+                          &count);
+    assert(err == EMBEDLET_OK);
+    assert(dev.searches == 0 && count == 10 && results[0].id == 5);
+    test_offload_expect(store, &offload, data, 4, 10, &dev);
+
+    /* Writes reach the mirror */
+    size_t id;
+    for (size_t i = rows - 10; i < rows; i++) {
+      err = embedlet_append(store, data + i * dims, false, &id);
+      assert(err == EMBEDLET_OK);
+    }
+    err = embedlet_replace(store, 8, data + 199 * dims);
+    assert(err == EMBEDLET_OK);
+    err = embedlet_delete(store, 150);
+    assert(err == EMBEDLET_OK);
+    err = embedlet_delete(store, 12);
+    assert(err == EMBEDLET_OK);
+    size_t moved;
+    err = embedlet_vacuum(store, 100, &moved);
+    assert(err == EMBEDLET_OK);
+    assert(moved > 0);
+    assert(!dev.live[rows - 1] && dev.live[3]);
+    err = embedlet_get_copy(store, 8, row);
+    assert(err == EMBEDLET_OK);
+    assert(memcmp(dev.data + 8 * dims, row, sizeof(row)) == 0);
+    test_offload_expect(store, &offload, data + 190 * dims, 4, 10, &dev);
+
+    /* A failed device search falls back to the CPU */
+    dev.fail_search = true;
+    embedlet_result_t batch[4 * 10];
+    size_t counts[4];
+    err = embedlet_search_batch(store, data + 30 * dims, 4, 10, true,
+                                EMBEDLET_SINGLE_THREAD, batch,
+                                counts);
+    assert(err == EMBEDLET_OK);
+    assert(counts[0] == 10 && batch[0].id == 30);
+    dev.fail_search = false;
+
+    /* A failed write detaches the backend */
+    dev.fail_write = true;
+    err = embedlet_delete(store, 20);
+    assert(err == EMBEDLET_OK);
+    assert(dev.detached == 3);
+    int searches = dev.searches;
+    err = embedlet_search_batch(store, data, 4, 10, true,
+                                EMBEDLET_SINGLE_THREAD, batch,
+                                counts);
+    assert(err == EMBEDLET_OK);
+    assert(dev.searches == searches);
+
+    /* ... but only once the searches inside the device are out */
+    offload_task_t task = {store, data + 40 * dims, 100};
+    embedlet_pool_t *client = NULL;
+    err = embedlet_pool_create(1, false, &client);
+    assert(err == EMBEDLET_OK);
+    for (int i = 0; i < 10; i++) {
+      dev.fail_write = false;
+      err = embedlet_attach_offload(store, &offload);
+      assert(err == EMBEDLET_OK);
+      dev.fail_write = true;
+      embedlet_pool_submit(client, offload_worker, &task);
+      err = embedlet_replace(store, 40, data + 40 * dims);
+      assert(err == EMBEDLET_OK);
+      embedlet_pool_wait(client);
+    }
+    embedlet_pool_destroy(client);
+    assert(dev.detached == 13 && store->offload_refs == 0);
+    dev.fail_write = false;
+
+    /* Closing the store detaches it too */
+    dev.rows = 0;
+    err = embedlet_attach_offload(store, &offload);
+    assert(err == EMBEDLET_OK);
+    embedlet_close(store, false);
+    assert(dev.detached == 14);
+    free(dev.data);
+    free(dev.live);
+  }
+
+  embedlet_store_t *store = NULL;
+  embedlet_options_t options = {0};
+  options.metric = EMBEDLET_METRIC_HAMMING;
+  embedlet_remove(TEST_STORE_PATH);
+  err = embedlet_open_ex(TEST_STORE_PATH, dims, &options, &store);
+  assert(err == EMBEDLET_OK);
+  embedlet_offload_t offload = {0};
+  offload.write = test_device_write;
+  offload.search = test_device_search;
+  err = embedlet_attach_offload(store, &offload);
+  assert(err == EMBEDLET_ERR_INVALID_ARG);
+  embedlet_close(store, false);
+  embedlet_remove(TEST_STORE_PATH);
 
+  free(data);
   printf("  PASSED\n");
 }
 
@@ -647,13 +3865,42 @@ int main(void) {
   test_replace();
   test_delete_compact();
   test_similarity();
+  test_simd_kernels();
   test_search_single();
   test_search_multi();
+  test_search_batch();
   test_thread_safety();
   test_persistence();
   test_close_compact();
+  test_norm_cache();
+  test_live_bitmap();
+  test_file_header();
   test_edge_cases();
   test_batch_append();
+  test_append_batch();
+  test_quantized();
+  test_search_rerank();
+  test_search_ann();
+  test_search_ivf();
+  test_stable_mapping();
+  test_search_scratch();
+  test_work_stealing();
+  test_shared_pool();
+  test_search_async();
+  test_search_metrics();
+  test_search_filtered();
+  test_search_range();
+  test_large_topn();
+  test_search_stats();
+  test_advise_warm();
+  test_read_only();
+  test_segmented();
+  test_vacuum();
+  test_search_prefix();
+  test_blocked();
+  test_fixed_dims();
+  test_knn_graph();
+  test_offload();
 
   printf("\n=== All tests PASSED ===\n");
   return 0;